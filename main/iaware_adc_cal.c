@@ -0,0 +1,132 @@
+#include <stdint.h>
+
+#include "driver/adc.h"
+#include "esp_adc_cal.h"
+#include "esp_log.h"
+
+#include "iaware_adc_cal.h"
+#include "iaware_gpio.h"
+#include "iaware_helper.h"
+#include "iaware_packet.h"
+#include "main.h"
+
+static void adc_cal_keep(const char *key, uint32_t value);
+
+uint8_t adc_cal_enabled = iawFalse;
+uint32_t adc_cal_uv_per_lsb = 1;
+uint8_t adc_cal_send_pending = iawFalse;
+
+static esp_adc_cal_characteristics_t adc_cal_chars;
+static esp_adc_cal_value_t adc_cal_source = ESP_ADC_CAL_VAL_DEFAULT_VREF;
+static uint16_t adc_cal_lut[ADC_CAL_LUT_SIZE + 1];  // The last entry repeats the full scale for the interpolation.
+
+void init_adc_cal(void)
+// Call it after iaware_init_gpio() and before init_sampling_data_task(), which takes the bits of the samples from here.
+{
+    uint32_t value;
+
+    if (nvs_read_u32(ADC_CAL_NVS_ENABLED, &value) == iawTrue)
+        adc_cal_enabled = value ? iawTrue : iawFalse;
+
+    adc_cal_source = esp_adc_cal_characterize(ADC_UNIT_1, GPIO_ADC_ATTEN, ADC_WIDTH_BIT_12, ADC_CAL_DEFAULT_VREF, &adc_cal_chars);
+
+    // The unit is chosen so that the highest voltage fits in ADC_CAL_BITS.
+    uint32_t full_scale_uv = esp_adc_cal_raw_to_voltage(ADC_CAL_LUT_SIZE - 1, &adc_cal_chars)*1000 + 1000;
+
+    adc_cal_uv_per_lsb = (full_scale_uv + (1 << ADC_CAL_BITS) - 2)/((1 << ADC_CAL_BITS) - 1);
+
+    for (uint32_t raw = 0; raw < ADC_CAL_LUT_SIZE; raw++)
+    {
+        uint64_t uv;
+
+        // The linear fit in microvolts, from its Q16 coefficients, is finer than the millivolts of esp_adc_cal_raw_to_voltage().
+        // The curves that correct its nonlinearity exist only for some attenuations.
+        if (adc_cal_chars.low_curve == NULL)
+            uv = ((uint64_t) adc_cal_chars.coeff_a*raw*1000 + 32768)/65536 + (uint64_t) adc_cal_chars.coeff_b*1000;
+        else
+            uv = (uint64_t) esp_adc_cal_raw_to_voltage(raw, &adc_cal_chars)*1000;
+
+        uint64_t v = (uv + adc_cal_uv_per_lsb/2)/adc_cal_uv_per_lsb;
+
+        adc_cal_lut[raw] = (uint16_t) ((v > 0xFFFF) ? 0xFFFF : v);
+    }
+
+    adc_cal_lut[ADC_CAL_LUT_SIZE] = adc_cal_lut[ADC_CAL_LUT_SIZE - 1];
+
+    // Keep the characterization with the samples that it calibrates.
+    adc_cal_keep(ADC_CAL_NVS_SOURCE, (uint32_t) adc_cal_source);
+    adc_cal_keep(ADC_CAL_NVS_COEFF_A, adc_cal_chars.coeff_a);
+    adc_cal_keep(ADC_CAL_NVS_COEFF_B, adc_cal_chars.coeff_b);
+    adc_cal_keep(ADC_CAL_NVS_VREF, adc_cal_chars.vref);
+
+    ESP_LOGI(IAWARE_GPIO, "Main: ADC calibration %s, from %s, %d..%d mV, %d microV per LSB.", (adc_cal_enabled == iawTrue) ? "on" : "off",
+        (adc_cal_source == ESP_ADC_CAL_VAL_EFUSE_TP) ? "eFuse Two Point" : ((adc_cal_source == ESP_ADC_CAL_VAL_EFUSE_VREF) ? "eFuse Vref" : "the default Vref"),
+        esp_adc_cal_raw_to_voltage(0, &adc_cal_chars), esp_adc_cal_raw_to_voltage(ADC_CAL_LUT_SIZE - 1, &adc_cal_chars), adc_cal_uv_per_lsb);
+}
+
+int adc_cal_set_enabled(uint8_t is_on)
+// The bits of the samples change, so ESP32 restarts like for a new decimation.
+{
+    return nvs_write_u32(ADC_CAL_NVS_ENABLED, is_on ? 1 : 0);
+}
+
+void adc_cal_process_block(uint8_t *samples, uint32_t n_values, uint8_t bits)
+// Map n_values big-endian samples of bits bits in place. A sample of more than GPIO_ADC_BITS bits, i.e. decimated, is
+// interpolated linearly between the entries of its GPIO_ADC_BITS high bits.
+{
+    if (bits <= GPIO_ADC_BITS)
+    {
+        for (uint32_t i = 0; i < n_values; i++)
+        {
+            uint32_t raw = (((uint32_t) samples[2*i] << 8) | samples[2*i + 1]) & (ADC_CAL_LUT_SIZE - 1);
+            uint16_t v = adc_cal_lut[raw];
+
+            samples[2*i]        = highbyte(v);
+            samples[2*i + 1]    = lowbyte(v);
+        }
+    }
+    else
+    {
+        const uint8_t shift = bits - GPIO_ADC_BITS;
+        const uint32_t frac_mask = (1 << shift) - 1;
+
+        for (uint32_t i = 0; i < n_values; i++)
+        {
+            uint32_t x = ((uint32_t) samples[2*i] << 8) | samples[2*i + 1];
+            uint32_t raw = (x >> shift) & (ADC_CAL_LUT_SIZE - 1);
+            int32_t lo = adc_cal_lut[raw];
+            int32_t hi = adc_cal_lut[raw + 1];
+            uint16_t v = (uint16_t) (lo + (((hi - lo)*(int32_t) (x & frac_mask)) >> shift));
+
+            samples[2*i]        = highbyte(v);
+            samples[2*i + 1]    = lowbyte(v);
+        }
+    }
+}
+
+uint32_t adc_cal_pack(uint8_t *dst)
+// The reply to CMD_GET_ADC_CAL, see PACKET_HEADER_ADC_CAL_META_SIZE.
+{
+    uint32_to_bytes(PACKET_HEADER_ADC_CAL_META_SIZE, &(dst[0]));
+    dst[4] = PACKET_HEADER_ADC_CAL;
+    dst[5] = adc_cal_enabled;
+    dst[6] = (uint8_t) adc_cal_source;
+    dst[7] = (uint8_t) GPIO_ADC_ATTEN;
+    uint32_to_bytes(adc_cal_chars.vref, &(dst[8]));
+    uint32_to_bytes(adc_cal_chars.coeff_a, &(dst[12]));
+    uint32_to_bytes(adc_cal_chars.coeff_b, &(dst[16]));
+    uint32_to_bytes(adc_cal_uv_per_lsb, &(dst[20]));
+
+    return 4 + PACKET_HEADER_ADC_CAL_META_SIZE;
+}
+
+//////////////////// Private ////////////////////
+
+static void adc_cal_keep(const char *key, uint32_t value)
+// Write key only when it changed, so a boot does not wear the flash.
+{
+    uint32_t old;
+
+    if ((nvs_read_u32(key, &old) == iawFalse) || (old != value))
+        nvs_write_u32(key, value);
+}
@@ -0,0 +1,34 @@
+#ifndef IAWARE_ADC_CAL_H
+#define IAWARE_ADC_CAL_H
+
+#include <stdint.h>
+
+// The calibration of the ADC1 reads. At boot, the curve of the chip is characterized from its eFuse (Two Point or Vref,
+// else ADC_CAL_DEFAULT_VREF) with esp_adc_cal_characterize(), and tabulated for every raw code into adc_cal_lut. With the
+// calibration on (CMD_SET_ADC_CAL, kept in NVS), sampling_filter_task() maps every completed block through the table
+// before the filters, so the filters, the band powers, the trigger threshold, the flash and the clients all see
+// calibrated samples. A calibrated sample is in units of adc_cal_uv_per_lsb microvolts, as unsigned ADC_CAL_BITS-bit
+// samples, and its block carries STREAM_FLAG_CALIBRATED. The decimated samples are interpolated between two entries.
+//
+// The characterization is kept in NVS and sent to the client as a PACKET_HEADER_ADC_CAL packet on CMD_GET_ADC_CAL, so
+// the raw samples can be calibrated offline too. Cost per sample: one table read, or two and a multiply with the decimation.
+#define ADC_CAL_LUT_SIZE        4096    // 1 << GPIO_ADC_BITS
+#define ADC_CAL_BITS            16
+#define ADC_CAL_DEFAULT_VREF    1100    // [mV]. The typical Vref of a chip without eFuse data.
+
+#define ADC_CAL_NVS_ENABLED     "cal_on"
+#define ADC_CAL_NVS_SOURCE      "cal_src"
+#define ADC_CAL_NVS_COEFF_A     "cal_a"
+#define ADC_CAL_NVS_COEFF_B     "cal_b"
+#define ADC_CAL_NVS_VREF        "cal_vref"
+
+extern uint8_t adc_cal_enabled;             // Read from NVS at boot. It cannot change without a restart.
+extern uint32_t adc_cal_uv_per_lsb;         // [microvolt]. The full scale fits in ADC_CAL_BITS.
+extern uint8_t adc_cal_send_pending;        // Set by CMD_GET_ADC_CAL. Cleared by com_tcp_send_task() after the reply.
+
+void init_adc_cal(void);
+int adc_cal_set_enabled(uint8_t is_on);
+void adc_cal_process_block(uint8_t *samples, uint32_t n_values, uint8_t bits);
+uint32_t adc_cal_pack(uint8_t *dst);
+
+#endif
@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "iaware_arena.h"
+#include "main.h"
+
+static uint8_t *arena_base = NULL;
+static uint32_t arena_size = 0;
+static uint32_t arena_used = 0;
+
+int arena_init(uint32_t size)
+// The only heap allocation of the streaming memory. It is called once at boot from init_buff_nodes().
+{
+    if (arena_base != NULL)
+    {
+        ESP_LOGE(IAWARE_CORE, "Arena: already initialized with %d bytes.", arena_size);
+
+        return iawFalse;
+    }
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if ((arena_base = (uint8_t *) heap_caps_malloc(size, MALLOC_CAP_8BIT)) == NULL)
+    {
+        ESP_LOGE(IAWARE_CORE, "Arena: heap_caps_malloc(%d) fails.", size);
+
+        return iawFalse;
+    }
+
+    arena_size = size;
+    arena_used = 0;
+
+    return iawTrue;
+}
+
+void *arena_alloc(uint32_t size)
+// Bump allocation. Return NULL when the arena is exhausted.
+{
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if ((arena_base == NULL) || (size > (arena_size - arena_used)))
+        return NULL;
+
+    void *ptr = arena_base + arena_used;
+
+    arena_used = arena_used + size;
+
+    return ptr;
+}
+
+void arena_reset(void)
+// All pointers returned by arena_alloc() become invalid. The memory itself stays allocated.
+{
+    arena_used = 0;
+}
+
+uint32_t arena_size_bytes(void)
+{
+    return arena_size;
+}
+
+uint32_t arena_used_bytes(void)
+{
+    return arena_used;
+}
+
+uint32_t arena_free_bytes(void)
+{
+    return arena_size - arena_used;
+}
+
+uint32_t arena_max_size(void)
+// The largest arena that can be allocated while leaving ARENA_HEAP_RESERVE for the other components.
+{
+    uint32_t largest    = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    uint32_t free_heap  = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+    if (free_heap <= ARENA_HEAP_RESERVE)
+        return 0;
+
+    if (largest > (free_heap - ARENA_HEAP_RESERVE))
+        largest = free_heap - ARENA_HEAP_RESERVE;
+
+    return largest & ~(ARENA_ALIGN - 1);
+}
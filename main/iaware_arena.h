@@ -0,0 +1,20 @@
+#ifndef IAWARE_ARENA_H
+#define IAWARE_ARENA_H
+
+#include <stdint.h>
+
+// All streaming memory (buff nodes and their samples_buff) is carved out of one block that is allocated once at boot.
+// Nothing is returned to the heap in steady state; arena_reset() releases everything at once.
+#define ARENA_ALIGN             4       // [bytes]. Every allocation is aligned to a 32-bit word.
+#define ARENA_HEAP_RESERVE      (48*1024) // [bytes]. The heap left for Wi-Fi, lwIP and Bluedroid when the arena is sized.
+
+int arena_init(uint32_t size);
+void *arena_alloc(uint32_t size);
+void arena_reset(void);
+
+uint32_t arena_size_bytes(void);
+uint32_t arena_used_bytes(void);
+uint32_t arena_free_bytes(void);
+uint32_t arena_max_size(void);
+
+#endif
@@ -0,0 +1,111 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "iaware_ble_adv.h"
+#include "iaware_bool.h"
+
+static void ble_adv_pack_u32(uint32_t v, uint8_t *dst);
+static uint32_t ble_adv_unpack_u32(const uint8_t *src);
+
+uint32_t ble_adv_metrics_pack(const struct ble_adv_metrics *m, const char *name, uint8_t *dst)
+// The raw scan response, at most BLE_ADV_MAX_SIZE bytes. Return its length. A name too long for the room left is
+// shortened.
+{
+    uint32_t name_max = BLE_ADV_MAX_SIZE - (2 + 2 + BLE_ADV_METRICS_SIZE) - 2;
+    uint32_t name_len = (uint32_t) strlen(name);
+    uint8_t *p;
+
+    dst[1] = (name_len > name_max) ? BLE_ADV_AD_TYPE_NAME_SHORT : BLE_ADV_AD_TYPE_NAME_CMPL;
+
+    if (name_len > name_max)
+        name_len = name_max;
+
+    dst[0] = (uint8_t) (1 + name_len);
+    memcpy(&(dst[2]), name, name_len);
+
+    p = &(dst[2 + name_len]);
+
+    p[0] = 1 + 2 + BLE_ADV_METRICS_SIZE;
+    p[1] = BLE_ADV_AD_TYPE_MANUFACTURER;
+    p[2] = (uint8_t) (BLE_ADV_COMPANY_ID & 0xFF);
+    p[3] = (uint8_t) (BLE_ADV_COMPANY_ID >> 8);
+
+    p = &(p[4]);
+
+    p[0] = BLE_ADV_METRICS_VERSION;
+    p[1] = m->flags;
+    p[2] = m->n_channels;
+    p[3] = m->battery;
+    ble_adv_pack_u32(m->rate, &(p[4]));
+    ble_adv_pack_u32(m->block_seq, &(p[8]));
+    ble_adv_pack_u32(m->n_dropped, &(p[12]));
+    p[16] = (uint8_t) (m->n_skipped >> 8);
+    p[17] = (uint8_t) (m->n_skipped & 0xFF);
+
+    return 2 + name_len + 2 + 2 + BLE_ADV_METRICS_SIZE;
+}
+
+uint8_t ble_adv_metrics_parse(const uint8_t *adv, uint32_t len, struct ble_adv_metrics *m)
+// The advertising data and the scan response of a report. Return iawTrue when they carry the metrics of a version that
+// it knows.
+{
+    uint32_t i = 0;
+
+    while ((i + 1) < len)
+    {
+        uint32_t field_len = adv[i];
+        uint32_t end = i + 1 + field_len;
+
+        if ((field_len == 0) || (end > len))
+            break;
+
+        const uint8_t *p = &(adv[i + 2]);
+
+        if ((adv[i + 1] == BLE_ADV_AD_TYPE_MANUFACTURER) && (field_len >= (1 + 2 + BLE_ADV_METRICS_SIZE)) &&
+            (((p[1] << 8) | p[0]) == BLE_ADV_COMPANY_ID) && (p[2] == BLE_ADV_METRICS_VERSION))
+        {
+            p = &(p[2]);
+
+            m->flags        = p[1];
+            m->n_channels   = p[2];
+            m->battery      = p[3];
+            m->rate         = ble_adv_unpack_u32(&(p[4]));
+            m->block_seq    = ble_adv_unpack_u32(&(p[8]));
+            m->n_dropped    = ble_adv_unpack_u32(&(p[12]));
+            m->n_skipped    = (uint16_t) ((p[16] << 8) | p[17]);
+
+            return iawTrue;
+        }
+
+        i = end;
+    }
+
+    return iawFalse;
+}
+
+uint8_t ble_adv_interval_is_valid(uint32_t interval_ms)
+{
+    return ((interval_ms >= BLE_ADV_INTERVAL_MIN_MS) && (interval_ms <= BLE_ADV_INTERVAL_MAX_MS)) ? iawTrue : iawFalse;
+}
+
+uint16_t ble_adv_interval_units(uint32_t interval_ms)
+// The interval in the 0.625 ms of the controller.
+{
+    return (uint16_t) (interval_ms*8/5);
+}
+
+//////////////////// Private ////////////////////
+
+static void ble_adv_pack_u32(uint32_t v, uint8_t *dst)
+// Big-endian, like uint32_to_bytes() of iaware_helper.c, which would pull ESP-IDF in.
+{
+    dst[0] = (uint8_t) (v >> 24);
+    dst[1] = (uint8_t) (v >> 16);
+    dst[2] = (uint8_t) (v >> 8);
+    dst[3] = (uint8_t) v;
+}
+
+static uint32_t ble_adv_unpack_u32(const uint8_t *src)
+{
+    return ((uint32_t) src[0] << 24) | ((uint32_t) src[1] << 16) | ((uint32_t) src[2] << 8) | (uint32_t) src[3];
+}
@@ -0,0 +1,59 @@
+#ifndef IAWARE_BLE_ADV_H
+#define IAWARE_BLE_ADV_H
+
+#include <stdint.h>
+
+// The metrics broadcast of the BLE server (CMD_SET_BLE_ADV): a scanner sees the status of every i-Aware in range without
+// connecting to any of them. Every BLE_ADV_METRICS_PERIOD_MS the scan response is rebuilt as the name followed by a
+// manufacturer specific AD structure, 31 bytes with IAWARE_DEVICE_NAME:
+//
+//     |len|0x09|name|len|0xFF|uint16_t company id, little-endian|payload|
+//     payload: |uint8_t version|uint8_t flags|uint8_t n_channels|uint8_t battery [%]|uint32_t rate [scans/sec]|
+//              |uint32_t block_seq|uint32_t n_dropped|uint16_t n_skipped|
+//
+// The payload is big-endian like the packets of iaware_packet.h. rate is the effective rate of the last block and
+// block_seq the one of the next block, so a scanner tells a stalled device. n_dropped counts the blocks that the TCP
+// clients missed since the boot, n_skipped the ones that the BLE clients connected now skipped, it stops at 0xFFFF. The
+// board does not measure its battery, battery is BLE_ADV_BATTERY_UNKNOWN. A passive scan gets no scan response, the
+// scanner must scan actively. It includes no ESP-IDF header, so a central or a PC decodes the payload with
+// ble_adv_metrics_parse().
+#define BLE_ADV_METRICS_VERSION     1
+#define BLE_ADV_COMPANY_ID          0xFFFF  // The id that the Bluetooth SIG keeps for the tests.
+#define BLE_ADV_METRICS_SIZE        (1 + 1 + 1 + 1 + 4 + 4 + 4 + 2)    // [bytes]
+#define BLE_ADV_MAX_SIZE            31      // [bytes]
+#define BLE_ADV_METRICS_PERIOD_MS   1000    // [ms]
+
+#define BLE_ADV_AD_TYPE_NAME_SHORT  0x08
+#define BLE_ADV_AD_TYPE_NAME_CMPL   0x09
+#define BLE_ADV_AD_TYPE_MANUFACTURER    0xFF
+
+#define BLE_ADV_FLAG_TCP_STREAMING  (1 << 0)
+#define BLE_ADV_FLAG_BLE_STREAMING  (1 << 1)
+#define BLE_ADV_FLAG_RECORDING      (1 << 2)    // flash_tier_record_mode
+#define BLE_ADV_FLAG_TRIGGER        (1 << 3)    // The triggered capture is armed.
+#define BLE_ADV_FLAG_CLIENTS_SHIFT  4           // Bits 4 and 5, the BLE clients connected.
+#define BLE_ADV_BATTERY_UNKNOWN     0xFF
+
+// The advertising interval of CMD_SET_BLE_ADV, the power against the time that a central takes to find the device. The
+// controller advertises every interval_ms to 2*interval_ms.
+#define BLE_ADV_INTERVAL_MIN_MS     20      // [ms]
+#define BLE_ADV_INTERVAL_MAX_MS     5120    // [ms]. Twice the interval is still within the 10.24 sec of the controller.
+#define BLE_ADV_INTERVAL_DEFAULT_MS 20      // [ms]
+
+struct ble_adv_metrics
+{
+    uint8_t flags;
+    uint8_t n_channels;
+    uint8_t battery;
+    uint32_t rate;
+    uint32_t block_seq;
+    uint32_t n_dropped;
+    uint16_t n_skipped;
+};
+
+uint32_t ble_adv_metrics_pack(const struct ble_adv_metrics *m, const char *name, uint8_t *dst);
+uint8_t ble_adv_metrics_parse(const uint8_t *adv, uint32_t len, struct ble_adv_metrics *m);
+uint8_t ble_adv_interval_is_valid(uint32_t interval_ms);
+uint16_t ble_adv_interval_units(uint32_t interval_ms);
+
+#endif
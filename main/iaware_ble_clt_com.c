@@ -10,34 +10,66 @@
 #include "esp_bt_main.h"
 #include "esp_gatt_common_api.h"
 #include "esp_log.h"
+#include "esp_gatts_api.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 
 #include "iaware_ble_clt_com.h"
+#include "iaware_ble_hub.h"
+#include "iaware_ble_scan.h"
+#include "iaware_ble_svr_com.h"
+#include "iaware_blog.h"
 #include "iaware_helper.h"
+#include "iaware_packet.h"
 #include "main.h"
 
-static const char remote_device_name[] = "i-Aware-peripheral";
-static bool connect    = false;
-static bool get_server = false;
-static esp_gattc_char_elem_t *char_elem_result   = NULL;
-static esp_gattc_descr_elem_t *descr_elem_result = NULL;
+// The peripherals are i-Aware devices that run iaware_ble_svr_com.c, see iaware_ble_hub.h.
+static struct ble_scan hub_scanner;
+static bool hub_is_scanning = false;
+static bool hub_is_opening  = false;   // esp_ble_gattc_open() opens one connection at a time.
+static struct ble_hub_peripheral hub_peripherals[BLE_HUB_MAX_PERIPHERALS];
+static esp_gattc_char_elem_t char_elem_result;     // The service has one TX characteristic.
+static esp_gattc_descr_elem_t descr_elem_result;   // The TX characteristic has one descriptor, its CCCD.
+
+// See BLE_HUB_KNOWN_PEERS.
+static struct ble_hub_known hub_known[BLE_HUB_KNOWN_PEERS];
+static bool hub_known_tried[BLE_HUB_KNOWN_PEERS];  // Opened directly since the boot. Only a disconnect of the peer clears it, the scan finds a peer out of range.
+static uint32_t hub_known_seq = 0;
+static esp_bd_addr_t hub_open_bda;
+static uint8_t hub_open_addr_type = BLE_ADDR_TYPE_PUBLIC;
+// The peripherals whose blocks do not fit in the slots of the hub, not opened again until the reboot.
+static esp_bd_addr_t hub_rejected[BLE_HUB_KNOWN_PEERS];
+static uint8_t hub_n_rejected = 0;
 
 /* Declare static functions */
 static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
 static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param);
 static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param);
+static struct ble_hub_peripheral *hub_find(uint16_t conn_id);
+static struct ble_hub_peripheral *hub_find_bda(esp_bd_addr_t bda);
+static struct ble_hub_peripheral *hub_find_registering(uint16_t char_handle);
+static struct ble_hub_peripheral *hub_new(void);
+static void hub_scan(void);
+static bool hub_open(esp_bd_addr_t bda, uint8_t addr_type);
+static void hub_subscribe(esp_gatt_if_t gattc_if, struct ble_hub_peripheral *p);
+static void hub_known_load(void);
+static struct ble_hub_known *hub_known_find(esp_bd_addr_t bda);
+static void hub_known_save(struct ble_hub_peripheral *p);
+static void hub_known_forget(esp_bd_addr_t bda);
+static void hub_reject(esp_gatt_if_t gattc_if, struct ble_hub_peripheral *p);
+static bool hub_is_rejected(esp_bd_addr_t bda);
 
 
 static esp_bt_uuid_t remote_filter_service_uuid = {
-    .len = ESP_UUID_LEN_16,
-    .uuid = {.uuid16 = REMOTE_SERVICE_UUID,},
+    .len = ESP_UUID_LEN_128,
+    .uuid = {.uuid128 = IAWARE_BLE_UUID128(IAWARE_BLE_UUID_SERVICE),},
 };
 
 static esp_bt_uuid_t remote_filter_char_uuid = {
-    .len = ESP_UUID_LEN_16,
-    .uuid = {.uuid16 = REMOTE_NOTIFY_CHAR_UUID,},
+    .len = ESP_UUID_LEN_128,
+    .uuid = {.uuid128 = IAWARE_BLE_UUID128(IAWARE_BLE_UUID_TX),},
 };
 
 static esp_bt_uuid_t notify_descr_uuid = {
@@ -51,7 +83,7 @@ static esp_ble_scan_params_t ble_scan_params = {
     .scan_filter_policy     = BLE_SCAN_FILTER_ALLOW_ALL,
     .scan_interval          = 0x50,
     .scan_window            = 0x30,
-    .scan_duplicate         = BLE_SCAN_DUPLICATE_DISABLE
+    .scan_duplicate         = BLE_SCAN_DUPLICATE_ENABLE
 };
 
 
@@ -65,9 +97,20 @@ static struct gattc_profile_inst gl_profile_tab[CLT_PROFILE_NUM] = {
 
 ////////// Public //////////
 int init_ble_client(void)
+// The hub, see iaware_ble_hub.h. It connects to every i-Aware peripheral in range, up to BLE_HUB_MAX_PERIPHERALS.
 {
     esp_err_t err;
 
+    if (ble_hub_init() == iawFalse)
+    {
+        ESP_LOGE(IAWARE_BLE, "%s allocate the hub slots failed", __func__);
+        return -1;
+    }
+
+    hub_known_load();
+
+    ble_scan_init(&hub_scanner, remote_filter_service_uuid.uuid.uuid128);
+
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
 
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
@@ -146,7 +189,7 @@ int init_ble_client(void)
         return -1;
     }
 
-    esp_err_t local_mtu_err = esp_ble_gatt_set_local_mtu(500);
+    esp_err_t local_mtu_err = esp_ble_gatt_set_local_mtu(BLE_LOCAL_MTU);
     if (local_mtu_err)
     {
         ESP_LOGE(IAWARE_BLE, "set local  MTU failed, error code = %x", local_mtu_err);
@@ -164,6 +207,7 @@ int init_ble_client(void)
 static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
 {
     esp_ble_gattc_cb_param_t *p_data = (esp_ble_gattc_cb_param_t *)param;
+    struct ble_hub_peripheral *p;
 
     switch (event) 
     {
@@ -181,12 +225,44 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
         case ESP_GATTC_CONNECT_EVT:
             ESP_LOGI(IAWARE_BLE, "ESP_GATTC_CONNECT_EVT conn_id %d, if %d", p_data->connect.conn_id, gattc_if);
 
-            gl_profile_tab[PROFILE_A_APP_ID].conn_id = p_data->connect.conn_id;
-            memcpy(gl_profile_tab[PROFILE_A_APP_ID].remote_bda, p_data->connect.remote_bda, sizeof(esp_bd_addr_t));
+            hub_is_opening = false;
+
+            if ((p = hub_find_bda(p_data->connect.remote_bda)) == NULL)
+                p = hub_new();
+
+            if (p == NULL)
+            {
+                ESP_LOGE(IAWARE_BLE, "ESP_GATTC_CONNECT_EVT, %d peripherals are connected already", BLE_HUB_MAX_PERIPHERALS);
+
+                esp_ble_gap_disconnect(p_data->connect.remote_bda);
+
+                break;
+            }
+
+            p->conn_id = p_data->connect.conn_id;
+            p->is_registering = false;
+            p->is_used = true;
+            memcpy(p->remote_bda, p_data->connect.remote_bda, sizeof(esp_bd_addr_t));
+            p->addr_type = (memcmp(hub_open_bda, p->remote_bda, sizeof(esp_bd_addr_t)) == 0) ? hub_open_addr_type : BLE_ADDR_TYPE_PUBLIC;
+            p->t_connect = esp_timer_get_time();
+            p->is_first_pending = true;
+            p->get_server = false;
+
+            struct ble_hub_known *k = hub_known_find(p->remote_bda);
+
+            if ((p->is_cached = (k != NULL)))
+            {
+                p->service_start_handle = k->service_start_handle;
+                p->service_end_handle   = k->service_end_handle;
+                p->char_handle          = k->char_handle;
+                p->cccd_handle          = k->cccd_handle;
+            }
+
+            ble_hub_rx_reset(&(p->rx), (uint8_t) (p - hub_peripherals), p->remote_bda);
 
             ESP_LOGI(IAWARE_BLE, "REMOTE BDA:");
 
-            esp_log_buffer_hex(IAWARE_BLE, gl_profile_tab[PROFILE_A_APP_ID].remote_bda, sizeof(esp_bd_addr_t));
+            esp_log_buffer_hex(IAWARE_BLE, p->remote_bda, sizeof(esp_bd_addr_t));
 
             esp_err_t mtu_ret = esp_ble_gattc_send_mtu_req (gattc_if, p_data->connect.conn_id);
             if (mtu_ret)
@@ -194,6 +270,9 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
                 ESP_LOGE(IAWARE_BLE, "config MTU error, error code = %x", mtu_ret);
             }
 
+            // Look for the next peripheral while a slot is free.
+            hub_scan();
+
             break;
 
         case ESP_GATTC_OPEN_EVT:
@@ -201,6 +280,10 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
             {
                 ESP_LOGE(IAWARE_BLE, "open failed, status %d", p_data->open.status);
 
+                hub_is_opening = false;
+
+                hub_scan();
+
                 break;
             }
 
@@ -216,7 +299,20 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
 
             ESP_LOGI(IAWARE_BLE, "ESP_GATTC_CFG_MTU_EVT, Status %d, MTU %d, conn_id %d", param->cfg_mtu.status, param->cfg_mtu.mtu, param->cfg_mtu.conn_id);
 
-            esp_ble_gattc_search_service(gattc_if, param->cfg_mtu.conn_id, &remote_filter_service_uuid);
+            if ((p = hub_find(param->cfg_mtu.conn_id)) == NULL)
+                break;
+
+            if (p->is_cached)
+            {
+                // Neither the search of the service nor of its attributes, see BLE_HUB_KNOWN_PEERS.
+                p->get_server = true;
+                p->is_registering = true;
+                esp_ble_gattc_register_for_notify(gattc_if, p->remote_bda, p->char_handle);
+            }
+            else
+            {
+                esp_ble_gattc_search_service(gattc_if, param->cfg_mtu.conn_id, &remote_filter_service_uuid);
+            }
 
             break;
 
@@ -224,15 +320,17 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
             ESP_LOGI(IAWARE_BLE, "SEARCH RES: conn_id = %x is primary service %d", p_data->search_res.conn_id, p_data->search_res.is_primary);
             ESP_LOGI(IAWARE_BLE, "start handle %d end handle %d current handle value %d", p_data->search_res.start_handle, p_data->search_res.end_handle, p_data->search_res.srvc_id.inst_id);
 
-            if (p_data->search_res.srvc_id.uuid.len == ESP_UUID_LEN_16 && p_data->search_res.srvc_id.uuid.uuid.uuid16 == REMOTE_SERVICE_UUID) 
+            if ((p = hub_find(p_data->search_res.conn_id)) == NULL)
+                break;
+
+            if ((p_data->search_res.srvc_id.uuid.len == ESP_UUID_LEN_128) && 
+                (memcmp(p_data->search_res.srvc_id.uuid.uuid.uuid128, remote_filter_service_uuid.uuid.uuid128, ESP_UUID_LEN_128) == 0))
             {
                 ESP_LOGI(IAWARE_BLE, "service found");
 
-                get_server = true;
-                gl_profile_tab[PROFILE_A_APP_ID].service_start_handle = p_data->search_res.start_handle;
-                gl_profile_tab[PROFILE_A_APP_ID].service_end_handle = p_data->search_res.end_handle;
-
-                ESP_LOGI(IAWARE_BLE, "UUID16: %x", p_data->search_res.srvc_id.uuid.uuid.uuid16);
+                p->get_server = true;
+                p->service_start_handle = p_data->search_res.start_handle;
+                p->service_end_handle = p_data->search_res.end_handle;
             }
 
             break;
@@ -259,52 +357,27 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
             }
 
             ESP_LOGI(IAWARE_BLE, "ESP_GATTC_SEARCH_CMPL_EVT");
-            if (get_server)
+
+            if (((p = hub_find(p_data->search_cmpl.conn_id)) != NULL) && p->get_server)
             {
-                uint16_t count = 0;
-                esp_gatt_status_t status = esp_ble_gattc_get_attr_count( gattc_if,
-                                                                         p_data->search_cmpl.conn_id,
-                                                                         ESP_GATT_DB_CHARACTERISTIC,
-                                                                         gl_profile_tab[PROFILE_A_APP_ID].service_start_handle,
-                                                                         gl_profile_tab[PROFILE_A_APP_ID].service_end_handle,
-                                                                         INVALID_HANDLE,
-                                                                         &count);
+                uint16_t count = 1;
+                esp_gatt_status_t status = esp_ble_gattc_get_char_by_uuid( gattc_if,
+                                                                           p->conn_id,
+                                                                           p->service_start_handle,
+                                                                           p->service_end_handle,
+                                                                           remote_filter_char_uuid,
+                                                                           &char_elem_result,
+                                                                           &count);
                 if (status != ESP_GATT_OK)
                 {
-                    ESP_LOGE(IAWARE_BLE, "esp_ble_gattc_get_attr_count error");
+                    ESP_LOGE(IAWARE_BLE, "esp_ble_gattc_get_char_by_uuid error");
                 }
 
-                if (count > 0)
+                if ((status == ESP_GATT_OK) && (count > 0) && (char_elem_result.properties & ESP_GATT_CHAR_PROP_BIT_NOTIFY))
                 {
-                    char_elem_result = (esp_gattc_char_elem_t *)malloc(sizeof(esp_gattc_char_elem_t) * count);
-                    if (!char_elem_result)
-                    {
-                        ESP_LOGE(IAWARE_BLE, "gattc no mem");
-                    }
-                    else
-                    {
-                        status = esp_ble_gattc_get_char_by_uuid( gattc_if,
-                                                                 p_data->search_cmpl.conn_id,
-                                                                 gl_profile_tab[PROFILE_A_APP_ID].service_start_handle,
-                                                                 gl_profile_tab[PROFILE_A_APP_ID].service_end_handle,
-                                                                 remote_filter_char_uuid,
-                                                                 char_elem_result,
-                                                                 &count);
-                        if (status != ESP_GATT_OK)
-                        {
-                            ESP_LOGE(IAWARE_BLE, "esp_ble_gattc_get_char_by_uuid error");
-                        }
-
-                        /*  Every service have only one char in our 'ESP_GATTS_DEMO' demo, so we used first 'char_elem_result' */
-                        if (count > 0 && (char_elem_result[0].properties & ESP_GATT_CHAR_PROP_BIT_NOTIFY))
-                        {
-                            gl_profile_tab[PROFILE_A_APP_ID].char_handle = char_elem_result[0].char_handle;
-                            esp_ble_gattc_register_for_notify (gattc_if, gl_profile_tab[PROFILE_A_APP_ID].remote_bda, char_elem_result[0].char_handle);
-                        }
-                    }
-                    /* free char_elem_result */
-                    free(char_elem_result);
-
+                    p->char_handle = char_elem_result.char_handle;
+                    p->is_registering = true;
+                    esp_ble_gattc_register_for_notify (gattc_if, p->remote_bda, char_elem_result.char_handle);
                 }
                 else
                 {
@@ -317,87 +390,73 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
         case ESP_GATTC_REG_FOR_NOTIFY_EVT:
             ESP_LOGI(IAWARE_BLE, "ESP_GATTC_REG_FOR_NOTIFY_EVT");
 
+            // The event does not tell the peripheral, the registrations complete in the order that they were asked.
+            if ((p = hub_find_registering(p_data->reg_for_notify.handle)) == NULL)
+                break;
+
+            p->is_registering = false;
+
             if (p_data->reg_for_notify.status != ESP_GATT_OK)
             {
                 ESP_LOGE(IAWARE_BLE, "REG FOR NOTIFY failed: error status = %d", p_data->reg_for_notify.status);
             }
+            else if (p->is_cached)
+            {
+                hub_subscribe(gattc_if, p);
+            }
             else
             {
-                uint16_t count = 0;
-                uint16_t notify_en = 1;
-                esp_gatt_status_t ret_status = esp_ble_gattc_get_attr_count( gattc_if,
-                                                                             gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                                                                             ESP_GATT_DB_DESCRIPTOR,
-                                                                             gl_profile_tab[PROFILE_A_APP_ID].service_start_handle,
-                                                                             gl_profile_tab[PROFILE_A_APP_ID].service_end_handle,
-                                                                             gl_profile_tab[PROFILE_A_APP_ID].char_handle,
-                                                                             &count);
+                uint16_t count = 1;
+                esp_gatt_status_t ret_status = esp_ble_gattc_get_descr_by_char_handle( gattc_if,
+                                                                                       p->conn_id,
+                                                                                       p_data->reg_for_notify.handle,
+                                                                                       notify_descr_uuid,
+                                                                                       &descr_elem_result,
+                                                                                       &count);
                 if (ret_status != ESP_GATT_OK)
                 {
-                    ESP_LOGE(IAWARE_BLE, "esp_ble_gattc_get_attr_count error");
+                    ESP_LOGE(IAWARE_BLE, "esp_ble_gattc_get_descr_by_char_handle error");
                 }
 
-                if (count > 0)
+                if ((ret_status == ESP_GATT_OK) && (count > 0) && (descr_elem_result.uuid.len == ESP_UUID_LEN_16) && 
+                    (descr_elem_result.uuid.uuid.uuid16 == ESP_GATT_UUID_CHAR_CLIENT_CONFIG))
                 {
-                    descr_elem_result = malloc(sizeof(esp_gattc_descr_elem_t) * count);
-                    if (!descr_elem_result)
-                    {
-                        ESP_LOGE(IAWARE_BLE, "malloc error, gattc no mem");
-                    }
-                    else
-                    {
-                        ret_status = esp_ble_gattc_get_descr_by_char_handle( gattc_if,
-                                                                             gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                                                                             p_data->reg_for_notify.handle,
-                                                                             notify_descr_uuid,
-                                                                             descr_elem_result,
-                                                                             &count);
-                        if (ret_status != ESP_GATT_OK)
-                        {
-                            ESP_LOGE(IAWARE_BLE, "esp_ble_gattc_get_descr_by_char_handle error");
-                        }
-                        
-                        /* Every char has only one descriptor in our 'ESP_GATTS_DEMO' demo, so we used first 'descr_elem_result' */
-                        if (count > 0 && descr_elem_result[0].uuid.len == ESP_UUID_LEN_16 && descr_elem_result[0].uuid.uuid.uuid16 == ESP_GATT_UUID_CHAR_CLIENT_CONFIG)
-                        {
-                            ret_status = esp_ble_gattc_write_char_descr( gattc_if,
-                                                                         gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                                                                         descr_elem_result[0].handle,
-                                                                         sizeof(notify_en),
-                                                                         (uint8_t *)&notify_en,
-                                                                         ESP_GATT_WRITE_TYPE_RSP,
-                                                                         ESP_GATT_AUTH_REQ_NONE);
-                        }
-
-                        if (ret_status != ESP_GATT_OK)
-                        {
-                            ESP_LOGE(IAWARE_BLE, "esp_ble_gattc_write_char_descr error");
-                        }
-
-                        /* free descr_elem_result */
-                        free(descr_elem_result);
-                    }
+                    p->cccd_handle = descr_elem_result.handle;
+
+                    hub_subscribe(gattc_if, p);
                 }
                 else
                 {
                     ESP_LOGE(IAWARE_BLE, "decsr not found");
                 }
-
             }
+
             break;
         
         case ESP_GATTC_NOTIFY_EVT:
-            if (p_data->notify.is_notify)
+            if ((p = hub_find(p_data->notify.conn_id)) == NULL)
+                break;
+
+            if (p->is_first_pending)
+            {
+                p->is_first_pending = false;
+
+                BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_HUB_FIRST_NOTIFY, p->rx.source, (int) ((esp_timer_get_time() - p->t_connect)/1000), p->is_cached);
+            }
+
+            // The fragments of the sample blocks go to com_tcp_send_task(), the other notifications are only logged.
+            if ((p_data->notify.value_len > 0) && (p_data->notify.value[0] == PACKET_HEADER_BLE_FRAGMENT))
             {
-                ESP_LOGI(IAWARE_BLE, "ESP_GATTC_NOTIFY_EVT, receive notify value:");
+                ble_hub_rx_feed(&(p->rx), p_data->notify.value, p_data->notify.value_len);
+
+                if (p->rx.is_unsupported == iawTrue)
+                    hub_reject(gattc_if, p);
             }
             else
             {
-                ESP_LOGI(IAWARE_BLE, "ESP_GATTC_NOTIFY_EVT, receive indicate value:");
+                BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_CLT_NOTIFY, p_data->notify.is_notify, p_data->notify.handle, p_data->notify.value_len);
             }
 
-            esp_log_buffer_hex(IAWARE_BLE, p_data->notify.value, p_data->notify.value_len);
-
             break;
 
         case ESP_GATTC_WRITE_DESCR_EVT:
@@ -405,25 +464,28 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
             {
                 ESP_LOGE(IAWARE_BLE, "write descr failed, error status = %x", p_data->write.status);
 
-                break;
-            }
+                // The saved handles are stale, e.g. the peripheral runs another firmware: discover it.
+                if (((p = hub_find(p_data->write.conn_id)) != NULL) && p->is_cached)
+                {
+                    hub_known_forget(p->remote_bda);
+
+                    p->is_cached = false;
+                    p->get_server = false;
 
-            ESP_LOGI(IAWARE_BLE, "write descr success ");
+                    esp_ble_gattc_search_service(gattc_if, p->conn_id, &remote_filter_service_uuid);
+                }
 
-            uint8_t write_char_data[35];
+                break;
+            }
 
-            for (int i = 0; i < sizeof(write_char_data); ++i)
+            if ((p = hub_find(p_data->write.conn_id)) != NULL)
             {
-                write_char_data[i] = i % 256;
+                BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_HUB_SUBSCRIBED, p->rx.source, (p->remote_bda[4] << 8) | p->remote_bda[5], p->conn_id);
+
+                if (!p->is_cached)
+                    hub_known_save(p);
             }
 
-            esp_ble_gattc_write_char( gattc_if,
-                                      gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                                      gl_profile_tab[PROFILE_A_APP_ID].char_handle,
-                                      sizeof(write_char_data),
-                                      write_char_data,
-                                      ESP_GATT_WRITE_TYPE_RSP,
-                                      ESP_GATT_AUTH_REQ_NONE);
             break;
 
         case ESP_GATTC_SRVC_CHG_EVT:
@@ -437,6 +499,8 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
 
             esp_log_buffer_hex(IAWARE_BLE, bda, sizeof(esp_bd_addr_t));
 
+            hub_known_forget(bda);
+
             break;
         
         case ESP_GATTC_WRITE_CHAR_EVT:
@@ -452,11 +516,27 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
             break;
 
         case ESP_GATTC_DISCONNECT_EVT:
-            connect = false;
-            get_server = false;
-
             ESP_LOGI(IAWARE_BLE, "ESP_GATTC_DISCONNECT_EVT, reason = %d", p_data->disconnect.reason);
 
+            if ((p = hub_find(p_data->disconnect.conn_id)) != NULL)
+            {
+                BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_HUB_RX, p->rx.source, p->rx.n_blocks, p->rx.n_dropped);
+
+                ble_hub_rx_reset(&(p->rx), p->rx.source, NULL);
+
+                // Open it again directly, before any scan.
+                struct ble_hub_known *k = hub_known_find(p->remote_bda);
+
+                if (k != NULL)
+                    hub_known_tried[k - hub_known] = false;
+
+                p->get_server = false;
+                p->is_registering = false;
+                p->is_used = false;
+            }
+
+            hub_scan();
+
             break;
 
         default:
@@ -464,19 +544,227 @@ static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_
     }
 }
 
+static struct ble_hub_peripheral *hub_find(uint16_t conn_id)
+// NULL when conn_id is not connected.
+{
+    for (uint8_t i = 0; i < BLE_HUB_MAX_PERIPHERALS; i++)
+    {
+        if (hub_peripherals[i].is_used && (hub_peripherals[i].conn_id == conn_id))
+            return &(hub_peripherals[i]);
+    }
+
+    return NULL;
+}
+
+static struct ble_hub_peripheral *hub_find_bda(esp_bd_addr_t bda)
+{
+    for (uint8_t i = 0; i < BLE_HUB_MAX_PERIPHERALS; i++)
+    {
+        if (hub_peripherals[i].is_used && (memcmp(hub_peripherals[i].remote_bda, bda, sizeof(esp_bd_addr_t)) == 0))
+            return &(hub_peripherals[i]);
+    }
+
+    return NULL;
+}
+
+static struct ble_hub_peripheral *hub_find_registering(uint16_t char_handle)
+{
+    for (uint8_t i = 0; i < BLE_HUB_MAX_PERIPHERALS; i++)
+    {
+        if (hub_peripherals[i].is_used && hub_peripherals[i].is_registering && (hub_peripherals[i].char_handle == char_handle))
+            return &(hub_peripherals[i]);
+    }
+
+    return NULL;
+}
+
+static struct ble_hub_peripheral *hub_new(void)
+// A free slot, or NULL when BLE_HUB_MAX_PERIPHERALS peripherals are connected.
+{
+    for (uint8_t i = 0; i < BLE_HUB_MAX_PERIPHERALS; i++)
+    {
+        if (!hub_peripherals[i].is_used)
+            return &(hub_peripherals[i]);
+    }
+
+    return NULL;
+}
+
+static void hub_scan(void)
+// Unless the scan goes on, a connection is being opened, or every slot is taken: open the next known peripheral that
+// was not tried since its link loss or the boot, else the strongest candidate of the last scan, or scan again. A known
+// peripheral out of range fails its ESP_GATTC_OPEN_EVT once the controller gives up on the connection, the scan finds it
+// once it is back.
+{
+    esp_bd_addr_t bda;
+    uint8_t addr_type;
+
+    if (hub_is_scanning || hub_is_opening || (hub_new() == NULL))
+        return;
+
+    for (uint8_t i = 0; i < BLE_HUB_KNOWN_PEERS; i++)
+    {
+        if (hub_known[i].is_valid && !hub_known_tried[i] && (hub_find_bda(hub_known[i].bda) == NULL))
+        {
+            hub_known_tried[i] = true;
+
+            if (hub_open(hub_known[i].bda, hub_known[i].addr_type))
+                return;
+        }
+    }
+
+    while (ble_scan_pop(&hub_scanner, bda, &addr_type) == iawTrue)
+    {
+        if ((hub_find_bda(bda) == NULL) && !hub_is_rejected(bda) && hub_open(bda, addr_type))
+            return;
+    }
+
+    hub_is_scanning = true;
+
+    ble_scan_start(&hub_scanner);
+
+    esp_ble_gap_start_scanning(BLE_HUB_SCAN_DURATION);
+}
+
+static bool hub_open(esp_bd_addr_t bda, uint8_t addr_type)
+// ESP_GATTC_CONNECT_EVT or a failed ESP_GATTC_OPEN_EVT follows when it returns true.
+{
+    hub_is_opening = true;
+    hub_open_addr_type = addr_type;
+    memcpy(hub_open_bda, bda, sizeof(esp_bd_addr_t));
+
+    if (esp_ble_gattc_open(gl_profile_tab[PROFILE_A_APP_ID].gattc_if, bda, (esp_ble_addr_type_t) addr_type, true) != ESP_OK)
+    {
+        ESP_LOGE(IAWARE_BLE, "esp_ble_gattc_open error");
+
+        hub_is_opening = false;
+    }
+
+    return hub_is_opening;
+}
+
+static void hub_subscribe(esp_gatt_if_t gattc_if, struct ble_hub_peripheral *p)
+// Enable the notifications in the CCCD of the TX characteristic, ESP_GATTC_WRITE_DESCR_EVT follows.
+{
+    uint16_t notify_en = 1;
+
+    if (esp_ble_gattc_write_char_descr(gattc_if, p->conn_id, p->cccd_handle, sizeof(notify_en), (uint8_t *)&notify_en, ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE) != ESP_OK)
+        ESP_LOGE(IAWARE_BLE, "esp_ble_gattc_write_char_descr error");
+}
+
+static void hub_known_load(void)
+// None when NVS holds none, or a table of another layout.
+{
+    if (nvs_read_blob(BLE_HUB_NVS_KNOWN, hub_known, sizeof(hub_known)) == iawFalse)
+        memset(hub_known, 0, sizeof(hub_known));
+
+    for (uint8_t i = 0; i < BLE_HUB_KNOWN_PEERS; i++)
+    {
+        if (hub_known[i].is_valid && ((int32_t) (hub_known[i].save_seq - hub_known_seq) >= 0))
+            hub_known_seq = hub_known[i].save_seq + 1;
+    }
+}
+
+static struct ble_hub_known *hub_known_find(esp_bd_addr_t bda)
+{
+    for (uint8_t i = 0; i < BLE_HUB_KNOWN_PEERS; i++)
+    {
+        if (hub_known[i].is_valid && (memcmp(hub_known[i].bda, bda, sizeof(esp_bd_addr_t)) == 0))
+            return &(hub_known[i]);
+    }
+
+    return NULL;
+}
+
+static void hub_known_save(struct ble_hub_peripheral *p)
+// A discovered peripheral was subscribed. It takes a free entry, or the oldest one.
+{
+    struct ble_hub_known *k = hub_known_find(p->remote_bda);
+
+    if (k == NULL)
+    {
+        k = &(hub_known[0]);
+
+        for (uint8_t i = 0; i < BLE_HUB_KNOWN_PEERS; i++)
+        {
+            if (!hub_known[i].is_valid)
+            {
+                k = &(hub_known[i]);
+                break;
+            }
+
+            if ((int32_t) (hub_known[i].save_seq - k->save_seq) < 0)
+                k = &(hub_known[i]);
+        }
+    }
+
+    memcpy(k->bda, p->remote_bda, sizeof(esp_bd_addr_t));
+    k->addr_type            = p->addr_type;
+    k->is_valid             = 1;
+    k->service_start_handle = p->service_start_handle;
+    k->service_end_handle   = p->service_end_handle;
+    k->char_handle          = p->char_handle;
+    k->cccd_handle          = p->cccd_handle;
+    k->save_seq             = hub_known_seq;
+
+    hub_known_seq = hub_known_seq + 1;
+
+    nvs_write_blob(BLE_HUB_NVS_KNOWN, hub_known, sizeof(hub_known));
+}
+
+static void hub_known_forget(esp_bd_addr_t bda)
+{
+    struct ble_hub_known *k = hub_known_find(bda);
+
+    if (k == NULL)
+        return;
+
+    k->is_valid = 0;
+
+    nvs_write_blob(BLE_HUB_NVS_KNOWN, hub_known, sizeof(hub_known));
+}
+
+static void hub_reject(esp_gatt_if_t gattc_if, struct ble_hub_peripheral *p)
+// Its blocks do not fit in a slot, see BLE_HUB_MAX_FRAME. Once per connection, the notifications that are still queued
+// are ignored by ble_hub_rx_feed().
+{
+    if (hub_is_rejected(p->remote_bda))
+        return;
+
+    ESP_LOGE(IAWARE_BLE, "Hub: peripheral %02x:%02x:%02x:%02x:%02x:%02x sends blocks of %d bytes, a slot holds %d (%d channels), it is disconnected.",
+             p->remote_bda[0], p->remote_bda[1], p->remote_bda[2], p->remote_bda[3], p->remote_bda[4], p->remote_bda[5],
+             p->rx.frame_len, BLE_HUB_MAX_FRAME, BLE_HUB_MAX_CHANNELS);
+
+    memcpy(hub_rejected[hub_n_rejected % BLE_HUB_KNOWN_PEERS], p->remote_bda, sizeof(esp_bd_addr_t));
+    hub_n_rejected = hub_n_rejected + 1;
+
+    hub_known_forget(p->remote_bda);
+
+    if (esp_ble_gattc_close(gattc_if, p->conn_id) != ESP_OK)
+        ESP_LOGE(IAWARE_BLE, "esp_ble_gattc_close error");
+}
+
+static bool hub_is_rejected(esp_bd_addr_t bda)
+{
+    uint8_t n = (hub_n_rejected < BLE_HUB_KNOWN_PEERS) ? hub_n_rejected : BLE_HUB_KNOWN_PEERS;
+
+    for (uint8_t i = 0; i < n; i++)
+    {
+        if (memcmp(hub_rejected[i], bda, sizeof(esp_bd_addr_t)) == 0)
+            return true;
+    }
+
+    return false;
+}
 
 static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
 {
-    uint8_t *adv_name = NULL;
-    uint8_t adv_name_len = 0;
     switch (event) 
     {
         case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT: 
             ESP_LOGI(IAWARE_BLE, "esp_gap_cb: ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT");
 
-            //the unit of the duration is second
-            uint32_t duration = 30;
-            esp_ble_gap_start_scanning(duration);
+            hub_scan();
 
             break;
         
@@ -486,6 +774,8 @@ static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
             {
                 ESP_LOGE(IAWARE_BLE, "scan start failed, error status = %x", param->scan_start_cmpl.status);
 
+                hub_is_scanning = false;
+
                 break;
             }
 
@@ -494,59 +784,45 @@ static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
             break;
 
         case ESP_GAP_BLE_SCAN_RESULT_EVT: 
-            ESP_LOGI(IAWARE_BLE, "esp_gap_cb: ESP_GAP_BLE_SCAN_RESULT_EVT");
-
-            esp_ble_gap_cb_param_t *scan_result = (esp_ble_gap_cb_param_t *)param;
-            switch (scan_result->scan_rst.search_evt) 
+            switch (param->scan_rst.search_evt) 
             {
                 case ESP_GAP_SEARCH_INQ_RES_EVT:
-                    esp_log_buffer_hex(IAWARE_BLE, scan_result->scan_rst.bda, 6);
-
-                    ESP_LOGI(IAWARE_BLE, "searched Adv Data Len %d, Scan Response Len %d", scan_result->scan_rst.adv_data_len, scan_result->scan_rst.scan_rsp_len);
-
-                    adv_name = esp_ble_resolve_adv_data(scan_result->scan_rst.ble_adv, ESP_BLE_AD_TYPE_NAME_CMPL, &adv_name_len);
-
-                    ESP_LOGI(IAWARE_BLE, "searched Device Name Len %d", adv_name_len);
-
-                    esp_log_buffer_char(IAWARE_BLE, adv_name, adv_name_len);
+                    // No more than a lookup for most reports, see iaware_ble_scan.h.
+                    if (hub_find_bda(param->scan_rst.bda) != NULL)
+                        break;
+
+                    ble_scan_report(&hub_scanner,
+                                    param->scan_rst.bda,
+                                    param->scan_rst.ble_addr_type,
+                                    (int8_t) param->scan_rst.rssi,
+                                    param->scan_rst.ble_adv,
+                                    param->scan_rst.adv_data_len + param->scan_rst.scan_rsp_len,
+                                    (param->scan_rst.scan_rsp_len > 0) || 
+                                    ((param->scan_rst.ble_evt_type != ESP_BLE_EVT_CONN_ADV) && (param->scan_rst.ble_evt_type != ESP_BLE_EVT_DISC_ADV)));
 
 #if CONFIG_EXAMPLE_DUMP_ADV_DATA_AND_SCAN_RESP
-                    if (scan_result->scan_rst.adv_data_len > 0) 
+                    if (param->scan_rst.adv_data_len > 0) 
                     {
                         ESP_LOGI(IAWARE_BLE, "adv data:");
 
-                        esp_log_buffer_hex(IAWARE_BLE, &scan_result->scan_rst.ble_adv[0], scan_result->scan_rst.adv_data_len);
+                        esp_log_buffer_hex(IAWARE_BLE, &param->scan_rst.ble_adv[0], param->scan_rst.adv_data_len);
                     }
 
-                    if (scan_result->scan_rst.scan_rsp_len > 0) 
+                    if (param->scan_rst.scan_rsp_len > 0) 
                     {
                         ESP_LOGI(IAWARE_BLE, "scan resp:");
 
-                        esp_log_buffer_hex(IAWARE_BLE, &scan_result->scan_rst.ble_adv[scan_result->scan_rst.adv_data_len], scan_result->scan_rst.scan_rsp_len);
+                        esp_log_buffer_hex(IAWARE_BLE, &param->scan_rst.ble_adv[param->scan_rst.adv_data_len], param->scan_rst.scan_rsp_len);
                     }
 #endif
-                    ESP_LOGI(IAWARE_BLE, "\n");
-
-                    if (adv_name != NULL) 
-                    {
-                        if (strlen(remote_device_name) == adv_name_len && strncmp((char *)adv_name, remote_device_name, adv_name_len) == 0) 
-                        {
-                            ESP_LOGI(IAWARE_BLE, "searched device %s\n", remote_device_name);
-
-                            if (connect == false) 
-                            {
-                                connect = true;
+                    break;
+                case ESP_GAP_SEARCH_INQ_CMPL_EVT:
+                    ESP_LOGI(IAWARE_BLE, "scan complete, %d reports, %d parsed, %d candidates", hub_scanner.n_reports, hub_scanner.n_parsed, hub_scanner.n_candidates);
 
-                                ESP_LOGI(IAWARE_BLE, "connect to the remote device.");
+                    hub_is_scanning = false;
 
-                                esp_ble_gap_stop_scanning();
+                    hub_scan();
 
-                                esp_ble_gattc_open(gl_profile_tab[PROFILE_A_APP_ID].gattc_if, scan_result->scan_rst.bda, scan_result->scan_rst.ble_addr_type, true);
-                            }
-                        }
-                    }
-                    break;
-                case ESP_GAP_SEARCH_INQ_CMPL_EVT:
                     break;
                 default:
                     break;
@@ -564,6 +840,10 @@ static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
 
             ESP_LOGI(IAWARE_BLE, "stop scan successfully");
 
+            hub_is_scanning = false;
+
+            hub_scan();
+
             break;
 
         case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
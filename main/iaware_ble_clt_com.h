@@ -1,22 +1,56 @@
 #ifndef IAWARE_BLE_CLT_COM_H
 #define IAWARE_BLE_CLT_COM_H
 
+#include "iaware_ble_hub.h"
+
 #define GATTC_TAG "GATTC_DEMO"
-#define REMOTE_SERVICE_UUID        0x00FF
-#define REMOTE_NOTIFY_CHAR_UUID    0xFF01
 #define CLT_PROFILE_NUM      1
 #define PROFILE_A_APP_ID 0
 #define INVALID_HANDLE   0
 
+#define BLE_HUB_SCAN_DURATION   3  // [sec]. The strongest peripherals of a scan are opened at its end, see iaware_ble_scan.h.
+                                   // The scan starts again while a slot is free.
+
+// The peripherals that the hub subscribed to are saved in NVS with the handles that they use, so that it opens them
+// directly at boot and after a link loss, and subscribes with the saved handles instead of a discovery. A write of the
+// saved CCCD that fails, or a service change, forgets the peripheral, which is then discovered again.
+#define BLE_HUB_KNOWN_PEERS     4
+#define BLE_HUB_NVS_KNOWN       "hub_known"
+
+struct ble_hub_known {
+    esp_bd_addr_t bda;
+    uint8_t addr_type;          // esp_ble_addr_type_t
+    uint8_t is_valid;
+    uint16_t service_start_handle;
+    uint16_t service_end_handle;
+    uint16_t char_handle;
+    uint16_t cccd_handle;
+    uint32_t save_seq;          // The oldest is replaced when the table is full.
+};
+
 struct gattc_profile_inst {
     esp_gattc_cb_t gattc_cb;
     uint16_t gattc_if;
     uint16_t app_id;
+};
+
+// A connected peripheral of the hub, see iaware_ble_hub.h.
+struct ble_hub_peripheral {
+    bool is_used;
+    bool get_server;
+    bool is_registering;        // Waits for ESP_GATTC_REG_FOR_NOTIFY_EVT.
+    bool is_cached;             // Subscribes with the handles of its struct ble_hub_known.
+    bool is_first_pending;      // Waits for its first notification since the connection.
     uint16_t conn_id;
     uint16_t service_start_handle;
     uint16_t service_end_handle;
-    uint16_t char_handle;
+    uint16_t char_handle;       // The TX characteristic.
+    uint16_t cccd_handle;
     esp_bd_addr_t remote_bda;
+    uint8_t addr_type;
+    int64_t t_connect;          // [microsec]
+
+    struct ble_hub_rx rx;
 };
 
 
@@ -0,0 +1,207 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iaware_ble_hub.h"
+#include "iaware_ble_stream.h"
+#include "iaware_helper.h"
+#include "iaware_packet.h"
+#include "main.h"
+
+static void ble_hub_rx_drop(struct ble_hub_rx *rx);
+static struct ble_hub_slot *ble_hub_claim(void);
+
+static struct ble_hub_slot hub_slots[BLE_HUB_SLOTS];
+static uint32_t hub_ready_seq = 0;                  // The Bluedroid task only.
+static struct ble_hub_slot *hub_peeked = NULL;      // com_tcp_send_task() only.
+
+uint8_t ble_hub_init(void)
+// Allocate the slots once, before the first peripheral connects. Return iawFalse when the heap cannot hold them.
+{
+    for (uint8_t i = 0; i < BLE_HUB_SLOTS; i++)
+    {
+        if ((hub_slots[i].buff = (uint8_t *) malloc(BLE_HUB_HEADER_SIZE - 4 + BLE_HUB_MAX_FRAME)) == NULL)
+            return iawFalse;
+
+        hub_slots[i].state = BLE_HUB_SLOT_FREE;
+    }
+
+    return iawTrue;
+}
+
+void ble_hub_rx_reset(struct ble_hub_rx *rx, uint8_t source, const uint8_t *bda)
+// At every connection of a peripheral, and at its disconnection with bda NULL, which gives back its slot.
+{
+    if (rx->slot != NULL)
+        rx->slot->state = BLE_HUB_SLOT_FREE;
+
+    memset(rx, 0, sizeof(struct ble_hub_rx));
+
+    rx->source = source;
+
+    if (bda != NULL)
+        memcpy(rx->bda, bda, sizeof(rx->bda));
+}
+
+uint8_t ble_hub_rx_feed(struct ble_hub_rx *rx, const uint8_t *value, uint32_t len)
+// A notification of the peripheral. Return iawTrue when it completed a block, which is then ready for ble_hub_peek().
+// The other notifications, e.g. the PACKET_HEADER_FEATURE ones, are ignored, and so is everything once is_unsupported.
+{
+    if ((len <= BLE_STREAM_FRAG_HEADER_SIZE) || (value[0] != PACKET_HEADER_BLE_FRAGMENT) || (rx->is_unsupported == iawTrue))
+        return iawFalse;
+
+    uint32_t block_seq = bytes_to_uint32((uint8_t *) &(value[1]));
+    uint16_t i_frag = (uint16_t) ((value[5] << 8) | value[6]);
+    uint16_t n_frags = (uint16_t) ((value[7] << 8) | value[8]);
+    uint16_t payload = (uint16_t) (len - BLE_STREAM_FRAG_HEADER_SIZE);
+
+    if (i_frag == 0)
+    {
+        if (rx->slot != NULL)
+            ble_hub_rx_drop(rx);
+
+        // The frame starts with its length. Every block of a peripheral has the same size, so its first block decides.
+        uint32_t frame_len = (payload >= 4) ? (bytes_to_uint32((uint8_t *) &(value[BLE_STREAM_FRAG_HEADER_SIZE])) + 4) : 0;
+
+        if ((n_frags == 0) || (frame_len <= (uint32_t) (n_frags - 1)*payload) || (frame_len > (uint32_t) n_frags*payload))
+        {
+            rx->n_dropped = rx->n_dropped + 1;
+
+            return iawFalse;
+        }
+
+        if (frame_len > BLE_HUB_MAX_FRAME)
+        {
+            rx->is_unsupported = iawTrue;
+            rx->frame_len = frame_len;
+
+            return iawFalse;
+        }
+
+        if ((rx->slot = ble_hub_claim()) == NULL)
+        {
+            rx->n_dropped = rx->n_dropped + 1;
+
+            return iawFalse;
+        }
+
+        rx->block_seq       = block_seq;
+        rx->i_frag          = 0;
+        rx->n_frags         = n_frags;
+        rx->frag_payload    = payload;
+    }
+    else if (rx->slot == NULL)
+    {
+        return iawFalse; // The first fragments went by before the connection.
+    }
+    else if ((block_seq != rx->block_seq) || (i_frag != rx->i_frag) || (n_frags != rx->n_frags) ||
+             ((i_frag < n_frags - 1) && (payload != rx->frag_payload)))
+    {
+        ble_hub_rx_drop(rx);
+
+        return iawFalse;
+    }
+
+    // The frame goes right after the header of the hub, its 4-bytes length is overwritten once the block is complete.
+    uint32_t offset = (uint32_t) i_frag*rx->frag_payload;
+
+    if ((offset + payload) > BLE_HUB_MAX_FRAME)
+    {
+        ble_hub_rx_drop(rx);
+
+        return iawFalse;
+    }
+
+    memcpy(&(rx->slot->buff[BLE_HUB_HEADER_SIZE - 4 + offset]), &(value[BLE_STREAM_FRAG_HEADER_SIZE]), payload);
+
+    rx->i_frag = rx->i_frag + 1;
+
+    if (rx->i_frag < rx->n_frags)
+        return iawFalse;
+
+    struct ble_hub_slot *slot = rx->slot;
+    uint32_t frame_len = offset + payload;
+
+    rx->slot = NULL;
+
+    if ((frame_len <= 4) || (slot->buff[BLE_HUB_HEADER_SIZE] != PACKET_HEADER_STREAM))
+    {
+        slot->state = BLE_HUB_SLOT_FREE;
+        rx->n_dropped = rx->n_dropped + 1;
+
+        return iawFalse;
+    }
+
+    slot->len = BLE_HUB_HEADER_SIZE - 4 + frame_len;
+
+    uint32_to_bytes(slot->len - 4, &(slot->buff[0]));
+    slot->buff[4] = PACKET_HEADER_BLE_HUB;
+    slot->buff[5] = rx->source;
+    memcpy(&(slot->buff[6]), rx->bda, sizeof(rx->bda));
+
+    slot->ready_seq = hub_ready_seq;
+    hub_ready_seq = hub_ready_seq + 1;
+
+    // The state last, com_tcp_send_task() reads the slot as soon as it is ready.
+    slot->state = BLE_HUB_SLOT_READY;
+
+    rx->n_blocks = rx->n_blocks + 1;
+
+    return iawTrue;
+}
+
+uint32_t ble_hub_peek(uint8_t **packet)
+// The oldest complete block, as the packet to send. Return its length, or 0 when there is none. It stays until ble_hub_pop().
+{
+    if (hub_peeked == NULL)
+    {
+        for (uint8_t i = 0; i < BLE_HUB_SLOTS; i++)
+        {
+            struct ble_hub_slot *slot = &(hub_slots[i]);
+
+            if ((slot->state == BLE_HUB_SLOT_READY) && ((hub_peeked == NULL) || ((int32_t) (slot->ready_seq - hub_peeked->ready_seq) < 0)))
+                hub_peeked = slot;
+        }
+
+        if (hub_peeked == NULL)
+            return 0;
+    }
+
+    *packet = hub_peeked->buff;
+
+    return hub_peeked->len;
+}
+
+void ble_hub_pop(void)
+// The block of the last ble_hub_peek() was sent, or failed to.
+{
+    if (hub_peeked == NULL)
+        return;
+
+    hub_peeked->state = BLE_HUB_SLOT_FREE;
+    hub_peeked = NULL;
+}
+
+//////////////////// Private ////////////////////
+
+static void ble_hub_rx_drop(struct ble_hub_rx *rx)
+{
+    rx->slot->state = BLE_HUB_SLOT_FREE;
+    rx->slot = NULL;
+    rx->n_dropped = rx->n_dropped + 1;
+}
+
+static struct ble_hub_slot *ble_hub_claim(void)
+{
+    for (uint8_t i = 0; i < BLE_HUB_SLOTS; i++)
+    {
+        if ((hub_slots[i].buff != NULL) && (hub_slots[i].state == BLE_HUB_SLOT_FREE))
+        {
+            hub_slots[i].state = BLE_HUB_SLOT_FILLING;
+
+            return &(hub_slots[i]);
+        }
+    }
+
+    return NULL;
+}
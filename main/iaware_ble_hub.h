@@ -0,0 +1,74 @@
+#ifndef IAWARE_BLE_HUB_H
+#define IAWARE_BLE_HUB_H
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "iaware_packet.h"
+#include "iaware_sampling_data.h"
+#include "iaware_tcp_com.h"
+
+// The hub: an ESP32 in the central role (iaware_ble_clt_com.c) collects the sample blocks of several i-Aware peripherals
+// and forwards them to the TCP client of TCP_SEND_PORT. The fragments of a peripheral (see iaware_ble_stream.h) are put
+// back together in a slot of a pool shared by all the peripherals, and com_tcp_send_task() sends the complete slots in
+// the order that they completed. The pool is not the buff nodes, which hold the samples of the hub itself in its own
+// layout and are sized after it:
+//
+//     |(4bytes)|PACKET_HEADER_BLE_HUB|uint8_t source|6 bytes bda|PACKET_HEADER_STREAM|header|samples|
+//
+// source is the connection slot of the peripheral, so a client tells the peripherals apart as channels of their own, and
+// bda says which peripheral holds the slot. The rest is the v2 frame of the peripheral without its 4-bytes length. A block
+// with a missing fragment or without a free slot is dropped; block_seq in its header shows the gap.
+//
+// A slot holds the frame of a peripheral with BLE_HUB_MAX_CHANNELS channels at the default sampling frequency and block
+// rate. The first block of a peripheral tells the size of its frames: a larger one marks it is_unsupported, and the hub
+// logs it and closes the link instead of dropping every block.
+#define BLE_HUB_MAX_PERIPHERALS     3       // At most CONFIG_BTDM_CTRL_BLE_MAX_CONN.
+#define BLE_HUB_SLOTS               (2*BLE_HUB_MAX_PERIPHERALS)
+#ifdef CONFIG_IAWARE_BLE_HUB_MAX_CHANNELS
+#define BLE_HUB_MAX_CHANNELS        CONFIG_IAWARE_BLE_HUB_MAX_CHANNELS
+#else
+#define BLE_HUB_MAX_CHANNELS        4
+#endif
+#define BLE_HUB_MAX_FRAME           (4 + PACKET_HEADER_STREAM_V2_META_SIZE + 2*BLE_HUB_MAX_CHANNELS*(SAMPLING_DATA_FS/TCP_SEND_FREQUENCY)) // [bytes]. The v2 frame of a block, its 4-bytes length included.
+#define BLE_HUB_HEADER_SIZE         (4 + 1 + 1 + 6) // [bytes]
+
+#define BLE_HUB_SLOT_FREE           0
+#define BLE_HUB_SLOT_FILLING        1       // Owned by the struct ble_hub_rx that reassembles a block into it.
+#define BLE_HUB_SLOT_READY          2       // Owned by com_tcp_send_task() until ble_hub_pop().
+
+struct ble_hub_slot
+{
+    volatile uint8_t state;
+    uint32_t ready_seq;             // The order of completion.
+    uint32_t len;                   // [bytes]. The packet, from its 4-bytes length.
+    uint8_t *buff;                  // BLE_HUB_HEADER_SIZE - 4 + BLE_HUB_MAX_FRAME bytes.
+};
+
+// The reassembly of a peripheral, touched by the Bluedroid task only.
+struct ble_hub_rx
+{
+    uint8_t source;
+    uint8_t bda[6];
+
+    struct ble_hub_slot *slot;      // The block being reassembled, or NULL.
+    uint32_t block_seq;
+    uint16_t i_frag;                // The next fragment.
+    uint16_t n_frags;
+    uint16_t frag_payload;          // The frame bytes of every fragment but the last.
+
+    uint32_t n_blocks;              // The blocks queued for TCP.
+    uint32_t n_dropped;
+
+    uint8_t is_unsupported;         // Its frames do not fit in a slot, it is ignored from then on.
+    uint32_t frame_len;             // [bytes]. The frame that made it is_unsupported.
+};
+
+uint8_t ble_hub_init(void);
+void ble_hub_rx_reset(struct ble_hub_rx *rx, uint8_t source, const uint8_t *bda);
+uint8_t ble_hub_rx_feed(struct ble_hub_rx *rx, const uint8_t *value, uint32_t len);
+uint32_t ble_hub_peek(uint8_t **packet);
+void ble_hub_pop(void);
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "iaware_ble_link.h"
+#include "iaware_helper.h"
+#include "iaware_packet.h"
+#include "main.h"
+
+static uint16_t ble_link_choose(const struct ble_link *l);
+
+void ble_link_reset(struct ble_link *l)
+// At every connection, before any request.
+{
+    memset(l, 0, sizeof(struct ble_link));
+
+    l->want_min_int = BLE_LINK_MAX_INT/2;
+    l->want_max_int = BLE_LINK_MAX_INT;
+    l->tx_data_len  = BLE_LINK_DEFAULT_DATA_LEN;
+    l->rx_data_len  = BLE_LINK_DEFAULT_DATA_LEN;
+    l->tx_phy       = BLE_LINK_PHY_1M;
+    l->rx_phy       = BLE_LINK_PHY_1M;
+}
+
+uint8_t ble_link_set_rate(struct ble_link *l, uint32_t rate)
+// The client enabled or disabled the notifications, or the benchmark. Return iawTrue when the interval to ask for changed.
+{
+    l->rate = rate;
+
+    return ble_link_data_len(l, l->tx_data_len, l->rx_data_len);
+}
+
+uint8_t ble_link_conn_params(struct ble_link *l, uint8_t is_ok, uint16_t conn_int, uint16_t latency, uint16_t timeout)
+// ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT. Return iawTrue when the server should ask again for want_min_int and want_max_int.
+{
+    if (is_ok == iawTrue)
+    {
+        l->conn_int = conn_int;
+        l->latency  = latency;
+        l->timeout  = timeout;
+
+        if (conn_int <= l->want_max_int)
+            return iawFalse;
+    }
+
+    // The central refused or chose a slower interval. A central already at the shortest interval it allows is left alone.
+    if ((l->n_retunes == BLE_LINK_MAX_RETUNES) || (l->want_min_int >= BLE_LINK_IOS_MIN_INT))
+        return iawFalse;
+
+    l->n_retunes    = l->n_retunes + 1;
+    l->want_min_int = BLE_LINK_IOS_MIN_INT;
+    l->want_max_int = ((l->want_max_int < (BLE_LINK_IOS_MIN_INT + BLE_LINK_IOS_MIN_INT)) ? (BLE_LINK_IOS_MIN_INT + BLE_LINK_IOS_MIN_INT) : l->want_max_int);
+
+    return iawTrue;
+}
+
+uint8_t ble_link_data_len(struct ble_link *l, uint16_t tx_data_len, uint16_t rx_data_len)
+// ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT. A longer PDU carries the rate at a longer interval. Return iawTrue when the
+// interval to ask for changed.
+{
+    uint16_t max_int;
+
+    l->tx_data_len = tx_data_len;
+    l->rx_data_len = rx_data_len;
+
+    if ((max_int = ble_link_choose(l)) == l->want_max_int)
+        return iawFalse;
+
+    l->want_max_int = max_int;
+    l->want_min_int = ((max_int/2) < BLE_LINK_MIN_INT) ? BLE_LINK_MIN_INT : (max_int/2);
+    l->n_retunes    = 0;
+
+    return iawTrue;
+}
+
+uint32_t ble_link_pack(const struct ble_link *l, uint16_t mtu, uint8_t *dst)
+// A PACKET_HEADER_BLE_LINK notification, BLE_LINK_PACKET_SIZE bytes.
+{
+    dst[0] = PACKET_HEADER_BLE_LINK;
+    dst[1] = highbyte(l->conn_int);
+    dst[2] = lowbyte(l->conn_int);
+    dst[3] = highbyte(l->latency);
+    dst[4] = lowbyte(l->latency);
+    dst[5] = highbyte(l->timeout);
+    dst[6] = lowbyte(l->timeout);
+    dst[7] = highbyte(l->tx_data_len);
+    dst[8] = lowbyte(l->tx_data_len);
+    dst[9] = highbyte(l->rx_data_len);
+    dst[10] = lowbyte(l->rx_data_len);
+    dst[11] = l->tx_phy;
+    dst[12] = l->rx_phy;
+    dst[13] = highbyte(mtu);
+    dst[14] = lowbyte(mtu);
+    uint32_to_bytes(l->rate, &(dst[15]));
+    dst[19] = highbyte(l->want_min_int);
+    dst[20] = lowbyte(l->want_min_int);
+    dst[21] = highbyte(l->want_max_int);
+    dst[22] = lowbyte(l->want_max_int);
+
+    return BLE_LINK_PACKET_SIZE;
+}
+
+//////////////////// Private ////////////////////
+
+static uint16_t ble_link_choose(const struct ble_link *l)
+// The longest interval that carries l->rate, in 1.25 ms.
+{
+    // A PDU carries the notification less the L2CAP and the ATT headers.
+    uint64_t bytes_per_event = (uint64_t) BLE_LINK_PDUS_PER_EVENT*(l->tx_data_len - 4 - 3);
+    uint64_t need = (uint64_t) l->rate*(100 + BLE_LINK_HEADROOM_PCT)/100;
+    uint64_t interval;
+
+    if (l->rate == 0)
+        return BLE_LINK_MAX_INT;
+
+    if (l->rate == BLE_LINK_RATE_MAX)
+        return BLE_LINK_MIN_INT;
+
+    // 800 intervals of 1.25 ms per second.
+    interval = 800*bytes_per_event/need;
+
+    if (interval < BLE_LINK_MIN_INT)
+        return BLE_LINK_MIN_INT;
+
+    return (interval > BLE_LINK_MAX_INT) ? BLE_LINK_MAX_INT : (uint16_t) interval;
+}
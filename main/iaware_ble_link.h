@@ -0,0 +1,60 @@
+#ifndef IAWARE_BLE_LINK_H
+#define IAWARE_BLE_LINK_H
+
+#include <stdint.h>
+
+// The link parameters that the server asks of a central. On every connection it asks for the data length extension, so a
+// link-layer PDU carries up to BLE_LINK_DATA_LEN bytes instead of 27, and, on the chips with Bluetooth 5
+// (CONFIG_BT_BLE_50_FEATURES_SUPPORTED), for the 2M PHY. The ESP32 has neither 2M PHY nor the PHY events and stays at 1M.
+//
+// The connection interval is chosen from the rate of the notifications that the client enabled: the longest interval at
+// which BLE_LINK_PDUS_PER_EVENT PDUs per connection event carry the rate with BLE_LINK_HEADROOM_PCT percent to spare, in
+// [BLE_LINK_MIN_INT, BLE_LINK_MAX_INT]. The band powers alone take BLE_LINK_MAX_INT, the former fixed request, and the
+// benchmark takes BLE_LINK_MIN_INT. The central has the last word: when ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT reports a
+// failure or an interval that does not carry the rate, the server asks again within the limits that iOS accepts, i.e.
+// a minimum of at least 15 ms and a maximum at least 15 ms above it, at most BLE_LINK_MAX_RETUNES times per choice.
+//
+// The achieved parameters go to the client in a PACKET_HEADER_BLE_LINK notification whenever they change:
+//
+//     |PACKET_HEADER_BLE_LINK|uint16_t conn_int|uint16_t latency|uint16_t timeout|uint16_t tx_data_len|uint16_t rx_data_len|
+//     |uint8_t tx_phy|uint8_t rx_phy|uint16_t mtu|uint32_t rate [bytes/sec]|uint16_t want_min_int|uint16_t want_max_int|
+//
+// The intervals are in 1.25 ms and the timeout in 10 ms, like in esp_ble_conn_update_params_t.
+#define BLE_LINK_DATA_LEN           251     // [bytes]. The maximum of Bluetooth 4.2.
+#define BLE_LINK_DEFAULT_DATA_LEN   27      // [bytes]. Without the data length extension.
+#define BLE_LINK_MIN_INT            6       // [1.25 ms], i.e. 7.5 ms.
+#define BLE_LINK_MAX_INT            32      // [1.25 ms], i.e. 40 ms.
+#define BLE_LINK_IOS_MIN_INT        12      // [1.25 ms], i.e. 15 ms.
+#define BLE_LINK_TIMEOUT            400     // [10 ms], i.e. 4 sec.
+#define BLE_LINK_PDUS_PER_EVENT     4       // The PDUs that a central lets through in a connection event, conservatively.
+#define BLE_LINK_HEADROOM_PCT       50
+#define BLE_LINK_MAX_RETUNES        1
+#define BLE_LINK_RATE_MAX           0xFFFFFFFF  // [bytes/sec]. As fast as the link goes, for the benchmark.
+#define BLE_LINK_PHY_1M             1       // ESP_BLE_GAP_PHY_1M
+
+#define BLE_LINK_PACKET_SIZE        (1 + 2 + 2 + 2 + 2 + 2 + 1 + 1 + 2 + 4 + 2 + 2)  // [bytes]
+
+struct ble_link
+{
+    uint32_t rate;                  // [bytes/sec]. The notifications that the interval is chosen for.
+    uint16_t want_min_int;
+    uint16_t want_max_int;
+    uint8_t n_retunes;
+
+    // As achieved. The data lengths and the PHYs are the defaults until the controller reports otherwise.
+    uint16_t conn_int;
+    uint16_t latency;
+    uint16_t timeout;
+    uint16_t tx_data_len;
+    uint16_t rx_data_len;
+    uint8_t tx_phy;
+    uint8_t rx_phy;
+};
+
+void ble_link_reset(struct ble_link *l);
+uint8_t ble_link_set_rate(struct ble_link *l, uint32_t rate);
+uint8_t ble_link_conn_params(struct ble_link *l, uint8_t is_ok, uint16_t conn_int, uint16_t latency, uint16_t timeout);
+uint8_t ble_link_data_len(struct ble_link *l, uint16_t tx_data_len, uint16_t rx_data_len);
+uint32_t ble_link_pack(const struct ble_link *l, uint16_t mtu, uint8_t *dst);
+
+#endif
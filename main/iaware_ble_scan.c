@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "iaware_ble_scan.h"
+#include "iaware_bool.h"
+
+static struct ble_scan_seen *ble_scan_seen_find(struct ble_scan *s, const uint8_t *bda);
+static void ble_scan_rank(struct ble_scan *s, const uint8_t *bda, uint8_t addr_type, int8_t rssi);
+
+void ble_scan_init(struct ble_scan *s, const uint8_t *uuid128)
+{
+    memcpy(s->uuid128, uuid128, sizeof(s->uuid128));
+
+    ble_scan_start(s);
+}
+
+void ble_scan_start(struct ble_scan *s)
+// Forget the addresses and the candidates, at the start of every scan.
+{
+    memset(s->seen, 0, sizeof(s->seen));
+
+    s->n_candidates = 0;
+    s->n_reports    = 0;
+    s->n_parsed     = 0;
+}
+
+uint8_t ble_scan_report(struct ble_scan *s, const uint8_t *bda, uint8_t addr_type, int8_t rssi, const uint8_t *adv, uint32_t len, uint8_t is_complete)
+// An advertising report, adv is its advertising data followed by its scan response. Return iawTrue when bda advertises
+// the service. A candidate that reports again is ranked again with its new RSSI.
+{
+    struct ble_scan_seen *seen = ble_scan_seen_find(s, bda);
+
+    s->n_reports = s->n_reports + 1;
+
+    if ((seen != NULL) && (seen->verdict == BLE_SCAN_SEEN_REJECTED))
+        return iawFalse;
+
+    if ((seen == NULL) || (seen->verdict == BLE_SCAN_SEEN_NONE))
+    {
+        s->n_parsed = s->n_parsed + 1;
+
+        if (ble_scan_adv_has_uuid128(adv, len, s->uuid128) == iawFalse)
+        {
+            if ((seen != NULL) && is_complete)
+            {
+                memcpy(seen->bda, bda, sizeof(seen->bda));
+                seen->verdict = BLE_SCAN_SEEN_REJECTED;
+            }
+
+            return iawFalse;
+        }
+
+        if (seen != NULL)
+        {
+            memcpy(seen->bda, bda, sizeof(seen->bda));
+            seen->verdict = BLE_SCAN_SEEN_CANDIDATE;
+        }
+    }
+
+    ble_scan_rank(s, bda, addr_type, rssi);
+
+    return iawTrue;
+}
+
+uint8_t ble_scan_pop(struct ble_scan *s, uint8_t *bda, uint8_t *addr_type)
+// Take the strongest candidate out of the table. Return iawFalse when there is none.
+{
+    if (s->n_candidates == 0)
+        return iawFalse;
+
+    memcpy(bda, s->candidates[0].bda, sizeof(s->candidates[0].bda));
+    *addr_type = s->candidates[0].addr_type;
+
+    s->n_candidates = s->n_candidates - 1;
+
+    memmove(&(s->candidates[0]), &(s->candidates[1]), s->n_candidates*sizeof(struct ble_scan_candidate));
+
+    return iawTrue;
+}
+
+uint8_t ble_scan_adv_has_uuid128(const uint8_t *adv, uint32_t len, const uint8_t *uuid128)
+// Look for uuid128 in the 128-bit service UUID lists of the AD structures |uint8_t len|uint8_t type|len - 1 bytes|.
+// A structure that runs past len ends the search, a zero length is the padding of the payload.
+{
+    uint32_t i = 0;
+
+    while ((i + 1) < len)
+    {
+        uint32_t field_len = adv[i];
+        uint32_t end = i + 1 + field_len;
+
+        if ((field_len == 0) || (end > len))
+            break;
+
+        if ((adv[i + 1] == BLE_SCAN_AD_TYPE_128SRV_CMPL) || (adv[i + 1] == BLE_SCAN_AD_TYPE_128SRV_PART))
+        {
+            for (uint32_t j = i + 2; (j + 16) <= end; j = j + 16)
+            {
+                if (memcmp(&(adv[j]), uuid128, 16) == 0)
+                    return iawTrue;
+            }
+        }
+
+        i = end;
+    }
+
+    return iawFalse;
+}
+
+//////////////////// Private ////////////////////
+
+static struct ble_scan_seen *ble_scan_seen_find(struct ble_scan *s, const uint8_t *bda)
+// The entry of bda, or the free entry where it goes, or NULL when its probes are all taken.
+{
+    // The low bytes of an address change the most from a device to another, the OUI of a public one does not.
+    uint32_t x = (uint32_t) bda[2] | ((uint32_t) bda[3] << 8) | ((uint32_t) bda[4] << 16) | ((uint32_t) bda[5] << 24);
+    uint32_t h;
+
+    x = ((x >> 16) ^ x)*0x45d9f3b;
+    x = ((x >> 16) ^ x)*0x45d9f3b;
+    h = ((x >> 16) ^ x) & (BLE_SCAN_SEEN_SIZE - 1);
+
+    for (uint8_t i = 0; i < BLE_SCAN_SEEN_PROBES; i++)
+    {
+        struct ble_scan_seen *seen = &(s->seen[(h + i) & (BLE_SCAN_SEEN_SIZE - 1)]);
+
+        if ((seen->verdict == BLE_SCAN_SEEN_NONE) || (memcmp(seen->bda, bda, sizeof(seen->bda)) == 0))
+            return seen;
+    }
+
+    return NULL;
+}
+
+static void ble_scan_rank(struct ble_scan *s, const uint8_t *bda, uint8_t addr_type, int8_t rssi)
+{
+    struct ble_scan_candidate *c = s->candidates;
+    uint8_t i;
+
+    // Take bda out of the table if it is in.
+    for (i = 0; i < s->n_candidates; i++)
+    {
+        if (memcmp(c[i].bda, bda, sizeof(c[i].bda)) == 0)
+        {
+            s->n_candidates = s->n_candidates - 1;
+
+            memmove(&(c[i]), &(c[i + 1]), (s->n_candidates - i)*sizeof(struct ble_scan_candidate));
+
+            break;
+        }
+    }
+
+    for (i = 0; (i < s->n_candidates) && (c[i].rssi >= rssi); i++)
+        ;
+
+    if (i == BLE_SCAN_MAX_CANDIDATES)
+        return; // Weaker than every candidate of a full table.
+
+    if (s->n_candidates < BLE_SCAN_MAX_CANDIDATES)
+        s->n_candidates = s->n_candidates + 1;
+
+    memmove(&(c[i + 1]), &(c[i]), (s->n_candidates - 1 - i)*sizeof(struct ble_scan_candidate));
+
+    memcpy(c[i].bda, bda, sizeof(c[i].bda));
+    c[i].addr_type  = addr_type;
+    c[i].rssi       = rssi;
+}
@@ -0,0 +1,57 @@
+#ifndef IAWARE_BLE_SCAN_H
+#define IAWARE_BLE_SCAN_H
+
+#include <stdint.h>
+
+// The scan of the hub (iaware_ble_clt_com.c). Every advertising report goes through ble_scan_report(), which looks its
+// address up in a table of the addresses seen since ble_scan_start(), and parses the advertising payload only for a new
+// address: one pass over the AD structures for the 128-bit service UUID of the i-Aware peripherals, which they put in
+// their advertising data. An address is remembered as rejected once its report is complete, i.e. it carries the scan
+// response or the advertising is not scannable. The controller filters the duplicates too, the table covers the scan
+// responses and the addresses that its filter forgets in a busy room.
+//
+// The matching peripherals are ranked by RSSI in a table of BLE_SCAN_MAX_CANDIDATES, the strongest first. A weaker one is
+// dropped when the table is full. It includes no ESP-IDF header, test_host_ble_scan.py runs and times it on a PC.
+#define BLE_SCAN_MAX_CANDIDATES     4
+#define BLE_SCAN_SEEN_SIZE          256     // A power of 2.
+#define BLE_SCAN_SEEN_PROBES        16      // An address that finds no room is parsed at every report.
+
+#define BLE_SCAN_AD_TYPE_128SRV_PART    0x06
+#define BLE_SCAN_AD_TYPE_128SRV_CMPL    0x07
+
+#define BLE_SCAN_SEEN_NONE          0
+#define BLE_SCAN_SEEN_REJECTED      1
+#define BLE_SCAN_SEEN_CANDIDATE     2
+
+struct ble_scan_seen
+{
+    uint8_t bda[6];
+    uint8_t verdict;
+};
+
+struct ble_scan_candidate
+{
+    uint8_t bda[6];
+    uint8_t addr_type;              // esp_ble_addr_type_t
+    int8_t rssi;                    // [dBm]
+};
+
+struct ble_scan
+{
+    uint8_t uuid128[16];            // The service, least significant byte first as in the advertising payload.
+
+    struct ble_scan_seen seen[BLE_SCAN_SEEN_SIZE];
+    struct ble_scan_candidate candidates[BLE_SCAN_MAX_CANDIDATES];
+    uint8_t n_candidates;
+
+    uint32_t n_reports;             // Since ble_scan_start().
+    uint32_t n_parsed;
+};
+
+void ble_scan_init(struct ble_scan *s, const uint8_t *uuid128);
+void ble_scan_start(struct ble_scan *s);
+uint8_t ble_scan_report(struct ble_scan *s, const uint8_t *bda, uint8_t addr_type, int8_t rssi, const uint8_t *adv, uint32_t len, uint8_t is_complete);
+uint8_t ble_scan_pop(struct ble_scan *s, uint8_t *bda, uint8_t *addr_type);
+uint8_t ble_scan_adv_has_uuid128(const uint8_t *adv, uint32_t len, const uint8_t *uuid128);
+
+#endif
@@ -0,0 +1,40 @@
+// Replay of a captured stream of advertising reports through iaware_ble_scan.c on a PC. It is not in COMPONENT_SRCS, so
+// the ESP32 firmware does not use it. Build it together with the scan, e.g. gcc -I. iaware_ble_scan.c iaware_ble_scan_replay.c
+// A report is |6 bytes bda|uint8_t addr_type|int8_t rssi|uint8_t is_complete|uint8_t len|len bytes adv|, as written by
+// ble_scan_capture() of iaware_host.py. The stream is in memory, so a benchmark times only the parser.
+
+#include <stdint.h>
+
+#include "iaware_ble_scan.h"
+
+#define BLE_SCAN_REPLAY_HEADER_SIZE     10  // [bytes]
+
+uint32_t ble_scan_replay(struct ble_scan *s, const uint8_t *reports, uint32_t len, uint32_t n_rounds)
+// Feed the reports n_rounds times, each round a scan of its own. Return the number of parsed reports of all the rounds, or
+// 0xFFFFFFFF when a report runs past len.
+{
+    uint32_t n_parsed = 0;
+
+    for (uint32_t round = 0; round < n_rounds; round++)
+    {
+        uint32_t i = 0;
+
+        ble_scan_start(s);
+
+        while (i < len)
+        {
+            const uint8_t *r = &(reports[i]);
+
+            if (((i + BLE_SCAN_REPLAY_HEADER_SIZE) > len) || ((i + BLE_SCAN_REPLAY_HEADER_SIZE + r[9]) > len))
+                return 0xFFFFFFFF;
+
+            ble_scan_report(s, r, r[6], (int8_t) r[7], &(r[BLE_SCAN_REPLAY_HEADER_SIZE]), r[9], r[8]);
+
+            i = i + BLE_SCAN_REPLAY_HEADER_SIZE + r[9];
+        }
+
+        n_parsed = n_parsed + s->n_parsed;
+    }
+
+    return n_parsed;
+}
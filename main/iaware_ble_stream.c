@@ -0,0 +1,239 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "iaware_ble_stream.h"
+#include "iaware_helper.h"
+#include "iaware_packet.h"
+#include "iaware_sampling_data.h"
+#include "iaware_stream.h"
+#include "main.h"
+
+static uint8_t ble_stream_start(struct ble_stream *bs, uint16_t mtu);
+static struct buff_node *ble_stream_find(uint32_t block_seq);
+
+void ble_stream_reset(struct ble_stream *bs)
+// Start at the next block that completes. Called when a client enables the notifications.
+{
+    memset(bs, 0, sizeof(struct ble_stream));
+
+    bs->next_block_seq = sampling_data_block_seq;
+}
+
+uint32_t ble_stream_peek(struct ble_stream *bs, uint16_t mtu, uint8_t *dst)
+// Write the next fragment to dst, at most mtu - 3 bytes. Return its length, or 0 when no block is ready. The fragment
+// stays the next one until ble_stream_advance(), so a notification that could not be queued is built again.
+{
+    if ((bs->node == NULL) && (ble_stream_start(bs, mtu) == iawFalse))
+        return 0;
+
+    struct buff_node *node = bs->node;
+    uint32_t begin = (uint32_t) bs->i_frag*bs->frag_payload;
+    uint32_t len = ((bs->frame_len - begin) < bs->frag_payload) ? (bs->frame_len - begin) : bs->frag_payload;
+    uint8_t *p = &(dst[BLE_STREAM_FRAG_HEADER_SIZE]);
+
+    dst[0] = PACKET_HEADER_BLE_FRAGMENT;
+    uint32_to_bytes(bs->block_seq, &(dst[1]));
+    dst[5] = highbyte(bs->i_frag);
+    dst[6] = lowbyte(bs->i_frag);
+    dst[7] = highbyte(bs->n_frags);
+    dst[8] = lowbyte(bs->n_frags);
+
+    // The frame is the header followed by the samples, which stay in the node.
+    if (begin < bs->header_len)
+    {
+        uint32_t n = ((bs->header_len - begin) < len) ? (bs->header_len - begin) : len;
+
+        memcpy(p, &(bs->header[begin]), n);
+        memcpy(&(p[n]), node->samples_buff + STREAM_HEADROOM, len - n);
+    }
+    else
+    {
+        memcpy(p, node->samples_buff + STREAM_HEADROOM + (begin - bs->header_len), len);
+    }
+
+    // The sampling callback may have started to refill the node.
+    if ((node->block_seq != bs->block_seq) || (node == run_buff_node_ptr))
+    {
+        bs->n_skipped = bs->n_skipped + 1;
+        bs->node = NULL;
+
+        return 0;
+    }
+
+    return BLE_STREAM_FRAG_HEADER_SIZE + len;
+}
+
+void ble_stream_advance(struct ble_stream *bs)
+// The fragment of the last ble_stream_peek() was queued.
+{
+    bs->n_frags_sent = bs->n_frags_sent + 1;
+    bs->i_frag = bs->i_frag + 1;
+
+    if (bs->i_frag == bs->n_frags)
+    {
+        bs->n_blocks = bs->n_blocks + 1;
+        bs->node = NULL;
+    }
+}
+
+void ble_flow_reset(struct ble_flow *f, int64_t now)
+// At every new client and every change of mode.
+{
+    memset(f, 0, sizeof(struct ble_flow));
+
+    f->credits  = BLE_FLOW_CREDITS;
+    f->t_last   = now;
+    f->t_window = now;
+}
+
+uint8_t ble_flow_take(struct ble_flow *f, int64_t now)
+// Take a credit right before esp_ble_gatts_send_indicate(). Return iawFalse when the notification must wait.
+{
+    if (f->is_congested == iawTrue)
+        return iawFalse;
+
+    if ((f->credits == 0) && ((now - f->t_last) > (int64_t) BLE_FLOW_STALL_MS*1000))
+    {
+        f->credits = BLE_FLOW_CREDITS;
+        f->i_sent = 0;
+    }
+
+    if (f->credits == 0)
+        return iawFalse;
+
+    uint8_t n_in_flight = BLE_FLOW_CREDITS - f->credits;
+
+    f->t_sent[(f->i_sent + n_in_flight) % BLE_FLOW_CREDITS] = now;
+    f->credits = f->credits - 1;
+
+    if (f->credits == 0)
+        f->t_last = now;
+
+    return iawTrue;
+}
+
+void ble_flow_untake(struct ble_flow *f)
+// esp_ble_gatts_send_indicate() did not queue the notification.
+{
+    if (f->credits < BLE_FLOW_CREDITS)
+        f->credits = f->credits + 1;
+}
+
+void ble_flow_conf(struct ble_flow *f, uint16_t len, int64_t now)
+// ESP_GATTS_CONF_EVT of a notification of len bytes.
+{
+    f->t_last = now;
+
+    if (f->credits == BLE_FLOW_CREDITS)
+        return; // Not one of ours, e.g. after the credits came back from a stall.
+
+    uint32_t latency = (uint32_t) (now - f->t_sent[f->i_sent]);
+
+    f->i_sent = (f->i_sent + 1) % BLE_FLOW_CREDITS;
+    f->credits = f->credits + 1;
+
+    f->window_bytes = f->window_bytes + len;
+    f->window_n = f->window_n + 1;
+    f->window_latency_sum = f->window_latency_sum + latency;
+
+    if (latency > f->window_latency_max)
+        f->window_latency_max = latency;
+}
+
+uint8_t ble_flow_report(struct ble_flow *f, int64_t now, uint32_t *kbps, uint32_t *latency_avg, uint32_t *latency_max)
+// Every BLE_FLOW_REPORT_MS, return iawTrue with the throughput of the confirmed notifications [kbit/s] and their latency
+// [microsec] over the window, and start the next window.
+{
+    int64_t span = now - f->t_window;
+
+    if (span < (int64_t) BLE_FLOW_REPORT_MS*1000)
+        return iawFalse;
+
+    *kbps           = (uint32_t) ((uint64_t) f->window_bytes*8*1000/(uint64_t) span);
+    *latency_avg    = (f->window_n > 0) ? (uint32_t) (f->window_latency_sum/f->window_n) : 0;
+    *latency_max    = f->window_latency_max;
+
+    f->t_window             = now;
+    f->window_bytes         = 0;
+    f->window_n             = 0;
+    f->window_latency_sum   = 0;
+    f->window_latency_max   = 0;
+
+    return iawTrue;
+}
+
+uint32_t ble_bench_pack(uint8_t *dst, uint16_t mtu, uint32_t bench_seq, int64_t now)
+// A PACKET_HEADER_BLE_BENCH notification of mtu - 3 bytes. The padding counts up, so a corrupted one shows.
+{
+    uint32_t len = mtu - 3;
+
+    dst[0] = PACKET_HEADER_BLE_BENCH;
+    uint32_to_bytes(bench_seq, &(dst[1]));
+    uint64_to_bytes((uint64_t) now, &(dst[5]));
+
+    for (uint32_t i = BLE_BENCH_HEADER_SIZE; i < len; i++)
+        dst[i] = (uint8_t) i;
+
+    return len;
+}
+
+//////////////////// Private ////////////////////
+
+static uint8_t ble_stream_start(struct ble_stream *bs, uint16_t mtu)
+// Pick the block to send and write its header. Return iawFalse when none is ready.
+{
+    struct stream_block_meta meta;
+    uint32_t newest = sampling_data_block_seq; // The block_seq of the next block that completes.
+
+    if (bs->next_block_seq >= newest)
+        return iawFalse;
+
+    if ((newest - bs->next_block_seq) > BLE_STREAM_MAX_BACKLOG)
+    {
+        bs->n_skipped = bs->n_skipped + (newest - BLE_STREAM_MAX_BACKLOG - bs->next_block_seq);
+        bs->next_block_seq = newest - BLE_STREAM_MAX_BACKLOG;
+    }
+
+    struct buff_node *node = ble_stream_find(bs->next_block_seq);
+
+    if (node == NULL)
+    {
+        // It was overwritten already.
+        bs->n_skipped = bs->n_skipped + 1;
+        bs->next_block_seq = bs->next_block_seq + 1;
+
+        return iawFalse;
+    }
+
+    // sampling_filter_task() sets is_filtered before it filters, so it must have moved on too.
+    if ((node->is_filter_bypassed == iawFalse) && ((node->is_filtered == iawFalse) || (node == run_filter_buff_node_ptr)))
+        return iawFalse;
+
+    stream_meta_of_node(node, &meta);
+
+    meta.flags = meta.flags & ~STREAM_FLAG_STATS;
+    meta.stats = NULL;
+
+    bs->header_len      = stream_header_write(bs->header, STREAM_VERSION_2, &meta, node->n_samples);
+    bs->frame_len       = bs->header_len + node->n_samples;
+    bs->frag_payload    = mtu - 3 - BLE_STREAM_FRAG_HEADER_SIZE;
+    bs->n_frags         = (uint16_t) ((bs->frame_len + bs->frag_payload - 1)/bs->frag_payload);
+    bs->i_frag          = 0;
+    bs->block_seq       = bs->next_block_seq;
+    bs->node            = node;
+
+    bs->next_block_seq = bs->next_block_seq + 1;
+
+    return iawTrue;
+}
+
+static struct buff_node *ble_stream_find(uint32_t block_seq)
+{
+    for (struct buff_node *node = head_buff_node_ptr; node != NULL; node = node->next)
+    {
+        if ((node->block_seq == block_seq) && (node != run_buff_node_ptr))
+            return node;
+    }
+
+    return NULL;
+}
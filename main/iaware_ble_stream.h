@@ -0,0 +1,88 @@
+#ifndef IAWARE_BLE_STREAM_H
+#define IAWARE_BLE_STREAM_H
+
+#include <stdint.h>
+
+#include "iaware_helper.h"
+#include "iaware_packet.h"
+#include "iaware_stream.h"
+
+// The sample blocks over the BLE notifications of the TX characteristic, for the clients that cannot join the Wi-Fi AP.
+// Every completed block is sent as the frame that a v2 TCP client gets, |(4bytes)|PACKET_HEADER_STREAM|header|samples|,
+// split into fragments of the negotiated ATT MTU - 3 bytes:
+//
+//     |PACKET_HEADER_BLE_FRAGMENT|uint32_t block_seq|uint16_t i_frag|uint16_t n_frags|frame bytes|
+//
+// Every fragment of a block but the last carries the same number of frame bytes, so the central appends them in the order
+// of i_frag and drops the block when one is missing. The band-power notifications keep their PACKET_HEADER_FEATURE packets.
+//
+// The blocks are read from the buff nodes directly, behind a cursor of their own, so the BLE client neither waits for nor
+// delays com_tcp_send_task(). BLE carries far less than the ADC produces at high rates: when the link falls behind, the
+// cursor jumps to the newest block, and a block that the sampling callback overwrites while it is sent is dropped.
+// Both count as skipped blocks. The blocks are never degraded and carry no statistics.
+#define BLE_STREAM_FRAG_HEADER_SIZE     (1 + 4 + 2 + 2)     // [bytes]
+#define BLE_STREAM_MAX_BACKLOG          2       // [blocks]. A block older than this behind the newest one is skipped.
+
+// The flow control of the notifications. Bluedroid queues every notification that esp_ble_gatts_send_indicate() accepts
+// and reports ESP_GATTS_CONF_EVT once the controller took it, so a notification holds a credit from the send to its
+// ESP_GATTS_CONF_EVT. BLE_FLOW_CREDITS in flight keep several notifications ready for every connection event without
+// filling the Bluedroid buffers. Nothing is sent while ESP_GATTS_CONGEST_EVT reports the link congested. The credits come
+// back after BLE_FLOW_STALL_MS without any ESP_GATTS_CONF_EVT, e.g. when one was lost.
+//
+// The benchmark mode (CMD_SET_BLE_BENCH) fills the link with PACKET_HEADER_BLE_BENCH notifications instead of the
+// blocks, and logs the throughput and the latency from the send to ESP_GATTS_CONF_EVT every BLE_FLOW_REPORT_MS:
+//
+//     |PACKET_HEADER_BLE_BENCH|uint32_t bench_seq|uint64_t t [microsec]|padding to the MTU - 3 bytes|
+#define BLE_FLOW_CREDITS                8
+#define BLE_FLOW_STALL_MS               500     // [ms]
+#define BLE_FLOW_REPORT_MS              1000    // [ms]
+#define BLE_BENCH_HEADER_SIZE           (1 + 4 + 8)         // [bytes]
+
+struct ble_stream
+{
+    uint32_t next_block_seq;        // The block to send after the current one.
+    struct buff_node *node;         // The block being sent, or NULL.
+
+    uint32_t block_seq;
+    uint8_t header[4 + PACKET_HEADER_STREAM_V2_META_SIZE];
+    uint32_t header_len;
+    uint32_t frame_len;             // header_len plus the samples.
+    uint16_t frag_payload;          // The frame bytes per fragment, fixed for the block.
+    uint16_t i_frag;
+    uint16_t n_frags;
+
+    uint32_t n_blocks;              // The blocks sent whole.
+    uint32_t n_skipped;
+    uint32_t n_frags_sent;
+};
+
+struct ble_flow
+{
+    uint8_t credits;
+    uint8_t is_congested;
+    int64_t t_last;                 // [microsec]. The last ESP_GATTS_CONF_EVT, or the send that emptied the credits.
+
+    // The notifications in flight, in the order of their ESP_GATTS_CONF_EVT.
+    int64_t t_sent[BLE_FLOW_CREDITS];
+    uint8_t i_sent;
+
+    // The report window.
+    int64_t t_window;
+    uint32_t window_bytes;
+    uint32_t window_n;
+    uint64_t window_latency_sum;
+    uint32_t window_latency_max;
+};
+
+void ble_stream_reset(struct ble_stream *bs);
+uint32_t ble_stream_peek(struct ble_stream *bs, uint16_t mtu, uint8_t *dst);
+void ble_stream_advance(struct ble_stream *bs);
+
+void ble_flow_reset(struct ble_flow *f, int64_t now);
+uint8_t ble_flow_take(struct ble_flow *f, int64_t now);
+void ble_flow_untake(struct ble_flow *f);
+void ble_flow_conf(struct ble_flow *f, uint16_t len, int64_t now);
+uint8_t ble_flow_report(struct ble_flow *f, int64_t now, uint32_t *kbps, uint32_t *latency_avg, uint32_t *latency_max);
+uint32_t ble_bench_pack(uint8_t *dst, uint16_t mtu, uint32_t bench_seq, int64_t now);
+
+#endif
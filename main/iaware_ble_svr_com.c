@@ -43,6 +43,7 @@
 #include "esp_log.h"
 #include "nvs_flash.h"
 #include "esp_bt.h"
+#include "esp_timer.h"
 
 #include "esp_gap_ble_api.h"
 #include "esp_gatts_api.h"
@@ -50,33 +51,123 @@
 #include "esp_bt_main.h"
 #include "esp_gatt_common_api.h"
 
+#include "iaware_adc_cal.h"
+#include "iaware_ble_adv.h"
+#include "iaware_ble_link.h"
+#include "iaware_ble_stream.h"
 #include "iaware_ble_svr_com.h"
+#include "iaware_blog.h"
+#include "iaware_feature.h"
+#include "iaware_flash_tier.h"
+#include "iaware_gpio.h"
 #include "iaware_helper.h"
+#include "iaware_packet.h"
+#include "iaware_sampling_data.h"
+#include "iaware_stream.h"
+#include "iaware_tcp_com.h"
+#include "iaware_trigger.h"
 #include "main.h"
 
-static uint8_t char1_str[] = {0x11,0x22,0x44};
-static esp_gatt_char_prop_t a_property = 0;
-static esp_gatt_perm_t a_permission = 0;
 
-static esp_gatt_char_prop_t TX_a_property = 0;
-static esp_gatt_perm_t TX_a_permission = 0;
-
-static esp_gatt_char_prop_t RX_a_property = 0;
-static esp_gatt_perm_t RX_a_permission = 0;
+typedef struct prepare_type_env prepare_type_env_t;
 
+// A connected central. Every one has the notifications of its own, so a slow client never holds back a fast one: its
+// CCCD, its MTU, its cursor in the buff nodes, its credits and its link parameters. Bluedroid keeps one value of the CCCD
+// for all the connections, so the CCCD of a client is is_streaming.
+struct ble_peer
+{
+    volatile uint8_t is_used;
+    uint16_t conn_id;
+    esp_bd_addr_t bda;
+    uint16_t mtu;                   // The ATT MTU negotiated with the client.
+
+    // The sample blocks, see iaware_ble_stream.h. Only ble_stream_task() touches stream and bench_seq.
+    volatile uint8_t is_streaming;
+    volatile uint8_t stream_reset_pending;
+    struct ble_stream stream;
+    uint32_t bench_seq;
+    uint32_t feature_seq;           // The publish_seq of the last band powers, see feature_pack().
+
+    // The credits, taken by ble_stream_task() and the timer, given back by the GATTS events. Under notify_mux.
+    struct ble_flow flow;
+
+    // The link parameters, see iaware_ble_link.h. Under notify_mux.
+    struct ble_link link;
+    volatile uint8_t link_pending;
+    uint8_t link_len_wanted;        // The data length extension waits for the one of another client, see link_len_next().
+
+    // The commands written to the RX characteristic run through com_cmd_feed() like the ones of TCP_RECV_PORT. Their
+    // replies wait for ble_stream_task(), which sends them ahead of the sample blocks.
+    struct com_cmd_parser cmd_parser;
+    uint8_t cmd_msg[MAX_MSG_SIZE_SENTTO_ESP32];
+    uint8_t cmd_ack[BLE_CMD_ACK_SIZE];  // The last acknowledgement, under notify_mux.
+    uint16_t cmd_n_msgs;
+    volatile uint8_t cmd_ack_pending;
+    volatile uint8_t cmd_version_pending;
+    volatile uint8_t cmd_adc_cal_pending;
+
+    prepare_type_env_t prepare_write_env;
+};
 
-static esp_gatts_cb_event_t notify_event;
 static esp_gatt_if_t notify_gatts_if;
-static esp_ble_gatts_cb_param_t *notify_param;
 static xTimerHandle notify_timerHandle;
 
-static esp_attr_value_t gatts_demo_char1_val =
+static struct ble_peer notify_peers[BLE_SVR_MAX_PEERS];
+static volatile uint8_t notify_is_bench = iawFalse;    // For all the clients.
+// Only ble_stream_task() fills it, for one client at a time, and esp_ble_gatts_send_indicate() copies the value before it
+// returns, so the clients share it. A fragment that waits for a credit is built again, see notify_pump().
+static uint8_t notify_stream_buff[BLE_LOCAL_MTU - 3];
+static TaskHandle_t notify_stream_task = NULL;
+static portMUX_TYPE notify_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// The advertising, see iaware_ble_adv.h.
+static xTimerHandle adv_timerHandle = NULL;
+static volatile uint8_t adv_is_metrics = iawFalse;
+static volatile uint8_t adv_restart_pending = iawFalse;   // A new interval, it takes effect once the advertising stopped.
+
+static struct ble_peer *cmd_peer;       // The client of the command that com_cmd_feed() is parsing.
+// ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT does not tell the client, so one client asks at a time, see link_len_next().
+static struct ble_peer *link_len_peer;
+static esp_bd_addr_t link_len_bda;      // A slot may go to another client before the event comes.
+
+// The service as one attribute table, created by one esp_ble_gatts_create_attr_tab() instead of a round trip through
+// the GATTS events per attribute. The stack answers the TX value and its CCCD, the rest is answered by
+// gatts_profile_a_event_handler(). The handles of the entries are in gatt_handle_table, in the order of IAW_IDX_*.
+static const uint16_t gatt_primary_service_uuid     = ESP_GATT_UUID_PRI_SERVICE;
+static const uint16_t gatt_char_declare_uuid        = ESP_GATT_UUID_CHAR_DECLARE;
+static const uint16_t gatt_cccd_uuid                = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
+static const uint8_t gatt_service_uuid[ESP_UUID_LEN_128]    = IAWARE_BLE_UUID128(IAWARE_BLE_UUID_SERVICE);
+static const uint8_t gatt_rx_uuid[ESP_UUID_LEN_128]         = IAWARE_BLE_UUID128(IAWARE_BLE_UUID_RX);
+static const uint8_t gatt_tx_uuid[ESP_UUID_LEN_128]         = IAWARE_BLE_UUID128(IAWARE_BLE_UUID_TX);
+static const uint8_t gatt_stats_uuid[ESP_UUID_LEN_128]      = IAWARE_BLE_UUID128(IAWARE_BLE_UUID_STATS);
+static const uint8_t gatt_ctrl_uuid[ESP_UUID_LEN_128]       = IAWARE_BLE_UUID128(IAWARE_BLE_UUID_CTRL);
+static const uint8_t gatt_prop_write    = ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
+static const uint8_t gatt_prop_notify   = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint8_t gatt_prop_read     = ESP_GATT_CHAR_PROP_BIT_READ;
+static const uint8_t gatt_prop_ctrl     = ESP_GATT_CHAR_PROP_BIT_WRITE;
+static const uint8_t gatt_cccd_value[2] = {0x00, 0x00};
+
+static const esp_gatts_attr_db_t gatt_db[IAW_IDX_NB] =
 {
-    .attr_max_len = GATTS_DEMO_CHAR_VAL_LEN_MAX,
-    .attr_len     = sizeof(char1_str),
-    .attr_value   = char1_str,
+    [IAW_IDX_SVC]           = {{ESP_GATT_AUTO_RSP},   {ESP_UUID_LEN_16,  (uint8_t *) &gatt_primary_service_uuid, ESP_GATT_PERM_READ, ESP_UUID_LEN_128, ESP_UUID_LEN_128, (uint8_t *) gatt_service_uuid}},
+
+    [IAW_IDX_RX_CHAR]       = {{ESP_GATT_AUTO_RSP},   {ESP_UUID_LEN_16,  (uint8_t *) &gatt_char_declare_uuid, ESP_GATT_PERM_READ, 1, 1, (uint8_t *) &gatt_prop_write}},
+    [IAW_IDX_RX_VAL]        = {{ESP_GATT_RSP_BY_APP}, {ESP_UUID_LEN_128, (uint8_t *) gatt_rx_uuid, ESP_GATT_PERM_WRITE, PREPARE_BUF_MAX_SIZE, 0, NULL}},
+
+    [IAW_IDX_TX_CHAR]       = {{ESP_GATT_AUTO_RSP},   {ESP_UUID_LEN_16,  (uint8_t *) &gatt_char_declare_uuid, ESP_GATT_PERM_READ, 1, 1, (uint8_t *) &gatt_prop_notify}},
+    [IAW_IDX_TX_VAL]        = {{ESP_GATT_AUTO_RSP},   {ESP_UUID_LEN_128, (uint8_t *) gatt_tx_uuid, ESP_GATT_PERM_READ, BLE_LOCAL_MTU - 3, 0, NULL}},
+    [IAW_IDX_TX_CCCD]       = {{ESP_GATT_AUTO_RSP},   {ESP_UUID_LEN_16,  (uint8_t *) &gatt_cccd_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, sizeof(gatt_cccd_value), sizeof(gatt_cccd_value), (uint8_t *) gatt_cccd_value}},
+
+    [IAW_IDX_STATS_CHAR]    = {{ESP_GATT_AUTO_RSP},   {ESP_UUID_LEN_16,  (uint8_t *) &gatt_char_declare_uuid, ESP_GATT_PERM_READ, 1, 1, (uint8_t *) &gatt_prop_read}},
+    [IAW_IDX_STATS_VAL]     = {{ESP_GATT_RSP_BY_APP}, {ESP_UUID_LEN_128, (uint8_t *) gatt_stats_uuid, ESP_GATT_PERM_READ, BLE_STATS_SIZE, 0, NULL}},
+
+    [IAW_IDX_CTRL_CHAR]     = {{ESP_GATT_AUTO_RSP},   {ESP_UUID_LEN_16,  (uint8_t *) &gatt_char_declare_uuid, ESP_GATT_PERM_READ, 1, 1, (uint8_t *) &gatt_prop_ctrl}},
+    [IAW_IDX_CTRL_VAL]      = {{ESP_GATT_RSP_BY_APP}, {ESP_UUID_LEN_128, (uint8_t *) gatt_ctrl_uuid, ESP_GATT_PERM_WRITE, 1, 0, NULL}},
 };
 
+static uint16_t gatt_handle_table[IAW_IDX_NB];
+static int64_t gatt_t_init; // [microsec]. When init_ble_server() started, for the time to advertise.
+
 static uint8_t adv_config_done = 0;
 
 #ifdef CONFIG_SET_RAW_ADV_DATA
@@ -89,20 +180,16 @@ static uint8_t adv_config_done = 0;
             0x45, 0x4d, 0x4f
     };
 #else
-    static uint8_t adv_service_uuid128[32] = {
-        /* LSB <--------------------------------------------------------------------------------> MSB */
-        //first uuid, 16bit, [12],[13] is the value
-        0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00, 0xEE, 0x00, 0x00, 0x00,
-        //second uuid, 32bit, [12], [13], [14], [15] is the value
-        0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00, 0xFF, 0x00, 0x00, 0x00,
-    };
+    // The hub matches the service in the advertising data, see iaware_ble_scan.h. The name goes in the scan response,
+    // both would not fit in 31 bytes.
+    static uint8_t adv_service_uuid128[ESP_UUID_LEN_128] = IAWARE_BLE_UUID128(IAWARE_BLE_UUID_SERVICE);
 
     // The length of adv data must be less than 31 bytes
     //static uint8_t test_manufacturer[TEST_MANUFACTURER_DATA_LEN] =  {0x12, 0x23, 0x45, 0x56};
     //adv data
     static esp_ble_adv_data_t adv_data = {
         .set_scan_rsp = false,
-        .include_name = true,
+        .include_name = false,
         .include_txpower = true,
         .min_interval = 0x0006, //slave connection min interval, Time = min_interval * 1.25 msec
         .max_interval = 0x0010, //slave connection max interval, Time = max_interval * 1.25 msec
@@ -119,7 +206,7 @@ static uint8_t adv_config_done = 0;
     static esp_ble_adv_data_t scan_rsp_data = {
         .set_scan_rsp = true,
         .include_name = true,
-        .include_txpower = true,
+        .include_txpower = false,
         .min_interval = 0x0006,
         .max_interval = 0x0010,
         .appearance = 0x00,
@@ -127,8 +214,8 @@ static uint8_t adv_config_done = 0;
         .p_manufacturer_data =  NULL, //&test_manufacturer[0],
         .service_data_len = 0,
         .p_service_data = NULL,
-        .service_uuid_len = sizeof(adv_service_uuid128),
-        .p_service_uuid = adv_service_uuid128,
+        .service_uuid_len = 0,
+        .p_service_uuid = NULL,
         .flag = (ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT),
     };
 #endif
@@ -145,12 +232,32 @@ static esp_ble_adv_params_t adv_params = {
     .adv_filter_policy  = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY, // Advertising filter policy. ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY = Allow both scan and connection requests from anyone.
 };
 
-typedef struct prepare_type_env prepare_type_env_t;
-
-static prepare_type_env_t a_prepare_write_env;
-
 static void vTimerCallbackNotifyExpired(xTimerHandle pxTimer);
-static void exec_write_event_env(prepare_type_env_t *prepare_write_env, esp_ble_gatts_cb_param_t *param);
+static void vTimerCallbackAdvExpired(xTimerHandle pxTimer);
+static void adv_metrics_update(void);
+static void adv_restore(void);
+static void adv_set_interval(uint32_t interval_ms);
+static void ble_stream_task(void *pvParameter);
+static void notify_pump(struct ble_peer *p);
+static struct ble_peer *peer_find(uint16_t conn_id);
+static struct ble_peer *peer_find_bda(esp_bd_addr_t bda);
+static struct ble_peer *peer_new(void);
+static uint8_t peer_count(uint8_t is_streaming_only);
+static uint8_t notify_take_credit(struct ble_peer *p);
+static void notify_untake_credit(struct ble_peer *p);
+static uint8_t notify_send(struct ble_peer *p, uint8_t *data, uint32_t len);
+static void notify_send_replies(struct ble_peer *p);
+static void cmd_feed(struct ble_peer *p, const uint8_t *buf, uint32_t len);
+static void cmd_on_msg(uint8_t cmd, uint8_t is_known);
+static void gatt_ctrl_write(struct ble_peer *p, uint8_t op);
+static uint32_t gatt_stats_pack(struct ble_peer *p, uint8_t *dst);
+static uint32_t notify_rate(struct ble_peer *p);
+static void link_set_rate(struct ble_peer *p);
+static void peer_set_streaming(struct ble_peer *p, uint8_t is_on);
+static void link_request(struct ble_peer *p);
+static void link_changed(struct ble_peer *p, uint8_t is_retune);
+static void link_len_next(void);
+static void exec_write_event_env(struct ble_peer *p, esp_ble_gatts_cb_param_t *param);
 static void write_event_env(esp_gatt_if_t gatts_if, prepare_type_env_t *prepare_write_env, esp_ble_gatts_cb_param_t *param);
 static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
 static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
@@ -168,6 +275,16 @@ static struct gatts_profile_inst gl_profile_tab[SVR_PROFILE_NUM] = {
 int init_ble_server(void)
 {
     esp_err_t err;
+    uint32_t value;
+
+    gatt_t_init = esp_timer_get_time();
+
+    // Before the stack starts to advertise.
+    if ((nvs_read_u32(BLE_ADV_NVS_INTERVAL, &value) == iawTrue) && (ble_adv_interval_is_valid(value) == iawTrue))
+        adv_set_interval(value);
+
+    if ((nvs_read_u32(BLE_ADV_NVS_METRICS, &value) == iawTrue) && (value != 0))
+        adv_is_metrics = iawTrue;
 
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
 
@@ -255,7 +372,7 @@ int init_ble_server(void)
     }
 
     // Set the maximum length of an ATT packet (MTU is Maximum Transmission Unit in bytes). 251 (for BLE4.2)
-    esp_err_t local_mtu_err = esp_ble_gatt_set_local_mtu(500);
+    esp_err_t local_mtu_err = esp_ble_gatt_set_local_mtu(BLE_LOCAL_MTU);
     if (local_mtu_err != ESP_OK)
     {
         ESP_LOGE(IAWARE_BLE, "set local  MTU failed: %s", err_to_str(local_mtu_err));
@@ -278,97 +395,670 @@ int init_ble_server(void)
                                       (void*)0, /* timer ID */
                                       vTimerCallbackNotifyExpired); /* callback */
 
+    adv_timerHandle = xTimerCreate("adv_timerHandle", pdMS_TO_TICKS(BLE_ADV_METRICS_PERIOD_MS), pdTRUE, (void*)0, vTimerCallbackAdvExpired);
+
+    if ((adv_is_metrics == iawTrue) && (xTimerStart(adv_timerHandle, 0) != pdPASS))
+        ESP_LOGE(IAWARE_BLE, "Cannot start adv_timerHandle.");
+
+    // On Core 0 with the sampling callback, which then never runs in the middle of a fragment, see ble_stream_peek().
+    xTaskCreatePinnedToCore(
+        ble_stream_task, // Function to implement the task
+        "ble_stream_task", // Name of the task
+        2048, // Stack size in words (32 bits in esp32)
+        NULL, // Task input parameter
+        XTASK_LOW_PRIORITY, // Priority of the task
+        &notify_stream_task, // Task handle.
+        0); // Core where the task should run
+
     return 0;
 }
 
+void ble_server_set_bench(uint8_t is_on)
+// CMD_SET_BLE_BENCH, for all the clients. It lasts until a client turns it off or the last one disconnects.
+{
+    notify_is_bench = is_on ? iawTrue : iawFalse;
+
+    for (uint8_t i = 0; i < BLE_SVR_MAX_PEERS; i++)
+    {
+        struct ble_peer *p = &(notify_peers[i]);
+
+        if (p->is_used == iawFalse)
+            continue;
+
+        link_set_rate(p);
+        p->stream_reset_pending = iawTrue;
+    }
+
+    if (notify_stream_task != NULL)
+        xTaskNotifyGive(notify_stream_task);
+}
+
+uint8_t ble_server_set_adv(uint8_t is_metrics, uint16_t interval_ms)
+// CMD_SET_BLE_ADV, both are kept in NVS. Return iawFalse when interval_ms is out of range.
+{
+    uint16_t adv_int_min = adv_params.adv_int_min;
+
+    if (ble_adv_interval_is_valid(interval_ms) == iawFalse)
+        return iawFalse;
+
+    if ((nvs_write_u32(BLE_ADV_NVS_METRICS, is_metrics ? 1 : 0) == iawFalse) || (nvs_write_u32(BLE_ADV_NVS_INTERVAL, interval_ms) == iawFalse))
+        return iawFalse;
+
+    adv_set_interval(interval_ms);
+
+    if (adv_timerHandle == NULL)
+        return iawTrue; // The BLE server does not run, e.g. on the hub. It takes them at the next boot.
+
+    if (is_metrics && (adv_is_metrics == iawFalse))
+    {
+        adv_is_metrics = iawTrue;
+
+        xTimerStart(adv_timerHandle, 0);
+    }
+    else if (!is_metrics && (adv_is_metrics == iawTrue))
+    {
+        adv_is_metrics = iawFalse;
+
+        xTimerStop(adv_timerHandle, 0);
+
+        adv_restore();
+    }
+
+    // The controller takes a new interval when the advertising starts.
+    if (adv_params.adv_int_min != adv_int_min)
+    {
+        adv_restart_pending = iawTrue;
+
+        esp_ble_gap_stop_advertising();
+    }
+
+    return iawTrue;
+}
+
 ////////// Private //////////
+static void vTimerCallbackAdvExpired(xTimerHandle pxTimer)
+{
+    if (adv_is_metrics == iawTrue)
+        adv_metrics_update();
+}
+
+static void adv_metrics_update(void)
+// The scan response with the metrics of now. Its ESP_GAP_BLE_SCAN_RSP_DATA_RAW_SET_COMPLETE_EVT leaves the advertising as
+// it is.
+{
+    struct ble_adv_metrics m;
+    uint8_t scan_rsp[BLE_ADV_MAX_SIZE];
+    uint32_t n_skipped = 0;
+
+    m.flags         = (uint8_t) ((peer_count(iawFalse) & 0x03) << BLE_ADV_FLAG_CLIENTS_SHIFT);
+    m.n_channels    = gpio_adc_n_channels;
+    m.battery       = BLE_ADV_BATTERY_UNKNOWN;
+    m.rate          = sampling_data_rate;   // Published by the sampling, the buff nodes are not walked outside of it.
+    m.block_seq     = sampling_data_block_seq;
+    m.n_dropped     = sampling_data_n_dropped;
+
+    if (tcp_is_draining == iawTrue)
+        m.flags = m.flags | BLE_ADV_FLAG_TCP_STREAMING;
+
+    if (peer_count(iawTrue) > 0)
+        m.flags = m.flags | BLE_ADV_FLAG_BLE_STREAMING;
+
+    if (flash_tier_record_mode == iawTrue)
+        m.flags = m.flags | BLE_ADV_FLAG_RECORDING;
+
+    if (trigger_sources != 0)
+        m.flags = m.flags | BLE_ADV_FLAG_TRIGGER;
+
+    for (uint8_t i = 0; i < BLE_SVR_MAX_PEERS; i++)
+    {
+        if (notify_peers[i].is_used == iawTrue)
+            n_skipped = n_skipped + notify_peers[i].stream.n_skipped;
+    }
+
+    m.n_skipped = (n_skipped > 0xFFFF) ? 0xFFFF : (uint16_t) n_skipped;
+
+    esp_err_t ret = esp_ble_gap_config_scan_rsp_data_raw(scan_rsp, ble_adv_metrics_pack(&m, IAWARE_DEVICE_NAME, scan_rsp));
+    if (ret)
+    {
+        ESP_LOGE(IAWARE_BLE, "A: config metrics scan rsp data failed, error code = %x", ret);
+    }
+}
+
+static void adv_restore(void)
+// The scan response without the metrics.
+{
+#ifdef CONFIG_SET_RAW_ADV_DATA
+    esp_ble_gap_config_scan_rsp_data_raw(raw_scan_rsp_data, sizeof(raw_scan_rsp_data));
+#else
+    esp_ble_gap_config_adv_data(&scan_rsp_data);
+#endif
+}
+
+static void adv_set_interval(uint32_t interval_ms)
+{
+    adv_params.adv_int_min = ble_adv_interval_units(interval_ms);
+    adv_params.adv_int_max = ble_adv_interval_units(2*interval_ms);
+}
+
 static void vTimerCallbackNotifyExpired(xTimerHandle pxTimer) 
+// Notify the band powers once per period, as a PACKET_HEADER_FEATURE packet without the 4-bytes length. A notification
+// holds at most MTU - 3 bytes, so the packet keeps only the channels that fit the MTU of the client.
 {    
-    uint8_t notify_data[15];
-    for (int i = 0; i < sizeof(notify_data); ++i)
+    uint8_t notify_data[PACKET_HEADER_FEATURE_META_SIZE + 2*FEATURE_N_BANDS*FEATURE_MAX_CHANNELS];
+
+    if (notify_is_bench == iawTrue)
+        return;
+
+    for (uint8_t i = 0; i < BLE_SVR_MAX_PEERS; i++)
     {
-        // notify_data[i] = i%0xff;
-        notify_data[i] = 0x21;
+        struct ble_peer *p = &(notify_peers[i]);
+        uint32_t max_len = ((uint32_t) (p->mtu - 3) < sizeof(notify_data)) ? (uint32_t) (p->mtu - 3) : sizeof(notify_data);
+        uint32_t feature_seq = p->feature_seq;
+        uint32_t len;
+
+        if ((p->is_used == iawFalse) || (p->is_streaming == iawFalse))
+            continue;
+
+        if ((len = sampling_data_features_pack(notify_data, max_len, &feature_seq)) == 0)
+            continue;
+
+        // Without a credit, the band powers wait for the next period rather than be dropped.
+        if (notify_send(p, notify_data, len) == iawTrue)
+            p->feature_seq = feature_seq;
     }
+}
+
+static void ble_stream_task(void *pvParameter)
+// Queue the fragments of the sample blocks, or the benchmark notifications, as long as there are credits while a client has
+// the notifications on. The clients take turns, each up to its credits. ESP_GATTS_CONF_EVT wakes it up as soon as a
+// credit comes back.
+{
+    while (1)
+    {
+        for (uint8_t i = 0; i < BLE_SVR_MAX_PEERS; i++)
+        {
+            struct ble_peer *p = &(notify_peers[i]);
+
+            if (p->stream_reset_pending == iawTrue)
+            {
+                if (p->stream.n_frags_sent > 0)
+                    BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_STREAM, p->stream.n_blocks, p->stream.n_frags_sent, p->stream.n_skipped);
 
+                ble_stream_reset(&(p->stream));
+
+                portENTER_CRITICAL(&notify_mux);
+
+                ble_flow_reset(&(p->flow), esp_timer_get_time());
+
+                portEXIT_CRITICAL(&notify_mux);
+
+                p->bench_seq = 0;
+                p->stream_reset_pending = iawFalse;
+            }
+
+            if ((p->is_used == iawTrue) && (p->is_streaming == iawTrue))
+                notify_pump(p);
+        }
 
-    //the size of notify_data[] need less than MTU size
-    esp_ble_gatts_send_indicate(notify_gatts_if, notify_param->write.conn_id, gl_profile_tab[PROFILE_A_APP_ID].char_handle, sizeof(notify_data), notify_data, false);    
+        ulTaskNotifyTake(pdTRUE, 1);
+    }
 }
 
-static void exec_write_event_env(prepare_type_env_t *prepare_write_env, esp_ble_gatts_cb_param_t *param)
+static void notify_pump(struct ble_peer *p)
+// The replies to the commands first, then the blocks until the credits of the client run out.
 {
-    if (param->exec_write.exec_write_flag == ESP_GATT_PREP_WRITE_EXEC)
+    notify_send_replies(p);
+
+    while (p->is_streaming == iawTrue)
     {
-        esp_log_buffer_hex(IAWARE_BLE, prepare_write_env->prepare_buf, prepare_write_env->prepare_len);
+        uint32_t len;
+
+        // A fragment is built again after a failed send, ble_stream_peek() does not move on.
+        if (notify_is_bench == iawTrue)
+            len = ble_bench_pack(notify_stream_buff, p->mtu, p->bench_seq, esp_timer_get_time());
+        else if ((len = ble_stream_peek(&(p->stream), p->mtu, notify_stream_buff)) == 0)
+            break;
+
+        if (notify_send(p, notify_stream_buff, len) == iawFalse)
+            break;
+
+        if (notify_is_bench == iawTrue)
+            p->bench_seq = p->bench_seq + 1;
+        else
+            ble_stream_advance(&(p->stream));
+    }
+
+    if (notify_is_bench == iawTrue)
+    {
+        uint32_t kbps, latency_avg, latency_max;
+
+        portENTER_CRITICAL(&notify_mux);
+
+        uint8_t is_report = ble_flow_report(&(p->flow), esp_timer_get_time(), &kbps, &latency_avg, &latency_max);
+
+        portEXIT_CRITICAL(&notify_mux);
+
+        if (is_report == iawTrue)
+            BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_BENCH, kbps, latency_avg, latency_max);
+    }
+}
+
+static struct ble_peer *peer_find(uint16_t conn_id)
+// NULL when conn_id is not connected.
+{
+    for (uint8_t i = 0; i < BLE_SVR_MAX_PEERS; i++)
+    {
+        if ((notify_peers[i].is_used == iawTrue) && (notify_peers[i].conn_id == conn_id))
+            return &(notify_peers[i]);
+    }
+
+    return NULL;
+}
+
+static struct ble_peer *peer_find_bda(esp_bd_addr_t bda)
+{
+    for (uint8_t i = 0; i < BLE_SVR_MAX_PEERS; i++)
+    {
+        if ((notify_peers[i].is_used == iawTrue) && (memcmp(notify_peers[i].bda, bda, sizeof(esp_bd_addr_t)) == 0))
+            return &(notify_peers[i]);
+    }
+
+    return NULL;
+}
+
+static struct ble_peer *peer_new(void)
+// A free slot, or NULL when BLE_SVR_MAX_PEERS clients are connected.
+{
+    for (uint8_t i = 0; i < BLE_SVR_MAX_PEERS; i++)
+    {
+        if (notify_peers[i].is_used == iawFalse)
+            return &(notify_peers[i]);
+    }
+
+    return NULL;
+}
+
+static uint8_t peer_count(uint8_t is_streaming_only)
+// The connected clients, or the ones with the notifications on.
+{
+    uint8_t n = 0;
+
+    for (uint8_t i = 0; i < BLE_SVR_MAX_PEERS; i++)
+    {
+        if ((notify_peers[i].is_used == iawTrue) && ((is_streaming_only == iawFalse) || (notify_peers[i].is_streaming == iawTrue)))
+            n = n + 1;
+    }
+
+    return n;
+}
+
+static uint8_t notify_take_credit(struct ble_peer *p)
+{
+    portENTER_CRITICAL(&notify_mux);
+
+    uint8_t is_taken = ble_flow_take(&(p->flow), esp_timer_get_time());
+
+    portEXIT_CRITICAL(&notify_mux);
+
+    return is_taken;
+}
+
+static void notify_untake_credit(struct ble_peer *p)
+{
+    portENTER_CRITICAL(&notify_mux);
+
+    ble_flow_untake(&(p->flow));
+
+    portEXIT_CRITICAL(&notify_mux);
+}
+
+static uint8_t notify_send(struct ble_peer *p, uint8_t *data, uint32_t len)
+// Queue a notification on the TX characteristic of the client with a credit. Return iawFalse when it must wait.
+{
+    if (notify_take_credit(p) == iawFalse)
+        return iawFalse;
+
+    if (esp_ble_gatts_send_indicate(notify_gatts_if, p->conn_id, gatt_handle_table[IAW_IDX_TX_VAL], len, data, false) != ESP_OK)
+    {
+        notify_untake_credit(p);
+
+        return iawFalse;
+    }
+
+    return iawTrue;
+}
+
+static void notify_send_replies(struct ble_peer *p)
+// The replies to the commands on the RX characteristic, as the packets of com_tcp_send_task() without the 4-bytes length.
+{
+    uint8_t reply[4 + PACKET_HEADER_ADC_CAL_META_SIZE];
+    uint32_t len;
+
+    if (p->cmd_ack_pending == iawTrue)
+    {
+        portENTER_CRITICAL(&notify_mux);
+
+        memcpy(reply, p->cmd_ack, BLE_CMD_ACK_SIZE);
+        p->cmd_ack_pending = iawFalse;
+
+        portEXIT_CRITICAL(&notify_mux);
+
+        if (notify_send(p, reply, BLE_CMD_ACK_SIZE) == iawFalse)
+        {
+            p->cmd_ack_pending = iawTrue;
+
+            return;
+        }
+    }
+
+    if (p->link_pending == iawTrue)
+    {
+        p->link_pending = iawFalse;
+
+        portENTER_CRITICAL(&notify_mux);
+
+        len = ble_link_pack(&(p->link), p->mtu, reply);
+
+        portEXIT_CRITICAL(&notify_mux);
+
+        if (notify_send(p, reply, len) == iawFalse)
+        {
+            p->link_pending = iawTrue;
+
+            return;
+        }
+    }
+
+    if (p->cmd_version_pending == iawTrue)
+    {
+        len = stream_pack_version(reply, STREAM_VERSION_2);   // The frames of iaware_ble_stream.h.
+
+        if (notify_send(p, &(reply[4]), len - 4) == iawFalse)
+            return;
+
+        p->cmd_version_pending = iawFalse;
+    }
+
+    if (p->cmd_adc_cal_pending == iawTrue)
+    {
+        len = adc_cal_pack(reply);
+
+        if (notify_send(p, &(reply[4]), len - 4) == iawFalse)
+            return;
+
+        p->cmd_adc_cal_pending = iawFalse;
+    }
+}
+
+static void cmd_feed(struct ble_peer *p, const uint8_t *buf, uint32_t len)
+// A write to the RX characteristic, in the Bluedroid task. A message too long drops what was parsed.
+{
+    cmd_peer = p;
+
+    if (com_cmd_feed(&(p->cmd_parser), buf, len) == iawFalse)
+        com_cmd_reset(&(p->cmd_parser), COM_CMD_LINK_BLE, p->cmd_msg, cmd_on_msg);
+
+    cmd_peer = NULL;
+}
+
+static void cmd_on_msg(uint8_t cmd, uint8_t is_known)
+// Called by com_cmd_feed() after every command on the RX characteristic of cmd_peer.
+{
+    struct ble_peer *p = cmd_peer;
+
+    if (p == NULL)
+        return;
+
+    portENTER_CRITICAL(&notify_mux);
+
+    p->cmd_n_msgs = p->cmd_n_msgs + 1;
+
+    p->cmd_ack[0] = PACKET_HEADER_BLE_ACK;
+    p->cmd_ack[1] = cmd;
+    p->cmd_ack[2] = is_known;
+    p->cmd_ack[3] = highbyte(p->cmd_n_msgs);
+    p->cmd_ack[4] = lowbyte(p->cmd_n_msgs);
+    p->cmd_ack_pending = iawTrue;
+
+    portEXIT_CRITICAL(&notify_mux);
+
+    if ((is_known == iawTrue) && (cmd == CMD_START_STREAM))
+        peer_set_streaming(p, iawTrue);
+    else if ((is_known == iawTrue) && (cmd == CMD_STOP_STREAM))
+        peer_set_streaming(p, iawFalse);
+    else if ((is_known == iawTrue) && (cmd == CMD_SET_STREAM_VERSION))
+        p->cmd_version_pending = iawTrue;
+    else if ((is_known == iawTrue) && (cmd == CMD_GET_ADC_CAL))
+        p->cmd_adc_cal_pending = iawTrue;
+
+    if (notify_stream_task != NULL)
+        xTaskNotifyGive(notify_stream_task);
+}
+
+static void gatt_ctrl_write(struct ble_peer *p, uint8_t op)
+// A write to the control characteristic, one of BLE_CTRL_*.
+{
+    if (op == BLE_CTRL_RESET_STATS)
+    {
+        p->stream_reset_pending = iawTrue;
+    }
+    else if ((op == BLE_CTRL_BENCH_ON) || (op == BLE_CTRL_BENCH_OFF))
+    {
+        ble_server_set_bench((op == BLE_CTRL_BENCH_ON) ? iawTrue : iawFalse);
+    }
+    else if (op == BLE_CTRL_RETUNE)
+    {
+        link_request(p);
     }
     else
     {
-        ESP_LOGI(IAWARE_BLE,"ESP_GATT_PREP_WRITE_CANCEL");
+        ESP_LOGW(IAWARE_BLE, "A: control %d does not support.", op);
+    }
+}
+
+static uint32_t gatt_stats_pack(struct ble_peer *p, uint8_t *dst)
+// The value of the stats characteristic for the client that reads it, BLE_STATS_SIZE bytes. The counters of the stream
+// are read while ble_stream_task() may change them, a client reads them again anyway.
+{
+    uint32_to_bytes(p->stream.n_blocks, &(dst[1]));
+    uint32_to_bytes(p->stream.n_frags_sent, &(dst[5]));
+    uint32_to_bytes(p->stream.n_skipped, &(dst[9]));
+
+    portENTER_CRITICAL(&notify_mux);
+
+    dst[13] = highbyte(p->cmd_n_msgs);
+    dst[14] = lowbyte(p->cmd_n_msgs);
+    dst[15] = p->flow.credits;
+    dst[16] = p->flow.is_congested;
+
+    ble_link_pack(&(p->link), p->mtu, &(dst[17]));
+
+    portEXIT_CRITICAL(&notify_mux);
+
+    dst[0] = PACKET_HEADER_BLE_STATS;
+
+    return BLE_STATS_SIZE;
+}
+
+static uint32_t notify_rate(struct ble_peer *p)
+// [bytes/sec]. The sample blocks that the client gets while it has the notifications on.
+{
+    if (p->is_streaming == iawFalse)
+        return 0;
+
+    if (notify_is_bench == iawTrue)
+        return BLE_LINK_RATE_MAX;
+
+    return sampling_data_fs/sampling_data_decimation*gpio_adc_n_channels*2;
+}
+
+static void peer_set_streaming(struct ble_peer *p, uint8_t is_on)
+// The sample blocks of the client on or off, by its CCCD or by CMD_START_STREAM and CMD_STOP_STREAM on RX. On again starts
+// its stream from the newest block.
+{
+    if (is_on == iawTrue)
+    {
+        p->stream_reset_pending = iawTrue;
+        p->is_streaming = iawTrue;
+
+        link_set_rate(p);
+
+        if (xTimerStart(notify_timerHandle, 0) != pdPASS)
+            ESP_LOGE(IAWARE_BLE, "A: %s, Fail to start notification timer", __func__);
+    }
+    else
+    {
+        p->is_streaming = iawFalse;
+
+        link_set_rate(p);
+
+        if ((peer_count(iawTrue) == 0) && (xTimerStop(notify_timerHandle, 0) != pdPASS))
+            ESP_LOGE(IAWARE_BLE, "A: %s, Fail to stop notification timer", __func__);
     }
+}
+
+static void link_set_rate(struct ble_peer *p)
+// The client enabled or disabled the notifications or the benchmark.
+{
+    if (p->is_used == iawFalse)
+        return;
+
+    portENTER_CRITICAL(&notify_mux);
 
-    if (prepare_write_env->prepare_buf) 
+    uint8_t is_retune = ble_link_set_rate(&(p->link), notify_rate(p));
+
+    portEXIT_CRITICAL(&notify_mux);
+
+    link_changed(p, is_retune);
+}
+
+static void link_request(struct ble_peer *p)
+// Ask the central for the connection interval that its link wants.
+{
+    esp_ble_conn_update_params_t conn_params = {0};
+    uint32_t rate;
+
+    memcpy(conn_params.bda, p->bda, sizeof(esp_bd_addr_t));
+
+    portENTER_CRITICAL(&notify_mux);
+
+    conn_params.min_int = p->link.want_min_int;
+    conn_params.max_int = p->link.want_max_int;
+    rate = p->link.rate;
+
+    portEXIT_CRITICAL(&notify_mux);
+
+    conn_params.latency = 0;
+    conn_params.timeout = BLE_LINK_TIMEOUT;
+
+    BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_LINK_REQUEST, conn_params.min_int, conn_params.max_int, rate);
+
+    esp_ble_gap_update_conn_params(&conn_params);
+}
+
+static void link_changed(struct ble_peer *p, uint8_t is_retune)
+// Ask again when iaware_ble_link.c says so, and tell the client the parameters.
+{
+    if (is_retune == iawTrue)
+        link_request(p);
+
+    p->link_pending = iawTrue;
+
+    if (notify_stream_task != NULL)
+        xTaskNotifyGive(notify_stream_task);
+}
+
+static void link_len_next(void)
+// Ask for the data length extension of the next client that waits, once the previous one completed.
+{
+    // The event comes even when the client left meanwhile, with a failure, see ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT.
+    for (uint8_t i = 0; (i < BLE_SVR_MAX_PEERS) && (link_len_peer == NULL); i++)
     {
-        free(prepare_write_env->prepare_buf);
-        prepare_write_env->prepare_buf = NULL;
+        struct ble_peer *p = &(notify_peers[i]);
+
+        if ((p->is_used == iawFalse) || (p->link_len_wanted == iawFalse))
+            continue;
+
+        p->link_len_wanted = iawFalse;
+
+        if (esp_ble_gap_set_pkt_data_len(p->bda, BLE_LINK_DATA_LEN) != ESP_OK)
+        {
+            ESP_LOGW(IAWARE_BLE, "A: Fail to ask for the data length extension");
+
+            continue;
+        }
+
+        link_len_peer = p;
+        memcpy(link_len_bda, p->bda, sizeof(esp_bd_addr_t));
+    }
+}
+
+static void exec_write_event_env(struct ble_peer *p, esp_ble_gatts_cb_param_t *param)
+// A long write is complete. A command on the RX characteristic runs like a short write.
+{
+    prepare_type_env_t *prepare_write_env = &(p->prepare_write_env);
+
+    if (param->exec_write.exec_write_flag == ESP_GATT_PREP_WRITE_EXEC)
+    {
+        if (prepare_write_env->handle == gatt_handle_table[IAW_IDX_RX_VAL])
+        {
+            cmd_feed(p, prepare_write_env->prepare_buf, prepare_write_env->prepare_len);
+        }
+        else
+        {
+            esp_log_buffer_hex(IAWARE_BLE, prepare_write_env->prepare_buf, prepare_write_env->prepare_len);
+        }
+    }
+    else
+    {
+        ESP_LOGI(IAWARE_BLE,"ESP_GATT_PREP_WRITE_CANCEL");
     }
 
     prepare_write_env->prepare_len = 0;
 }
 
 static void write_event_env(esp_gatt_if_t gatts_if, prepare_type_env_t *prepare_write_env, esp_ble_gatts_cb_param_t *param)
+// The pieces of a long write go to prepare_buf at their offset, so a long write never touches the heap.
 {
+    static esp_gatt_rsp_t gatt_rsp; // It holds ESP_GATT_MAX_ATTR_LEN bytes, too many for the stack of the Bluedroid task.
+
     esp_gatt_status_t status = ESP_GATT_OK;
 
     if (param->write.need_rsp)
     {
         if (param->write.is_prep)
         {
-            if (prepare_write_env->prepare_buf == NULL) 
+            if (param->write.offset > PREPARE_BUF_MAX_SIZE)
             {
-                prepare_write_env->prepare_buf = (uint8_t *)malloc(PREPARE_BUF_MAX_SIZE*sizeof(uint8_t));
-                prepare_write_env->prepare_len = 0;
-                if (prepare_write_env->prepare_buf == NULL) 
-                {
-                    ESP_LOGE(IAWARE_BLE, "Gatt_server prep no mem");
-
-                    status = ESP_GATT_NO_RESOURCES;
-                }
-            } 
-            else 
+                status = ESP_GATT_INVALID_OFFSET;
+            }
+            else if ((param->write.offset + param->write.len) > PREPARE_BUF_MAX_SIZE)
             {
-                if(param->write.offset > PREPARE_BUF_MAX_SIZE) 
-                {
-                    status = ESP_GATT_INVALID_OFFSET;
-                } 
-                else if ((param->write.offset + param->write.len) > PREPARE_BUF_MAX_SIZE) 
-                {
-                    status = ESP_GATT_INVALID_ATTR_LEN;
-                }
+                status = ESP_GATT_INVALID_ATTR_LEN;
             }
 
-            esp_gatt_rsp_t *gatt_rsp = (esp_gatt_rsp_t *)malloc(sizeof(esp_gatt_rsp_t));
-            gatt_rsp->attr_value.len = param->write.len;
-            gatt_rsp->attr_value.handle = param->write.handle;
-            gatt_rsp->attr_value.offset = param->write.offset;
-            gatt_rsp->attr_value.auth_req = ESP_GATT_AUTH_REQ_NONE;
-            memcpy(gatt_rsp->attr_value.value, param->write.value, param->write.len);
+            gatt_rsp.attr_value.len = param->write.len;
+            gatt_rsp.attr_value.handle = param->write.handle;
+            gatt_rsp.attr_value.offset = param->write.offset;
+            gatt_rsp.attr_value.auth_req = ESP_GATT_AUTH_REQ_NONE;
+            memcpy(gatt_rsp.attr_value.value, param->write.value, param->write.len);
 
-            esp_err_t response_err = esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, status, gatt_rsp);
+            esp_err_t response_err = esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, status, &gatt_rsp);
             if (response_err != ESP_OK)
             {
                ESP_LOGE(IAWARE_BLE, "Send response error");
             }
 
-            free(gatt_rsp);
-            
             if (status != ESP_GATT_OK)
             {
                 return;
             }
             memcpy(prepare_write_env->prepare_buf + param->write.offset, param->write.value, param->write.len);
 
-            prepare_write_env->prepare_len += param->write.len;
+            prepare_write_env->handle = param->write.handle;
+
+            if ((param->write.offset + param->write.len) > prepare_write_env->prepare_len)
+                prepare_write_env->prepare_len = param->write.offset + param->write.len;
 
         }
         else
@@ -380,6 +1070,8 @@ static void write_event_env(esp_gatt_if_t gatts_if, prepare_type_env_t *prepare_
 
 static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
 {
+    struct ble_peer *p;
+
     switch (event) 
     {
 #ifdef CONFIG_SET_RAW_ADV_DATA
@@ -397,6 +1089,9 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
         case ESP_GAP_BLE_SCAN_RSP_DATA_RAW_SET_COMPLETE_EVT: // When raw advertising data set complete, the event comes.
             ESP_LOGI(IAWARE_BLE, "gap_event_handler: ESP_GAP_BLE_SCAN_RSP_DATA_RAW_SET_COMPLETE_EVT");
 
+            if ((adv_config_done & scan_rsp_config_flag) == 0)
+                break; // An update while it advertises, see adv_metrics_update().
+
             adv_config_done &= (~scan_rsp_config_flag);
             if (adv_config_done == 0)
             {
@@ -419,6 +1114,9 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
         case ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT: // When scan response data set complete, the event comes.                    
             ESP_LOGI(IAWARE_BLE, "gap_event_handler: ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT");
 
+            if ((adv_config_done & scan_rsp_config_flag) == 0)
+                break; // An update while it advertises, see adv_restore().
+
             adv_config_done &= (~scan_rsp_config_flag);
             if (adv_config_done == 0)
             {
@@ -435,6 +1133,13 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
             {
                 ESP_LOGE(IAWARE_BLE, "gap_event_handler: Advertising start failed");
             }
+            else if (gatt_t_init > 0)
+            {
+                // Once per boot, the advertising restarts after every client.
+                BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_ADV_READY, (uint32_t) ((esp_timer_get_time() - gatt_t_init)/1000), 0, 0);
+
+                gatt_t_init = 0;
+            }
 
             break;
 
@@ -450,62 +1155,82 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
                 ESP_LOGI(IAWARE_BLE, "Stop adv successfully");
             }
 
+            // A new interval, see ble_server_set_adv(). The advertising stays off while every slot is taken.
+            if (adv_restart_pending == iawTrue)
+            {
+                adv_restart_pending = iawFalse;
+
+                if ((adv_config_done == 0) && (peer_new() != NULL))
+                    esp_ble_gap_start_advertising(&adv_params);
+            }
+
             break;
 
         case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT: // When updating connection parameters complete, the event comes.
-            ESP_LOGI(IAWARE_BLE, "gap_event_handler: ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT");
+            BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_CONN_PARAMS, param->update_conn_params.status, param->update_conn_params.conn_int, param->update_conn_params.latency);
+
+            if ((p = peer_find_bda(param->update_conn_params.bda)) != NULL)
+            {
+                portENTER_CRITICAL(&notify_mux);
+
+                uint8_t is_retune = ble_link_conn_params(&(p->link), (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS) ? iawTrue : iawFalse,
+                                                         param->update_conn_params.conn_int, param->update_conn_params.latency, param->update_conn_params.timeout);
+
+                portEXIT_CRITICAL(&notify_mux);
+
+                link_changed(p, is_retune);
+            }
 
-            ESP_LOGI(IAWARE_BLE, "update connection params status = %d, min_int = %d, max_int = %d,conn_int = %d,latency = %d, timeout = %d",
-                      param->update_conn_params.status,
-                      param->update_conn_params.min_int,
-                      param->update_conn_params.max_int,
-                      param->update_conn_params.conn_int,
-                      param->update_conn_params.latency,
-                      param->update_conn_params.timeout);
-             
             break;
 
-        default:
-            ESP_LOGI(IAWARE_BLE, "gap_event_handler: default");
+        case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT: // When the data length extension is set up, the event comes.
+            BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_DATA_LEN, param->pkt_data_lenth_cmpl.status, param->pkt_data_lenth_cmpl.params.tx_len, param->pkt_data_lenth_cmpl.params.rx_len);
+
+            if ((link_len_peer != NULL) && (link_len_peer->is_used == iawTrue) && (memcmp(link_len_peer->bda, link_len_bda, sizeof(esp_bd_addr_t)) == 0) &&
+                (param->pkt_data_lenth_cmpl.status == ESP_BT_STATUS_SUCCESS))
+            {
+                p = link_len_peer;
+
+                portENTER_CRITICAL(&notify_mux);
+
+                uint8_t is_retune = ble_link_data_len(&(p->link), param->pkt_data_lenth_cmpl.params.tx_len, param->pkt_data_lenth_cmpl.params.rx_len);
+
+                portEXIT_CRITICAL(&notify_mux);
+
+                link_changed(p, is_retune);
+            }
+
+            link_len_peer = NULL;
+
+            link_len_next();
 
             break;
-    }
-}
 
-// static void str_to_uuid128(struct gatts_profile_inst *ptr, char uuid128_str[])
-static void str_to_uuid128(uint8_t uuid128[], char uuid128_str[])
-// Params:
-//     uuid128_str  : It is a string, of which length is 36 (including '-')
-{
-    printf("%s\n", uuid128_str);
-    int n = 0;
-    for (int i = 0; i < 36;)
-    {
-        if (uuid128_str[i] == '-')
-            i++;
+#ifdef CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+        case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT: // When the PHY changes, the event comes.
+            BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_PHY, param->phy_update.status, param->phy_update.tx_phy, param->phy_update.rx_phy);
 
-        uint8_t MSB = uuid128_str[i];
-        uint8_t LSB = uuid128_str[i + 1];
+            if (((p = peer_find_bda(param->phy_update.bda)) != NULL) && (param->phy_update.status == ESP_BT_STATUS_SUCCESS))
+            {
+                portENTER_CRITICAL(&notify_mux);
 
-        if (MSB > '9') 
-            MSB -= 7; 
+                p->link.tx_phy = param->phy_update.tx_phy;
+                p->link.rx_phy = param->phy_update.rx_phy;
 
-        if (LSB > '9') 
-            LSB -= 7;
+                portEXIT_CRITICAL(&notify_mux);
 
-        // ptr->service_id.id.uuid.uuid.uuid128[15 - n++] = ( (MSB&0x0F) << 4 ) | (LSB & 0x0F);
-        uuid128[15 - n++] = ( (MSB&0x0F) << 4 ) | (LSB & 0x0F);
-        i+=2;   
-    }
+                link_changed(p, iawFalse);
+            }
 
-    for (int i = 0; i < 16; i++)
-    {
-        printf("%d", uuid128[i]);
-    }
-    printf("\n");
-}
+            break;
+#endif
 
+        default:
+            ESP_LOGI(IAWARE_BLE, "gap_event_handler: default");
 
+            break;
+    }
+}
 
 static void gatts_profile_a_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param) 
 // Params:
@@ -513,17 +1238,13 @@ static void gatts_profile_a_event_handler(esp_gatts_cb_event_t event, esp_gatt_i
 //      esp_gatt_if_t   : Gatt interface type, different application on GATT client use different gatt_if 
 //      esp_ble_gatts_cb_param_t    : Gatt server callback parameters union.
 {
+    struct ble_peer *p;
+
     switch (event) 
     {
         case ESP_GATTS_REG_EVT: // When register application id, the event comes.
             ESP_LOGI(IAWARE_BLE, "A: REGISTER_APP_EVT, status %d, app_id %d", param->reg.status, param->reg.app_id);
 
-            gl_profile_tab[PROFILE_A_APP_ID].service_id.is_primary = true;
-            gl_profile_tab[PROFILE_A_APP_ID].service_id.id.inst_id = 0x00;
-
-            gl_profile_tab[PROFILE_A_APP_ID].service_id.id.uuid.len = ESP_UUID_LEN_128;                        
-            str_to_uuid128(gl_profile_tab[PROFILE_A_APP_ID].service_id.id.uuid.uuid.uuid128, IAWARE_BLE_SERVICE_UUID);
-
             esp_err_t set_dev_name_ret = esp_ble_gap_set_device_name(IAWARE_DEVICE_NAME);
             if (set_dev_name_ret)
             {
@@ -565,165 +1286,109 @@ static void gatts_profile_a_event_handler(esp_gatts_cb_event_t event, esp_gatt_i
             adv_config_done |= scan_rsp_config_flag;
 
 #endif
-            // Create a service. number of handle requested for this service.
-            esp_ble_gatts_create_service(gatts_if, &gl_profile_tab[PROFILE_A_APP_ID].service_id, GATTS_NUM_HANDLE_TEST_A);
-
-            break;
-
-        case ESP_GATTS_CREATE_EVT: // When create service complete, the event comes.
-            ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_CREATE_EVT, status %d,  service_handle %d", param->create.status, param->create.service_handle);
-
-            // When we success in creating the service, we then create characteristics.
-            gl_profile_tab[PROFILE_A_APP_ID].service_handle = param->create.service_handle;
-
-            // Add a characteristic of RX
-            gl_profile_tab[PROFILE_A_APP_ID].RX_char_uuid.len = ESP_UUID_LEN_128;
-            str_to_uuid128(gl_profile_tab[PROFILE_A_APP_ID].RX_char_uuid.uuid.uuid128, IAWARE_BLE_CHARACTERISTIC_UUID_RX);            
-
-            // Add a characteristic of TX
-            gl_profile_tab[PROFILE_A_APP_ID].TX_char_uuid.len = ESP_UUID_LEN_128;
-            str_to_uuid128(gl_profile_tab[PROFILE_A_APP_ID].TX_char_uuid.uuid.uuid128, IAWARE_BLE_CHARACTERISTIC_UUID_TX);            
-            
-            // This function is called to start a service.
-            esp_ble_gatts_start_service(gl_profile_tab[PROFILE_A_APP_ID].service_handle);
+            // The advertising waits for the service too, so no central connects before the service is there.
+            adv_config_done |= service_start_flag;
 
-            esp_err_t add_char_ret;
-
-            RX_a_property = ESP_GATT_CHAR_PROP_BIT_WRITE;
-            RX_a_permission = ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE;
-
-            add_char_ret = esp_ble_gatts_add_char(gl_profile_tab[PROFILE_A_APP_ID].service_handle, 
-                                                    &gl_profile_tab[PROFILE_A_APP_ID].RX_char_uuid, 
-                                                    RX_a_permission, 
-                                                    RX_a_property, 
-                                                    &gatts_demo_char1_val, 
-                                                    NULL);
-            if (add_char_ret)
+            // Create the service with all its attributes.
+            esp_err_t create_attr_ret = esp_ble_gatts_create_attr_tab(gatt_db, gatts_if, IAW_IDX_NB, 0);
+            if (create_attr_ret)
             {
-                ESP_LOGE(IAWARE_BLE, "A: add char failed, error code =%x",add_char_ret);
+                ESP_LOGE(IAWARE_BLE, "A: create attr table failed, error code = %x", create_attr_ret);
             }
 
-            TX_a_property = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
-            TX_a_permission = ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE;
-
-            add_char_ret = esp_ble_gatts_add_char(gl_profile_tab[PROFILE_A_APP_ID].service_handle, 
-                                                    &gl_profile_tab[PROFILE_A_APP_ID].TX_char_uuid, 
-                                                    TX_a_permission, 
-                                                    TX_a_property, 
-                                                    &gatts_demo_char1_val, 
-                                                    NULL);
-            if (add_char_ret)
-            {
-                ESP_LOGE(IAWARE_BLE, "A: add char failed, error code =%x",add_char_ret);
-            }            
-
-
             break;
 
-        case ESP_GATTS_ADD_CHAR_EVT: // When add characteristic complete, the event comes.
-            ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_ADD_CHAR_EVT, status %d,  attr_handle %d, service_handle %d", param->add_char.status, param->add_char.attr_handle, param->add_char.service_handle);
+        case ESP_GATTS_CREAT_ATTR_TAB_EVT: // When the whole attribute table is created, the event comes.
+            ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_CREAT_ATTR_TAB_EVT, status %d, num_handle %d", param->add_attr_tab.status, param->add_attr_tab.num_handle);
 
-            for (int i = 0; i < 16; i++)
+            if ((param->add_attr_tab.status != ESP_GATT_OK) || (param->add_attr_tab.num_handle != IAW_IDX_NB))
             {
-                printf("%d", param->add_char.char_uuid.uuid.uuid128[i]);
-            }
-            printf("\n");            
+                ESP_LOGE(IAWARE_BLE, "A: ESP_GATTS_CREAT_ATTR_TAB_EVT, the table has %d handles instead of %d", param->add_attr_tab.num_handle, IAW_IDX_NB);
 
-            uint16_t length = 0;
-            const uint8_t *prf_char;
-            
-            gl_profile_tab[PROFILE_A_APP_ID].char_handle = param->add_char.attr_handle;
-            gl_profile_tab[PROFILE_A_APP_ID].TX_descr_uuid.len = ESP_UUID_LEN_16;
-            gl_profile_tab[PROFILE_A_APP_ID].TX_descr_uuid.uuid.uuid16 = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
-
-            
-
-            esp_err_t get_attr_ret = esp_ble_gatts_get_attr_value(param->add_char.attr_handle, &length, &prf_char);
-            if (get_attr_ret == ESP_FAIL)
-            {
-                ESP_LOGE(IAWARE_BLE, "A: ILLEGAL HANDLE");
+                break;
             }
 
-            ESP_LOGI(IAWARE_BLE, "A: the gatts demo char length = %x", length);
+            memcpy(gatt_handle_table, param->add_attr_tab.handles, sizeof(gatt_handle_table));
 
-            for(int i = 0; i < length; i++)
-            {
-                ESP_LOGI(IAWARE_BLE, "A: prf_char[%x] =%x",i,prf_char[i]);
-            }
+            gl_profile_tab[PROFILE_A_APP_ID].service_handle = gatt_handle_table[IAW_IDX_SVC];
 
-            esp_err_t add_descr_ret = esp_ble_gatts_add_char_descr(gl_profile_tab[PROFILE_A_APP_ID].service_handle, // service handle to which this characteristic descriptor is to be added.
-                                                                    &gl_profile_tab[PROFILE_A_APP_ID].TX_descr_uuid, // descriptor UUID.
-                                                                    ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, // descriptor access permission.
-                                                                    NULL, // Characteristic descriptor value 
-                                                                    NULL); // attribute response control byte 
-
-
-            if (add_descr_ret)
-            {
-                ESP_LOGE(IAWARE_BLE, "A: add char descr failed, error code =%x", add_descr_ret);
-            }
-
-            break;
-        
-        case ESP_GATTS_ADD_CHAR_DESCR_EVT: // When add descriptor complete, the event comes.
-            ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_ADD_CHAR_DESCR_EVT, status %d, attr_handle %d, service_handle %d", param->add_char_descr.status, param->add_char_descr.attr_handle, param->add_char_descr.service_handle);
+            // This function is called to start a service.
+            esp_ble_gatts_start_service(gatt_handle_table[IAW_IDX_SVC]);
 
             break;
 
-
-
         case ESP_GATTS_READ_EVT: // This is where we send data back to the central server.
-            ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_READ_EVT, conn_id %d, trans_id %d, handle %d", param->read.conn_id, param->read.trans_id, param->read.handle);
+            BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_READ, param->read.conn_id, param->read.trans_id, param->read.handle);
+
+            // The stack answers the ESP_GATT_AUTO_RSP attributes itself.
+            if (!param->read.need_rsp)
+                break;
 
             esp_gatt_rsp_t rsp;
+            uint8_t stats[BLE_STATS_SIZE];
             memset(&rsp, 0, sizeof(esp_gatt_rsp_t));
             rsp.attr_value.handle = param->read.handle;
-            rsp.attr_value.len = 4;
-            rsp.attr_value.value[0] = 0xde;
-            rsp.attr_value.value[1] = 0xed;
-            rsp.attr_value.value[2] = 0xbe;
-            rsp.attr_value.value[3] = 0xef;
+            rsp.attr_value.offset = param->read.offset;
+
+            // A client with the default MTU reads the stats in several pieces.
+            if ((param->read.handle == gatt_handle_table[IAW_IDX_STATS_VAL]) && ((p = peer_find(param->read.conn_id)) != NULL) &&
+                (param->read.offset < gatt_stats_pack(p, stats)))
+            {
+                rsp.attr_value.len = BLE_STATS_SIZE - param->read.offset;
+                memcpy(rsp.attr_value.value, &(stats[param->read.offset]), rsp.attr_value.len);
+            }
+
             esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id, ESP_GATT_OK, &rsp); // This function is called to send a response to a request.
 
             break;
         
         case ESP_GATTS_WRITE_EVT:
-            ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_WRITE_EVT, conn_id %d, trans_id %d, handle %d", param->write.conn_id, param->write.trans_id, param->write.handle);
+            BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_WRITE, param->write.conn_id, param->write.trans_id, param->write.handle);
+
+            if ((p = peer_find(param->write.conn_id)) == NULL)
+            {
+                if (param->write.need_rsp)
+                    esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, ESP_GATT_ERROR, NULL);
 
-            if (!param->write.is_prep) //  If the write is a long write, then (param->write.is_prep) will be set, if it is a short write then (param->write.is_prep) will not be set. 
+                break;
+            }
+
+            if (param->write.handle == gatt_handle_table[IAW_IDX_RX_VAL])
+            {
+                // A command, see iaware_tcp_com.h. The pieces of a long write wait for ESP_GATTS_EXEC_WRITE_EVT.
+                if (!param->write.is_prep)
+                    cmd_feed(p, param->write.value, param->write.len);
+            }
+            else if (param->write.handle == gatt_handle_table[IAW_IDX_CTRL_VAL])
+            {
+                if ((!param->write.is_prep) && (param->write.len == 1))
+                    gatt_ctrl_write(p, param->write.value[0]);
+            }
+            else if ((param->write.handle == gatt_handle_table[IAW_IDX_TX_CCCD]) && (!param->write.is_prep) && (param->write.len == 2))
+            // If the write is a long write, then (param->write.is_prep) will be set, if it is a short write then (param->write.is_prep) will not be set. 
             // when short write occurs, i.e. the size of the payload is less than MTU-3, where MTU is usually 23 bytes.
             {
-                ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_WRITE_EVT, value len %d", param->write.len);
+                BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_WRITE_LEN, param->write.len, 0, 0);
 
                 // Log a buffer of hex bytes at Info level. 
                 esp_log_buffer_hex(IAWARE_BLE, param->write.value, param->write.len);
 
-                // printf("%d\n", param->write.handle);
-                // printf("%d\n", gl_profile_tab[PROFILE_A_APP_ID].descr_handle);
-                // if ( (gl_profile_tab[PROFILE_A_APP_ID].descr_handle == param->write.handle) && (param->write.len == 2) )
                 {
                     uint16_t descr_value = param->write.value[1]<<8 | param->write.value[0];
                     if (descr_value == 0x0001)
                     {
                         // if (a_property & ESP_GATT_CHAR_PROP_BIT_NOTIFY)
                         {
-                            ESP_LOGI(IAWARE_BLE, "A: notify enable");
-
-                            notify_event = event;
-                            notify_gatts_if = gatts_if;
-                            notify_param = param;
+                            BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_NOTIFY_ENABLE, 0, 0, 0);
 
-                            if (xTimerStart(notify_timerHandle, 0) != pdPASS) 
-                            {
-                                ESP_LOGE(IAWARE_BLE, "A: ESP_GATTS_WRITE_EVT, Fail to start notification timer");
-                            }                            
+                            peer_set_streaming(p, iawTrue);
                         }
                     }
                     else if (descr_value == 0x0002)
                     {
                         // if (a_property & ESP_GATT_CHAR_PROP_BIT_INDICATE)
                         {
-                            ESP_LOGI(IAWARE_BLE, "A: indicate enable");
+                            BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_INDICATE_ENABLE, 0, 0, 0);
 
                             uint8_t indicate_data[15];
                             for (int i = 0; i < sizeof(indicate_data); ++i)
@@ -731,17 +1396,14 @@ static void gatts_profile_a_event_handler(esp_gatts_cb_event_t event, esp_gatt_i
                                 indicate_data[i] = i%0xff;
                             }
                             //the size of indicate_data[] need less than MTU size
-                            esp_ble_gatts_send_indicate(gatts_if, param->write.conn_id, gl_profile_tab[PROFILE_A_APP_ID].char_handle, sizeof(indicate_data), indicate_data, true);
+                            esp_ble_gatts_send_indicate(gatts_if, param->write.conn_id, gatt_handle_table[IAW_IDX_TX_VAL], sizeof(indicate_data), indicate_data, true);
                         }
                     }                    
                     else if (descr_value == 0x0000)
                     {
-                        ESP_LOGI(IAWARE_BLE, "A: notify/indicate disable ");
+                        BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_NOTIFY_DISABLE, 0, 0, 0);
 
-                        if (xTimerStop(notify_timerHandle, 0) != pdPASS) 
-                        {
-                            ESP_LOGE(IAWARE_BLE, "A: ESP_GATTS_WRITE_EVT, Fail to stop notification timer");
-                        }                        
+                        peer_set_streaming(p, iawFalse);
                     }
                     else
                     {
@@ -752,21 +1414,28 @@ static void gatts_profile_a_event_handler(esp_gatts_cb_event_t event, esp_gatt_i
                 }
             }
 
-            write_event_env(gatts_if, &a_prepare_write_env, param);
+            write_event_env(gatts_if, &(p->prepare_write_env), param);
 
             break;
         
         case ESP_GATTS_EXEC_WRITE_EVT:
-            ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_EXEC_WRITE_EVT");
+            BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_EXEC_WRITE, 0, 0, 0);
 
             esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, ESP_GATT_OK, NULL);
 
-            exec_write_event_env(&a_prepare_write_env, param);
+            if ((p = peer_find(param->exec_write.conn_id)) != NULL)
+                exec_write_event_env(p, param);
 
             break;
 
         case ESP_GATTS_MTU_EVT:
-            ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_MTU_EVT, MTU %d", param->mtu.mtu);
+            BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_MTU, param->mtu.mtu, 0, 0);
+
+            if ((p = peer_find(param->mtu.conn_id)) != NULL)
+            {
+                p->mtu = param->mtu.mtu;
+                p->link_pending = iawTrue;
+            }
 
             break;
 
@@ -790,6 +1459,12 @@ static void gatts_profile_a_event_handler(esp_gatts_cb_event_t event, esp_gatt_i
         case ESP_GATTS_START_EVT: // When start service complete, the event comes.
             ESP_LOGI(IAWARE_BLE, "A: SERVICE_START_EVT, status %d, service_handle %d", param->start.status, param->start.service_handle);
 
+            adv_config_done &= (~service_start_flag);
+            if (adv_config_done == 0)
+            {
+                esp_ble_gap_start_advertising(&adv_params);
+            }
+
             break;
 
         case ESP_GATTS_STOP_EVT:
@@ -798,44 +1473,106 @@ static void gatts_profile_a_event_handler(esp_gatts_cb_event_t event, esp_gatt_i
             break;
 
         case ESP_GATTS_CONNECT_EVT:
-            ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_CONNECT_EVT");
+            BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_CONNECT, param->connect.conn_id,
+                  (param->connect.remote_bda[2] << 8) | param->connect.remote_bda[3],
+                  (param->connect.remote_bda[4] << 8) | param->connect.remote_bda[5]);
+
+            if ((p = peer_new()) == NULL)
+            {
+                ESP_LOGE(IAWARE_BLE, "A: ESP_GATTS_CONNECT_EVT, %d clients are connected already", BLE_SVR_MAX_PEERS);
+
+                esp_ble_gap_disconnect(param->connect.remote_bda);
+
+                break;
+            }
+
+            notify_gatts_if = gatts_if;
+
+            p->conn_id = param->connect.conn_id;
+            p->mtu = ESP_GATT_DEF_BLE_MTU_SIZE;
+            p->is_streaming = iawFalse;
+            p->stream_reset_pending = iawTrue;
+            p->link_pending = iawFalse;
+            p->feature_seq = 0;
+            p->prepare_write_env.prepare_len = 0;
 
-            esp_ble_conn_update_params_t conn_params = {0};
-            memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+            com_cmd_reset(&(p->cmd_parser), COM_CMD_LINK_BLE, p->cmd_msg, cmd_on_msg);
+            p->cmd_n_msgs = 0;
+            p->cmd_ack_pending = iawFalse;
+            p->cmd_version_pending = iawFalse;
+            p->cmd_adc_cal_pending = iawFalse;
 
-            /* For the IOS system, please reference the apple official documents about the ble connection parameters restrictions. */
-            conn_params.latency = 0;
-            conn_params.min_int = 0x10;    // min_int = 0x10*1.25ms = 20ms            
-            conn_params.max_int = 0x20;    // max_int = 0x20*1.25ms = 40ms
-            conn_params.timeout = 400;    // timeout = 400*10ms = 4000ms
-            ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_CONNECT_EVT, conn_id %d, remote %02x:%02x:%02x:%02x:%02x:%02x:",
-                     param->connect.conn_id,
-                     param->connect.remote_bda[0], param->connect.remote_bda[1], param->connect.remote_bda[2],
-                     param->connect.remote_bda[3], param->connect.remote_bda[4], param->connect.remote_bda[5]);
+            // The interval is chosen again once the data length and the notifications are known, see iaware_ble_link.h.
+            memcpy(p->bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
 
-            gl_profile_tab[PROFILE_A_APP_ID].conn_id = param->connect.conn_id;
+            portENTER_CRITICAL(&notify_mux);
+
+            ble_link_reset(&(p->link));
+
+            portEXIT_CRITICAL(&notify_mux);
+
+            p->is_used = iawTrue;
 
             //start sent the update connection parameters to the peer device.
-            esp_ble_gap_update_conn_params(&conn_params);
+            link_request(p);
+
+            p->link_len_wanted = iawTrue;
+
+            link_len_next();
+
+#ifdef CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+            if (esp_ble_gap_set_preferred_phy(p->bda, ESP_BLE_GAP_NO_PREFER_TRANSMIT_PHY | ESP_BLE_GAP_NO_PREFER_RECEIVE_PHY, ESP_BLE_GAP_PHY_2M_PREF_MASK, ESP_BLE_GAP_PHY_2M_PREF_MASK, ESP_BLE_GAP_PHY_OPTIONS_NO_PREF) != ESP_OK)
+                ESP_LOGW(IAWARE_BLE, "A: ESP_GATTS_CONNECT_EVT, Fail to ask for the 2M PHY");
+#endif
+
+            // The advertising stops at every connection. It goes on while another client can connect.
+            if (peer_count(iawFalse) < BLE_SVR_MAX_PEERS)
+                esp_ble_gap_start_advertising(&adv_params);
 
             break;
         
         case ESP_GATTS_DISCONNECT_EVT:
-            ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_DISCONNECT_EVT, disconnect reason 0x%x", param->disconnect.reason);
+            BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_DISCONNECT, param->disconnect.reason, 0, 0);
+
+            if ((p = peer_find(param->disconnect.conn_id)) == NULL)
+                break;
+
+            // The advertising stopped when the last free slot was taken.
+            uint8_t is_adv_stopped = (peer_count(iawFalse) == BLE_SVR_MAX_PEERS) ? iawTrue : iawFalse;
+
+            // The slot goes to the next client, which negotiates again and enables the notifications again.
+            p->is_streaming = iawFalse;
+            p->link_pending = iawFalse;
+            p->stream_reset_pending = iawTrue;
+            p->is_used = iawFalse;
+
+            if (peer_count(iawFalse) == 0)
+                notify_is_bench = iawFalse;
+
+            if (peer_count(iawTrue) == 0)
+                xTimerStop(notify_timerHandle, 0);
 
-            esp_ble_gap_start_advertising(&adv_params);
+            if (is_adv_stopped == iawTrue)
+                esp_ble_gap_start_advertising(&adv_params);
             
             break;
 
-        case ESP_GATTS_CONF_EVT: // When receive confirm, the event comes
-            ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_CONF_EVT, status %d attr_handle %d", param->conf.status, param->conf.handle);
-
+        case ESP_GATTS_CONF_EVT: // When receive confirm, the event comes. A notification also gets one once the controller took it.
+            // It comes for every notification, so only a failure is logged.
             if (param->conf.status != ESP_GATT_OK)
-            {
-                ESP_LOGE(IAWARE_BLE, "A: param->conf.status != ESP_GATT_OK, status %d attr_handle %d", param->conf.status, param->conf.handle);
+                BLOGW(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_CONF, param->conf.status, param->conf.handle, 0);
 
-                esp_log_buffer_hex(IAWARE_BLE, param->conf.value, param->conf.len);
-            }
+            if ((p = peer_find(param->conf.conn_id)) == NULL)
+                break;
+
+            portENTER_CRITICAL(&notify_mux);
+
+            ble_flow_conf(&(p->flow), param->conf.len, esp_timer_get_time());
+
+            portEXIT_CRITICAL(&notify_mux);
+
+            if (notify_stream_task != NULL)
+                xTaskNotifyGive(notify_stream_task);
 
             break;
 
@@ -860,7 +1597,19 @@ static void gatts_profile_a_event_handler(esp_gatts_cb_event_t event, esp_gatt_i
             break;
 
         case ESP_GATTS_CONGEST_EVT:
-            ESP_LOGI(IAWARE_BLE, "A: ESP_GATTS_CONGEST_EVT not implement");
+            BLOGI(BLOG_TAG_IAWARE_BLE, BLOG_FMT_BLE_CONGEST, param->congest.conn_id, param->congest.congested, 0);
+
+            if ((p = peer_find(param->congest.conn_id)) == NULL)
+                break;
+
+            portENTER_CRITICAL(&notify_mux);
+
+            p->flow.is_congested = param->congest.congested ? iawTrue : iawFalse;
+
+            portEXIT_CRITICAL(&notify_mux);
+
+            if ((param->congest.congested == false) && (notify_stream_task != NULL))
+                xTaskNotifyGive(notify_stream_task);
 
             break;
 
@@ -8,6 +8,16 @@
 #define IAWARE_BLE_SERVICE_UUID                     "D0611E78-BBB4-4591-A5F8-487910AE4366" // UART service UUID
 #define IAWARE_BLE_CHARACTERISTIC_UUID_RX           "D0611E79-BBB4-4591-A5F8-487910AE4366"
 #define IAWARE_BLE_CHARACTERISTIC_UUID_TX           "D0611E7A-BBB4-4591-A5F8-487910AE4366" // Normal Read
+#define IAWARE_BLE_CHARACTERISTIC_UUID_STATS        "D0611E7B-BBB4-4591-A5F8-487910AE4366"
+#define IAWARE_BLE_CHARACTERISTIC_UUID_CTRL         "D0611E7C-BBB4-4591-A5F8-487910AE4366"
+
+// The UUIDs above as the bytes of esp_bt_uuid_t, i.e. least significant first. They differ in the 13th byte only.
+#define IAWARE_BLE_UUID128(b12)     {0x66, 0x43, 0xAE, 0x10, 0x79, 0x48, 0xF8, 0xA5, 0x91, 0x45, 0xB4, 0xBB, (b12), 0x1E, 0x61, 0xD0}
+#define IAWARE_BLE_UUID_SERVICE     0x78
+#define IAWARE_BLE_UUID_RX          0x79
+#define IAWARE_BLE_UUID_TX          0x7A
+#define IAWARE_BLE_UUID_STATS       0x7B
+#define IAWARE_BLE_UUID_CTRL        0x7C
 
 
 #define SVR_PROFILE_NUM 1
@@ -27,14 +37,62 @@
 
 #define adv_config_flag      (1 << 0)
 #define scan_rsp_config_flag (1 << 1)
+#define service_start_flag   (1 << 2)
+
+// The attributes of the service, in the order of the attribute table.
+enum
+{
+    IAW_IDX_SVC,
+
+    IAW_IDX_RX_CHAR,
+    IAW_IDX_RX_VAL,         // The commands, see BLE_CMD_ACK_SIZE.
+
+    IAW_IDX_TX_CHAR,
+    IAW_IDX_TX_VAL,         // The notifications.
+    IAW_IDX_TX_CCCD,
+
+    IAW_IDX_STATS_CHAR,
+    IAW_IDX_STATS_VAL,      // Read only, see BLE_STATS_SIZE.
+
+    IAW_IDX_CTRL_CHAR,
+    IAW_IDX_CTRL_VAL,       // One byte of BLE_CTRL_*.
+
+    IAW_IDX_NB,
+};
+
+#define BLE_NOTIFY_INTERVAL 50 // [ms]. How often the notifications look for new band powers, see iaware_feature.h.
+
+#define BLE_LOCAL_MTU       500 // [bytes]. The client may negotiate less, see ESP_GATTS_MTU_EVT.
+
+#define BLE_ADV_NVS_METRICS     "adv_metrics"   // See iaware_ble_adv.h.
+#define BLE_ADV_NVS_INTERVAL    "adv_int"       // [ms]
+
+#define BLE_SVR_MAX_PEERS   3   // The clients connected at once, at most CONFIG_BTDM_CTRL_BLE_MAX_CONN. Each gets the notifications on its own.
+
+// The RX characteristic takes the framed commands of TCP_RECV_PORT, in writes of any size or in long writes. Every command
+// is acknowledged on TX by |PACKET_HEADER_BLE_ACK|uint8_t cmd|uint8_t is_known|uint16_t n_cmds|, where n_cmds counts the
+// commands since the connection, so acknowledgements coalesced under load still show. CMD_SET_STREAM_VERSION and
+// CMD_GET_ADC_CAL are also answered on TX by their usual reply, without the 4-bytes length, the version being always v2.
+// CMD_START_STREAM and CMD_STOP_STREAM turn the sample blocks of the client on and off like its CCCD. The commands of the
+// TCP client, e.g. CMD_SET_DEGRADE, are acknowledged as unknown, see iaware_tcp_com.h.
+#define BLE_CMD_ACK_SIZE    (1 + 1 + 1 + 2) // [bytes]
+
+// The stats characteristic: |PACKET_HEADER_BLE_STATS|uint32_t n_blocks|uint32_t n_frags_sent|uint32_t n_skipped|
+// uint16_t n_cmds|uint8_t credits|uint8_t is_congested|the PACKET_HEADER_BLE_LINK packet|. The counters are those of
+// BLOG_FMT_BLE_STREAM of the client that reads them, since it enabled the notifications, see iaware_ble_stream.h and
+// iaware_ble_link.h.
+#define BLE_STATS_SIZE      (1 + 4 + 4 + 4 + 2 + 1 + 1 + BLE_LINK_PACKET_SIZE) // [bytes]
 
-#define BLE_NOTIFY_INTERVAL 1000 // [ms]
+// The control characteristic takes one byte.
+#define BLE_CTRL_RESET_STATS    1   // Start the counters of the stats again.
+#define BLE_CTRL_BENCH_ON       2   // Like CMD_SET_BLE_BENCH.
+#define BLE_CTRL_BENCH_OFF      3
+#define BLE_CTRL_RETUNE         4   // Ask the central again for the connection interval, see iaware_ble_link.h.
 
 struct gatts_profile_inst {
     esp_gatts_cb_t          gatts_cb;
     uint16_t                gatts_if;
     uint16_t                app_id;
-    uint16_t                conn_id;
     uint16_t                service_handle;
     esp_gatt_srvc_id_t      service_id;
     uint16_t                char_handle;
@@ -54,10 +112,13 @@ struct gatts_profile_inst {
 };
 
 struct prepare_type_env {
-    uint8_t                 *prepare_buf;
+    uint8_t                 prepare_buf[PREPARE_BUF_MAX_SIZE];
     int                     prepare_len;
+    uint16_t                handle;
 };
 
 int init_ble_server(void);
+void ble_server_set_bench(uint8_t is_on);
+uint8_t ble_server_set_adv(uint8_t is_metrics, uint16_t interval_ms);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "iaware_blog.h"
+#include "iaware_helper.h"
+#include "iaware_packet.h"
+#include "main.h"
+
+// The ring is a bounded multi-producer/single-consumer queue. Every slot carries a sequence number: a producer may write
+// slot (pos & mask) only when seq == pos, and the consumer may read it only when seq == pos + 1. Producers reserve a position
+// with a compare-and-swap on blog_head, so the sampling callback (core 0), the TCP tasks and the BLE callbacks (core 1) never
+// take a lock or wait for each other.
+struct blog_slot
+{
+    volatile uint32_t seq;
+
+    struct blog_record rec;
+};
+
+static struct blog_slot blog_ring[BLOG_QUEUE_LEN];
+static volatile uint32_t blog_head = 0;     // The next position to be reserved by a producer.
+static uint32_t blog_tail = 0;              // The next position to be read by the consumer.
+
+#define BLOG_FMT_STR(id, str) str,
+static const char *blog_fmt_strs[BLOG_FMT_NUM] = {
+    BLOG_FORMATS(BLOG_FMT_STR)
+};
+#undef BLOG_FMT_STR
+
+static char **blog_tags[BLOG_TAG_NUM] = {
+    [BLOG_TAG_IAWARE_EVENT]     = &IAWARE_EVENT,
+    [BLOG_TAG_IAWARE_NETWORK]   = &IAWARE_NETWORK,
+    [BLOG_TAG_IAWARE_CORE]      = &IAWARE_CORE,
+    [BLOG_TAG_IAWARE_GPIO]      = &IAWARE_GPIO,
+    [BLOG_TAG_IAWARE_BLE]       = &IAWARE_BLE,
+};
+
+esp_log_level_t blog_level[BLOG_TAG_NUM] = {
+    [BLOG_TAG_IAWARE_EVENT]     = ESP_LOG_LEVEL_IAWARE_EVENT,
+    [BLOG_TAG_IAWARE_NETWORK]   = ESP_LOG_LEVEL_IAWARE_NETWORK,
+    [BLOG_TAG_IAWARE_CORE]      = ESP_LOG_LEVEL_IAWARE_CORE,
+    [BLOG_TAG_IAWARE_GPIO]      = ESP_LOG_LEVEL_IAWARE_GPIO,
+    [BLOG_TAG_IAWARE_BLE]       = ESP_LOG_LEVEL_IAWARE_BLE,
+};
+
+volatile uint8_t blog_sink = BLOG_SINK_UART;
+static volatile uint8_t blog_owner = BLOG_SINK_UART;    // The consumer that may call blog_pop(), see blog_consume().
+uint8_t blog_send_formats_pending = iawFalse;
+uint32_t blog_dropped = 0;
+
+void blog_init(void)
+{
+    for (uint32_t i = 0; i < BLOG_QUEUE_LEN; i++)
+    {
+        blog_ring[i].seq = i;
+    }
+
+    blog_head = 0;
+    blog_tail = 0;
+}
+
+void blog_level_set(uint8_t tag_id, esp_log_level_t level)
+{
+    if (tag_id < BLOG_TAG_NUM)
+    {
+        blog_level[tag_id] = level;
+
+        esp_log_level_set(*blog_tags[tag_id], level);
+    }
+}
+
+void blog_push(esp_log_level_t level, uint8_t tag_id, uint16_t fmt_id, int32_t a0, int32_t a1, int32_t a2)
+// It never blocks. When the ring is full, the record is dropped and counted in blog_dropped.
+{
+    struct blog_slot *slot;
+
+    uint32_t pos = __atomic_load_n(&blog_head, __ATOMIC_RELAXED);
+
+    while (1)
+    {
+        slot = &blog_ring[pos & (BLOG_QUEUE_LEN - 1)];
+
+        int32_t dif = (int32_t) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (dif == 0)
+        {
+            if (__atomic_compare_exchange_n(&blog_head, &pos, pos + 1, pdTRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;  // pos is reserved.
+        }
+        else if (dif < 0)
+        {
+            __atomic_fetch_add(&blog_dropped, 1, __ATOMIC_RELAXED);
+
+            return;
+        }
+        else
+        {
+            pos = __atomic_load_n(&blog_head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->rec.t_ms      = esp_log_timestamp();
+    slot->rec.fmt_id    = fmt_id;
+    slot->rec.tag_id    = tag_id;
+    slot->rec.level     = (uint8_t) level;
+    slot->rec.args[0]   = a0;
+    slot->rec.args[1]   = a1;
+    slot->rec.args[2]   = a2;
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+uint8_t blog_consume(uint8_t sink)
+// Called by a consumer before it pops, with BLOG_SINK_UART from blog_drain_task() and BLOG_SINK_NETWORK from
+// com_tcp_send_task(). blog_sink only asks for the other consumer: the one that owns the ring hands it over between two
+// of its blog_pop(), so the two never pop at once. Return iawTrue when sink owns the ring.
+{
+    uint8_t owner = __atomic_load_n(&blog_owner, __ATOMIC_ACQUIRE);
+
+    if (owner != sink)
+        return iawFalse;
+
+    if (blog_sink != sink)
+    {
+        __atomic_store_n(&blog_owner, blog_sink, __ATOMIC_RELEASE);
+
+        return iawFalse;
+    }
+
+    return iawTrue;
+}
+
+int blog_pop(struct blog_record *rec)
+// Only the owner of the ring may call it, see blog_consume().
+// Return iawTrue when a record is copied into rec.
+{
+    struct blog_slot *slot = &blog_ring[blog_tail & (BLOG_QUEUE_LEN - 1)];
+
+    if ((int32_t) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (blog_tail + 1)) < 0)
+        return iawFalse;
+
+    *rec = slot->rec;
+
+    __atomic_store_n(&slot->seq, blog_tail + BLOG_QUEUE_LEN, __ATOMIC_RELEASE);
+
+    blog_tail = blog_tail + 1;
+
+    return iawTrue;
+}
+
+uint32_t blog_pack_records(uint8_t *buff, uint32_t max_records)
+// Pop at most max_records records into a packet |4 bytes length|PACKET_HEADER_LOG|uint8_t n_records|record_1|...|record_n|.
+// buff must hold 4 + PACKET_HEADER_LOG_META_SIZE + max_records*BLOG_RECORD_SIZE bytes. Return the packet size, or 0 when no record is pending.
+{
+    struct blog_record rec;
+
+    uint32_t n = 0;
+    uint8_t *ptr = buff + 4 + PACKET_HEADER_LOG_META_SIZE;
+
+    while ((n < max_records) && (blog_pop(&rec) == iawTrue))
+    {
+        uint32_to_bytes(rec.t_ms, ptr);         ptr += 4;
+        *ptr++ = (rec.fmt_id >> 8) & 0xFF;
+        *ptr++ = rec.fmt_id & 0xFF;
+        *ptr++ = rec.tag_id;
+        *ptr++ = rec.level;
+
+        for (int i = 0; i < BLOG_N_ARGS; i++)
+        {
+            uint32_to_bytes((uint32_t) rec.args[i], ptr);   ptr += 4;
+        }
+
+        n = n + 1;
+    }
+
+    if (n == 0)
+        return 0;
+
+    uint32_to_bytes(PACKET_HEADER_LOG_META_SIZE + n*BLOG_RECORD_SIZE, buff);
+    buff[4] = PACKET_HEADER_LOG;
+    buff[5] = (uint8_t) n;
+
+    return 4 + PACKET_HEADER_LOG_META_SIZE + n*BLOG_RECORD_SIZE;
+}
+
+uint32_t blog_pack_formats(uint8_t *buff, uint32_t buff_size)
+// Write the format table as |4 bytes length|PACKET_HEADER_LOG_FORMATS|uint16_t n_formats|len_1|fmt_1|...|len_n|fmt_n|, where len_x is one byte.
+// Return the packet size, or 0 when buff is too small.
+{
+    uint32_t i_buff = 4 + 1 + 2;
+
+    for (uint16_t i = 0; i < BLOG_FMT_NUM; i++)
+    {
+        uint32_t len = strlen(blog_fmt_strs[i]);
+
+        if ((len > 0xFF) || (i_buff + 1 + len > buff_size))
+            return 0;
+
+        buff[i_buff] = (uint8_t) len;
+        memcpy(&buff[i_buff + 1], blog_fmt_strs[i], len);
+
+        i_buff = i_buff + 1 + len;
+    }
+
+    uint32_to_bytes(i_buff - 4, buff);
+    buff[4] = PACKET_HEADER_LOG_FORMATS;
+    buff[5] = (BLOG_FMT_NUM >> 8) & 0xFF;
+    buff[6] = BLOG_FMT_NUM & 0xFF;
+
+    return i_buff;
+}
+
+const char *blog_fmt_str(uint16_t fmt_id)
+{
+    if (fmt_id < BLOG_FMT_NUM)
+        return blog_fmt_strs[fmt_id];
+
+    return "Unknown blog format %d %d %d";
+}
+
+void blog_drain_task(void *arg)
+// Format the records in the low-priority task, so the UART never stalls the sampling callback or the TCP/BLE tasks.
+{
+    static const char level_letters[] = {'N', 'E', 'W', 'I', 'D', 'V'};
+
+    struct blog_record rec;
+    char msg[128];
+
+    uint32_t reported_dropped = 0;
+
+    while (1)
+    {
+        while ((blog_consume(BLOG_SINK_UART) == iawTrue) && (blog_pop(&rec) == iawTrue))
+        {
+            snprintf(msg, sizeof(msg), blog_fmt_str(rec.fmt_id), rec.args[0], rec.args[1], rec.args[2]);
+
+            const char *tag = (rec.tag_id < BLOG_TAG_NUM) ? *blog_tags[rec.tag_id] : "blog";
+            char letter = (rec.level < sizeof(level_letters)) ? level_letters[rec.level] : '?';
+
+            esp_log_write((esp_log_level_t) rec.level, tag, "%c (%u) %s: %s\n", letter, rec.t_ms, tag, msg);
+        }
+
+        if (blog_dropped != reported_dropped)
+        {
+            ESP_LOGW(IAWARE_CORE, "Binary log: %u records dropped.", blog_dropped - reported_dropped);
+
+            reported_dropped = blog_dropped;
+        }
+
+        vTaskDelay(BLOG_DRAIN_INTERVAL / portTICK_PERIOD_MS);
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef IAWARE_BLOG_H
+#define IAWARE_BLOG_H
+
+#include <stdint.h>
+
+#include "esp_log.h"
+
+// Binary logging. A hot path pushes |format id|tag id|level|timestamp|3 raw 32-bit arguments| into a lock-free ring
+// (blog_push() never blocks and never formats). The strings are formatted later by blog_drain_task() running at low priority,
+// or the raw records are shipped to the client by com_tcp_send_task() and decoded on the host (see iaware_host.py).
+#define BLOG_QUEUE_LEN      128     // Number of records in the ring. It must be a power of two.
+#define BLOG_N_ARGS         3       // Number of 32-bit arguments per record.
+#define BLOG_RECORD_SIZE    (4 + 2 + 1 + 1 + 4*BLOG_N_ARGS) // The size in bytes of a record on the wire, i.e. |t_ms(4)|fmt_id(2)|tag_id(1)|level(1)|args(4*BLOG_N_ARGS)|
+#define BLOG_MAX_RECORDS_PER_PACKET 32  // The maximum number of records in one PACKET_HEADER_LOG packet.
+#define BLOG_DRAIN_INTERVAL 50      // [ms]
+
+// The sinks of the binary log.
+#define BLOG_SINK_UART      0       // Formatted by blog_drain_task() and printed through esp_log_write().
+#define BLOG_SINK_NETWORK   1       // Shipped raw to the client through TCP_SEND_PORT.
+
+// The tags are the same as those of ESP_LOGx, i.e. IAWARE_EVENT, IAWARE_NETWORK, etc. in main.h.
+enum blog_tag_id
+{
+    BLOG_TAG_IAWARE_EVENT = 0,
+    BLOG_TAG_IAWARE_NETWORK,
+    BLOG_TAG_IAWARE_CORE,
+    BLOG_TAG_IAWARE_GPIO,
+    BLOG_TAG_IAWARE_BLE,
+    BLOG_TAG_NUM
+};
+
+// The format strings. Only int32-compatible conversions (%d, %u, %x) are allowed because the arguments are stored as raw 32-bit words.
+// Append new formats at the end, so the ids used by the host decoder do not change.
+#define BLOG_FORMATS(X) \
+    X(BLOG_FMT_SAMPLING_TOO_HIGH_FS,    "Sample data: Too high sampling frequency by %d microsec.") \
+    X(BLOG_FMT_SEND_FAIL,               "Send conns: Send data fail caused by errno %d.") \
+    X(BLOG_FMT_SEND_WAIT_AP,            "Send conns: Wait for AP to start.") \
+    X(BLOG_FMT_SEND_RECREATE_SOCKET,    "Send conns: Recreate a socket.") \
+    X(BLOG_FMT_SEND_WAIT_CLIENT,        "Send conns: Wait for a new client.") \
+    X(BLOG_FMT_SEND_WAIT_SEND,          "Send conns: Wait for a new send().") \
+    X(BLOG_FMT_SEND_TOO_HIGH_LATENCY,   "Send conns: Too high latency by %d microsec.") \
+    X(BLOG_FMT_BLE_READ,                "A: ESP_GATTS_READ_EVT, conn_id %d, trans_id %d, handle %d") \
+    X(BLOG_FMT_BLE_WRITE,               "A: ESP_GATTS_WRITE_EVT, conn_id %d, trans_id %d, handle %d") \
+    X(BLOG_FMT_BLE_WRITE_LEN,           "A: ESP_GATTS_WRITE_EVT, value len %d") \
+    X(BLOG_FMT_BLE_NOTIFY_ENABLE,       "A: notify enable") \
+    X(BLOG_FMT_BLE_INDICATE_ENABLE,     "A: indicate enable") \
+    X(BLOG_FMT_BLE_NOTIFY_DISABLE,      "A: notify/indicate disable") \
+    X(BLOG_FMT_BLE_EXEC_WRITE,          "A: ESP_GATTS_EXEC_WRITE_EVT") \
+    X(BLOG_FMT_BLE_MTU,                 "A: ESP_GATTS_MTU_EVT, MTU %d") \
+    X(BLOG_FMT_BLE_CONNECT,             "A: ESP_GATTS_CONNECT_EVT, conn_id %d, remote xx:xx:%04x:%04x") \
+    X(BLOG_FMT_BLE_DISCONNECT,          "A: ESP_GATTS_DISCONNECT_EVT, disconnect reason 0x%x") \
+    X(BLOG_FMT_BLE_CONF,                "A: ESP_GATTS_CONF_EVT, status %d attr_handle %d") \
+    X(BLOG_FMT_BLE_CONGEST,             "A: ESP_GATTS_CONGEST_EVT, conn_id %d, congested %d") \
+    X(BLOG_FMT_BLE_CONN_PARAMS,         "update connection params status = %d, conn_int = %d, latency = %d") \
+    X(BLOG_FMT_BLE_CLT_NOTIFY,          "ESP_GATTC_NOTIFY_EVT, is_notify %d, handle %d, value len %d") \
+    X(BLOG_FMT_FLASH_SPILL_FAIL,        "Flash tier: Spill block %d fail (%d).") \
+    X(BLOG_FMT_FLASH_BACKFILL_PLANAR,   "Flash tier: Drop planar block %d, a v1 client cannot parse it.") \
+    X(BLOG_FMT_DEGRADE_LEVEL,           "Send conns: Degradation level %d, backlog %d blocks, send() %d microsec on average.") \
+    X(BLOG_FMT_TRIGGER_EVENT,           "Trigger: Source 0x%02x at block %d, full blocks until block %d.") \
+    X(BLOG_FMT_TRIGGER_LOST,            "Trigger: Block %d of the pre-trigger window was overwritten before it was sent again.") \
+    X(BLOG_FMT_MARKER_DROPPED,          "Marker: %d markers dropped, more than %d waited for their block.") \
+    X(BLOG_FMT_BLE_STREAM,              "A: Streamed %d blocks in %d notifications, skipped %d blocks.") \
+    X(BLOG_FMT_BLE_BENCH,               "A: Benchmark %d kbit/s, %d microsec from the send to ESP_GATTS_CONF_EVT on average, %d at most.") \
+    X(BLOG_FMT_BLE_LINK_REQUEST,        "A: Ask for a connection interval in [%d, %d] x 1.25 ms for %d bytes/sec.") \
+    X(BLOG_FMT_BLE_DATA_LEN,            "A: ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT, status %d, tx %d bytes, rx %d bytes") \
+    X(BLOG_FMT_BLE_PHY,                 "A: ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT, status %d, tx PHY %d, rx PHY %d") \
+    X(BLOG_FMT_BLE_ADV_READY,           "A: Advertising %d ms after init_ble_server().") \
+    X(BLOG_FMT_BLE_HUB_SUBSCRIBED,      "H: Peripheral %d (..:%04x) subscribed, conn_id %d") \
+    X(BLOG_FMT_BLE_HUB_RX,              "H: Peripheral %d disconnected, %d blocks forwarded, %d dropped") \
+    X(BLOG_FMT_BLE_HUB_FIRST_NOTIFY,    "H: Peripheral %d first notification %d ms after the connection, cached handles %d")
+
+#define BLOG_FMT_ENUM(id, str) id,
+enum blog_fmt_id
+{
+    BLOG_FORMATS(BLOG_FMT_ENUM)
+    BLOG_FMT_NUM
+};
+#undef BLOG_FMT_ENUM
+
+struct blog_record
+{
+    uint32_t t_ms;          // The same timestamp as ESP_LOGx, i.e. esp_log_timestamp().
+    uint16_t fmt_id;
+    uint8_t tag_id;
+    uint8_t level;
+    int32_t args[BLOG_N_ARGS];
+};
+
+extern esp_log_level_t blog_level[BLOG_TAG_NUM];   // Level filtering per tag, the same as esp_log_level_set().
+extern volatile uint8_t blog_sink;                  // The consumer asked by CMD_SET_LOG_SINK, see blog_consume().
+extern uint8_t blog_send_formats_pending;           // Set by CMD_GET_LOG_FORMATS. Cleared by com_tcp_send_task() after sending the format table.
+extern uint32_t blog_dropped;                       // The number of records dropped because the ring was full.
+
+// The level check is done inline, so a filtered-out record costs only a load and a compare.
+#define BLOG(level_, tag_id_, fmt_id_, a0, a1, a2) \
+    do { \
+        if (blog_level[(tag_id_)] >= (level_)) \
+            blog_push((level_), (tag_id_), (fmt_id_), (int32_t) (a0), (int32_t) (a1), (int32_t) (a2)); \
+    } while (0)
+
+#define BLOGE(tag_id, fmt_id, a0, a1, a2)   BLOG(ESP_LOG_ERROR, tag_id, fmt_id, a0, a1, a2)
+#define BLOGW(tag_id, fmt_id, a0, a1, a2)   BLOG(ESP_LOG_WARN, tag_id, fmt_id, a0, a1, a2)
+#define BLOGI(tag_id, fmt_id, a0, a1, a2)   BLOG(ESP_LOG_INFO, tag_id, fmt_id, a0, a1, a2)
+
+void blog_init(void);
+void blog_level_set(uint8_t tag_id, esp_log_level_t level);
+void blog_push(esp_log_level_t level, uint8_t tag_id, uint16_t fmt_id, int32_t a0, int32_t a1, int32_t a2);
+uint8_t blog_consume(uint8_t sink);
+int blog_pop(struct blog_record *rec);
+uint32_t blog_pack_records(uint8_t *buff, uint32_t max_records);
+uint32_t blog_pack_formats(uint8_t *buff, uint32_t buff_size);
+const char *blog_fmt_str(uint16_t fmt_id);
+
+void blog_drain_task(void *arg);
+
+#endif
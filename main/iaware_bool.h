@@ -0,0 +1,8 @@
+#ifndef IAWARE_BOOL_H
+#define IAWARE_BOOL_H
+
+// The booleans of the i-Aware sources. main.h includes them, a source that has to build on a PC too includes only this.
+#define iawTrue     1
+#define iawFalse    0
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "iaware_decimate.h"
+
+// Least-squares design for a 3-stage CIC: the passband to 0.18 of the FIR input rate follows 1/sinc^3 within +0.07/-0.17 dB
+// (CIC included), and the band from 0.30 that aliases after the decimation by 2 is at least 47 dB down. The DC gain is 1.
+const int16_t decimate_fir_coefs[DECIMATE_FIR_TAPS] =
+{
+    171, 190, -392, -652, 646, 1630, -782, -3753, 183, 10802, 16682,
+    10802, 183, -3753, -782, 1630, 646, -652, -392, 190, 171
+};
+
+int decimate_init(struct decimate *dec, uint32_t factor, uint8_t n_channels)
+// Params:
+//     factor       : DECIMATE_OFF, or a power of 2 from 4 to DECIMATE_FACTOR_MAX.
+//     n_channels   : The channels of a scan, at most DECIMATE_MAX_CHANNELS.
+{
+    if ((decimate_factor_is_valid(factor) == 0) || (n_channels == 0) || (n_channels > DECIMATE_MAX_CHANNELS))
+        return DECIMATE_ERR_FACTOR;
+
+    memset(dec, 0, sizeof(struct decimate));
+
+    dec->factor     = factor;
+    dec->bits       = decimate_bits(factor);
+    dec->n_channels = n_channels;
+
+    dec->cic_log2 = 0;
+    while ((2u << dec->cic_log2) < factor)
+    {
+        dec->cic_log2 = dec->cic_log2 + 1;
+    }
+
+    return DECIMATE_OK;
+}
+
+int decimate_push(struct decimate *dec, uint8_t i_channel, uint16_t in, uint16_t *out)
+// Feed one raw sample of a channel. Return 1 when out holds a new output sample, and 0 otherwise.
+// All channels are pushed once per scan, so they produce their outputs at the same scan.
+{
+    struct decimate_channel *ch = &(dec->channels[i_channel]);
+
+    // The integrators run at the input rate. The input is made signed so the output of the CIC is centred on 0.
+    ch->integ[0] = ch->integ[0] + (uint32_t) ((int32_t) in - (1 << (DECIMATE_IN_BITS - 1)));
+    ch->integ[1] = ch->integ[1] + ch->integ[0];
+    ch->integ[2] = ch->integ[2] + ch->integ[1];
+
+    ch->i_cic = ch->i_cic + 1;
+    if (ch->i_cic < (1u << dec->cic_log2))
+        return 0;
+
+    ch->i_cic = 0;
+
+    // The combs run at the CIC output rate. The gain is (factor/2)^3, and the result always fits in int32_t.
+    uint32_t c0 = ch->integ[2] - ch->comb[0];
+    ch->comb[0] = ch->integ[2];
+
+    uint32_t c1 = c0 - ch->comb[1];
+    ch->comb[1] = c0;
+
+    uint32_t c2 = c1 - ch->comb[2];
+    ch->comb[2] = c1;
+
+    int16_t v = (int16_t) (((int32_t) c2) >> (3*dec->cic_log2 - DECIMATE_CIC_FRAC_BITS));
+
+    // Store v twice, so fir_hist[i_fir_hist + 1 .. i_fir_hist + DECIMATE_FIR_TAPS] is the whole history in order.
+    uint8_t i_hist = ch->i_fir_hist;
+
+    ch->fir_hist[i_hist] = v;
+    ch->fir_hist[i_hist + DECIMATE_FIR_TAPS] = v;
+
+    ch->i_fir_hist = (i_hist + 1 == DECIMATE_FIR_TAPS) ? 0 : (i_hist + 1);
+
+    ch->i_fir = ch->i_fir + 1;
+    if (ch->i_fir < 2)
+        return 0;
+
+    ch->i_fir = 0;
+
+    // The coefficients are symmetric, so the order of the dot product does not matter.
+    const int16_t *x = &(ch->fir_hist[i_hist + 1]);
+    int32_t acc = 0;
+
+    for (uint32_t i = 0; i < DECIMATE_FIR_TAPS; i++)
+    {
+        acc = acc + ((int32_t) x[i])*((int32_t) decimate_fir_coefs[i]);
+    }
+
+    // Back to unsigned with the extra bits of the averaging, rounded to nearest.
+    uint32_t shift = DECIMATE_FIR_Q + DECIMATE_CIC_FRAC_BITS - (dec->bits - DECIMATE_IN_BITS);
+    int32_t y = ((acc + (1 << (shift - 1))) >> shift) + (1 << (dec->bits - 1));
+
+    if (y < 0)
+        y = 0;
+
+    if (y > ((1 << dec->bits) - 1))
+        y = (1 << dec->bits) - 1;
+
+    *out = (uint16_t) y;
+
+    return 1;
+}
+
+int decimate_factor_is_valid(uint32_t factor)
+{
+    if (factor == DECIMATE_OFF)
+        return 1;
+
+    return (factor >= 4) && (factor <= DECIMATE_FACTOR_MAX) && ((factor & (factor - 1)) == 0);
+}
+
+uint8_t decimate_bits(uint32_t factor)
+// About half a bit per doubling, i.e. 13 bits for a factor of 4 or 8, 14 bits for 16 or 32, and 15 bits for 64.
+{
+    uint8_t log2_factor = 0;
+
+    while ((1u << (log2_factor + 1)) <= factor)
+    {
+        log2_factor = log2_factor + 1;
+    }
+
+    return DECIMATE_IN_BITS + log2_factor/2;
+}
@@ -0,0 +1,58 @@
+#ifndef IAWARE_DECIMATE_H
+#define IAWARE_DECIMATE_H
+
+#include <stdint.h>
+
+// The decimation stage between the ADC and the buff nodes. The ADC is oversampled at sampling_data_fs, and every channel is
+// decimated by factor before it is stored: a 3-stage CIC decimates by factor/2, and a FIR decimates by another 2 while it
+// compensates the droop of the CIC. The averaging adds about half a bit per doubling of factor, so the output keeps
+// decimate_bits(factor) significant bits, as unsigned 16-bit samples. The factor DECIMATE_OFF stores the raw samples.
+//
+// Everything is integer arithmetic, so decimate_reference() in iaware_host.py reproduces the output bit-exactly, see
+// test_host_decimate.py.
+//
+// Cost per input sample: 3 additions, plus 3 subtractions every factor/2 samples and a DECIMATE_FIR_TAPS MAC every factor
+// samples. The FIR multiplies 16-bit samples by 16-bit coefficients into a 32-bit accumulator, which the Xtensa MUL16S/MAC16
+// instructions do in one cycle, and its history is stored twice so the dot product never wraps around.
+#define DECIMATE_OFF            1
+#define DECIMATE_FACTOR_MAX     64
+#define DECIMATE_CIC_STAGES     3
+#define DECIMATE_FIR_TAPS       21
+#define DECIMATE_FIR_Q          15      // The FIR coefficients are Q15.
+#define DECIMATE_CIC_FRAC_BITS  3       // The CIC output is a signed 15-bit value with 3 fractional bits.
+#define DECIMATE_IN_BITS        12      // GPIO_ADC_BITS
+#define DECIMATE_MAX_CHANNELS   8       // GPIO_ADC_MAX_CHANNELS
+
+#define DECIMATE_OK             0
+#define DECIMATE_ERR_FACTOR     -1      // The factor is not a power of 2 from 4 to DECIMATE_FACTOR_MAX.
+
+struct decimate_channel
+{
+    uint32_t integ[DECIMATE_CIC_STAGES];    // The CIC integrators wrap around on purpose, the combs undo it.
+    uint32_t comb[DECIMATE_CIC_STAGES];     // The previous input of each comb.
+
+    int16_t fir_hist[2*DECIMATE_FIR_TAPS];
+    uint8_t i_fir_hist;
+
+    uint8_t i_cic;                          // Counts the input samples up to factor/2.
+    uint8_t i_fir;                          // Counts the CIC outputs up to 2.
+};
+
+struct decimate
+{
+    uint32_t factor;
+    uint8_t cic_log2;                       // log2(factor/2)
+    uint8_t bits;                           // The significant bits of the output.
+    uint8_t n_channels;
+
+    struct decimate_channel channels[DECIMATE_MAX_CHANNELS];
+};
+
+extern const int16_t decimate_fir_coefs[DECIMATE_FIR_TAPS];
+
+int decimate_init(struct decimate *dec, uint32_t factor, uint8_t n_channels);
+int decimate_push(struct decimate *dec, uint8_t i_channel, uint16_t in, uint16_t *out);
+int decimate_factor_is_valid(uint32_t factor);
+uint8_t decimate_bits(uint32_t factor);
+
+#endif
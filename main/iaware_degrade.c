@@ -0,0 +1,149 @@
+#include <stdint.h>
+
+#include "iaware_degrade.h"
+
+void degrade_init(struct degrade *d, uint8_t max_level, uint32_t n_buff_nodes)
+// Params:
+//     n_buff_nodes : The length of the ring. A quarter of it waiting is congested.
+{
+    d->level = DEGRADE_LEVEL_FULL;
+    d->max_level = (max_level > DEGRADE_LEVEL_MAX) ? DEGRADE_LEVEL_MAX : max_level;
+    d->backlog_high = (n_buff_nodes/4 < 2) ? 2 : n_buff_nodes/4;
+    d->backlog_prev = 0;
+    d->send_us_avg = 0;
+    d->n_congested = 0;
+    d->n_idle = 0;
+}
+
+int degrade_update(struct degrade *d, uint32_t backlog, uint32_t send_us, uint32_t period_us)
+// Params:
+//     backlog      : The completed blocks that wait behind the one just sent.
+//     send_us      : [microsec]. The time that send() took for it.
+//     period_us    : [microsec]. The time that a block takes to fill.
+// Return 1 when the level changes.
+{
+    d->send_us_avg = (3*d->send_us_avg + send_us)/4;
+
+    if (d->level > d->max_level)
+    {
+        d->level = d->max_level;
+
+        return 1;
+    }
+
+    // A long backlog that already drains does not need a lower level.
+    uint8_t is_congested = ((backlog >= d->backlog_high) && (backlog >= d->backlog_prev)) || ((uint64_t) d->send_us_avg*100 > (uint64_t) period_us*DEGRADE_BUSY_HIGH);
+    uint8_t is_idle = (backlog == 0) && ((uint64_t) d->send_us_avg*100 < (uint64_t) period_us*DEGRADE_BUSY_LOW);
+
+    d->n_congested = is_congested ? (d->n_congested + 1) : 0;
+    d->n_idle = is_idle ? (d->n_idle + 1) : 0;
+    d->backlog_prev = backlog;
+
+    if ((d->n_congested >= DEGRADE_DOWN_BLOCKS) && (d->level < d->max_level))
+    {
+        d->level = d->level + 1;
+        d->n_congested = 0;
+        d->send_us_avg = 0; // The average restarts from the blocks of the new level.
+
+        return 1;
+    }
+
+    if ((d->n_idle >= DEGRADE_UP_BLOCKS) && (d->level > DEGRADE_LEVEL_FULL))
+    {
+        d->level = d->level - 1;
+        d->n_idle = 0;
+        d->send_us_avg = 0; // The average restarts from the blocks of the new level.
+
+        return 1;
+    }
+
+    return 0;
+}
+
+uint32_t degrade_average(const uint8_t *src, uint8_t *dst, uint32_t n_scans, uint8_t n_channels, uint8_t is_planar, uint32_t factor)
+// Average every factor scans of big-endian unsigned 16-bit samples into dst, in the same layout. The last scans are
+// averaged on their own when factor does not divide n_scans. Return the number of scans in dst.
+{
+    uint32_t n_out = (n_scans + factor - 1)/factor;
+
+    for (uint8_t i_channel = 0; i_channel < n_channels; i_channel++)
+    {
+        uint32_t stride = is_planar ? 2 : 2*n_channels; // [bytes]
+        const uint8_t *p = is_planar ? (src + 2*i_channel*n_scans) : (src + 2*i_channel);
+        uint8_t *q = is_planar ? (dst + 2*i_channel*n_out) : (dst + 2*i_channel);
+
+        for (uint32_t i = 0; i < n_out; i++)
+        {
+            uint32_t n = ((n_scans - i*factor) < factor) ? (n_scans - i*factor) : factor;
+            uint32_t sum = 0;
+
+            for (uint32_t j = 0; j < n; j++)
+            {
+                sum = sum + (((uint32_t) p[0] << 8) | p[1]);
+                p = p + stride;
+            }
+
+            uint32_t v = (sum + n/2)/n;
+
+            q[0] = (uint8_t) (v >> 8);
+            q[1] = (uint8_t) (v & 0xFF);
+
+            q = q + stride;
+        }
+    }
+
+    return n_out;
+}
+
+uint32_t degrade_to_u8(const uint8_t *src, uint8_t *dst, uint32_t n_values, uint8_t bits)
+// Keep the 8 high bits of bits-bit samples. dst may be src. Return the number of bytes in dst.
+{
+    const uint8_t shift = (bits > 8) ? (bits - 8) : 0;
+
+    for (uint32_t i = 0; i < n_values; i++)
+    {
+        dst[i] = (uint8_t) (((((uint32_t) src[2*i]) << 8) | src[2*i + 1]) >> shift);
+    }
+
+    return n_values;
+}
+
+uint32_t degrade_delta8(const uint8_t *src, uint8_t *dst, uint32_t n_scans, uint8_t n_channels, uint8_t is_planar, uint32_t max_len)
+// Encode the samples in their order in src. A sample is its difference to the previous sample of its channel (0 before
+// the first one) as one int8, or DEGRADE_DELTA_ESCAPE followed by the sample. Return the number of bytes in dst, or 0
+// when they would exceed max_len.
+{
+    uint16_t prev[DEGRADE_MAX_CHANNELS] = {0};
+    uint32_t n_values = n_scans*n_channels;
+    uint32_t len = 0;
+
+    for (uint32_t i = 0; i < n_values; i++)
+    {
+        uint8_t i_channel = (uint8_t) (is_planar ? (i/n_scans) : (i % n_channels));
+        uint16_t v = (uint16_t) ((((uint32_t) src[2*i]) << 8) | src[2*i + 1]);
+        int32_t delta = (int32_t) v - (int32_t) prev[i_channel];
+
+        if ((delta >= -127) && (delta <= 127))
+        {
+            if (len + 1 > max_len)
+                return 0;
+
+            dst[len] = (uint8_t) (int8_t) delta;
+            len = len + 1;
+        }
+        else
+        {
+            if (len + 3 > max_len)
+                return 0;
+
+            dst[len]        = DEGRADE_DELTA_ESCAPE;
+            dst[len + 1]    = (uint8_t) (v >> 8);
+            dst[len + 2]    = (uint8_t) (v & 0xFF);
+            len = len + 3;
+        }
+
+        prev[i_channel] = v;
+    }
+
+    return len;
+}
@@ -0,0 +1,51 @@
+#ifndef IAWARE_DEGRADE_H
+#define IAWARE_DEGRADE_H
+
+#include <stdint.h>
+
+// The adaptive degradation of the live stream when the link cannot keep up. com_tcp_send_task() calls degrade_update()
+// after every block with the backlog, i.e. the completed blocks that wait behind it, and the time that send() took.
+// The level steps down one at a time while the link is congested and back up once it has been idle for a while:
+//
+//     DEGRADE_LEVEL_FULL       The blocks as they are stored.
+//     DEGRADE_LEVEL_COMPRESS   Lossless, every sample as the 8-bit difference to the previous one of its channel.
+//     DEGRADE_LEVEL_DECIMATE   Every 2 scans are averaged, then compressed like DEGRADE_LEVEL_COMPRESS.
+//     DEGRADE_LEVEL_PREVIEW    Every 2 scans are averaged, and only the 8 high bits of a sample are kept.
+//
+// The compression depends on the signal, so DEGRADE_LEVEL_PREVIEW is the one that bounds the stream to a quarter.
+// Only the sent copy is degraded. The buff nodes, the filters, the band powers and the flash keep the full blocks.
+// test_host_degrade.py runs the controller against a link with a bandwidth cap.
+#define DEGRADE_LEVEL_FULL      0
+#define DEGRADE_LEVEL_COMPRESS  1
+#define DEGRADE_LEVEL_DECIMATE  2
+#define DEGRADE_LEVEL_PREVIEW   3
+#define DEGRADE_LEVEL_MAX       DEGRADE_LEVEL_PREVIEW
+
+#define DEGRADE_BUSY_HIGH       80      // [%]. send() takes more of the block period than this on average: congested.
+#define DEGRADE_BUSY_LOW        30      // [%]. Less than this with no backlog: idle. One level up about doubles it.
+#define DEGRADE_DOWN_BLOCKS     4       // The congested blocks in a row before stepping down.
+#define DEGRADE_UP_BLOCKS       60      // The idle blocks in a row before stepping up.
+#define DEGRADE_AVERAGE         2       // The scans averaged by DEGRADE_LEVEL_DECIMATE and DEGRADE_LEVEL_PREVIEW.
+
+#define DEGRADE_MAX_CHANNELS    8       // GPIO_ADC_MAX_CHANNELS
+#define DEGRADE_DELTA_ESCAPE    0x80    // Followed by the sample itself, big-endian, when the difference does not fit in int8.
+
+struct degrade
+{
+    uint8_t level;
+    uint8_t max_level;              // DEGRADE_LEVEL_FULL turns the adaptation off.
+    uint32_t backlog_high;          // [blocks]. A backlog from here on is congested.
+    uint32_t backlog_prev;
+    uint32_t send_us_avg;           // [microsec]. The moving average of the send() time of a block.
+    uint32_t n_congested;
+    uint32_t n_idle;
+};
+
+void degrade_init(struct degrade *d, uint8_t max_level, uint32_t n_buff_nodes);
+int degrade_update(struct degrade *d, uint32_t backlog, uint32_t send_us, uint32_t period_us);
+
+uint32_t degrade_average(const uint8_t *src, uint8_t *dst, uint32_t n_scans, uint8_t n_channels, uint8_t is_planar, uint32_t factor);
+uint32_t degrade_to_u8(const uint8_t *src, uint8_t *dst, uint32_t n_values, uint8_t bits);
+uint32_t degrade_delta8(const uint8_t *src, uint8_t *dst, uint32_t n_scans, uint8_t n_channels, uint8_t is_planar, uint32_t max_len);
+
+#endif
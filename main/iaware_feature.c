@@ -0,0 +1,316 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "iaware_feature.h"
+#include "iaware_packet.h"
+
+static void feature_push(struct feature *f, const int32_t *acc);
+static void feature_end_segment(struct feature *f);
+static void feature_publish(struct feature *f, uint64_t t_end);
+static int16_t feature_band_power(struct feature *f, const float *x_re, const float *x_im, uint8_t i_band);
+
+static const uint8_t feature_band_hz[FEATURE_N_BANDS + 1] = {1, 4, 8, 13, 30, 45};
+
+int feature_period_is_valid(uint32_t period_ms)
+{
+    if ((period_ms == 0) || ((FEATURE_WINDOW_MS % period_ms) != 0))
+        return 0;
+
+    return (FEATURE_WINDOW_MS/period_ms) <= FEATURE_MAX_SEGMENTS;
+}
+
+int feature_init(struct feature *f, uint32_t period_ms, uint32_t rate, uint8_t n_channels, uint8_t channel_mask)
+// Params:
+//     period_ms    : FEATURE_PERIOD_OFF or a divisor of FEATURE_WINDOW_MS of at least FEATURE_WINDOW_MS/FEATURE_MAX_SEGMENTS.
+//     rate         : [Hz]. The nominal rate of the scans in the blocks.
+// The windows restart from empty. The last published powers stay until the next window is full.
+{
+    uint32_t publish_seq = f->publish_seq;
+
+    memset(f, 0, sizeof(struct feature));
+
+    f->publish_seq = publish_seq;
+
+    if (period_ms == FEATURE_PERIOD_OFF)
+        return FEATURE_OK;
+
+    f->n_avg = (rate > FEATURE_RATE) ? (rate/FEATURE_RATE) : 1;
+
+    if ((feature_period_is_valid(period_ms) == 0) || ((rate/f->n_avg) < 2*FEATURE_N_BINS))
+        return FEATURE_ERR_ARG;
+
+    f->period_ms = period_ms;
+    f->n_segments = (uint8_t) (FEATURE_WINDOW_MS/period_ms);
+    f->seg_len = (rate*period_ms + f->n_avg*500)/(f->n_avg*1000); // Rounded, the bin spacing is then about 1 Hz.
+    f->n_channels = (n_channels > FEATURE_MAX_CHANNELS) ? FEATURE_MAX_CHANNELS : n_channels;
+    f->channel_mask = channel_mask;
+
+    uint32_t n = f->seg_len*f->n_segments; // The window, in inputs.
+
+    for (uint8_t k = 0; k < FEATURE_N_BINS; k++)
+    {
+        float w = 2.0f*(float) M_PI*k/n;
+
+        f->cos_w[k] = cosf(w);
+        f->sin_w[k] = sinf(w);
+        f->coef[k]  = 2.0f*f->cos_w[k];
+        f->end_re[k] = cosf(w*(f->seg_len - 1));
+        f->end_im[k] = -sinf(w*(f->seg_len - 1));
+    }
+
+    for (uint8_t q = 0; q < f->n_segments; q++)
+    {
+        f->rot_re[q] = cosf(2.0f*(float) M_PI*q/f->n_segments);
+        f->rot_im[q] = -sinf(2.0f*(float) M_PI*q/f->n_segments);
+    }
+
+    // The first bin at or above each edge. The Hann window needs one more bin above the highest band.
+    for (uint8_t i_band = 0; i_band < FEATURE_N_BANDS; i_band++)
+    {
+        uint32_t lo = (uint32_t) (((uint64_t) feature_band_hz[i_band]*n*f->n_avg + rate - 1)/rate);
+        uint32_t hi = (uint32_t) (((uint64_t) feature_band_hz[i_band + 1]*n*f->n_avg + rate - 1)/rate);
+
+        f->band_lo[i_band] = (uint8_t) ((lo < 1) ? 1 : ((lo > FEATURE_N_BINS - 1) ? FEATURE_N_BINS - 1 : lo));
+        f->band_hi[i_band] = (uint8_t) ((hi > FEATURE_N_BINS - 1) ? FEATURE_N_BINS - 1 : hi);
+    }
+
+    return FEATURE_OK;
+}
+
+void feature_process_block(struct feature *f, const uint8_t *samples, uint32_t n_scans, uint8_t is_planar, uint8_t bits, uint64_t t_begin, uint32_t eff_rate)
+// Params:
+//     samples      : n_scans scans of f->n_channels big-endian unsigned 16-bit samples.
+//     is_planar    : The layout of the block, see STREAM_FLAG_PLANAR.
+//     bits         : The significant bits of a sample. The samples are made signed around the middle of the range.
+//     t_begin      : [microsec]. The time of the first scan, and eff_rate [Hz] the rate of the scans, for the time of a window.
+{
+    if (f->period_ms == FEATURE_PERIOD_OFF)
+        return;
+
+    int32_t acc[FEATURE_MAX_CHANNELS];
+
+    const int32_t offset = 1 << (bits - 1);
+
+    for (uint32_t i_scan = 0; i_scan < n_scans; i_scan++)
+    {
+        for (uint8_t i_channel = 0; i_channel < f->n_channels; i_channel++)
+        {
+            const uint8_t *p = is_planar ? (samples + 2*(i_channel*n_scans + i_scan)) : (samples + 2*(i_scan*f->n_channels + i_channel));
+
+            f->channels[i_channel].acc = f->channels[i_channel].acc + ((((int32_t) p[0]) << 8 | p[1]) - offset);
+        }
+
+        f->i_avg = f->i_avg + 1;
+
+        if (f->i_avg < f->n_avg)
+            continue;
+
+        for (uint8_t i_channel = 0; i_channel < f->n_channels; i_channel++)
+        {
+            acc[i_channel] = f->channels[i_channel].acc;
+            f->channels[i_channel].acc = 0;
+        }
+
+        f->i_avg = 0;
+
+        feature_push(f, acc);
+
+        if (f->i_seg_input < f->seg_len)
+            continue;
+
+        feature_end_segment(f);
+
+        if (f->n_segments_done == f->n_segments)
+            feature_publish(f, t_begin + ((eff_rate > 0) ? ((uint64_t) (i_scan + 1))*1000000/eff_rate : 0));
+
+        f->i_segment = (uint8_t) ((f->i_segment + 1) % f->n_segments);
+    }
+}
+
+uint32_t feature_pack(struct feature *f, uint8_t *dst, uint32_t max_len, uint32_t *publish_seq)
+// Write |PACKET_HEADER_FEATURE|...|powers| (see PACKET_HEADER_FEATURE_META_SIZE) to dst when powers were published since
+// *publish_seq, with as many channels as fit in max_len. Return its length, or 0 when there is nothing new.
+// Params:
+//     publish_seq  : The publish_seq of the last packet of the caller, 0 at first. It is updated.
+{
+    uint32_t seq;
+
+    do
+    {
+        seq = f->publish_seq;
+
+        if ((seq == 0) || (seq == *publish_seq) || (max_len < PACKET_HEADER_FEATURE_META_SIZE + 2*FEATURE_N_BANDS))
+            return 0;
+
+        if (seq & 1)
+            continue; // feature_publish() is writing.
+
+        uint8_t n_channels = f->n_channels;
+        uint8_t channel_mask = f->channel_mask;
+
+        if (n_channels > (max_len - PACKET_HEADER_FEATURE_META_SIZE)/(2*FEATURE_N_BANDS))
+        {
+            // Keep the channels of the lowest bits of channel_mask, i.e. the first ones of a scan.
+            n_channels = (uint8_t) ((max_len - PACKET_HEADER_FEATURE_META_SIZE)/(2*FEATURE_N_BANDS));
+
+            uint8_t n = 0;
+            for (uint8_t i = 0; i < 8; i++)
+            {
+                if ((channel_mask & (1 << i)) && (n++ >= n_channels))
+                    channel_mask = (uint8_t) (channel_mask & ~(1 << i));
+            }
+        }
+
+        dst[0] = PACKET_HEADER_FEATURE;
+        dst[1] = n_channels;
+        dst[2] = FEATURE_N_BANDS;
+        dst[3] = channel_mask;
+        dst[4] = (uint8_t) ((seq/2) >> 8);
+        dst[5] = (uint8_t) ((seq/2) & 0xFF);
+        dst[6] = (uint8_t) (f->t_end >> 24);
+        dst[7] = (uint8_t) ((f->t_end >> 16) & 0xFF);
+        dst[8] = (uint8_t) ((f->t_end >> 8) & 0xFF);
+        dst[9] = (uint8_t) (f->t_end & 0xFF);
+
+        uint8_t *p = dst + PACKET_HEADER_FEATURE_META_SIZE;
+
+        for (uint8_t i_channel = 0; i_channel < n_channels; i_channel++)
+        {
+            for (uint8_t i_band = 0; i_band < FEATURE_N_BANDS; i_band++)
+            {
+                uint16_t v = (uint16_t) f->power[i_channel][i_band];
+
+                p[0] = (uint8_t) (v >> 8);
+                p[1] = (uint8_t) (v & 0xFF);
+                p = p + 2;
+            }
+        }
+
+        if (f->publish_seq == seq)
+        {
+            *publish_seq = seq;
+
+            return PACKET_HEADER_FEATURE_META_SIZE + 2*FEATURE_N_BANDS*n_channels;
+        }
+    } while (1);
+}
+
+//////////////////// Private ////////////////////
+
+static void feature_push(struct feature *f, const int32_t *acc)
+// One Goertzel step of every bin of every channel.
+{
+    const float scale = 1.0f/f->n_avg;
+
+    for (uint8_t i_channel = 0; i_channel < f->n_channels; i_channel++)
+    {
+        struct feature_channel *channel = &(f->channels[i_channel]);
+
+        const float x = acc[i_channel]*scale;
+
+        for (uint8_t k = 0; k < FEATURE_N_BINS; k++)
+        {
+            float s0 = x + f->coef[k]*channel->s1[k] - channel->s2[k];
+
+            channel->s2[k] = channel->s1[k];
+            channel->s1[k] = s0;
+        }
+    }
+
+    f->i_seg_input = f->i_seg_input + 1;
+}
+
+static void feature_end_segment(struct feature *f)
+// Keep the DFT of the segment in its slot, exp(-j*w*(L - 1))*(s1 - exp(-j*w)*s2), and restart the Goertzel filters.
+{
+    for (uint8_t i_channel = 0; i_channel < f->n_channels; i_channel++)
+    {
+        struct feature_channel *channel = &(f->channels[i_channel]);
+
+        for (uint8_t k = 0; k < FEATURE_N_BINS; k++)
+        {
+            float y_re = channel->s1[k] - f->cos_w[k]*channel->s2[k];
+            float y_im = f->sin_w[k]*channel->s2[k];
+
+            channel->seg_re[f->i_segment][k] = f->end_re[k]*y_re - f->end_im[k]*y_im;
+            channel->seg_im[f->i_segment][k] = f->end_re[k]*y_im + f->end_im[k]*y_re;
+        }
+
+        memset(channel->s1, 0, sizeof(channel->s1));
+        memset(channel->s2, 0, sizeof(channel->s2));
+    }
+
+    f->i_seg_input = 0;
+
+    if (f->n_segments_done < f->n_segments)
+        f->n_segments_done = f->n_segments_done + 1;
+}
+
+static void feature_publish(struct feature *f, uint64_t t_end)
+// Sum the segments of the window, the current one being the newest, and update the published powers.
+{
+    float x_re[FEATURE_N_BINS];
+    float x_im[FEATURE_N_BINS];
+
+    f->publish_seq = f->publish_seq + 1;
+
+    for (uint8_t i_channel = 0; i_channel < f->n_channels; i_channel++)
+    {
+        struct feature_channel *channel = &(f->channels[i_channel]);
+
+        for (uint8_t k = 0; k < FEATURE_N_BINS; k++)
+        {
+            x_re[k] = 0.0f;
+            x_im[k] = 0.0f;
+
+            for (uint8_t m = 0; m < f->n_segments; m++)
+            {
+                uint8_t slot = (uint8_t) ((f->i_segment + 1 + m) % f->n_segments);
+                uint8_t q = (uint8_t) ((k*m) % f->n_segments);
+
+                x_re[k] = x_re[k] + f->rot_re[q]*channel->seg_re[slot][k] - f->rot_im[q]*channel->seg_im[slot][k];
+                x_im[k] = x_im[k] + f->rot_re[q]*channel->seg_im[slot][k] + f->rot_im[q]*channel->seg_re[slot][k];
+            }
+        }
+
+        for (uint8_t i_band = 0; i_band < FEATURE_N_BANDS; i_band++)
+        {
+            f->power[i_channel][i_band] = feature_band_power(f, x_re, x_im, i_band);
+        }
+    }
+
+    f->t_end = (uint32_t) (t_end/1000);
+
+    f->publish_seq = f->publish_seq + 1;
+}
+
+static int16_t feature_band_power(struct feature *f, const float *x_re, const float *x_im, uint8_t i_band)
+// The one-sided power of the Hann-windowed bins of the band. A sine of amplitude A in the band gives A^2/2.
+{
+    float sum = 0.0f;
+
+    for (uint8_t k = f->band_lo[i_band]; k < f->band_hi[i_band]; k++)
+    {
+        float h_re = 0.5f*x_re[k] - 0.25f*(x_re[k - 1] + x_re[k + 1]);
+        float h_im = 0.5f*x_im[k] - 0.25f*(x_im[k - 1] + x_im[k + 1]);
+
+        sum = sum + h_re*h_re + h_im*h_im;
+    }
+
+    float n = (float) (f->seg_len*f->n_segments);
+    float p = sum*16.0f/(3.0f*n*n);
+
+    if (p <= 0.0f)
+        return FEATURE_POWER_NONE;
+
+    float cdb = 1000.0f*log10f(p);
+
+    if (cdb < (float) (INT16_MIN + 1))
+        return INT16_MIN + 1;
+
+    if (cdb > (float) INT16_MAX)
+        return INT16_MAX;
+
+    return (int16_t) lrintf(cdb);
+}
@@ -0,0 +1,79 @@
+#ifndef IAWARE_FEATURE_H
+#define IAWARE_FEATURE_H
+
+#include <stdint.h>
+
+// The EEG band powers of every channel, computed on device from the completed blocks, for a client that does not need
+// the raw samples, e.g. over BLE. Every period_ms, the powers of the last FEATURE_WINDOW_MS of samples are published as a
+// PACKET_HEADER_FEATURE packet, i.e. the Hann windows overlap when period_ms is shorter than the window.
+//
+// The samples are first averaged down to about FEATURE_RATE, because the bands end at 45 Hz. A window of N samples is
+// cut into FEATURE_WINDOW_MS/period_ms segments, and a Goertzel filter per DFT bin runs over each segment. The DFT of the
+// window is the sum of the DFTs of its segments, each rotated by its position, so a new window costs one segment of
+// samples instead of N. The Hann window is applied in the frequency domain, 0.5X(k) - 0.25X(k-1) - 0.25X(k+1).
+//
+// Cost per scan: FEATURE_N_BINS multiply-adds per channel at FEATURE_RATE, plus an addition per channel at the block rate.
+// A power is 1000*log10(P) (centi-dB) where P is in LSB^2 of the stored samples, i.e. after the decimation and the
+// filters.
+#define FEATURE_WINDOW_MS       1000    // [ms]. The bin spacing is about 1 Hz.
+#define FEATURE_RATE            250     // [Hz]. The rate that the samples are averaged down to.
+#define FEATURE_N_BINS          47      // 0 to 46 Hz, the highest band plus one bin on each side for the Hann window.
+#define FEATURE_MAX_SEGMENTS    4       // The shortest period_ms is FEATURE_WINDOW_MS/FEATURE_MAX_SEGMENTS.
+#define FEATURE_MAX_CHANNELS    8       // GPIO_ADC_MAX_CHANNELS
+#define FEATURE_PERIOD_OFF      0
+
+#define FEATURE_N_BANDS         5       // delta 1-4, theta 4-8, alpha 8-13, beta 13-30 and gamma 30-45 Hz.
+#define FEATURE_POWER_NONE      INT16_MIN   // The power of a band without any bin or of a silent channel.
+
+#define FEATURE_OK              0
+#define FEATURE_ERR_ARG         -1      // period_ms does not divide FEATURE_WINDOW_MS into at most FEATURE_MAX_SEGMENTS, or the rate is too low.
+
+struct feature_channel
+{
+    float s1[FEATURE_N_BINS];       // The Goertzel states of the current segment.
+    float s2[FEATURE_N_BINS];
+
+    float seg_re[FEATURE_MAX_SEGMENTS][FEATURE_N_BINS];     // The DFT of the last segments, in the ring of struct feature.
+    float seg_im[FEATURE_MAX_SEGMENTS][FEATURE_N_BINS];
+
+    int32_t acc;                    // The sum of the samples that are averaged into the next input.
+};
+
+struct feature
+{
+    uint32_t period_ms;             // FEATURE_PERIOD_OFF or a divisor of FEATURE_WINDOW_MS.
+    uint32_t n_avg;                 // The samples averaged into one input.
+    uint32_t seg_len;               // [inputs]
+    uint8_t n_segments;
+    uint8_t n_channels;
+    uint8_t channel_mask;
+
+    float coef[FEATURE_N_BINS];     // 2*cos(w)
+    float cos_w[FEATURE_N_BINS];
+    float sin_w[FEATURE_N_BINS];
+    float end_re[FEATURE_N_BINS];   // exp(-j*w*(seg_len - 1)), which aligns a segment to its first input.
+    float end_im[FEATURE_N_BINS];
+    float rot_re[FEATURE_MAX_SEGMENTS]; // exp(-j*2*pi*q/n_segments), which aligns a segment to the start of the window.
+    float rot_im[FEATURE_MAX_SEGMENTS];
+    uint8_t band_lo[FEATURE_N_BANDS];   // The bins of a band are from band_lo to band_hi - 1.
+    uint8_t band_hi[FEATURE_N_BANDS];
+
+    uint32_t i_avg;
+    uint32_t i_seg_input;
+    uint8_t i_segment;              // The slot of the current segment.
+    uint8_t n_segments_done;        // Up to n_segments. The first window is published once it is full.
+
+    struct feature_channel channels[FEATURE_MAX_CHANNELS];
+
+    // The last published powers. feature_process_block() is the only writer, feature_pack() may run on another task.
+    volatile uint32_t publish_seq;  // Odd while the powers are being written, 0 before the first window.
+    uint32_t t_end;                 // [ms]. The time of the last sample of the window.
+    int16_t power[FEATURE_MAX_CHANNELS][FEATURE_N_BANDS];
+};
+
+int feature_init(struct feature *f, uint32_t period_ms, uint32_t rate, uint8_t n_channels, uint8_t channel_mask);
+void feature_process_block(struct feature *f, const uint8_t *samples, uint32_t n_scans, uint8_t is_planar, uint8_t bits, uint64_t t_begin, uint32_t eff_rate);
+uint32_t feature_pack(struct feature *f, uint8_t *dst, uint32_t max_len, uint32_t *publish_seq);
+int feature_period_is_valid(uint32_t period_ms);
+
+#endif
@@ -0,0 +1,151 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "iaware_filter.h"
+
+static int16_t saturate16(int64_t v);
+
+void filter_init(struct filter_bank *bank, uint8_t n_channels)
+// Every channel starts without sections.
+{
+    memset(bank, 0, sizeof(struct filter_bank));
+
+    bank->n_channels = (n_channels > FILTER_MAX_CHANNELS) ? FILTER_MAX_CHANNELS : n_channels;
+}
+
+int filter_set(struct filter_bank *bank, uint8_t i_channel, uint8_t n_sections, const struct filter_section *sections)
+// Params:
+//     i_channel    : The position in the scan order, or FILTER_ALL_CHANNELS.
+//     n_sections   : 0 to FILTER_MAX_SECTIONS. The state of the channel restarts from 0.
+{
+    if ((n_sections > FILTER_MAX_SECTIONS) || ((i_channel != FILTER_ALL_CHANNELS) && (i_channel >= bank->n_channels)))
+        return FILTER_ERR_ARG;
+
+    for (uint8_t i = 0; i < bank->n_channels; i++)
+    {
+        if ((i_channel != FILTER_ALL_CHANNELS) && (i_channel != i))
+            continue;
+
+        struct filter_channel *channel = &(bank->channels[i]);
+
+        channel->n_sections = n_sections;
+
+        memcpy(channel->sections, sections, n_sections*sizeof(struct filter_section));
+        memset(channel->states, 0, sizeof(channel->states));
+    }
+
+    return FILTER_OK;
+}
+
+int filter_is_active(struct filter_bank *bank)
+{
+    for (uint8_t i = 0; i < bank->n_channels; i++)
+    {
+        if (bank->channels[i].n_sections > 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+void filter_run(struct filter_channel *channel, int16_t *x, uint32_t n)
+// Filter n signed samples of one channel in place, one section after the other.
+{
+    for (uint8_t i_section = 0; i_section < channel->n_sections; i_section++)
+    {
+        const int32_t b0 = channel->sections[i_section].b0;
+        const int32_t b1 = channel->sections[i_section].b1;
+        const int32_t b2 = channel->sections[i_section].b2;
+        const int32_t a1 = channel->sections[i_section].a1;
+        const int32_t a2 = channel->sections[i_section].a2;
+
+        int32_t x1 = channel->states[i_section].x1;
+        int32_t x2 = channel->states[i_section].x2;
+        int32_t y1 = channel->states[i_section].y1;
+        int32_t y2 = channel->states[i_section].y2;
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            int32_t x0 = x[i];
+
+            int64_t acc = (int64_t) (b0*x0) + (int64_t) (b1*x1) + (int64_t) (b2*x2) - (int64_t) (a1*y1) - (int64_t) (a2*y2);
+
+            int32_t y0 = saturate16((acc + (1 << (FILTER_Q - 1))) >> FILTER_Q);
+
+            x2 = x1;
+            x1 = x0;
+            y2 = y1;
+            y1 = y0;
+
+            x[i] = (int16_t) y0;
+        }
+
+        channel->states[i_section].x1 = (int16_t) x1;
+        channel->states[i_section].x2 = (int16_t) x2;
+        channel->states[i_section].y1 = (int16_t) y1;
+        channel->states[i_section].y2 = (int16_t) y2;
+    }
+}
+
+void filter_process_block(struct filter_bank *bank, uint8_t *samples, uint32_t n_scans, uint8_t is_planar, uint8_t bits)
+// Params:
+//     samples      : n_scans scans of bank->n_channels big-endian unsigned 16-bit samples, filtered in place.
+//     is_planar    : The layout of the block, see STREAM_FLAG_PLANAR.
+//     bits         : The significant bits of a sample. The output is clamped to the same range.
+{
+    int16_t chunk[FILTER_CHUNK];
+
+    const int32_t offset = 1 << (bits - 1);
+    const int32_t max = (1 << bits) - 1;
+
+    for (uint8_t i_channel = 0; i_channel < bank->n_channels; i_channel++)
+    {
+        struct filter_channel *channel = &(bank->channels[i_channel]);
+
+        if (channel->n_sections == 0)
+            continue;
+
+        uint32_t stride = is_planar ? 2 : 2*bank->n_channels; // [bytes]
+        uint8_t *base = is_planar ? (samples + 2*i_channel*n_scans) : (samples + 2*i_channel);
+
+        for (uint32_t i_scan = 0; i_scan < n_scans; i_scan = i_scan + FILTER_CHUNK)
+        {
+            uint32_t n = ((n_scans - i_scan) < FILTER_CHUNK) ? (n_scans - i_scan) : FILTER_CHUNK;
+            uint8_t *p = base + i_scan*stride;
+
+            for (uint32_t i = 0; i < n; i++)
+            {
+                chunk[i] = (int16_t) ((((int32_t) p[i*stride]) << 8 | p[i*stride + 1]) - offset);
+            }
+
+            filter_run(channel, chunk, n);
+
+            for (uint32_t i = 0; i < n; i++)
+            {
+                int32_t y = chunk[i] + offset;
+
+                if (y < 0)
+                    y = 0;
+
+                if (y > max)
+                    y = max;
+
+                p[i*stride]     = (uint8_t) (y >> 8);
+                p[i*stride + 1] = (uint8_t) (y & 0xFF);
+            }
+        }
+    }
+}
+
+//////////////////// Private ////////////////////
+
+static int16_t saturate16(int64_t v)
+{
+    if (v > INT16_MAX)
+        return INT16_MAX;
+
+    if (v < INT16_MIN)
+        return INT16_MIN;
+
+    return (int16_t) v;
+}
@@ -0,0 +1,63 @@
+#ifndef IAWARE_FILTER_H
+#define IAWARE_FILTER_H
+
+#include <stdint.h>
+
+// A cascade of biquads per channel, e.g. a 50/60 Hz notch followed by a band-pass, applied to every completed block
+// before it is sent or spilled. It runs after the decimation, on the samples as they are stored.
+//
+// A section is y = b0*x + b1*x1 + b2*x2 - a1*y1 - a2*y2 (direct form I) with Q14 coefficients, i.e. from -2 to 2.
+// The samples are made signed around the middle of the range, the 16x16-bit products are summed in 64 bits like the
+// 40-bit accumulator of the Xtensa MAC16, and every section output is rounded and saturated to 16 bits.
+// filter_reference() in iaware_host.py reproduces the output bit-exactly, see test_host_filter.py.
+//
+// A block is processed one channel and FILTER_CHUNK samples at a time, and one section at a time over the chunk, so the
+// coefficients and the state of a section stay in registers through the inner loop.
+#define FILTER_MAX_SECTIONS     4
+#define FILTER_Q                14
+#define FILTER_CHUNK            64      // [samples]. The scratch on the stack of the caller of filter_process_block().
+#define FILTER_MAX_CHANNELS     8       // GPIO_ADC_MAX_CHANNELS
+#define FILTER_ALL_CHANNELS     0xFF
+
+#define FILTER_OK               0
+#define FILTER_ERR_ARG          -1
+
+struct filter_section
+{
+    int16_t b0;
+    int16_t b1;
+    int16_t b2;
+    int16_t a1;
+    int16_t a2;
+};
+
+struct filter_state
+{
+    int16_t x1;
+    int16_t x2;
+    int16_t y1;
+    int16_t y2;
+};
+
+struct filter_channel
+{
+    uint8_t n_sections;     // 0 leaves the channel as it is.
+
+    struct filter_section sections[FILTER_MAX_SECTIONS];
+    struct filter_state states[FILTER_MAX_SECTIONS];
+};
+
+struct filter_bank
+{
+    uint8_t n_channels;
+
+    struct filter_channel channels[FILTER_MAX_CHANNELS];
+};
+
+void filter_init(struct filter_bank *bank, uint8_t n_channels);
+int filter_set(struct filter_bank *bank, uint8_t i_channel, uint8_t n_sections, const struct filter_section *sections);
+int filter_is_active(struct filter_bank *bank);
+void filter_run(struct filter_channel *channel, int16_t *x, uint32_t n);
+void filter_process_block(struct filter_bank *bank, uint8_t *samples, uint32_t n_scans, uint8_t is_planar, uint8_t bits);
+
+#endif
@@ -0,0 +1,55 @@
+#include <stdint.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+
+#include "iaware_flash.h"
+#include "main.h"
+
+static int partition_read(void *ctx, uint32_t addr, void *buff, uint32_t len);
+static int partition_write(void *ctx, uint32_t addr, const void *buff, uint32_t len);
+static int partition_erase_sector(void *ctx, uint32_t sector);
+
+int flash_dev_init_partition(struct flash_dev *dev, const char *label)
+// Bind dev to the data partition label. Return 0 when success.
+{
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+
+    if (partition == NULL)
+    {
+        ESP_LOGE(IAWARE_CORE, "Flash: partition %s is not found. Check partitions.csv.", label);
+
+        return -1;
+    }
+
+    dev->ctx            = (void *) partition;
+    dev->sector_size    = SPI_FLASH_SEC_SIZE;
+    dev->n_sectors      = partition->size/SPI_FLASH_SEC_SIZE;
+    dev->read           = partition_read;
+    dev->write          = partition_write;
+    dev->erase_sector   = partition_erase_sector;
+
+    ESP_LOGI(IAWARE_CORE, "Flash: partition %s at 0x%x has %d sectors.", label, partition->address, dev->n_sectors);
+
+    return 0;
+}
+
+//////////////////// Private ////////////////////
+
+static int partition_read(void *ctx, uint32_t addr, void *buff, uint32_t len)
+{
+    return (esp_partition_read((const esp_partition_t *) ctx, addr, buff, len) == ESP_OK) ? 0 : -1;
+}
+
+static int partition_write(void *ctx, uint32_t addr, const void *buff, uint32_t len)
+{
+    return (esp_partition_write((const esp_partition_t *) ctx, addr, buff, len) == ESP_OK) ? 0 : -1;
+}
+
+static int partition_erase_sector(void *ctx, uint32_t sector)
+// Erasing disables the flash cache of both cores for tens of ms. Choose idf.py menuconfig->Component config->SPI Flash driver->
+// Enables yield operation during flash erase, so the sampling timer keeps running between erase chunks.
+{
+    return (esp_partition_erase_range((const esp_partition_t *) ctx, sector*SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE) == ESP_OK) ? 0 : -1;
+}
@@ -0,0 +1,28 @@
+#ifndef IAWARE_FLASH_H
+#define IAWARE_FLASH_H
+
+#include <stdint.h>
+
+// A NOR flash device as seen by iaware_flash_ring.c. The ring does not know whether it runs on the ESP32 partition
+// (iaware_flash.c) or on the file-backed emulator used on Linux (iaware_flash_file.c).
+// NOR semantics: an erased sector reads 0xFF and a write can only clear bits.
+// Every function returns 0 when success.
+struct flash_dev
+{
+    void *ctx;
+
+    uint32_t sector_size;   // [bytes]
+    uint32_t n_sectors;
+
+    int (*read)(void *ctx, uint32_t addr, void *buff, uint32_t len);
+    int (*write)(void *ctx, uint32_t addr, const void *buff, uint32_t len);
+    int (*erase_sector)(void *ctx, uint32_t sector);
+};
+
+#define FLASH_LOG_PARTITION_LABEL   "iaware_log"    // See partitions.csv.
+
+int flash_dev_init_partition(struct flash_dev *dev, const char *label);
+int flash_dev_init_file(struct flash_dev *dev, const char *path, uint32_t sector_size, uint32_t n_sectors);
+void flash_dev_close_file(struct flash_dev *dev);
+
+#endif
@@ -0,0 +1,151 @@
+// File-backed NOR flash emulator for running iaware_flash_ring.c on Linux. It is not in COMPONENT_SRCS, so the ESP32 firmware does not use it.
+// Build it together with the ring, e.g. gcc -I. iaware_flash_ring.c iaware_flash_file.c my_program.c
+// The emulator keeps the NOR rules, i.e. erase sets 0xFF and write ANDs the new bytes into the old ones, so torn and
+// repeated writes behave as on the real chip. It also counts the erases per sector to check the wear of the rotation.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iaware_flash.h"
+
+struct flash_file
+{
+    FILE *fp;
+
+    uint32_t size;
+    uint32_t sector_size;
+
+    uint32_t *erase_counts;
+};
+
+static int file_read(void *ctx, uint32_t addr, void *buff, uint32_t len);
+static int file_write(void *ctx, uint32_t addr, const void *buff, uint32_t len);
+static int file_erase_sector(void *ctx, uint32_t sector);
+
+int flash_dev_init_file(struct flash_dev *dev, const char *path, uint32_t sector_size, uint32_t n_sectors)
+// Open (or create, fully erased) the image at path. Return 0 when success.
+{
+    struct flash_file *f = (struct flash_file *) calloc(1, sizeof(struct flash_file));
+    if (f == NULL)
+        return -1;
+
+    f->size         = sector_size*n_sectors;
+    f->sector_size  = sector_size;
+
+    if ((f->erase_counts = (uint32_t *) calloc(n_sectors, sizeof(uint32_t))) == NULL)
+    {
+        free(f);
+        return -1;
+    }
+
+    if ((f->fp = fopen(path, "r+b")) == NULL)
+    {
+        if ((f->fp = fopen(path, "w+b")) == NULL)
+        {
+            free(f->erase_counts);
+            free(f);
+            return -1;
+        }
+
+        uint8_t ff[256];
+        memset(ff, 0xFF, sizeof(ff));
+
+        for (uint32_t i = 0; i < f->size; i += sizeof(ff))
+            fwrite(ff, 1, sizeof(ff), f->fp);
+    }
+
+    dev->ctx            = f;
+    dev->sector_size    = sector_size;
+    dev->n_sectors      = n_sectors;
+    dev->read           = file_read;
+    dev->write          = file_write;
+    dev->erase_sector   = file_erase_sector;
+
+    return 0;
+}
+
+void flash_dev_close_file(struct flash_dev *dev)
+{
+    struct flash_file *f = (struct flash_file *) dev->ctx;
+
+    if (f != NULL)
+    {
+        fclose(f->fp);
+        free(f->erase_counts);
+        free(f);
+
+        dev->ctx = NULL;
+    }
+}
+
+//////////////////// Private ////////////////////
+
+static int file_read(void *ctx, uint32_t addr, void *buff, uint32_t len)
+{
+    struct flash_file *f = (struct flash_file *) ctx;
+
+    if ((addr + len) > f->size)
+        return -1;
+
+    if (fseek(f->fp, addr, SEEK_SET) != 0)
+        return -1;
+
+    return (fread(buff, 1, len, f->fp) == len) ? 0 : -1;
+}
+
+static int file_write(void *ctx, uint32_t addr, const void *buff, uint32_t len)
+{
+    struct flash_file *f = (struct flash_file *) ctx;
+
+    const uint8_t *src = (const uint8_t *) buff;
+    uint8_t chunk[256];
+
+    if ((addr + len) > f->size)
+        return -1;
+
+    while (len > 0)
+    {
+        uint32_t n = (len > sizeof(chunk)) ? sizeof(chunk) : len;
+
+        if (file_read(ctx, addr, chunk, n) != 0)
+            return -1;
+
+        for (uint32_t i = 0; i < n; i++)
+            chunk[i] &= src[i];    // NOR: a write can only clear bits.
+
+        if ((fseek(f->fp, addr, SEEK_SET) != 0) || (fwrite(chunk, 1, n, f->fp) != n))
+            return -1;
+
+        addr += n;
+        src += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int file_erase_sector(void *ctx, uint32_t sector)
+{
+    struct flash_file *f = (struct flash_file *) ctx;
+
+    uint8_t ff[256];
+    memset(ff, 0xFF, sizeof(ff));
+
+    if (((sector + 1)*f->sector_size) > f->size)
+        return -1;
+
+    if (fseek(f->fp, sector*f->sector_size, SEEK_SET) != 0)
+        return -1;
+
+    for (uint32_t i = 0; i < f->sector_size; i += sizeof(ff))
+    {
+        if (fwrite(ff, 1, sizeof(ff), f->fp) != sizeof(ff))
+            return -1;
+    }
+
+    f->erase_counts[sector] = f->erase_counts[sector] + 1;
+
+    return 0;
+}
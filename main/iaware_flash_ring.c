@@ -0,0 +1,494 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "iaware_flash_ring.h"
+
+#define REC_VALID   0
+#define REC_ERASED  1   // The rest of the sector is still erased.
+#define REC_END     2   // No more records fit, or the bytes are not a record (torn header).
+
+static int ring_format(struct flash_ring *ring);
+static int ring_start_sector(struct flash_ring *ring, uint32_t sector, uint32_t seq);
+static int ring_next_sector(struct flash_ring *ring);
+static int ring_scan_record(struct flash_ring *ring, uint32_t sector, uint32_t offset, struct flash_rec_hdr *hdr);
+static int ring_set_flags(struct flash_ring *ring, uint32_t sector, uint32_t offset, uint8_t flags);
+static int ring_read_sector_hdr(struct flash_ring *ring, uint32_t sector, struct flash_sector_hdr *sector_hdr);
+static int rec_is_pending(struct flash_rec_hdr *hdr);
+static int sector_hdr_is_later(struct flash_sector_hdr *sector_hdr, uint32_t boot_count, uint64_t t);
+static uint32_t ring_sector_of_seq(struct flash_ring *ring, uint32_t seq);
+static uint32_t rec_stride(uint32_t len);
+
+int flash_ring_mount(struct flash_ring *ring, struct flash_dev *dev)
+// Recover the write position and the oldest pending record from the flash. Nothing is erased unless the device is blank.
+{
+    struct flash_sector_hdr sector_hdr;
+    struct flash_rec_hdr hdr;
+
+    uint32_t n_valid    = 0;
+    uint32_t oldest     = 0;
+    uint32_t oldest_seq = 0;
+
+    if ((dev == NULL) || (dev->n_sectors < 2))
+        return FLASH_RING_ERR_NO_DEV;
+
+    ring->dev               = dev;
+    ring->n_pending         = 0;
+    ring->n_overwritten     = 0;
+    ring->erase_count_min   = UINT32_MAX;
+    ring->erase_count_max   = 0;
+
+    for (uint32_t s = 0; s < dev->n_sectors; s++)
+    {
+        if (ring_read_sector_hdr(ring, s, &sector_hdr) != FLASH_RING_OK)
+            continue;
+
+        if ((n_valid == 0) || (sector_hdr.seq > ring->head_seq))
+        {
+            ring->head_sector   = s;
+            ring->head_seq      = sector_hdr.seq;
+        }
+
+        if ((n_valid == 0) || (sector_hdr.seq < oldest_seq))
+        {
+            oldest      = s;
+            oldest_seq  = sector_hdr.seq;
+        }
+
+        if (sector_hdr.erase_count < ring->erase_count_min)
+            ring->erase_count_min = sector_hdr.erase_count;
+
+        if (sector_hdr.erase_count > ring->erase_count_max)
+            ring->erase_count_max = sector_hdr.erase_count;
+
+        n_valid = n_valid + 1;
+    }
+
+    if (n_valid == 0)
+        return ring_format(ring);
+
+    ring->oldest_seq = oldest_seq;
+
+    // Find the write position in the newest sector.
+    int r;
+
+    ring->head_offset = sizeof(struct flash_sector_hdr);
+    while ((r = ring_scan_record(ring, ring->head_sector, ring->head_offset, &hdr)) == REC_VALID)
+    {
+        ring->head_offset = ring->head_offset + rec_stride(hdr.len);
+    }
+
+    if (r == REC_END)
+        ring->head_offset = dev->sector_size; // Never program over bytes that are not erased. Start a new sector at the next append.
+
+    // Count the pending records from the oldest sector to the newest one. The first one becomes the tail.
+    ring->tail_sector = ring->head_sector;
+    ring->tail_offset = ring->head_offset;
+
+    uint32_t s = oldest;
+    while (1)
+    {
+        if (ring_read_sector_hdr(ring, s, &sector_hdr) == FLASH_RING_OK)
+        {
+            uint32_t offset = sizeof(struct flash_sector_hdr);
+
+            while (((s != ring->head_sector) || (offset < ring->head_offset)) && (ring_scan_record(ring, s, offset, &hdr) == REC_VALID))
+            {
+                if (rec_is_pending(&hdr))
+                {
+                    if (ring->n_pending == 0)
+                    {
+                        ring->tail_sector = s;
+                        ring->tail_offset = offset;
+                    }
+
+                    ring->n_pending = ring->n_pending + 1;
+                }
+
+                offset = offset + rec_stride(hdr.len);
+            }
+        }
+
+        if (s == ring->head_sector)
+            break;
+
+        s = (s + 1) % dev->n_sectors;
+    }
+
+    return FLASH_RING_OK;
+}
+
+int flash_ring_append(struct flash_ring *ring, struct flash_rec_hdr *hdr, const uint8_t *payload)
+// Params:
+//     hdr      : len, block_seq, eff_sampling_freq, t_begin, stream_flags, channel_mask and bits are given by the caller.
+//                magic and flags are filled in here.
+{
+    struct flash_dev *dev = ring->dev;
+
+    uint32_t stride = rec_stride(hdr->len);
+    int r;
+
+    if (dev == NULL)
+        return FLASH_RING_ERR_NO_DEV;
+
+    if (hdr->len > flash_ring_max_payload(ring))
+        return FLASH_RING_ERR_TOO_LARGE;
+
+    if ((ring->head_offset + stride) > dev->sector_size)
+    {
+        if ((r = ring_next_sector(ring)) != FLASH_RING_OK)
+            return r;
+    }
+
+    if (ring->n_pending == 0)
+    {
+        ring->tail_sector = ring->head_sector;
+        ring->tail_offset = ring->head_offset;
+    }
+
+    uint32_t addr = ring->head_sector*dev->sector_size + ring->head_offset;
+
+    // The first record of a sector makes the index entry of the sector.
+    if (ring->head_offset == sizeof(struct flash_sector_hdr))
+    {
+        uint32_t sector_addr = ring->head_sector*dev->sector_size;
+
+        if ((dev->write(dev->ctx, sector_addr + offsetof(struct flash_sector_hdr, t_first), &(hdr->t_begin), sizeof(uint64_t)) != 0) ||
+            (dev->write(dev->ctx, sector_addr + offsetof(struct flash_sector_hdr, block_seq_first), &(hdr->block_seq), sizeof(uint32_t)) != 0))
+            return FLASH_RING_ERR_IO;
+    }
+
+    hdr->magic = FLASH_REC_MAGIC;
+    hdr->flags = 0xFF;
+
+    // Reserve the space first, so a torn write is skipped by its length at the next mount.
+    ring->head_offset = ring->head_offset + stride;
+
+    if (dev->write(dev->ctx, addr, hdr, sizeof(struct flash_rec_hdr)) != 0)
+        return FLASH_RING_ERR_IO;
+
+    if ((hdr->len > 0) && (dev->write(dev->ctx, addr + sizeof(struct flash_rec_hdr), payload, hdr->len) != 0))
+        return FLASH_RING_ERR_IO;
+
+    hdr->flags = (uint8_t) (0xFF & ~FLASH_REC_FLAG_COMMITTED);
+
+    if (dev->write(dev->ctx, addr + offsetof(struct flash_rec_hdr, flags), &(hdr->flags), 1) != 0)
+        return FLASH_RING_ERR_IO;
+
+    ring->n_pending = ring->n_pending + 1;
+
+    return FLASH_RING_OK;
+}
+
+int flash_ring_read(struct flash_ring *ring, struct flash_rec_hdr *hdr, uint8_t *payload, uint32_t max_len)
+// Read the oldest pending record without consuming it. Return the payload length, FLASH_RING_ERR_EMPTY when there is none,
+// or FLASH_RING_ERR_TOO_LARGE when it does not fit in max_len (hdr is still filled in, so the caller can consume it).
+{
+    struct flash_dev *dev = ring->dev;
+
+    if (dev == NULL)
+        return FLASH_RING_ERR_NO_DEV;
+
+    while (ring->n_pending > 0)
+    {
+        if ((ring->tail_sector == ring->head_sector) && (ring->tail_offset >= ring->head_offset))
+            break;
+
+        if (ring_scan_record(ring, ring->tail_sector, ring->tail_offset, hdr) != REC_VALID)
+        {
+            if (ring->tail_sector == ring->head_sector)
+                break;
+
+            ring->tail_sector = (ring->tail_sector + 1) % dev->n_sectors;
+            ring->tail_offset = sizeof(struct flash_sector_hdr);
+
+            continue;
+        }
+
+        if (rec_is_pending(hdr))
+        {
+            if (hdr->len > max_len)
+                return FLASH_RING_ERR_TOO_LARGE;
+
+            uint32_t addr = ring->tail_sector*dev->sector_size + ring->tail_offset + sizeof(struct flash_rec_hdr);
+
+            if ((hdr->len > 0) && (dev->read(dev->ctx, addr, payload, hdr->len) != 0))
+                return FLASH_RING_ERR_IO;
+
+            return (int) hdr->len;
+        }
+
+        ring->tail_offset = ring->tail_offset + rec_stride(hdr->len);
+    }
+
+    // The count drifted from the flash content, e.g. after a torn write. The flash is the reference.
+    ring->n_pending = 0;
+
+    return FLASH_RING_ERR_EMPTY;
+}
+
+int flash_ring_consume(struct flash_ring *ring, uint32_t block_seq)
+// Mark the record returned by flash_ring_read() as delivered. Nothing happens when the ring has wrapped onto it meanwhile.
+{
+    struct flash_rec_hdr hdr;
+
+    if (ring->dev == NULL)
+        return FLASH_RING_ERR_NO_DEV;
+
+    if ((ring->n_pending == 0) || (ring_scan_record(ring, ring->tail_sector, ring->tail_offset, &hdr) != REC_VALID) || !rec_is_pending(&hdr) || (hdr.block_seq != block_seq))
+        return FLASH_RING_ERR_EMPTY;
+
+    if (ring_set_flags(ring, ring->tail_sector, ring->tail_offset, (uint8_t) (hdr.flags & ~FLASH_REC_FLAG_CONSUMED)) != FLASH_RING_OK)
+        return FLASH_RING_ERR_IO;
+
+    ring->tail_offset   = ring->tail_offset + rec_stride(hdr.len);
+    ring->n_pending     = ring->n_pending - 1;
+
+    return FLASH_RING_OK;
+}
+
+uint32_t flash_ring_max_payload(struct flash_ring *ring)
+{
+    if (ring->dev == NULL)
+        return 0;
+
+    uint32_t max_payload = (ring->dev->sector_size - sizeof(struct flash_sector_hdr) - sizeof(struct flash_rec_hdr)) & ~(FLASH_RING_ALIGN - 1);
+
+    return (max_payload > UINT16_MAX) ? (UINT16_MAX & ~(FLASH_RING_ALIGN - 1)) : max_payload; // See flash_rec_hdr.len.
+}
+
+uint64_t flash_ring_vaddr_begin(struct flash_ring *ring)
+{
+    if (ring->dev == NULL)
+        return 0;
+
+    return ((uint64_t) ring->oldest_seq)*ring->dev->sector_size;
+}
+
+uint64_t flash_ring_vaddr_end(struct flash_ring *ring)
+{
+    if (ring->dev == NULL)
+        return 0;
+
+    return ((uint64_t) ring->head_seq)*ring->dev->sector_size + ring->head_offset;
+}
+
+int flash_ring_read_raw(struct flash_ring *ring, uint64_t vaddr, uint8_t *buff, uint32_t len)
+// Read the raw log, i.e. sector headers, records and the erased tails, from vaddr. The range is clipped at
+// flash_ring_vaddr_end(). Return the number of bytes read, or FLASH_RING_ERR_EMPTY when vaddr is already overwritten.
+{
+    struct flash_dev *dev = ring->dev;
+
+    uint64_t vaddr_end = flash_ring_vaddr_end(ring);
+    uint32_t n_read = 0;
+
+    if (dev == NULL)
+        return FLASH_RING_ERR_NO_DEV;
+
+    if (vaddr < flash_ring_vaddr_begin(ring))
+        return FLASH_RING_ERR_EMPTY;
+
+    while ((len > 0) && (vaddr < vaddr_end))
+    {
+        uint32_t seq    = (uint32_t) (vaddr/dev->sector_size);
+        uint32_t offset = (uint32_t) (vaddr % dev->sector_size);
+        uint32_t n      = dev->sector_size - offset;
+
+        if (n > len)
+            n = len;
+
+        if (n > (vaddr_end - vaddr))
+            n = (uint32_t) (vaddr_end - vaddr);
+
+        if (dev->read(dev->ctx, ring_sector_of_seq(ring, seq)*dev->sector_size + offset, buff + n_read, n) != 0)
+            return FLASH_RING_ERR_IO;
+
+        vaddr   = vaddr + n;
+        n_read  = n_read + n;
+        len     = len - n;
+    }
+
+    return (int) n_read;
+}
+
+uint64_t flash_ring_find(struct flash_ring *ring, uint32_t boot_count, uint64_t t)
+// Return the vaddr of the sector holding the block that was recorded at t [microsec] of boot boot_count, i.e. the last
+// sector that starts at or before it. It costs log2(n_sectors) reads of a sector header.
+{
+    struct flash_sector_hdr sector_hdr;
+
+    if (ring->dev == NULL)
+        return 0;
+
+    uint32_t lo     = 0;
+    uint32_t hi     = ring->head_seq - ring->oldest_seq + 1;  // The number of sectors from the oldest one to the head.
+    uint32_t found  = 0;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo)/2;
+
+        uint32_t seq = ring->oldest_seq + mid;
+
+        // An empty or a torn sector sorts after everything, like the empty head sector.
+        if ((ring_read_sector_hdr(ring, ring_sector_of_seq(ring, seq), &sector_hdr) != FLASH_RING_OK) || (sector_hdr.t_first == UINT64_MAX) || sector_hdr_is_later(&sector_hdr, boot_count, t))
+        {
+            hi = mid;
+        }
+        else
+        {
+            found   = mid;
+            lo      = mid + 1;
+        }
+    }
+
+    return ((uint64_t) (ring->oldest_seq + found))*ring->dev->sector_size;
+}
+
+//////////////////// Private ////////////////////
+
+static int ring_format(struct flash_ring *ring)
+{
+    ring->head_seq      = 0;
+    ring->oldest_seq    = 1;
+
+    if (ring_start_sector(ring, 0, 1) != FLASH_RING_OK)
+        return FLASH_RING_ERR_IO;
+
+    ring->tail_sector = ring->head_sector;
+    ring->tail_offset = ring->head_offset;
+
+    return FLASH_RING_OK;
+}
+
+static int ring_start_sector(struct flash_ring *ring, uint32_t sector, uint32_t seq)
+// Erase sector and stamp it with seq and its erase count.
+{
+    struct flash_dev *dev = ring->dev;
+    struct flash_sector_hdr sector_hdr;
+
+    uint32_t erase_count = 1;
+
+    if (ring_read_sector_hdr(ring, sector, &sector_hdr) == FLASH_RING_OK)
+        erase_count = sector_hdr.erase_count + 1;
+
+    if (dev->erase_sector(dev->ctx, sector) != 0)
+        return FLASH_RING_ERR_IO;
+
+    sector_hdr.magic            = FLASH_SECTOR_MAGIC;
+    sector_hdr.seq              = seq;
+    sector_hdr.erase_count      = erase_count;
+    sector_hdr.boot_count       = ring->boot_count;
+    sector_hdr.t_first          = UINT64_MAX;   // Programmed by the first flash_ring_append() into this sector.
+    sector_hdr.block_seq_first  = UINT32_MAX;
+    sector_hdr.reserved         = UINT32_MAX;
+
+    if (dev->write(dev->ctx, sector*dev->sector_size, &sector_hdr, sizeof(struct flash_sector_hdr)) != 0)
+        return FLASH_RING_ERR_IO;
+
+    if (erase_count < ring->erase_count_min)
+        ring->erase_count_min = erase_count;
+
+    if (erase_count > ring->erase_count_max)
+        ring->erase_count_max = erase_count;
+
+    ring->head_sector   = sector;
+    ring->head_offset   = sizeof(struct flash_sector_hdr);
+    ring->head_seq      = seq;
+
+    if ((ring->head_seq - ring->oldest_seq + 1) > dev->n_sectors)
+        ring->oldest_seq = ring->head_seq - dev->n_sectors + 1;
+
+    return FLASH_RING_OK;
+}
+
+static int ring_next_sector(struct flash_ring *ring)
+// Move the head to the next sector. When the ring is full the next sector is the oldest one, so its pending records are lost.
+{
+    struct flash_rec_hdr hdr;
+
+    uint32_t next = (ring->head_sector + 1) % ring->dev->n_sectors;
+
+    if ((ring->n_pending > 0) && (ring->tail_sector == next))
+    {
+        uint32_t offset = ring->tail_offset;
+
+        while ((ring->n_pending > 0) && (ring_scan_record(ring, next, offset, &hdr) == REC_VALID))
+        {
+            if (rec_is_pending(&hdr))
+            {
+                ring->n_pending     = ring->n_pending - 1;
+                ring->n_overwritten = ring->n_overwritten + 1;
+            }
+
+            offset = offset + rec_stride(hdr.len);
+        }
+
+        ring->tail_sector = (next + 1) % ring->dev->n_sectors;
+        ring->tail_offset = sizeof(struct flash_sector_hdr);
+    }
+
+    return ring_start_sector(ring, next, ring->head_seq + 1);
+}
+
+static int ring_scan_record(struct flash_ring *ring, uint32_t sector, uint32_t offset, struct flash_rec_hdr *hdr)
+{
+    struct flash_dev *dev = ring->dev;
+
+    if ((offset + sizeof(struct flash_rec_hdr)) > dev->sector_size)
+        return REC_END;
+
+    if (dev->read(dev->ctx, sector*dev->sector_size + offset, hdr, sizeof(struct flash_rec_hdr)) != 0)
+        return REC_END;
+
+    if (hdr->magic == 0xFFFF)
+        return REC_ERASED;
+
+    if ((hdr->magic != FLASH_REC_MAGIC) || ((offset + rec_stride(hdr->len)) > dev->sector_size))
+        return REC_END;
+
+    return REC_VALID;
+}
+
+static int ring_set_flags(struct flash_ring *ring, uint32_t sector, uint32_t offset, uint8_t flags)
+{
+    struct flash_dev *dev = ring->dev;
+
+    uint32_t addr = sector*dev->sector_size + offset + offsetof(struct flash_rec_hdr, flags);
+
+    return (dev->write(dev->ctx, addr, &flags, 1) == 0) ? FLASH_RING_OK : FLASH_RING_ERR_IO;
+}
+
+static int ring_read_sector_hdr(struct flash_ring *ring, uint32_t sector, struct flash_sector_hdr *sector_hdr)
+{
+    struct flash_dev *dev = ring->dev;
+
+    if (dev->read(dev->ctx, sector*dev->sector_size, sector_hdr, sizeof(struct flash_sector_hdr)) != 0)
+        return FLASH_RING_ERR_IO;
+
+    return (sector_hdr->magic == FLASH_SECTOR_MAGIC) ? FLASH_RING_OK : FLASH_RING_ERR_EMPTY;
+}
+
+static int rec_is_pending(struct flash_rec_hdr *hdr)
+{
+    return ((hdr->flags & FLASH_REC_FLAG_COMMITTED) == 0) && ((hdr->flags & FLASH_REC_FLAG_CONSUMED) != 0);
+}
+
+static int sector_hdr_is_later(struct flash_sector_hdr *sector_hdr, uint32_t boot_count, uint64_t t)
+{
+    if (sector_hdr->boot_count != boot_count)
+        return sector_hdr->boot_count > boot_count;
+
+    return sector_hdr->t_first > t;
+}
+
+static uint32_t ring_sector_of_seq(struct flash_ring *ring, uint32_t seq)
+{
+    uint32_t n_sectors = ring->dev->n_sectors;
+
+    return (ring->head_sector + n_sectors - ((ring->head_seq - seq) % n_sectors)) % n_sectors;
+}
+
+static uint32_t rec_stride(uint32_t len)
+{
+    return (sizeof(struct flash_rec_hdr) + len + FLASH_RING_ALIGN - 1) & ~(FLASH_RING_ALIGN - 1);
+}
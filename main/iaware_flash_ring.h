@@ -0,0 +1,93 @@
+#ifndef IAWARE_FLASH_RING_H
+#define IAWARE_FLASH_RING_H
+
+#include <stdint.h>
+
+#include "iaware_flash.h"
+
+// A circular log of sample blocks on NOR flash. It does not depend on ESP-IDF so it also runs on Linux with iaware_flash_file.c,
+// see test_host_flash_ring.py.
+// The sectors are written strictly round robin and the write position survives a restart (it is recovered from the sector
+// sequence numbers), so every sector is erased exactly once per lap of the ring.
+//
+// A sector is addressed by its seq, so the virtual address vaddr = seq*sector_size + offset stays valid while the ring wraps.
+// The sector headers also form the time index: t_first of the first record is programmed into the header of every sector,
+// and the headers are in time order from the oldest sector to the head, so flash_ring_find() is a binary search.
+//
+// Sector: |sector header|record|record|...|0xFF...|
+// Record: |record header|payload|, padded to FLASH_RING_ALIGN. A record never crosses a sector.
+// A record is written with all flag bits set, followed by the payload, and only then FLASH_REC_FLAG_COMMITTED is cleared.
+// A record torn by a power loss is therefore never returned. Clearing FLASH_REC_FLAG_CONSUMED marks a record as delivered
+// without erasing anything, so delivered records are not sent again after a restart.
+#define FLASH_RING_ALIGN            4
+
+#define FLASH_SECTOR_MAGIC          0x52574149  // "IAWR"
+#define FLASH_REC_MAGIC             0x5AA5
+
+#define FLASH_REC_FLAG_COMMITTED    0x01        // The bit is cleared when the record is complete.
+#define FLASH_REC_FLAG_CONSUMED     0x02        // The bit is cleared when the record has been delivered.
+
+#define FLASH_RING_OK               0
+#define FLASH_RING_ERR_IO           -1
+#define FLASH_RING_ERR_TOO_LARGE    -2
+#define FLASH_RING_ERR_EMPTY        -3
+#define FLASH_RING_ERR_NO_DEV       -4
+
+struct flash_sector_hdr
+{
+    uint32_t magic;
+    uint32_t seq;           // Increases by one for every sector that is started.
+    uint32_t erase_count;   // The number of times this sector has been erased by the ring.
+    uint32_t boot_count;    // t_first is relative to this boot.
+    uint64_t t_first;       // [microsec]. The t_begin of the first record. It stays 0xFF... until the first record is appended.
+    uint32_t block_seq_first;
+    uint32_t reserved;
+};
+
+struct flash_rec_hdr
+{
+    uint16_t magic;
+    uint8_t flags;
+    uint8_t stream_flags;   // STREAM_FLAG_PLANAR when the samples are grouped by channel.
+    uint16_t len;           // [bytes]. The payload length. A record never crosses a sector, so 16 bits are enough.
+    uint8_t channel_mask;   // The channels of the block, in the order of the bits. See iaware_gpio.h.
+    uint8_t bits;           // The significant bits per sample. See iaware_decimate.h.
+    uint32_t block_seq;     // The sequence number of the sample block.
+    uint32_t eff_sampling_freq;
+    uint64_t t_begin;       // [microsec]
+};
+
+struct flash_ring
+{
+    struct flash_dev *dev;
+
+    uint32_t head_sector;   // The sector being written.
+    uint32_t head_offset;   // The next write offset in head_sector.
+    uint32_t head_seq;      // The seq of head_sector.
+
+    uint32_t oldest_seq;    // The seq of the oldest sector that is still on flash.
+    uint32_t boot_count;    // Set by the caller before flash_ring_mount(). It is stamped into the new sectors.
+
+    uint32_t tail_sector;   // The oldest record that may not be consumed yet.
+    uint32_t tail_offset;
+
+    uint32_t n_pending;     // Committed records that are not consumed.
+    uint32_t n_overwritten; // Pending records lost because the ring wrapped onto them.
+
+    uint32_t erase_count_min;
+    uint32_t erase_count_max;
+};
+
+int flash_ring_mount(struct flash_ring *ring, struct flash_dev *dev);
+int flash_ring_append(struct flash_ring *ring, struct flash_rec_hdr *hdr, const uint8_t *payload);
+int flash_ring_read(struct flash_ring *ring, struct flash_rec_hdr *hdr, uint8_t *payload, uint32_t max_len);
+int flash_ring_consume(struct flash_ring *ring, uint32_t block_seq);
+
+uint32_t flash_ring_max_payload(struct flash_ring *ring);
+
+uint64_t flash_ring_vaddr_begin(struct flash_ring *ring);
+uint64_t flash_ring_vaddr_end(struct flash_ring *ring);
+int flash_ring_read_raw(struct flash_ring *ring, uint64_t vaddr, uint8_t *buff, uint32_t len);
+uint64_t flash_ring_find(struct flash_ring *ring, uint32_t boot_count, uint64_t t);
+
+#endif
@@ -0,0 +1,385 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "iaware_blog.h"
+#include "iaware_flash.h"
+#include "iaware_flash_ring.h"
+#include "iaware_flash_tier.h"
+#include "iaware_gpio.h"
+#include "iaware_helper.h"
+#include "iaware_packet.h"
+#include "iaware_sampling_data.h"
+#include "iaware_stream.h"
+#include "iaware_tcp_com.h"
+#include "main.h"
+
+struct flash_read_req
+{
+    uint32_t req_id;
+    uint64_t vaddr;
+    uint32_t len;
+};
+
+static uint32_t pack_info(void);
+static uint32_t pack_find(void);
+static uint32_t pack_read(void);
+
+static struct flash_dev flash_tier_dev;
+static struct flash_ring flash_tier_ring;
+
+static SemaphoreHandle_t flash_tier_mutex = NULL; // flash_spill_task() appends and com_tcp_send_task() reads the same ring.
+
+// CMD_READ_RECORD requests from com_tcp_recv_task() to com_tcp_send_task(). read_req is the one being served.
+static QueueHandle_t flash_tier_read_queue = NULL;
+static struct flash_read_req read_req;
+static uint8_t read_req_is_active = iawFalse;
+
+static uint8_t info_pending = iawFalse;
+static uint8_t find_pending = iawFalse;
+static uint32_t find_boot_count = 0;
+static uint64_t find_t = 0;
+
+// Every packet of the flash tier is built here by com_tcp_send_task(), one at a time. A backfilled block is read to
+// tx_buff + STREAM_HEADROOM and its header is written in front, like the live blocks.
+static uint8_t tx_buff[STREAM_HEADROOM + FLASH_TIER_CHUNK_SIZE];
+
+uint8_t flash_tier_enabled = iawFalse;
+uint8_t flash_tier_record_mode = iawFalse;
+
+uint32_t flash_tier_spilled     = 0;
+uint32_t flash_tier_backfilled  = 0;
+
+void init_flash_tier(uint32_t block_bytes)
+// Params:
+//     block_bytes  : The number of sample bytes in one buff node.
+{
+    uint32_t value;
+
+    flash_tier_enabled = iawFalse;
+
+    // The boot count tells the recordings of different boots apart, because t_begin restarts from 0 at every boot.
+    flash_tier_ring.boot_count = 0;
+    nvs_read_u32(FLASH_TIER_NVS_BOOT_COUNT, &(flash_tier_ring.boot_count));
+    flash_tier_ring.boot_count = flash_tier_ring.boot_count + 1;
+    nvs_write_u32(FLASH_TIER_NVS_BOOT_COUNT, flash_tier_ring.boot_count);
+
+    if (nvs_read_u32(FLASH_TIER_NVS_RECORD_MODE, &value) == iawTrue)
+        flash_tier_record_mode = (value != 0) ? iawTrue : iawFalse;
+
+    if (flash_dev_init_partition(&flash_tier_dev, FLASH_LOG_PARTITION_LABEL) != 0)
+        return;
+
+    if (flash_ring_mount(&flash_tier_ring, &flash_tier_dev) != FLASH_RING_OK)
+    {
+        ESP_LOGE(IAWARE_CORE, "Flash tier: Mount the flash ring FAIL.");
+
+        return;
+    }
+
+    if ((block_bytes > flash_ring_max_payload(&flash_tier_ring)) || (block_bytes > FLASH_TIER_CHUNK_SIZE))
+    {
+        ESP_LOGW(IAWARE_CORE, "Flash tier: A block of %d bytes does not fit in a sector of %d bytes. Spilling is disabled.", block_bytes, flash_tier_dev.sector_size);
+
+        return;
+    }
+
+    if (((flash_tier_mutex = xSemaphoreCreateMutex()) == NULL) || ((flash_tier_read_queue = xQueueCreate(FLASH_TIER_READ_QUEUE_LEN, sizeof(struct flash_read_req))) == NULL))
+    {
+        ESP_LOGE(IAWARE_CORE, "Flash tier: Create the mutex and the read queue FAIL.");
+
+        return;
+    }
+
+    flash_tier_enabled = iawTrue;
+
+    ESP_LOGI(IAWARE_CORE, "Flash tier: Boot %d, record mode %d, %d blocks are pending. Erase counts are %d to %d.", flash_tier_ring.boot_count, flash_tier_record_mode, flash_tier_ring.n_pending, flash_tier_ring.erase_count_min, flash_tier_ring.erase_count_max);
+}
+
+void flash_spill_task(void *pvParameter)
+// Follow the buff nodes like com_tcp_send_task() does, and keep the blocks that no client is draining, or all of them in the record mode.
+{
+    struct flash_rec_hdr hdr;
+
+    run_flash_spill_buff_node_ptr = run_buff_node_ptr;
+
+    while (1)
+    {
+        if (run_flash_spill_buff_node_ptr->is_spilled == iawFalse)
+        {
+            run_flash_spill_buff_node_ptr->is_spilled = iawTrue;
+
+            if ((flash_tier_record_mode == iawTrue) || (tcp_is_draining == iawFalse))
+            {
+                hdr.stream_flags            = run_flash_spill_buff_node_ptr->stream_flags;
+                hdr.channel_mask            = gpio_adc_channel_mask;
+                hdr.bits                    = sampling_data_bits;
+                hdr.len                     = (uint16_t) run_flash_spill_buff_node_ptr->n_samples; // init_flash_tier() checked that a block fits.
+                hdr.block_seq               = run_flash_spill_buff_node_ptr->block_seq;
+                hdr.eff_sampling_freq       = run_flash_spill_buff_node_ptr->eff_sampling_freq;
+                hdr.t_begin                 = run_flash_spill_buff_node_ptr->t_begin;
+
+                xSemaphoreTake(flash_tier_mutex, portMAX_DELAY);
+                int r = flash_ring_append(&flash_tier_ring, &hdr, run_flash_spill_buff_node_ptr->samples_buff + STREAM_HEADROOM);
+                xSemaphoreGive(flash_tier_mutex);
+
+                if (r == FLASH_RING_OK)
+                    flash_tier_spilled = flash_tier_spilled + 1;
+                else
+                    BLOGW(BLOG_TAG_IAWARE_CORE, BLOG_FMT_FLASH_SPILL_FAIL, hdr.block_seq, r, 0);
+            }
+
+            if (run_flash_spill_buff_node_ptr->next != NULL)
+            {
+                run_flash_spill_buff_node_ptr = run_flash_spill_buff_node_ptr->next;
+            }
+            else
+            {
+                run_flash_spill_buff_node_ptr = head_buff_node_ptr;
+            }
+        }
+        else
+        {
+            vTaskDelay((250/tcp_send_frequency) / portTICK_PERIOD_MS);
+        }
+    }
+}
+
+uint8_t *flash_tier_backfill_pack(uint32_t *block_seq, uint32_t *frame_len)
+// Put the oldest spilled block into tx_buff. A v1 client gets |(4bytes)|PACKET_HEADER_GROUP1_BACKFILL|block_seq|t_begin|eff_sampling_freq|samples|,
+// and a v2 client gets the v2 header with STREAM_FLAG_BACKFILL. Return the start of the frame, or NULL when nothing is pending.
+// The block stays pending until flash_tier_backfill_done(). The recording is left for CMD_READ_RECORD in the record mode.
+{
+    struct flash_rec_hdr hdr;
+    struct stream_block_meta meta;
+    uint8_t *frame;
+
+    if ((flash_tier_enabled == iawFalse) || (flash_tier_record_mode == iawTrue))
+        return NULL;
+
+    xSemaphoreTake(flash_tier_mutex, portMAX_DELAY);
+
+    int r = flash_ring_read(&flash_tier_ring, &hdr, tx_buff + STREAM_HEADROOM, FLASH_TIER_CHUNK_SIZE);
+
+    if (r == FLASH_RING_ERR_TOO_LARGE)
+        flash_ring_consume(&flash_tier_ring, hdr.block_seq); // Never stall on a block that cannot be sent.
+
+    xSemaphoreGive(flash_tier_mutex);
+
+    if (r < 0)
+        return NULL;
+
+    uint8_t version = stream_version;
+
+    if ((version == STREAM_VERSION_1) && (hdr.stream_flags & STREAM_FLAG_PLANAR))
+    {
+        // Only a v2 header tells the layout. It happens to the blocks of a v2 client that left in the planar layout.
+        BLOGW(BLOG_TAG_IAWARE_CORE, BLOG_FMT_FLASH_BACKFILL_PLANAR, hdr.block_seq, 0, 0);
+
+        flash_tier_backfill_done(hdr.block_seq);
+
+        return NULL;
+    }
+
+    if (version == STREAM_VERSION_1)
+    {
+        frame = tx_buff + STREAM_HEADROOM - (4 + PACKET_HEADER_GROUP1_BACKFILL_META_SIZE);
+
+        uint32_to_bytes(PACKET_HEADER_GROUP1_BACKFILL_META_SIZE + r, &(frame[0]));
+        frame[4] = PACKET_HEADER_GROUP1_BACKFILL;
+        uint32_to_bytes(hdr.block_seq, &(frame[5]));
+        uint64_to_bytes(hdr.t_begin, &(frame[9]));
+        uint32_to_bytes(hdr.eff_sampling_freq, &(frame[17]));
+
+        *frame_len = 4 + PACKET_HEADER_GROUP1_BACKFILL_META_SIZE + r;
+    }
+    else
+    {
+        stream_meta_init(&meta);
+
+        meta.flags          = STREAM_FLAG_BACKFILL | hdr.stream_flags;
+        meta.channel_mask   = hdr.channel_mask; // The mask may have changed since the block was recorded.
+        meta.n_channels     = gpio_adc_count_channels(hdr.channel_mask);
+        meta.bits           = hdr.bits;
+        meta.block_seq      = hdr.block_seq;
+        meta.t_begin        = hdr.t_begin;
+        meta.rate           = hdr.eff_sampling_freq;
+        meta.n_samples      = r/(2*meta.n_channels);
+
+        frame = tx_buff + STREAM_HEADROOM - stream_header_size(version, &meta);
+
+        *frame_len = stream_header_write(frame, version, &meta, r) + r;
+    }
+
+    *block_seq = hdr.block_seq;
+
+    return frame;
+}
+
+void flash_tier_backfill_done(uint32_t block_seq)
+// The client has the block, so it is not sent again, not even after a restart.
+{
+    xSemaphoreTake(flash_tier_mutex, portMAX_DELAY);
+
+    if (flash_ring_consume(&flash_tier_ring, block_seq) == FLASH_RING_OK)
+        flash_tier_backfilled = flash_tier_backfilled + 1;
+
+    xSemaphoreGive(flash_tier_mutex);
+}
+
+void flash_tier_set_record_mode(uint8_t is_record_mode)
+// It takes effect at the next block, and it is restored at boot.
+{
+    flash_tier_record_mode = (is_record_mode != 0) ? iawTrue : iawFalse;
+
+    nvs_write_u32(FLASH_TIER_NVS_RECORD_MODE, flash_tier_record_mode);
+}
+
+void flash_tier_request_info(void)
+{
+    info_pending = iawTrue;
+}
+
+void flash_tier_request_find(uint32_t boot_count, uint64_t t)
+{
+    find_boot_count = boot_count;
+    find_t          = t;
+
+    find_pending = iawTrue;
+}
+
+int flash_tier_request_read(uint32_t req_id, uint64_t vaddr, uint32_t len)
+// Called by com_tcp_recv_task(). Return iawFalse when FLASH_TIER_READ_QUEUE_LEN requests are already waiting.
+{
+    struct flash_read_req req;
+
+    if (flash_tier_enabled == iawFalse)
+        return iawFalse;
+
+    req.req_id  = req_id;
+    req.vaddr   = vaddr;
+    req.len     = len;
+
+    return (xQueueSend(flash_tier_read_queue, &req, 0) == pdTRUE) ? iawTrue : iawFalse;
+}
+
+uint32_t flash_tier_record_pack(void)
+// Put the next reply to CMD_GET_RECORD_INFO, CMD_FIND_RECORD or CMD_READ_RECORD into tx_buff. Return the length of the
+// packet, or 0 when no reply is waiting. com_tcp_send_task() calls it back to back, so a download runs at the link rate.
+{
+    if (info_pending == iawTrue)
+    {
+        info_pending = iawFalse;
+
+        return pack_info();
+    }
+
+    if (flash_tier_enabled == iawFalse)
+        return 0;
+
+    if (find_pending == iawTrue)
+    {
+        find_pending = iawFalse;
+
+        return pack_find();
+    }
+
+    return pack_read();
+}
+
+uint8_t *flash_tier_tx_buff(void)
+{
+    return tx_buff;
+}
+
+uint32_t flash_tier_pending(void)
+{
+    return (flash_tier_enabled == iawTrue) ? flash_tier_ring.n_pending : 0;
+}
+
+//////////////////// Private ////////////////////
+
+static uint32_t pack_info(void)
+{
+    uint64_t vaddr_begin = 0, vaddr_end = 0;
+
+    if (flash_tier_enabled == iawTrue)
+    {
+        xSemaphoreTake(flash_tier_mutex, portMAX_DELAY);
+        vaddr_begin = flash_ring_vaddr_begin(&flash_tier_ring);
+        vaddr_end   = flash_ring_vaddr_end(&flash_tier_ring);
+        xSemaphoreGive(flash_tier_mutex);
+    }
+
+    uint32_to_bytes(PACKET_HEADER_RECORD_INFO_META_SIZE, &(tx_buff[0]));
+    tx_buff[4] = PACKET_HEADER_RECORD_INFO;
+    tx_buff[5] = flash_tier_record_mode;
+    uint32_to_bytes(flash_tier_ring.boot_count, &(tx_buff[6]));
+    uint64_to_bytes(vaddr_begin, &(tx_buff[10]));
+    uint64_to_bytes(vaddr_end, &(tx_buff[18]));
+    uint32_to_bytes(flash_tier_dev.sector_size, &(tx_buff[26]));
+
+    return 4 + PACKET_HEADER_RECORD_INFO_META_SIZE;
+}
+
+static uint32_t pack_find(void)
+{
+    xSemaphoreTake(flash_tier_mutex, portMAX_DELAY);
+    uint64_t vaddr = flash_ring_find(&flash_tier_ring, find_boot_count, find_t);
+    xSemaphoreGive(flash_tier_mutex);
+
+    uint32_to_bytes(PACKET_HEADER_RECORD_FIND_META_SIZE, &(tx_buff[0]));
+    tx_buff[4] = PACKET_HEADER_RECORD_FIND;
+    uint64_to_bytes(vaddr, &(tx_buff[5]));
+
+    return 4 + PACKET_HEADER_RECORD_FIND_META_SIZE;
+}
+
+static uint32_t pack_read(void)
+// One FLASH_TIER_CHUNK_SIZE piece of the active request, as |(4bytes)|PACKET_HEADER_RECORD_DATA|req_id|vaddr|flags|raw log|.
+{
+    uint8_t flags = 0;
+
+    if (read_req_is_active == iawFalse)
+    {
+        if (xQueueReceive(flash_tier_read_queue, &read_req, 0) != pdTRUE)
+            return 0;
+
+        read_req_is_active = iawTrue;
+    }
+
+    uint32_t n = (read_req.len > FLASH_TIER_CHUNK_SIZE) ? FLASH_TIER_CHUNK_SIZE : read_req.len;
+
+    xSemaphoreTake(flash_tier_mutex, portMAX_DELAY);
+    int r = flash_ring_read_raw(&flash_tier_ring, read_req.vaddr, tx_buff + 4 + PACKET_HEADER_RECORD_DATA_META_SIZE, n);
+    xSemaphoreGive(flash_tier_mutex);
+
+    if (r < 0)
+    {
+        flags = RECORD_DATA_FLAG_LAST | RECORD_DATA_FLAG_OVERWRITTEN;
+        r = 0;
+    }
+    else if (((uint32_t) r < n) || ((uint32_t) r == read_req.len))
+    {
+        flags = RECORD_DATA_FLAG_LAST; // Either the request is complete, or it reaches the end of the recording.
+    }
+
+    uint32_to_bytes(PACKET_HEADER_RECORD_DATA_META_SIZE + r, &(tx_buff[0]));
+    tx_buff[4] = PACKET_HEADER_RECORD_DATA;
+    uint32_to_bytes(read_req.req_id, &(tx_buff[5]));
+    uint64_to_bytes(read_req.vaddr, &(tx_buff[9]));
+    tx_buff[17] = flags;
+
+    read_req.vaddr  = read_req.vaddr + r;
+    read_req.len    = read_req.len - r;
+
+    if ((flags & RECORD_DATA_FLAG_LAST) != 0)
+        read_req_is_active = iawFalse;
+
+    return 4 + PACKET_HEADER_RECORD_DATA_META_SIZE + r;
+}
@@ -0,0 +1,42 @@
+#ifndef IAWARE_FLASH_TIER_H
+#define IAWARE_FLASH_TIER_H
+
+#include <stdint.h>
+
+// The second tier behind the buff nodes. While no client drains the buff nodes, flash_spill_task() copies every completed
+// block into the flash ring instead of letting the sampling callback overwrite it. When a client streams again,
+// com_tcp_send_task() sends the spilled blocks whenever no live block is waiting, as PACKET_HEADER_GROUP1_BACKFILL packets
+// to a v1 client and as PACKET_HEADER_STREAM packets with STREAM_FLAG_BACKFILL to a v2 client.
+// The iaware_log partition (about 2.4 MB, see partitions.csv) holds about 60 s of 20 kHz samples. Each sector is erased
+// once per lap, i.e. a continuous disconnect wears the partition by one cycle per minute.
+//
+// In the record mode (CMD_SET_RECORD_MODE) every block is kept, streamed or not, and nothing is backfilled. The client
+// downloads the raw log instead with CMD_READ_RECORD requests, which may be pipelined up to FLASH_TIER_READ_QUEUE_LEN deep.
+#define FLASH_TIER_CHUNK_SIZE       4096    // [bytes]. A record never exceeds a flash sector. It is also the download packet size.
+#define FLASH_TIER_READ_QUEUE_LEN   8
+
+#define FLASH_TIER_NVS_BOOT_COUNT   "boot"
+#define FLASH_TIER_NVS_RECORD_MODE  "rec_mode"
+
+extern uint8_t flash_tier_enabled;
+extern uint8_t flash_tier_record_mode;
+
+extern uint32_t flash_tier_spilled;
+extern uint32_t flash_tier_backfilled;
+
+void init_flash_tier(uint32_t block_bytes);
+void flash_spill_task(void *pvParameter);
+
+uint8_t *flash_tier_backfill_pack(uint32_t *block_seq, uint32_t *frame_len);
+void flash_tier_backfill_done(uint32_t block_seq);
+
+void flash_tier_set_record_mode(uint8_t is_record_mode);
+void flash_tier_request_info(void);
+void flash_tier_request_find(uint32_t boot_count, uint64_t t);
+int flash_tier_request_read(uint32_t req_id, uint64_t vaddr, uint32_t len);
+uint32_t flash_tier_record_pack(void);
+
+uint8_t *flash_tier_tx_buff(void);
+uint32_t flash_tier_pending(void);
+
+#endif
@@ -17,8 +17,22 @@
 #include "freertos/task.h"
 
 #include "iaware_gpio.h"
+#include "iaware_sampling_data.h"
+#include "iaware_source.h"
 #include "main.h"
 
+static void init_adc_channels(void);
+static void benchmark_adc_channels(void);
+static void adc_read_scan(void *ctx, uint16_t *scan, uint8_t n_channels);
+
+// The GPIO of each ADC1 channel. GPIO 37 and 38 are not broken out on most modules.
+static const uint8_t gpio_adc1_pads[GPIO_ADC_MAX_CHANNELS] = {36, 37, 38, 39, 32, 33, 34, 35};
+
+uint8_t gpio_adc_channel_mask = GPIO_ADC_CHANNEL_MASK;
+uint8_t gpio_adc_n_channels = 1;
+adc1_channel_t gpio_adc_channels[GPIO_ADC_MAX_CHANNELS] = {ADC1_CHANNEL_0};
+uint32_t gpio_adc_scan_ns = 0;
+
 void iaware_init_gpio(void)
 //GPIOs, src: https://docs.espressif.com/projects/esp-idf/en/latest/api-reference/peripherals/adc.html
 {
@@ -29,23 +43,62 @@ void iaware_init_gpio(void)
 
     turn_off_LED_ONBOARD();
 
+    // The interrupts of the trigger and the marker inputs, see init_trigger() and init_marker().
+    if (gpio_install_isr_service(0) != ESP_OK)
+        ESP_LOGE(IAWARE_GPIO, "Main: gpio_install_isr_service() FAIL");
+
 
     // Because we use WiFI, we should not use ADC2.
     // Note that even the hall sensor is internal to ESP32, reading from it uses channels 0 and 3 of ADC1 (GPIO 36 and 39)
     // ULP (Ultra Low Power) coprocessor is a simple FSM which is designed to perform measurements using ADC, temperature sensor, and external I2C sensors, while main processors are in deep sleep mode. 
 
-    adc1_config_width(ADC_WIDTH_BIT_12);
-    adc1_config_channel_atten(ADC1_CHANNEL_0, ADC_ATTEN_DB_0);
+    adc1_config_width(ADC_WIDTH_BIT_12); // GPIO_ADC_BITS
+
+    init_adc_channels();
 
-    int64_t pre_time = esp_timer_get_time();
-    adc1_get_raw(ADC1_CHANNEL_0);
-    
-    ESP_LOGW(IAWARE_GPIO, "Main: adc1_get_raw use %" PRId64 " microsec.", (esp_timer_get_time() - pre_time));   
+    benchmark_adc_channels();
 }
 
 int iaware_analogRead(void)
 {
-    return adc1_get_raw(ADC1_CHANNEL_0);
+    return adc1_get_raw(gpio_adc_channels[0]);
+}
+
+int iaware_analogRead_channel(uint8_t i_channel)
+// Params:
+//     i_channel    : The position in the scan order, from 0 to gpio_adc_n_channels - 1.
+{
+    return adc1_get_raw(gpio_adc_channels[i_channel]);
+}
+
+void source_init_adc(struct sample_source *src)
+// The default source of sampling_data_callback(), see iaware_source.h.
+{
+    src->ctx        = NULL;
+    src->kind       = SOURCE_ADC;
+    src->read_scan  = adc_read_scan;
+}
+
+uint8_t gpio_adc_count_channels(uint8_t channel_mask)
+{
+    uint8_t n = 0;
+
+    for (uint8_t i = 0; i < GPIO_ADC_MAX_CHANNELS; i++)
+    {
+        if (channel_mask & (1 << i))
+            n = n + 1;
+    }
+
+    return n;
+}
+
+int gpio_adc_set_channel_mask(uint8_t channel_mask)
+// Keep the new mask in NVS. It takes effect at the next boot.
+{
+    if (channel_mask == 0)
+        return iawFalse;
+
+    return nvs_write_u32(GPIO_NVS_CHANNEL_MASK, channel_mask);
 }
 
 void led_onboard_send_data_to_client(void)
@@ -99,4 +152,64 @@ void turn_off_LED_ONBOARD(void)
     gpio_set_level(GPIO_LED_ONBOARD, GPIO_OUTPUT_LOW);       
 }
 
+//////////////////// Private ////////////////////
 
+static void init_adc_channels(void)
+{
+    uint32_t value;
+
+    if ((nvs_read_u32(GPIO_NVS_CHANNEL_MASK, &value) == iawTrue) && ((value & 0xFF) != 0))
+        gpio_adc_channel_mask = (uint8_t) (value & 0xFF);
+
+    gpio_adc_n_channels = 0;
+
+    for (uint8_t i = 0; i < GPIO_ADC_MAX_CHANNELS; i++)
+    {
+        if (gpio_adc_channel_mask & (1 << i))
+        {
+            gpio_adc_channels[gpio_adc_n_channels] = (adc1_channel_t) i;
+            gpio_adc_n_channels = gpio_adc_n_channels + 1;
+
+            adc1_config_channel_atten((adc1_channel_t) i, GPIO_ADC_ATTEN);
+        }
+    }
+
+    ESP_LOGI(IAWARE_GPIO, "Main: Channel mask 0x%02x, %d channels.", gpio_adc_channel_mask, gpio_adc_n_channels);
+}
+
+static void benchmark_adc_channels(void)
+// Time the reads of every channel, because a scan must finish within one tick of the sampling timer.
+{
+    gpio_adc_scan_ns = 0;
+
+    for (uint8_t i_channel = 0; i_channel < gpio_adc_n_channels; i_channel++)
+    {
+        int64_t pre_time = esp_timer_get_time();
+
+        for (uint32_t i = 0; i < GPIO_ADC_BENCH_READS; i++)
+        {
+            iaware_analogRead_channel(i_channel);
+        }
+
+        uint32_t read_ns = (uint32_t) ((esp_timer_get_time() - pre_time)*1000/GPIO_ADC_BENCH_READS);
+
+        gpio_adc_scan_ns = gpio_adc_scan_ns + read_ns;
+
+        ESP_LOGI(IAWARE_GPIO, "Main: ADC1 channel %d (GPIO %d) takes %d ns per read, i.e. at most %d samples/s.", gpio_adc_channels[i_channel], gpio_adc1_pads[gpio_adc_channels[i_channel]], read_ns, (read_ns > 0) ? (1000000000/read_ns) : 0);
+    }
+
+    uint32_t max_fs = (gpio_adc_scan_ns > 0) ? (1000000000/gpio_adc_scan_ns) : 0;
+
+    if (sampling_data_fs > max_fs)
+        ESP_LOGW(IAWARE_GPIO, "Main: A scan of %d channels takes %d ns. %d Hz exceeds the highest sampling frequency of %d Hz.", gpio_adc_n_channels, gpio_adc_scan_ns, sampling_data_fs, max_fs);
+    else
+        ESP_LOGI(IAWARE_GPIO, "Main: A scan of %d channels takes %d ns, i.e. at most %d Hz.", gpio_adc_n_channels, gpio_adc_scan_ns, max_fs);
+}
+
+static void adc_read_scan(void *ctx, uint16_t *scan, uint8_t n_channels)
+{
+    for (uint8_t i_channel = 0; i_channel < n_channels; i_channel++)
+    {
+        scan[i_channel] = (uint16_t) adc1_get_raw(gpio_adc_channels[i_channel]);
+    }
+}
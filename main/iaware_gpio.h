@@ -8,8 +8,30 @@
 #define GPIO_OUTPUT_HIGH 	1
 
 #define GPIO_LED_ONBOARD 	GPIO_NUM_2
+#define GPIO_TRIGGER		GPIO_NUM_4	// The input of the external trigger, pulled down. See iaware_trigger.h.
+#define GPIO_MARKER			GPIO_NUM_5	// The input of the event markers, pulled down. See iaware_marker.h.
+
+#define GPIO_ADC_BITS		12	// See adc1_config_width() in iaware_init_gpio().
+#define GPIO_ADC_ATTEN		ADC_ATTEN_DB_0	// About 0 to 1.1 V. See iaware_adc_cal.h for the calibration.
+
+// Up to eight ADC1 channels are scanned at every tick of the sampling timer. ADC2 cannot be used while Wi-Fi is on.
+// Bit i of the channel mask selects ADC1_CHANNEL_i. The mask is kept in NVS, and CMD_SET_CHANNEL_MASK restarts ESP32
+// because the buff nodes are sized from the number of channels.
+#define GPIO_ADC_MAX_CHANNELS	8
+#define GPIO_ADC_CHANNEL_MASK	0x01	// The default, ADC1_CHANNEL_0 (GPIO 36) only.
+#define GPIO_NVS_CHANNEL_MASK	"ch_mask"
+
+#define GPIO_ADC_BENCH_READS	64		// The reads per channel timed by iaware_init_gpio().
+
+extern uint8_t gpio_adc_channel_mask;
+extern uint8_t gpio_adc_n_channels;
+extern adc1_channel_t gpio_adc_channels[GPIO_ADC_MAX_CHANNELS];	// The scan order, i.e. the order of the channels in a block.
+extern uint32_t gpio_adc_scan_ns;	// The time of one scan over all channels, measured at boot.
 
 int iaware_analogRead(void);
+int iaware_analogRead_channel(uint8_t i_channel);
+uint8_t gpio_adc_count_channels(uint8_t channel_mask);
+int gpio_adc_set_channel_mask(uint8_t channel_mask);
 void iaware_init_gpio(void);
 
 void turn_on_LED_ONBOARD(void);
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "esp_err.h"
 #include "esp_event.h"
@@ -11,8 +12,10 @@
 #include "freertos/semphr.h"
 #include "nvs_flash.h"
 
+#include "iaware_arena.h"
 #include "iaware_helper.h"
 #include "iaware_packet.h"
+#include "iaware_stream.h"
 #include "main.h"
 
 
@@ -92,7 +95,7 @@ const char* err_to_str(esp_err_t err)
 }
 
 void pop_buff_node_group1(void) 
-// The function frees tail_buff_node_ptr. If it is the last element, it will empty the list.
+// The function unlinks tail_buff_node_ptr. If it is the last element, it will empty the list. The memory stays in the arena.
 {
     struct buff_node *tmp_ptr = tail_buff_node_ptr;
 
@@ -144,6 +147,7 @@ int append_buff_node_group1(uint32_t elt_count)
 }
 
 void free_all_buff_node_group1(void)
+// Release all buff nodes at once by resetting the arena.
 {
     while (tail_buff_node_ptr != NULL)
     {
@@ -157,9 +161,12 @@ void free_all_buff_node_group1(void)
     head_buff_node_ptr  = NULL;
     run_buff_node_ptr   = NULL;
     tail_buff_node_ptr  = NULL;  
+
+    arena_reset();
 }
 
 void free_buff_node_group1(struct buff_node **curr_ptr)
+// Unlink the buff node. Its memory belongs to the arena and is released only by free_all_buff_node_group1().
 {
     if ((*curr_ptr) != NULL)
     {
@@ -177,40 +184,38 @@ void free_buff_node_group1(struct buff_node **curr_ptr)
             next_ptr->prev = prev_ptr;
         }
 
-        free((*curr_ptr)->samples_buff);
-        free(*curr_ptr);
-
         *curr_ptr = NULL;
     }
 }
 
+uint32_t buff_node_group1_size(uint32_t elt_count)
+// The number of bytes that buff_node_group1_alloc() takes from the arena.
+{
+    return ((sizeof(struct buff_node) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1)) + ((STREAM_HEADROOM + 2*elt_count + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1));
+}
+
 struct buff_node *buff_node_group1_alloc(uint32_t elt_count) 
+// Take the buff node and its samples_buff from the arena. It never touches the heap.
 {
-    uint8_t *samples_buff = NULL;
-    if ((samples_buff = (uint8_t *)calloc(4 + PACKET_HEADER_GROUP1_META_SIZE + 2*elt_count, sizeof(uint8_t))) == NULL) // 4 bytes for the length + 1 byte for PACKET_HEADER_GROUPx + 8 bytes to represent the duration in microsec that we use to contruct that data. We multiply with 2 because each sample is represented by two bytes.
+    struct buff_node *retVal = (struct buff_node *) arena_alloc(sizeof(struct buff_node));
+    if (retVal == NULL)
         return NULL;
 
-    uint8_t a[4];
-    uint32_to_bytes(PACKET_HEADER_GROUP1_META_SIZE + 2*elt_count, a); // 1 byte for PACKET_HEADER_GROUPx, 8 bytes for the duration in microsec.
-    samples_buff[0] = a[0];
-    samples_buff[1] = a[1];
-    samples_buff[2] = a[2];
-    samples_buff[3] = a[3];
+    uint8_t *samples_buff = NULL;
+    if ((samples_buff = (uint8_t *) arena_alloc(STREAM_HEADROOM + 2*elt_count)) == NULL) // The header is written into STREAM_HEADROOM when the node is sent. We multiply with 2 because each sample is represented by two bytes.
+        return NULL;
 
-    samples_buff[4] = PACKET_HEADER_GROUP1;
+    memset(samples_buff, 0, STREAM_HEADROOM + 2*elt_count);
 
-    struct buff_node *retVal = malloc(sizeof(struct buff_node));
-    if (retVal == NULL)
-    {
-        free(samples_buff);
-        return NULL;    
-    }
-    
     retVal->prev = NULL;
 
     retVal->is_sent = iawTrue;
+    retVal->is_spilled = iawTrue;
+    retVal->is_filtered = iawTrue;
+    retVal->is_filter_bypassed = iawTrue;
 
     retVal->packet_header_group_id = PACKET_HEADER_GROUP1;
+    retVal->stream_flags = 0;
 
     retVal->t_begin = 0;
 
@@ -219,6 +224,12 @@ struct buff_node *buff_node_group1_alloc(uint32_t elt_count)
     retVal->n_samples               = 2*elt_count;
     retVal->i_samples               = 0;
 
+    retVal->eff_sampling_freq       = 0;
+
+    retVal->block_seq               = 0;
+
+    stats_reset(&(retVal->stats), STATS_MAX_CHANNELS);
+
     retVal->next = NULL;
 
     return retVal;    
@@ -266,7 +277,7 @@ uint32_t bytes_to_uint32(uint8_t a[])
 uint64_t bytes_to_uint64(uint8_t a[])
 // a[0] contains the leading bits.
 {
-    return (a[0] << 56) | (a[1] << 48) | (a[2] << 40) | (a[3] << 32) | (a[4] << 24) | (a[5] << 16) | (a[6] << 8) | a[7];    
+    return (((uint64_t) bytes_to_uint32(&(a[0]))) << 32) | ((uint64_t) bytes_to_uint32(&(a[4])));
 }
 
 
@@ -3,23 +3,33 @@
 
 #include "esp_err.h"
 
+#include "iaware_stats.h"
+
 struct buff_node
 {
     struct buff_node *prev;
 
     uint8_t is_sent;
+    uint8_t is_spilled; // The same handshake as is_sent, but with flash_spill_task().
+    uint8_t is_filtered; // The same handshake with sampling_filter_task(), which then sets is_sent and is_spilled.
+    uint8_t is_filter_bypassed; // No filter was set when the block completed, so is_sent and is_spilled are already set.
 
     uint8_t packet_header_group_id;
+    uint8_t stream_flags; // STREAM_FLAG_PLANAR when the samples are grouped by channel, see iaware_stream.h.
 
     uint64_t t_begin; // [microsec]. The time that we begin to fill in samples_buff.
 
     uint8_t *samples_buff;
 
-    uint32_t n_samples; // It equals sizeof(samples_buff) - 4 (4 bytes equaling n_samples) - PACKET_HEADER_GROUPx_META_SIZE.
+    uint32_t n_samples; // [bytes]. It equals sizeof(samples_buff) - STREAM_HEADROOM. The samples start at samples_buff + STREAM_HEADROOM. A scan of gpio_adc_n_channels samples takes 2*gpio_adc_n_channels bytes.
     uint32_t i_samples; // i_samples starts from 0 to n_samples - 1.
 
     uint32_t eff_sampling_freq;
 
+    uint32_t block_seq; // Counts the completed blocks since boot. It orders the live and the backfilled blocks.
+
+    struct block_stats stats; // Of the raw reads of the block. The sampling callback resets it when the previous block completes.
+
     struct buff_node *next;
 };
 
@@ -29,6 +39,7 @@ void free_all_buff_node_group1(void);
 void free_buff_node_group1(struct buff_node **curr_ptr);
 void pop_buff_node_group1(void);
 struct buff_node *buff_node_group1_alloc(uint32_t elt_count);
+uint32_t buff_node_group1_size(uint32_t elt_count);
 
 void free_null(void **ptr);
 
@@ -0,0 +1,763 @@
+import collections
+import math
+import socket
+import struct
+
+import numpy as np
+
+# Host-side helpers for the packets that ESP32 sends on TCP_SEND_PORT. The constants must match iaware_packet.c.
+
+PACKET_HEADER_COMMAND=0
+PACKET_HEADER_GROUP1=1
+PACKET_HEADER_GROUP2=2
+PACKET_HEADER_LOG=3
+PACKET_HEADER_LOG_FORMATS=4
+PACKET_HEADER_GROUP1_BACKFILL=5
+PACKET_HEADER_RECORD_INFO=6
+PACKET_HEADER_RECORD_FIND=7
+PACKET_HEADER_RECORD_DATA=8
+PACKET_HEADER_STREAM=9
+PACKET_HEADER_STREAM_VERSION=10
+PACKET_HEADER_FEATURE=11
+PACKET_HEADER_TRIGGER=12
+PACKET_HEADER_MARKER=13
+PACKET_HEADER_ADC_CAL=14
+PACKET_HEADER_BLE_FRAGMENT=15
+PACKET_HEADER_BLE_BENCH=16
+PACKET_HEADER_BLE_ACK=17
+PACKET_HEADER_BLE_LINK=18
+PACKET_HEADER_BLE_STATS=19
+PACKET_HEADER_BLE_HUB=20
+
+CMD_START_STREAM=0
+CMD_STOP_STREAM=1
+CMD_SET_SAMPLING_FREQUENCY=2
+CMD_SET_SEND_DATA_FREQUENCY=3
+CMD_SET_LOG_SINK=4
+CMD_GET_LOG_FORMATS=5
+CMD_SET_RECORD_MODE=6
+CMD_GET_RECORD_INFO=7
+CMD_FIND_RECORD=8
+CMD_READ_RECORD=9
+CMD_SET_STREAM_VERSION=10
+CMD_SET_CHANNEL_MASK=11
+CMD_SET_STREAM_LAYOUT=12
+CMD_SET_DECIMATION=13
+CMD_SET_FILTER=14
+CMD_SET_FEATURES=15
+CMD_SET_DEGRADE=16
+CMD_SET_TRIGGER=17
+CMD_TRIGGER=18
+CMD_MARKER=19
+CMD_SET_STREAM_STATS=20
+CMD_GET_ADC_CAL=21
+CMD_SET_ADC_CAL=22
+CMD_SET_SOURCE=23
+CMD_SET_BLE_BENCH=24
+CMD_SET_BLE_ADV=25
+
+STREAM_VERSION_1=1
+STREAM_VERSION_2=2
+STREAM_VERSION_MAX=STREAM_VERSION_2
+STREAM_FLAG_BACKFILL=0x01
+STREAM_FLAG_PLANAR=0x02
+STREAM_FLAG_TRIGGERED=0x04
+STREAM_FLAG_PREVIEW=0x08
+STREAM_FLAG_STATS=0x10
+STREAM_FLAG_CALIBRATED=0x20
+STREAM_FLAG_SYNTHETIC=0x40
+STREAM_LAYOUT_INTERLEAVED=0
+STREAM_LAYOUT_PLANAR=1
+STREAM_ENCODING_U16_BE=0
+STREAM_ENCODING_DELTA8=1
+STREAM_ENCODING_U8=2
+
+# See iaware_degrade.h.
+DEGRADE_LEVEL_FULL=0
+DEGRADE_LEVEL_COMPRESS=1
+DEGRADE_LEVEL_DECIMATE=2
+DEGRADE_LEVEL_PREVIEW=3
+DEGRADE_DELTA_ESCAPE=0x80
+
+# See iaware_trigger.h.
+TRIGGER_SOURCE_GPIO=0x01
+TRIGGER_SOURCE_THRESHOLD=0x02
+TRIGGER_SOURCE_HOST=0x04
+
+# See iaware_marker.h.
+MARKER_SOURCE_GPIO=0x01
+MARKER_SOURCE_HOST=0x02
+MARKER_SCAN_UNKNOWN=0xFFFF
+
+# See iaware_stats.h.
+STATS_FRAC_BITS=4
+STATS_DTYPE=np.dtype([("min", ">u2"), ("max", ">u2"), ("mean", ">u2"), ("std", ">u2"), ("n_saturated", ">u2")])
+
+# See iaware_source.h.
+SOURCE_ADC=0
+SOURCE_SINE=1
+SOURCE_CHIRP=2
+SOURCE_NOISE=3
+SOURCE_REPLAY=4
+SOURCE_CHANNEL_PHASE=1 << 29
+SOURCE_SINE_TABLE=[round(32767*math.sin(i_l*math.pi/128)) for i_l in range(65)]
+
+# See iaware_adc_cal.h.
+ADC_CAL_BITS=16
+
+# See iaware_decimate.h.
+DECIMATE_OFF=1
+DECIMATE_CIC_STAGES=3
+DECIMATE_FIR_Q=15
+DECIMATE_CIC_FRAC_BITS=3
+DECIMATE_IN_BITS=12
+FILTER_Q=14
+FILTER_MAX_SECTIONS=4
+FILTER_ALL_CHANNELS=0xFF
+
+# See iaware_feature.h.
+FEATURE_PERIOD_OFF=0
+FEATURE_BANDS=["delta", "theta", "alpha", "beta", "gamma"]
+FEATURE_POWER_NONE=-32768
+
+DECIMATE_FIR_COEFS=np.array([171, 190, -392, -652, 646, 1630, -782, -3753, 183, 10802, 16682, 10802, 183, -3753, -782, 1630, 646, -652, -392, 190, 171], dtype=np.int64)
+
+BLOG_SINK_UART=0
+BLOG_SINK_NETWORK=1
+
+BLOG_TAGS=["iaware_event", "iaware_network", "iaware_core", "iaware_gpio", "iaware_ble"]
+BLOG_LEVELS="NEWIDV"
+BLOG_RECORD_STRUCT=struct.Struct(">IHBBiii")    # |t_ms|fmt_id|tag_id|level|arg0|arg1|arg2|, see iaware_blog.h
+BACKFILL_META_STRUCT=struct.Struct(">IQI")      # |block_seq|t_begin|eff_sampling_freq|, see PACKET_HEADER_GROUP1_BACKFILL_META_SIZE
+GROUP1_META_STRUCT=struct.Struct(">I")          # |eff_sampling_freq|
+STREAM_V2_STRUCT=struct.Struct(">BBBBBBBIQII")  # |version|flags|n_channels|encoding|bits|channel_mask|level|block_seq|t_begin|rate|n_samples|, see iaware_stream.h
+FEATURE_STRUCT=struct.Struct(">BBBHI")          # |n_channels|n_bands|channel_mask|feature_seq|t_end|, see PACKET_HEADER_FEATURE_META_SIZE
+TRIGGER_STRUCT=struct.Struct(">BIIQII")         # |source|trigger_count|block_seq|t|first_block_seq|last_block_seq|, see PACKET_HEADER_TRIGGER_META_SIZE
+BLE_FRAGMENT_STRUCT=struct.Struct(">BIHH")       # |PACKET_HEADER_BLE_FRAGMENT|block_seq|i_frag|n_frags|, see iaware_ble_stream.h
+BLE_BENCH_STRUCT=struct.Struct(">BIQ")          # |PACKET_HEADER_BLE_BENCH|bench_seq|t|, see iaware_ble_stream.h
+BLE_ACK_STRUCT=struct.Struct(">BBBH")           # |PACKET_HEADER_BLE_ACK|cmd|is_known|n_cmds|, see iaware_ble_svr_com.h
+BLE_LINK_STRUCT=struct.Struct(">BHHHHHBBHIHH")  # |PACKET_HEADER_BLE_LINK|conn_int|latency|timeout|tx_data_len|rx_data_len|tx_phy|rx_phy|mtu|rate|want_min_int|want_max_int|, see iaware_ble_link.h
+BLE_SCAN_REPORT_STRUCT=struct.Struct(">6sBbBB") # |bda|addr_type|rssi|is_complete|len|, see iaware_ble_scan_replay.c
+BleLink=collections.namedtuple("BleLink", ["conn_int_ms", "latency", "timeout_ms", "tx_data_len", "rx_data_len", "tx_phy", "rx_phy", "mtu", "rate", "want_min_int_ms", "want_max_int_ms"])
+BLE_STATS_STRUCT=struct.Struct(">BIIIHBB")      # |PACKET_HEADER_BLE_STATS|n_blocks|n_frags_sent|n_skipped|n_cmds|credits|is_congested|, then a PACKET_HEADER_BLE_LINK packet, see BLE_STATS_SIZE
+BLE_HUB_STRUCT=struct.Struct(">B6s")            # |source|bda|, then the v2 frame without its 4-bytes length, see iaware_ble_hub.h
+BLE_ADV_METRICS_STRUCT=struct.Struct(">BBBBIIIH")  # |version|flags|n_channels|battery|rate|block_seq|n_dropped|n_skipped|, see iaware_ble_adv.h
+BleAdvMetrics=collections.namedtuple("BleAdvMetrics", ["flags", "n_channels", "battery", "rate", "block_seq", "n_dropped", "n_skipped"])
+BLE_ADV_METRICS_VERSION=1
+BLE_ADV_COMPANY_ID=0xFFFF
+BLE_UUID_SERVICE=bytes([0x66, 0x43, 0xAE, 0x10, 0x79, 0x48, 0xF8, 0xA5, 0x91, 0x45, 0xB4, 0xBB, 0x78, 0x1E, 0x61, 0xD0])  # IAWARE_BLE_UUID128(IAWARE_BLE_UUID_SERVICE), as in the advertising payload
+BleStats=collections.namedtuple("BleStats", ["n_blocks", "n_frags_sent", "n_skipped", "n_cmds", "credits", "is_congested", "link"])
+MARKER_STRUCT=struct.Struct(">BBIHQ")           # |source|value|block_seq|i_scan|t|, see MARKER_RECORD_SIZE
+ADC_CAL_STRUCT=struct.Struct(">BBBIIII")       # |is_on|source|atten|vref|coeff_a|coeff_b|uv_per_lsb|, see PACKET_HEADER_ADC_CAL_META_SIZE
+AdcCal=collections.namedtuple("AdcCal", ["is_on", "source", "atten", "vref", "coeff_a", "coeff_b", "uv_per_lsb"])
+Marker=collections.namedtuple("Marker", ["source", "value", "block_seq", "i_scan", "t"])
+TriggerEvent=collections.namedtuple("TriggerEvent", ["source", "trigger_count", "block_seq", "t", "first_block_seq", "last_block_seq"])
+
+# A sample block of any header version. The fields that the version does not carry are None.
+StreamBlock=collections.namedtuple("StreamBlock", ["version", "flags", "n_channels", "encoding", "bits", "channel_mask", "level", "block_seq", "t_begin", "rate", "samples", "stats"], defaults=(None,))
+BlockStats=collections.namedtuple("BlockStats", ["n_reads", "min", "max", "mean", "std", "n_saturated"])
+
+RECORD_INFO_STRUCT=struct.Struct(">BIQQI")      # |is_record_mode|boot_count|vaddr_begin|vaddr_end|sector_size|
+RECORD_DATA_STRUCT=struct.Struct(">IQB")        # |req_id|vaddr|flags|
+RECORD_DATA_FLAG_LAST=0x01
+RECORD_DATA_FLAG_OVERWRITTEN=0x02
+
+# The raw log is little-endian as ESP32 writes it, see iaware_flash_ring.h.
+FLASH_SECTOR_STRUCT=struct.Struct("<IIIIQII")   # |magic|seq|erase_count|boot_count|t_first|block_seq_first|reserved|
+FLASH_REC_STRUCT=struct.Struct("<HBBHBBIIQ")    # |magic|flags|stream_flags|len|channel_mask|bits|block_seq|eff_sampling_freq|t_begin|
+FLASH_SECTOR_MAGIC=0x52574149
+FLASH_REC_MAGIC=0x5AA5
+FLASH_REC_FLAG_COMMITTED=0x01
+FLASH_RING_ALIGN=4
+
+def recv_exact(sock_p, n_p):
+    buff_l = bytearray(n_p)
+    view_l = memoryview(buff_l)
+
+    i_l = 0
+    while (i_l < n_p):
+        r_l = sock_p.recv_into(view_l[i_l:], n_p - i_l)
+        if (r_l == 0):
+            raise ConnectionError("ESP32 closed the connection.")
+        i_l = i_l + r_l
+
+    return buff_l
+
+def recv_packet(sock_p):
+    # Return (header, payload) of a packet |4 bytes length|header|payload|.
+    len_l = struct.unpack(">I", recv_exact(sock_p, 4))[0]
+    msg_l = recv_exact(sock_p, len_l)
+
+    return msg_l[0], memoryview(msg_l)[1:]
+
+def command_frame(cmd_p, payload_p=b""):
+    # The bytes of a command, for TCP_RECV_PORT and for the RX characteristic alike.
+    msg_l = bytes([PACKET_HEADER_COMMAND, cmd_p]) + bytes(payload_p)
+
+    return struct.pack(">I", len(msg_l)) + msg_l
+
+def send_command(sock_p, cmd_p, payload_p=b""):
+    sock_p.sendall(command_frame(cmd_p, payload_p))
+
+def log_set_sink(sock_p, sink_p):
+    send_command(sock_p, CMD_SET_LOG_SINK, bytes([sink_p]))
+
+def log_get_formats(sock_p):
+    send_command(sock_p, CMD_GET_LOG_FORMATS)
+
+def log_parse_formats(payload_p):
+    # payload_p is the payload of a PACKET_HEADER_LOG_FORMATS packet. Return the list of format strings indexed by fmt_id.
+    n_l = struct.unpack_from(">H", payload_p, 0)[0]
+
+    fmts_l = []
+    i_l = 2
+    for _ in range(n_l):
+        len_l = payload_p[i_l]
+        fmts_l.append(bytes(payload_p[i_l + 1:i_l + 1 + len_l]).decode("ascii"))
+        i_l = i_l + 1 + len_l
+
+    return fmts_l
+
+def backfill_parse(payload_p):
+    # payload_p is the payload of a PACKET_HEADER_GROUP1_BACKFILL packet. Return (block_seq, t_begin [microsec], eff_sampling_freq, samples).
+    # The samples are big-endian uint16 like the ones of PACKET_HEADER_GROUP1.
+    block_seq_l, t_begin_l, eff_fs_l = BACKFILL_META_STRUCT.unpack_from(payload_p, 0)
+
+    return block_seq_l, t_begin_l, eff_fs_l, payload_p[BACKFILL_META_STRUCT.size:]
+
+def recv_packet_of(sock_p, header_p):
+    # Skip the other packets, e.g. the live samples and the log, until a packet with header_p arrives.
+    while (True):
+        header_l, payload_l = recv_packet(sock_p)
+
+        if (header_l == header_p):
+            return payload_l
+
+def record_set_mode(sock_recv_p, is_record_mode_p):
+    send_command(sock_recv_p, CMD_SET_RECORD_MODE, bytes([1 if is_record_mode_p else 0]))
+
+def record_get_info(sock_recv_p, sock_send_p):
+    send_command(sock_recv_p, CMD_GET_RECORD_INFO)
+
+    is_record_mode_l, boot_count_l, vaddr_begin_l, vaddr_end_l, sector_size_l = RECORD_INFO_STRUCT.unpack_from(recv_packet_of(sock_send_p, PACKET_HEADER_RECORD_INFO), 0)
+
+    return {"is_record_mode": is_record_mode_l, "boot_count": boot_count_l, "vaddr_begin": vaddr_begin_l, "vaddr_end": vaddr_end_l, "sector_size": sector_size_l}
+
+def record_find(sock_recv_p, sock_send_p, boot_count_p, t_p):
+    # Return the vaddr of the sector that holds the block recorded at t_p [microsec] of boot boot_count_p.
+    send_command(sock_recv_p, CMD_FIND_RECORD, struct.pack(">IQ", boot_count_p, t_p))
+
+    return struct.unpack_from(">Q", recv_packet_of(sock_send_p, PACKET_HEADER_RECORD_FIND), 0)[0]
+
+def record_download(sock_recv_p, sock_send_p, vaddr_begin_p, vaddr_end_p, chunk_p=65536, depth_p=4):
+    # Download the raw log [vaddr_begin_p, vaddr_end_p) with depth_p requests of chunk_p bytes in flight, so the link never idles.
+    # depth_p must not exceed FLASH_TIER_READ_QUEUE_LEN. The bytes that were overwritten meanwhile stay 0xFF.
+    raw_l = bytearray(b"\xff"*(vaddr_end_p - vaddr_begin_p))
+
+    vaddr_next_l = vaddr_begin_p
+    req_id_l = 0
+    in_flight_l = set()
+
+    while ((vaddr_next_l < vaddr_end_p) or (len(in_flight_l) > 0)):
+        while ((vaddr_next_l < vaddr_end_p) and (len(in_flight_l) < depth_p)):
+            len_l = min(chunk_p, vaddr_end_p - vaddr_next_l)
+
+            send_command(sock_recv_p, CMD_READ_RECORD, struct.pack(">IQI", req_id_l, vaddr_next_l, len_l))
+
+            in_flight_l.add(req_id_l)
+            req_id_l = req_id_l + 1
+            vaddr_next_l = vaddr_next_l + len_l
+
+        payload_l = recv_packet_of(sock_send_p, PACKET_HEADER_RECORD_DATA)
+        rid_l, vaddr_l, flags_l = RECORD_DATA_STRUCT.unpack_from(payload_l, 0)
+        data_l = payload_l[RECORD_DATA_STRUCT.size:]
+
+        i_l = vaddr_l - vaddr_begin_p
+        raw_l[i_l:i_l + len(data_l)] = data_l
+
+        if (flags_l & RECORD_DATA_FLAG_LAST):
+            in_flight_l.discard(rid_l)
+
+    return raw_l
+
+def record_parse(raw_p, vaddr_p, sector_size_p):
+    # raw_p is the raw log from the sector-aligned vaddr_p. Return the list of committed blocks as
+    # (boot_count, block_seq, t_begin [microsec], eff_sampling_freq, stream_flags, channel_mask, bits, samples). The samples are big-endian uint16.
+    blocks_l = []
+
+    for i_sector_l in range(0, len(raw_p) - FLASH_SECTOR_STRUCT.size + 1, sector_size_p):
+        magic_l, seq_l, _, boot_count_l, _, _, _ = FLASH_SECTOR_STRUCT.unpack_from(raw_p, i_sector_l)
+
+        # A torn or an overwritten sector is skipped.
+        if ((magic_l != FLASH_SECTOR_MAGIC) or (seq_l != (vaddr_p + i_sector_l)//sector_size_p)):
+            continue
+
+        offset_l = FLASH_SECTOR_STRUCT.size
+        end_l = min(sector_size_p, len(raw_p) - i_sector_l)
+
+        while ((offset_l + FLASH_REC_STRUCT.size) <= end_l):
+            magic_l, flags_l, stream_flags_l, len_l, channel_mask_l, bits_l, block_seq_l, eff_fs_l, t_begin_l = FLASH_REC_STRUCT.unpack_from(raw_p, i_sector_l + offset_l)
+
+            if ((magic_l != FLASH_REC_MAGIC) or ((offset_l + FLASH_REC_STRUCT.size + len_l) > end_l)):
+                break
+
+            if ((flags_l & FLASH_REC_FLAG_COMMITTED) == 0):
+                i_l = i_sector_l + offset_l + FLASH_REC_STRUCT.size
+                blocks_l.append((boot_count_l, block_seq_l, t_begin_l, eff_fs_l, stream_flags_l, channel_mask_l, bits_l, bytes(raw_p[i_l:i_l + len_l])))
+
+            offset_l = offset_l + ((FLASH_REC_STRUCT.size + len_l + FLASH_RING_ALIGN - 1) & ~(FLASH_RING_ALIGN - 1))
+
+    return blocks_l
+
+def stream_negotiate(sock_recv_p, sock_send_p, version_p=STREAM_VERSION_MAX):
+    # Ask for version_p right after connecting, before CMD_START_STREAM. Return the version that ESP32 uses.
+    # The firmware that does not know CMD_SET_STREAM_VERSION never replies, so use a timeout on sock_send_p to fall back to v1.
+    send_command(sock_recv_p, CMD_SET_STREAM_VERSION, bytes([version_p]))
+
+    return recv_packet_of(sock_send_p, PACKET_HEADER_STREAM_VERSION)[0]
+
+def stream_parse(header_p, payload_p):
+    # Return a StreamBlock for a sample packet, or None for the other packets. The samples are a numpy view on payload_p, no copy,
+    # except for a STREAM_ENCODING_DELTA8 block, which is decoded.
+    if (header_p == PACKET_HEADER_STREAM):
+        version_l, flags_l, n_channels_l, encoding_l, bits_l, channel_mask_l, level_l, block_seq_l, t_begin_l, rate_l, n_samples_l = STREAM_V2_STRUCT.unpack_from(payload_p, 0)
+        offset_l = STREAM_V2_STRUCT.size
+        stats_l = None
+
+        if (flags_l & STREAM_FLAG_STATS):
+            stats_l = stats_parse(payload_p, offset_l, n_channels_l)
+            offset_l = offset_l + 4 + STATS_DTYPE.itemsize*n_channels_l
+
+        if (encoding_l == STREAM_ENCODING_DELTA8):
+            samples_l = stream_delta8_decode(payload_p[offset_l:], n_samples_l, n_channels_l, flags_l & STREAM_FLAG_PLANAR)
+        elif (encoding_l == STREAM_ENCODING_U8):
+            samples_l = np.frombuffer(payload_p, dtype=np.uint8, count=n_samples_l*n_channels_l, offset=offset_l)
+        else:
+            samples_l = np.frombuffer(payload_p, dtype=">u2", count=n_samples_l*n_channels_l, offset=offset_l)
+
+        return StreamBlock(version_l, flags_l, n_channels_l, encoding_l, bits_l, channel_mask_l, level_l, block_seq_l, t_begin_l, rate_l, samples_l, stats_l)
+
+    if (header_p == PACKET_HEADER_GROUP1):
+        rate_l = GROUP1_META_STRUCT.unpack_from(payload_p, 0)[0]
+
+        return StreamBlock(STREAM_VERSION_1, 0, 1, STREAM_ENCODING_U16_BE, None, None, None, None, None, rate_l, np.frombuffer(payload_p, dtype=">u2", offset=GROUP1_META_STRUCT.size))
+
+    if (header_p == PACKET_HEADER_GROUP1_BACKFILL):
+        block_seq_l, t_begin_l, rate_l = BACKFILL_META_STRUCT.unpack_from(payload_p, 0)
+
+        return StreamBlock(STREAM_VERSION_1, STREAM_FLAG_BACKFILL, 1, STREAM_ENCODING_U16_BE, None, None, None, block_seq_l, t_begin_l, rate_l, np.frombuffer(payload_p, dtype=">u2", offset=BACKFILL_META_STRUCT.size))
+
+    return None
+
+def ble_stream_blocks(values_p):
+    # Reassemble the sample blocks from the values of the TX notifications, in the order of arrival, see iaware_ble_stream.h.
+    # Yield a StreamBlock per complete block. A block with a missing fragment is dropped, and the other notifications, e.g. the
+    # PACKET_HEADER_FEATURE ones, are skipped.
+    block_seq_l = None
+    parts_l = []
+
+    for value_l in values_p:
+        if (len(value_l) < BLE_FRAGMENT_STRUCT.size) or (value_l[0] != PACKET_HEADER_BLE_FRAGMENT):
+            continue
+
+        _, seq_l, i_frag_l, n_frags_l = BLE_FRAGMENT_STRUCT.unpack_from(value_l, 0)
+
+        if (i_frag_l == 0):
+            block_seq_l = seq_l
+            parts_l = []
+
+        if (seq_l != block_seq_l) or (i_frag_l != len(parts_l)):
+            block_seq_l = None
+            continue
+
+        parts_l.append(bytes(value_l[BLE_FRAGMENT_STRUCT.size:]))
+
+        if (len(parts_l) == n_frags_l):
+            frame_l = b"".join(parts_l)
+            block_seq_l = None
+
+            # The frame is the packet of a v2 TCP client, |(4bytes)|PACKET_HEADER_STREAM|header|samples|.
+            yield stream_parse(frame_l[4], memoryview(frame_l)[5:])
+
+def ble_hub_parse(payload_p):
+    # The payload of a PACKET_HEADER_BLE_HUB packet as (source, bda, StreamBlock). bda is the address of the peripheral, e.g. "24:0a:c4:..".
+    source_l, bda_l = BLE_HUB_STRUCT.unpack_from(payload_p, 0)
+    frame_l = payload_p[BLE_HUB_STRUCT.size:]
+
+    return source_l, ":".join("%02x" % b for b in bda_l), stream_parse(frame_l[0], frame_l[1:])
+
+def ble_acks(values_p):
+    # Yield (cmd, is_known, n_cmds) per PACKET_HEADER_BLE_ACK among the values of the TX notifications. A jump of n_cmds by
+    # more than one means that acknowledgements were coalesced, not that commands were lost.
+    for value_l in values_p:
+        if (len(value_l) >= BLE_ACK_STRUCT.size) and (value_l[0] == PACKET_HEADER_BLE_ACK):
+            _, cmd_l, is_known_l, n_cmds_l = BLE_ACK_STRUCT.unpack_from(value_l, 0)
+
+            yield cmd_l, bool(is_known_l), n_cmds_l
+
+def ble_link_parse(value_p):
+    # The link parameters of a PACKET_HEADER_BLE_LINK notification, with the intervals and the timeout in ms. None for another one.
+    if (len(value_p) < BLE_LINK_STRUCT.size) or (value_p[0] != PACKET_HEADER_BLE_LINK):
+        return None
+
+    _, conn_int_l, latency_l, timeout_l, tx_len_l, rx_len_l, tx_phy_l, rx_phy_l, mtu_l, rate_l, min_int_l, max_int_l = BLE_LINK_STRUCT.unpack_from(value_p, 0)
+
+    return BleLink(conn_int_l*1.25, latency_l, timeout_l*10, tx_len_l, rx_len_l, tx_phy_l, rx_phy_l, mtu_l, rate_l, min_int_l*1.25, max_int_l*1.25)
+
+def ble_stats_parse(value_p):
+    # The value of the stats characteristic (IAWARE_BLE_CHARACTERISTIC_UUID_STATS). None when it is not one.
+    if (len(value_p) < BLE_STATS_STRUCT.size) or (value_p[0] != PACKET_HEADER_BLE_STATS):
+        return None
+
+    _, n_blocks_l, n_frags_l, n_skipped_l, n_cmds_l, credits_l, is_congested_l = BLE_STATS_STRUCT.unpack_from(value_p, 0)
+
+    return BleStats(n_blocks_l, n_frags_l, n_skipped_l, n_cmds_l, credits_l, is_congested_l, ble_link_parse(value_p[BLE_STATS_STRUCT.size:]))
+
+def ble_bench_set(sock_p, is_on_p):
+    # Fill the BLE notifications with PACKET_HEADER_BLE_BENCH instead of the sample blocks. ESP32 logs BLOG_FMT_BLE_BENCH every second.
+    send_command(sock_p, CMD_SET_BLE_BENCH, bytes([1 if is_on_p else 0]))
+
+def ble_bench_stats(values_p, duration_s_p):
+    # The throughput [kbit/s] of the PACKET_HEADER_BLE_BENCH notifications received over duration_s_p, and the ones lost by bench_seq.
+    n_bytes_l = 0
+    n_lost_l = 0
+    bench_seq_l = None
+
+    for value_l in values_p:
+        if (len(value_l) < BLE_BENCH_STRUCT.size) or (value_l[0] != PACKET_HEADER_BLE_BENCH):
+            continue
+
+        _, seq_l, _ = BLE_BENCH_STRUCT.unpack_from(value_l, 0)
+
+        if (bench_seq_l is not None) and (seq_l > bench_seq_l + 1):
+            n_lost_l = n_lost_l + (seq_l - bench_seq_l - 1)
+
+        bench_seq_l = seq_l
+        n_bytes_l = n_bytes_l + len(value_l)
+
+    return n_bytes_l*8/1000/duration_s_p, n_lost_l
+
+def ble_adv_set(sock_p, is_metrics_p, interval_ms_p):
+    # Broadcast the metrics in the scan response (iaware_ble_adv.h) and advertise every interval_ms_p to 2*interval_ms_p [ms], 20 to 5120. ESP32 keeps both over a reboot.
+    send_command(sock_p, CMD_SET_BLE_ADV, bytes([1 if is_metrics_p else 0]) + struct.pack(">H", interval_ms_p))
+
+def ble_adv_metrics_parse(data_p):
+    # The metrics of the manufacturer data after the company id, e.g. advertisement_data.manufacturer_data[BLE_ADV_COMPANY_ID] of bleak. None for another version.
+    if (len(data_p) < BLE_ADV_METRICS_STRUCT.size) or (data_p[0] != BLE_ADV_METRICS_VERSION):
+        return None
+
+    return BleAdvMetrics(*BLE_ADV_METRICS_STRUCT.unpack_from(data_p, 0)[1:])
+
+def ble_adv_metrics_from_adv(adv_p):
+    # The metrics of a raw advertising payload, i.e. its AD structures |len|type|len - 1 bytes|. None when it carries none.
+    i_l = 0
+
+    while i_l + 1 < len(adv_p):
+        len_l = adv_p[i_l]
+
+        if (len_l == 0) or (i_l + 1 + len_l > len(adv_p)):
+            break
+
+        if (adv_p[i_l + 1] == 0xFF) and (len_l >= 3) and (struct.unpack_from("<H", adv_p, i_l + 2)[0] == BLE_ADV_COMPANY_ID):
+            metrics_l = ble_adv_metrics_parse(adv_p[i_l + 4:i_l + 1 + len_l])
+
+            if metrics_l is not None:
+                return metrics_l
+
+        i_l = i_l + 1 + len_l
+
+    return None
+
+def stats_parse(payload_p, offset_p, n_channels_p):
+    # The statistics of a STREAM_FLAG_STATS block, per channel in the order of the block. mean and std are in LSB of the raw reads.
+    n_reads_l = struct.unpack_from(">I", payload_p, offset_p)[0]
+    s_l = np.frombuffer(payload_p, dtype=STATS_DTYPE, count=n_channels_p, offset=offset_p + 4)
+
+    return BlockStats(n_reads_l, s_l["min"].astype(np.int64), s_l["max"].astype(np.int64), s_l["mean"]/2.0**STATS_FRAC_BITS, s_l["std"]/2.0**STATS_FRAC_BITS, s_l["n_saturated"].astype(np.int64))
+
+def stream_delta8_decode(data_p, n_samples_p, n_channels_p, is_planar_p):
+    # Undo degrade_delta8(). Return the samples as a native uint16 array in the order of the block.
+    n_values_l = n_samples_p*n_channels_p
+    samples_l = np.empty(n_values_l, dtype=np.uint16)
+    prev_l = [0]*n_channels_p
+
+    i_l = 0
+    for i_value_l in range(n_values_l):
+        i_channel_l = (i_value_l//n_samples_p) if is_planar_p else (i_value_l % n_channels_p)
+
+        if (data_p[i_l] == DEGRADE_DELTA_ESCAPE):
+            v_l = (data_p[i_l + 1] << 8) | data_p[i_l + 2]
+            i_l = i_l + 3
+        else:
+            v_l = (prev_l[i_channel_l] + struct.unpack_from(">b", data_p, i_l)[0]) & 0xFFFF
+            i_l = i_l + 1
+
+        samples_l[i_value_l] = v_l
+        prev_l[i_channel_l] = v_l
+
+    return samples_l
+
+def stream_set_degrade(sock_p, max_level_p):
+    # DEGRADE_LEVEL_FULL keeps the full blocks whatever the link does. v2 only, it lasts until ESP32 restarts.
+    send_command(sock_p, CMD_SET_DEGRADE, bytes([max_level_p]))
+
+def trigger_set(sock_p, sources_p, pre_ms_p, post_ms_p, i_channel_p=0, threshold_p=0):
+    # sources_p is TRIGGER_SOURCE_x ORed, 0 turns the triggered capture off. i_channel_p is the position of the channel in
+    # the scan order and threshold_p is in the units of the stored samples. v2 only, it lasts until the client disconnects.
+    send_command(sock_p, CMD_SET_TRIGGER, struct.pack(">BHHBH", sources_p, pre_ms_p, post_ms_p, i_channel_p, threshold_p))
+
+def trigger(sock_p):
+    # An event of TRIGGER_SOURCE_HOST in the block being sampled.
+    send_command(sock_p, CMD_TRIGGER)
+
+def trigger_parse(payload_p):
+    # payload_p is the payload of a PACKET_HEADER_TRIGGER packet. The blocks from first_block_seq to last_block_seq come in
+    # full with STREAM_FLAG_TRIGGERED, maybe after their STREAM_FLAG_PREVIEW copy, which they replace.
+    return TriggerEvent(*TRIGGER_STRUCT.unpack_from(payload_p))
+
+def marker(sock_p, code_p):
+    # A marker of MARKER_SOURCE_HOST with an 8-bit code. ESP32 takes its time when it processes the command.
+    send_command(sock_p, CMD_MARKER, bytes([code_p]))
+
+def marker_parse(payload_p):
+    # payload_p is the payload of a PACKET_HEADER_MARKER packet. A marker is on scan i_scan of block block_seq, or only at
+    # t [microsec] when i_scan is MARKER_SCAN_UNKNOWN.
+    return [Marker(*MARKER_STRUCT.unpack_from(payload_p, 1 + i_l*MARKER_STRUCT.size)) for i_l in range(payload_p[0])]
+
+def adc_cal_get(sock_p):
+    # The reply is a PACKET_HEADER_ADC_CAL packet on the send socket, see adc_cal_parse().
+    send_command(sock_p, CMD_GET_ADC_CAL)
+
+def adc_cal_set(sock_p, is_on_p):
+    # Kept in NVS. ESP32 restarts, so reconnect.
+    send_command(sock_p, CMD_SET_ADC_CAL, bytes([1 if is_on_p else 0]))
+
+def adc_cal_parse(payload_p):
+    return AdcCal(*ADC_CAL_STRUCT.unpack(payload_p))
+
+def adc_cal_to_uv(samples_p, cal_p):
+    # [microvolt] from the samples of a STREAM_FLAG_CALIBRATED block.
+    return np.asarray(samples_p, dtype=np.int64)*cal_p.uv_per_lsb
+
+def adc_cal_raw_to_uv(raw_p, cal_p):
+    # [microvolt] from raw 12-bit reads with the linear fit of the chip, as the device does without the curve correction.
+    return (np.asarray(raw_p, dtype=np.int64)*cal_p.coeff_a*1000 + 32768)//65536 + cal_p.coeff_b*1000
+
+def stream_set_stats(sock_p, is_on_p):
+    # The statistics of iaware_stats.h in every block from the next one on. v2 only, it lasts until the client disconnects.
+    send_command(sock_p, CMD_SET_STREAM_STATS, bytes([1 if is_on_p else 0]))
+
+def stream_set_layout(sock_p, layout_p):
+    # STREAM_LAYOUT_PLANAR takes effect from the next block, and only after stream_negotiate() got v2.
+    send_command(sock_p, CMD_SET_STREAM_LAYOUT, bytes([layout_p]))
+
+def set_channel_mask(sock_p, channel_mask_p):
+    # Bit i selects ADC1_CHANNEL_i. ESP32 keeps the mask and restarts, so connect again afterwards.
+    send_command(sock_p, CMD_SET_CHANNEL_MASK, bytes([channel_mask_p]))
+
+def channel_list(channel_mask_p):
+    # The ADC1 channels in the order of a block.
+    return [i_l for i_l in range(8) if (channel_mask_p & (1 << i_l))]
+
+def stream_channels(block_p):
+    # Return the samples of a StreamBlock as a native uint16 array of shape (n_channels, n_samples), row i being channel_list()[i].
+    # The byte swap and the de-interleaving are done by numpy in one vectorized pass over the block.
+    n_channels_l = block_p.n_channels
+
+    if (block_p.flags & STREAM_FLAG_PLANAR):
+        return block_p.samples.reshape(n_channels_l, -1).astype(np.uint16)
+
+    return np.ascontiguousarray(block_p.samples.reshape(-1, n_channels_l).T, dtype=np.uint16)
+
+def set_decimation(sock_p, factor_p):
+    # DECIMATE_OFF, or a power of 2 from 4 to 64. ESP32 keeps the factor and restarts, so connect again afterwards.
+    send_command(sock_p, CMD_SET_DECIMATION, bytes([factor_p]))
+
+def source_set(sock_p, kind_p, f0_mhz_p=0, f1_mhz_p=0, sweep_ms_p=0, amplitude_p=0, offset_p=0, seed_p=1):
+    # SOURCE_ADC, SOURCE_SINE, SOURCE_CHIRP or SOURCE_NOISE. ESP32 keeps the source and restarts, so connect again afterwards.
+    send_command(sock_p, CMD_SET_SOURCE, struct.pack(">BIIIHHI", kind_p, f0_mhz_p, f1_mhz_p, sweep_ms_p, amplitude_p, offset_p, seed_p))
+
+def source_record(file_p, block_p):
+    # Append the raw samples of a block to file_p as big-endian interleaved scans, for SOURCE_REPLAY, see iaware_source_file.c.
+    file_p.write(stream_channels(block_p).T.astype(">u2").tobytes())
+
+def ble_scan_capture(file_p, bda_p, addr_type_p, rssi_p, is_complete_p, adv_p):
+    # Append an advertising report to file_p, adv_p its advertising data and its scan response, for ble_scan_replay() of
+    # iaware_ble_scan_replay.c.
+    file_p.write(BLE_SCAN_REPORT_STRUCT.pack(bytes(bda_p), addr_type_p, rssi_p, 1 if is_complete_p else 0, len(adv_p)) + bytes(adv_p))
+
+def source_sin_q15(phase_p):
+    y_l = []
+    for k_l in range(2):
+        step_l = ((phase_p >> 24) + k_l) & 0xFF
+        i_l = step_l & 63
+        q_l = step_l >> 6
+        v_l = SOURCE_SINE_TABLE[i_l if q_l in (0, 2) else 64 - i_l]
+        y_l.append(v_l if q_l < 2 else -v_l)
+
+    return y_l[0] + (((y_l[1] - y_l[0])*((phase_p >> 8) & 0xFFFF)) >> 16)
+
+def source_reference(n_scans_p, n_channels_p, kind_p, fs_p, f0_mhz_p=0, f1_mhz_p=0, sweep_scans_p=0, amplitude_p=0, offset_p=0, full_scale_p=(1 << DECIMATE_IN_BITS) - 1, seed_p=1):
+    # The first n_scans_p scans of a synthetic source, shape (n_scans_p, n_channels_p), bit for bit. The ESP32 sets fs_p to
+    # sampling_data_fs and sweep_scans_p to sweep_ms*fs_p//1000.
+    def inc_l(f_mhz_p):
+        return (((f_mhz_p << 32) + 500*fs_p)//(1000*fs_p)) & 0xFFFFFFFF
+
+    inc0_l = inc_l(f0_mhz_p)
+    inc1_l = inc_l(f1_mhz_p)
+    phase_l = 0
+    i_scan_l = 0
+    rng_l = seed_p if seed_p != 0 else 1
+    out_l = np.zeros((n_scans_p, n_channels_p), dtype=np.uint16)
+
+    for i_l in range(n_scans_p):
+        for i_channel_l in range(n_channels_p):
+            if (kind_p == SOURCE_NOISE):
+                rng_l ^= (rng_l << 13) & 0xFFFFFFFF
+                rng_l ^= rng_l >> 17
+                rng_l ^= (rng_l << 5) & 0xFFFFFFFF
+                v_l = rng_l % (2*amplitude_p + 1) - amplitude_p
+            else:
+                v_l = (amplitude_p*source_sin_q15((phase_l - i_channel_l*SOURCE_CHANNEL_PHASE) & 0xFFFFFFFF)) >> 15
+
+            out_l[i_l, i_channel_l] = min(max(offset_p + v_l, 0), full_scale_p)
+
+        if (kind_p == SOURCE_SINE):
+            phase_l = (phase_l + inc0_l) & 0xFFFFFFFF
+        elif (kind_p == SOURCE_CHIRP):
+            # The C division truncates toward zero.
+            d_l = (inc1_l - inc0_l)*i_scan_l
+            step_l = inc0_l + (abs(d_l)//sweep_scans_p)*(1 if d_l >= 0 else -1)
+            phase_l = (phase_l + step_l) & 0xFFFFFFFF
+            i_scan_l = i_scan_l + 1
+
+            if (i_scan_l == sweep_scans_p):
+                i_scan_l = 0
+                phase_l = 0
+
+    return out_l
+
+def decimate_bits(factor_p):
+    return DECIMATE_IN_BITS + (factor_p.bit_length() - 1)//2
+
+def decimate_reference(raw_p, factor_p):
+    # The output of decimate_push() for the raw samples of one channel since decimate_init(), bit for bit.
+    # The integrators wrap around modulo 2^32 on ESP32. uint64 wraps modulo 2^64, which keeps the same low 32 bits.
+    if (factor_p == DECIMATE_OFF):
+        return np.asarray(raw_p, dtype=np.uint16)
+
+    r_l = factor_p//2
+    bits_l = decimate_bits(factor_p)
+
+    x_l = (np.asarray(raw_p, dtype=np.int64) - (1 << (DECIMATE_IN_BITS - 1))).astype(np.uint64)
+    for _ in range(DECIMATE_CIC_STAGES):
+        x_l = np.cumsum(x_l, dtype=np.uint64)
+
+    c_l = x_l[r_l - 1::r_l]
+    for _ in range(DECIMATE_CIC_STAGES):
+        c_l = np.diff(c_l, prepend=np.uint64(0))
+
+    c_l = (c_l & np.uint64(0xFFFFFFFF)).astype(np.uint32).view(np.int32).astype(np.int64)
+    v_l = c_l >> (DECIMATE_CIC_STAGES*(r_l.bit_length() - 1) - DECIMATE_CIC_FRAC_BITS)
+
+    acc_l = np.convolve(v_l, DECIMATE_FIR_COEFS)[1:len(v_l):2]
+
+    shift_l = DECIMATE_FIR_Q + DECIMATE_CIC_FRAC_BITS - (bits_l - DECIMATE_IN_BITS)
+    y_l = ((acc_l + (1 << (shift_l - 1))) >> shift_l) + (1 << (bits_l - 1))
+
+    return np.clip(y_l, 0, (1 << bits_l) - 1).astype(np.uint16)
+
+def biquad_notch(f0_p, fs_p, q_p=30.0):
+    # (b0, b1, b2, a1, a2) normalized to a0 = 1, from the RBJ audio EQ cookbook. fs_p is the rate of the stored samples.
+    w_l = 2*np.pi*f0_p/fs_p
+    alpha_l = np.sin(w_l)/(2*q_p)
+    a0_l = 1 + alpha_l
+
+    return (1/a0_l, -2*np.cos(w_l)/a0_l, 1/a0_l, -2*np.cos(w_l)/a0_l, (1 - alpha_l)/a0_l)
+
+def biquad_bandpass(f0_p, fs_p, q_p=0.707):
+    # Constant 0 dB peak gain band-pass around f0_p, from the RBJ audio EQ cookbook.
+    w_l = 2*np.pi*f0_p/fs_p
+    alpha_l = np.sin(w_l)/(2*q_p)
+    a0_l = 1 + alpha_l
+
+    return (alpha_l/a0_l, 0.0, -alpha_l/a0_l, -2*np.cos(w_l)/a0_l, (1 - alpha_l)/a0_l)
+
+def filter_quantize(sections_p):
+    # Round the float sections to the Q14 integers of CMD_SET_FILTER. Every coefficient must be in [-2, 2).
+    return [tuple(int(np.clip(np.round(c_l*(1 << FILTER_Q)), -32768, 32767)) for c_l in s_l) for s_l in sections_p]
+
+def filter_set(sock_p, sections_q_p, i_channel_p=FILTER_ALL_CHANNELS):
+    # sections_q_p comes from filter_quantize(). An empty list removes the filter.
+    payload_l = bytes([i_channel_p, len(sections_q_p)]) + b"".join(struct.pack(">hhhhh", *s_l) for s_l in sections_q_p)
+
+    send_command(sock_p, CMD_SET_FILTER, payload_l)
+
+def filter_reference(samples_p, bits_p, sections_q_p):
+    # The output of filter_process_block() for the samples of one channel since CMD_SET_FILTER, bit for bit.
+    offset_l = 1 << (bits_p - 1)
+    x_l = [int(v_l) - offset_l for v_l in samples_p]
+
+    for b0_l, b1_l, b2_l, a1_l, a2_l in sections_q_p:
+        x1_l = x2_l = y1_l = y2_l = 0
+
+        for i_l, x0_l in enumerate(x_l):
+            acc_l = b0_l*x0_l + b1_l*x1_l + b2_l*x2_l - a1_l*y1_l - a2_l*y2_l
+            y0_l = min(max((acc_l + (1 << (FILTER_Q - 1))) >> FILTER_Q, -32768), 32767)
+
+            x2_l, x1_l, y2_l, y1_l = x1_l, x0_l, y1_l, y0_l
+            x_l[i_l] = y0_l
+
+    return np.clip(np.array(x_l, dtype=np.int64) + offset_l, 0, (1 << bits_p) - 1).astype(np.uint16)
+
+def set_features(sock_p, period_ms_p):
+    # FEATURE_PERIOD_OFF, 250, 500 or 1000 ms. ESP32 keeps the period in NVS.
+    send_command(sock_p, CMD_SET_FEATURES, struct.pack(">H", period_ms_p))
+
+def feature_parse(payload_p):
+    # payload_p is the payload of a PACKET_HEADER_FEATURE packet, or the value of a BLE notification without its first byte.
+    # Return (feature_seq, t_end [ms], channel_mask, powers [dB] of shape (n_channels, n_bands)). A band without power is -inf.
+    n_channels_l, n_bands_l, channel_mask_l, feature_seq_l, t_end_l = FEATURE_STRUCT.unpack_from(payload_p)
+
+    power_l = np.frombuffer(payload_p, dtype=">i2", count=n_channels_l*n_bands_l, offset=FEATURE_STRUCT.size).reshape(n_channels_l, n_bands_l)
+    power_db_l = np.where(power_l == FEATURE_POWER_NONE, -np.inf, power_l/100.0)
+
+    return feature_seq_l, t_end_l, channel_mask_l, power_db_l
+
+def log_decode(payload_p, fmts_p):
+    # payload_p is the payload of a PACKET_HEADER_LOG packet. Return the list of formatted lines in the same format as ESP_LOGx.
+    n_l = payload_p[0]
+
+    lines_l = []
+    for i_l in range(n_l):
+        t_ms_l, fmt_id_l, tag_id_l, level_l, a0_l, a1_l, a2_l = BLOG_RECORD_STRUCT.unpack_from(payload_p, 1 + i_l*BLOG_RECORD_STRUCT.size)
+
+        fmt_l = fmts_p[fmt_id_l] if (fmt_id_l < len(fmts_p)) else "Unknown blog format %d %d %d"
+        n_args_l = fmt_l.count("%") - 2*fmt_l.count("%%")
+        tag_l = BLOG_TAGS[tag_id_l] if (tag_id_l < len(BLOG_TAGS)) else "blog"
+        letter_l = BLOG_LEVELS[level_l] if (level_l < len(BLOG_LEVELS)) else "?"
+
+        lines_l.append("%s (%d) %s: %s" % (letter_l, t_ms_l, tag_l, fmt_l % (a0_l, a1_l, a2_l)[:n_args_l]))
+
+    return lines_l
+
+if __name__ == "__main__":
+    # Print the binary log of ESP32 streamed through the network.
+    sock_send_l = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock_send_l.connect(("192.168.4.1", 5000))
+
+    sock_recv_l = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock_recv_l.connect(("192.168.4.1", 5001))
+
+    log_get_formats(sock_recv_l)
+    log_set_sink(sock_recv_l, BLOG_SINK_NETWORK)
+
+    fmts_l = []
+    while (True):
+        header_l, payload_l = recv_packet(sock_send_l)
+
+        if (header_l == PACKET_HEADER_LOG_FORMATS):
+            fmts_l = log_parse_formats(payload_l)
+        elif (header_l == PACKET_HEADER_LOG):
+            for line_l in log_decode(payload_l, fmts_l):
+                print(line_l)
@@ -0,0 +1,177 @@
+#include <stdint.h>
+
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "iaware_blog.h"
+#include "iaware_gpio.h"
+#include "iaware_helper.h"
+#include "iaware_marker.h"
+#include "iaware_packet.h"
+#include "iaware_sampling_data.h"
+#include "main.h"
+
+struct marker
+{
+    uint8_t source;
+    uint8_t value;
+    uint32_t block_seq;     // The block being filled at t.
+    uint64_t t;             // [microsec]
+};
+
+static void marker_gpio_isr(void *arg);
+static int marker_push(uint8_t source, uint8_t value, uint64_t t);
+static uint16_t marker_scan_of(struct marker *m);
+
+// The queue. The GPIO interrupt and com_tcp_recv_task() push, com_tcp_send_task() pops.
+static portMUX_TYPE marker_mux = portMUX_INITIALIZER_UNLOCKED;
+static struct marker marker_queue[MARKER_QUEUE_LEN];
+static uint32_t marker_head = 0;        // The next marker to pop.
+static uint32_t marker_tail = 0;        // The next free slot. The queue is empty when it equals marker_head.
+static uint32_t marker_n_dropped = 0;
+
+void init_marker(void)
+{
+    gpio_config_t io_conf;
+
+    io_conf.pin_bit_mask    = (1ULL << GPIO_MARKER);
+    io_conf.mode            = GPIO_MODE_INPUT;
+    io_conf.pull_up_en      = GPIO_PULLUP_DISABLE;
+    io_conf.pull_down_en    = GPIO_PULLDOWN_ENABLE;
+    io_conf.intr_type       = GPIO_INTR_ANYEDGE;
+
+    if ((gpio_config(&io_conf) != ESP_OK) || (gpio_isr_handler_add(GPIO_MARKER, marker_gpio_isr, NULL) != ESP_OK))
+        ESP_LOGE(IAWARE_GPIO, "Main: Marker input on GPIO %d FAIL", GPIO_MARKER);
+    else
+        ESP_LOGI(IAWARE_GPIO, "Main: Marker input on GPIO %d.", GPIO_MARKER);
+}
+
+int marker_host(uint8_t code)
+// CMD_MARKER. The time is when the command is processed, i.e. after the network latency.
+{
+    int ret;
+
+    portENTER_CRITICAL(&marker_mux);
+
+    ret = marker_push(MARKER_SOURCE_HOST, code, (uint64_t) esp_timer_get_time());
+
+    portEXIT_CRITICAL(&marker_mux);
+
+    return ret;
+}
+
+uint32_t marker_pack(uint8_t *dst, uint32_t max_len)
+// Pop the markers whose block has completed into a PACKET_HEADER_MARKER packet in dst, in the order of the edges.
+// Return the length of the packet, or 0 when there is none.
+{
+    uint32_t n_markers = 0;
+    uint32_t i = 4 + PACKET_HEADER_MARKER_META_SIZE;
+    uint32_t n_dropped;
+
+    while ((i + MARKER_RECORD_SIZE <= max_len) && (n_markers < 255))
+    {
+        struct marker m;
+
+        portENTER_CRITICAL(&marker_mux);
+
+        uint8_t is_empty = (marker_head == marker_tail) ? iawTrue : iawFalse;
+
+        if (is_empty == iawFalse)
+            m = marker_queue[marker_head % MARKER_QUEUE_LEN];
+
+        portEXIT_CRITICAL(&marker_mux);
+
+        if ((is_empty == iawTrue) || (m.block_seq >= sampling_data_block_seq))
+            break;
+
+        dst[i]      = m.source;
+        dst[i + 1]  = m.value;
+        uint32_to_bytes(m.block_seq, &(dst[i + 2]));
+        uint16_t i_scan = marker_scan_of(&m);
+        dst[i + 6]  = (uint8_t) (i_scan >> 8);
+        dst[i + 7]  = (uint8_t) (i_scan & 0xFF);
+        uint64_to_bytes(m.t, &(dst[i + 8]));
+
+        i = i + MARKER_RECORD_SIZE;
+        n_markers = n_markers + 1;
+
+        marker_head = marker_head + 1; // Only this task moves the head.
+    }
+
+    portENTER_CRITICAL(&marker_mux);
+
+    n_dropped = marker_n_dropped;
+    marker_n_dropped = 0;
+
+    portEXIT_CRITICAL(&marker_mux);
+
+    if (n_dropped > 0)
+        BLOGW(BLOG_TAG_IAWARE_GPIO, BLOG_FMT_MARKER_DROPPED, n_dropped, MARKER_QUEUE_LEN, 0);
+
+    if (n_markers == 0)
+        return 0;
+
+    uint32_to_bytes(i - 4, &(dst[0]));
+    dst[4] = PACKET_HEADER_MARKER;
+    dst[5] = (uint8_t) n_markers;
+
+    return i;
+}
+
+//////////////////// Private ////////////////////
+
+static void IRAM_ATTR marker_gpio_isr(void *arg)
+{
+    portENTER_CRITICAL_ISR(&marker_mux);
+
+    marker_push(MARKER_SOURCE_GPIO, (uint8_t) gpio_get_level(GPIO_MARKER), (uint64_t) esp_timer_get_time());
+
+    portEXIT_CRITICAL_ISR(&marker_mux);
+}
+
+static int IRAM_ATTR marker_push(uint8_t source, uint8_t value, uint64_t t)
+// Hold marker_mux. Return iawFalse when the queue is full and the marker is dropped.
+{
+    if (marker_tail - marker_head < MARKER_QUEUE_LEN)
+    {
+        struct marker *m = &(marker_queue[marker_tail % MARKER_QUEUE_LEN]);
+
+        m->source = source;
+        m->value = value;
+        m->block_seq = sampling_data_block_seq;
+        m->t = t;
+
+        marker_tail = marker_tail + 1;
+
+        return iawTrue;
+    }
+
+    marker_n_dropped = marker_n_dropped + 1;
+
+    return iawFalse;
+}
+
+static uint16_t marker_scan_of(struct marker *m)
+// The scan of the completed block m->block_seq at m->t. An edge between the end of the previous block and the first scan
+// is on the first scan, and one after the last scan is on the last.
+{
+    for (struct buff_node *node = head_buff_node_ptr; node != NULL; node = node->next)
+    {
+        // The node being filled still has the block_seq of the block that it overwrites.
+        if ((node->block_seq != m->block_seq) || (node == run_buff_node_ptr))
+            continue;
+
+        uint32_t n_scans = node->n_samples/(2*gpio_adc_n_channels);
+
+        if (m->t <= node->t_begin)
+            return 0;
+
+        uint64_t i_scan = ((m->t - node->t_begin)*node->eff_sampling_freq + 500000)/1000000;
+
+        return (uint16_t) ((i_scan >= n_scans) ? (n_scans - 1) : i_scan);
+    }
+
+    return MARKER_SCAN_UNKNOWN;
+}
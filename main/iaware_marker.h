@@ -0,0 +1,25 @@
+#ifndef IAWARE_MARKER_H
+#define IAWARE_MARKER_H
+
+#include <stdint.h>
+
+// The event markers, e.g. the TTL of a stimulus PC, in the timebase of the samples. The interrupt of GPIO_MARKER only
+// takes esp_timer_get_time() and the block being filled at every edge, and queues them with the level after the edge.
+// CMD_MARKER queues a code from the host the same way. The sampling callback is not touched.
+//
+// com_tcp_send_task() places a marker once its block has completed: i_scan is the scan of the block that is the
+// closest to t, from t_begin and the effective rate of the block. The markers are sent as PACKET_HEADER_MARKER packets
+// between the blocks, to every client whether it streams or not. i_scan is MARKER_SCAN_UNKNOWN when the ring has already
+// overwritten the block, and the client then places it by t.
+#define MARKER_SOURCE_GPIO      0x01    // value is the level of GPIO_MARKER after the edge.
+#define MARKER_SOURCE_HOST      0x02    // value is the code of CMD_MARKER.
+
+#define MARKER_QUEUE_LEN        32      // The markers waiting for their block. A marker is dropped when it is full.
+#define MARKER_SCAN_UNKNOWN     0xFFFF
+#define MARKER_RECORD_SIZE      (1 + 1 + 4 + 2 + 8)     // |uint8_t source|uint8_t value|uint32_t block_seq|uint16_t i_scan|uint64_t t [microsec]|
+
+void init_marker(void);
+int marker_host(uint8_t code);
+uint32_t marker_pack(uint8_t *dst, uint32_t max_len);
+
+#endif
@@ -3,10 +3,50 @@
 uint8_t PACKET_HEADER_COMMAND   = 0;
 uint8_t PACKET_HEADER_GROUP1    = 1;
 uint8_t PACKET_HEADER_GROUP2    = 2;
+uint8_t PACKET_HEADER_LOG           = 3;
+uint8_t PACKET_HEADER_LOG_FORMATS   = 4;
+uint8_t PACKET_HEADER_GROUP1_BACKFILL   = 5;
+uint8_t PACKET_HEADER_RECORD_INFO       = 6;
+uint8_t PACKET_HEADER_RECORD_FIND       = 7;
+uint8_t PACKET_HEADER_RECORD_DATA       = 8;
+uint8_t PACKET_HEADER_STREAM            = 9;
+uint8_t PACKET_HEADER_STREAM_VERSION    = 10;
+uint8_t PACKET_HEADER_FEATURE           = 11;
+uint8_t PACKET_HEADER_TRIGGER           = 12;
+uint8_t PACKET_HEADER_MARKER            = 13;
+uint8_t PACKET_HEADER_ADC_CAL           = 14;
+uint8_t PACKET_HEADER_BLE_FRAGMENT      = 15;
+uint8_t PACKET_HEADER_BLE_BENCH         = 16;
+uint8_t PACKET_HEADER_BLE_ACK           = 17;
+uint8_t PACKET_HEADER_BLE_LINK          = 18;
+uint8_t PACKET_HEADER_BLE_STATS         = 19;
+uint8_t PACKET_HEADER_BLE_HUB           = 20;
 
 uint8_t CMD_START_STREAM            = 0;
 uint8_t CMD_STOP_STREAM             = 1;
 uint8_t CMD_SET_SAMPLING_FREQUENCY  = 2;
 uint8_t CMD_SET_SEND_DATA_FREQUENCY = 3;
+uint8_t CMD_SET_LOG_SINK            = 4;
+uint8_t CMD_GET_LOG_FORMATS         = 5;
+uint8_t CMD_SET_RECORD_MODE         = 6;
+uint8_t CMD_GET_RECORD_INFO         = 7;
+uint8_t CMD_FIND_RECORD             = 8;
+uint8_t CMD_READ_RECORD             = 9;
+uint8_t CMD_SET_STREAM_VERSION      = 10;
+uint8_t CMD_SET_CHANNEL_MASK        = 11;
+uint8_t CMD_SET_STREAM_LAYOUT       = 12;
+uint8_t CMD_SET_DECIMATION          = 13;
+uint8_t CMD_SET_FILTER              = 14;
+uint8_t CMD_SET_FEATURES            = 15;
+uint8_t CMD_SET_DEGRADE             = 16;
+uint8_t CMD_SET_TRIGGER             = 17;
+uint8_t CMD_TRIGGER                 = 18;
+uint8_t CMD_MARKER                  = 19;
+uint8_t CMD_SET_STREAM_STATS        = 20;
+uint8_t CMD_GET_ADC_CAL             = 21;
+uint8_t CMD_SET_ADC_CAL             = 22;
+uint8_t CMD_SET_SOURCE              = 23;
+uint8_t CMD_SET_BLE_BENCH           = 24;
+uint8_t CMD_SET_BLE_ADV             = 25;
 
 uint8_t CMD_SET_FIRMWARE_UPLOAD     = 100;
\ No newline at end of file
@@ -9,17 +9,85 @@ extern uint8_t PACKET_HEADER_COMMAND;
 
 // A command packet from a client to ESP32.
 #define MAX_PACKET_SIZE_SENTTO_ESP32 10				// In bytes
+#define MAX_MSG_SIZE_SENTTO_ESP32	512				// In bytes. The maximum length of a message, i.e. |4 bytes length = MAX_MSG_SIZE_SENTTO_ESP32|message|.
 
 extern uint8_t CMD_START_STREAM;					// |2 (4bytes)|PACKET_HEADER_COMMAND|CMD_START_STREAM
 extern uint8_t CMD_STOP_STREAM;						// |2 (4bytes)|PACKET_HEADER_COMMAND|CMD_STOP_STREAM
 extern uint8_t CMD_SET_SAMPLING_FREQUENCY;			// |6 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_SAMPLING_FREQUENCY	|uint32_t new_sampling_frequency
 extern uint8_t CMD_SET_SEND_DATA_FREQUENCY;			// |3 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_SEND_DATA_FREQUENCY|uint8_t new_send_data_sampling_frequency. The actual send data sampling frequency is new_send_data_sampling_frequency*0.1 Hz.
+extern uint8_t CMD_SET_LOG_SINK;					// |3 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_LOG_SINK|uint8_t sink (BLOG_SINK_UART or BLOG_SINK_NETWORK)
+extern uint8_t CMD_GET_LOG_FORMATS;					// |2 (4bytes)|PACKET_HEADER_COMMAND|CMD_GET_LOG_FORMATS. ESP32 replies with a PACKET_HEADER_LOG_FORMATS packet on TCP_SEND_PORT.
+extern uint8_t CMD_SET_RECORD_MODE;					// |3 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_RECORD_MODE|uint8_t is_record_mode. It is kept in NVS.
+extern uint8_t CMD_SET_DEGRADE;						// |3 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_DEGRADE|uint8_t max_level (DEGRADE_LEVEL_FULL is off, up to DEGRADE_LEVEL_PREVIEW by default). v2 only.
+extern uint8_t CMD_GET_RECORD_INFO;					// |2 (4bytes)|PACKET_HEADER_COMMAND|CMD_GET_RECORD_INFO. ESP32 replies with a PACKET_HEADER_RECORD_INFO packet on TCP_SEND_PORT.
+extern uint8_t CMD_FIND_RECORD;						// |14 (4bytes)|PACKET_HEADER_COMMAND|CMD_FIND_RECORD|uint32_t boot_count|uint64_t t [microsec]. ESP32 replies with a PACKET_HEADER_RECORD_FIND packet.
+extern uint8_t CMD_READ_RECORD;						// |18 (4bytes)|PACKET_HEADER_COMMAND|CMD_READ_RECORD|uint32_t req_id|uint64_t vaddr|uint32_t len. ESP32 replies with PACKET_HEADER_RECORD_DATA packets.
+extern uint8_t CMD_SET_STREAM_VERSION;				// |3 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_STREAM_VERSION|uint8_t version. ESP32 replies with a PACKET_HEADER_STREAM_VERSION packet on TCP_SEND_PORT.
+extern uint8_t CMD_SET_CHANNEL_MASK;				// |3 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_CHANNEL_MASK|uint8_t channel_mask. It is kept in NVS and ESP32 restarts.
+extern uint8_t CMD_SET_STREAM_LAYOUT;				// |3 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_STREAM_LAYOUT|uint8_t layout (STREAM_LAYOUT_INTERLEAVED or STREAM_LAYOUT_PLANAR). v2 only.
+extern uint8_t CMD_SET_STREAM_STATS;				// |3 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_STREAM_STATS|uint8_t is_on. The statistics of iaware_stats.h follow every v2 header. v2 only.
+extern uint8_t CMD_SET_DECIMATION;					// |3 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_DECIMATION|uint8_t factor (1 is off, or 4 to 64). It is kept in NVS and ESP32 restarts.
+extern uint8_t CMD_SET_FILTER;						// |4 + 10*n_sections (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_FILTER|uint8_t i_channel (0xFF for all)|uint8_t n_sections|n_sections*(int16_t b0|b1|b2|a1|a2 in Q14). See iaware_filter.h.
+extern uint8_t CMD_GET_ADC_CAL;						// |2 (4bytes)|PACKET_HEADER_COMMAND|CMD_GET_ADC_CAL. ESP32 replies with a PACKET_HEADER_ADC_CAL packet on TCP_SEND_PORT.
+extern uint8_t CMD_SET_ADC_CAL;						// |3 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_ADC_CAL|uint8_t is_on. It is kept in NVS and ESP32 restarts.
+extern uint8_t CMD_SET_SOURCE;						// |23 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_SOURCE|uint8_t kind|uint32_t f0 [mHz]|uint32_t f1 [mHz]|uint32_t sweep [ms]|uint16_t amplitude|uint16_t offset|uint32_t seed. See iaware_source.h. It is kept in NVS and ESP32 restarts.
+extern uint8_t CMD_SET_BLE_BENCH;					// |3 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_BLE_BENCH|uint8_t is_on. The BLE notifications become PACKET_HEADER_BLE_BENCH, see iaware_ble_stream.h.
+extern uint8_t CMD_SET_BLE_ADV;						// |5 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_BLE_ADV|uint8_t is_metrics|uint16_t interval_ms (20 to 5120). The metrics in the scan response, see iaware_ble_adv.h. It is kept in NVS.
+extern uint8_t CMD_SET_FEATURES;					// |4 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_FEATURES|uint16_t period_ms (0 is off, 250, 500 or 1000). It is kept in NVS.
+extern uint8_t CMD_SET_TRIGGER;						// |10 (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_TRIGGER|uint8_t sources (0 is off)|uint16_t pre_ms|uint16_t post_ms|uint8_t i_channel|uint16_t threshold. See iaware_trigger.h. v2 only.
+extern uint8_t CMD_TRIGGER;							// |2 (4bytes)|PACKET_HEADER_COMMAND|CMD_TRIGGER. An event of TRIGGER_SOURCE_HOST.
+extern uint8_t CMD_MARKER;							// |3 (4bytes)|PACKET_HEADER_COMMAND|CMD_MARKER|uint8_t code. A marker of MARKER_SOURCE_HOST, see iaware_marker.h.
 
 #define PACKET_HEADER_GROUP1_META_SIZE	(1 + 4)		// It is the size in bytes of the meta information between the 4-bytes header and the actual sampled signal, i.e. |(4bytes)|PACKET_HEADER_GROUP1_META_SIZE|buff_data
 extern uint8_t PACKET_HEADER_GROUP1;
 
+#define PACKET_HEADER_STREAM_V2_META_SIZE	(1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 4 + 8 + 4 + 4)	// The v2 header of a sample block. See iaware_stream.h.
+extern uint8_t PACKET_HEADER_STREAM;
+extern uint8_t PACKET_HEADER_STREAM_VERSION;		// |(4bytes)|PACKET_HEADER_STREAM_VERSION|uint8_t version
+
 extern uint8_t PACKET_HEADER_GROUP2;
 
+// The band powers of every channel, see iaware_feature.h. The same packet, without the 4-bytes length, is the value of the BLE notifications.
+#define PACKET_HEADER_FEATURE_META_SIZE	(1 + 1 + 1 + 1 + 2 + 4)	// |(4bytes)|PACKET_HEADER_FEATURE|uint8_t n_channels|uint8_t n_bands|uint8_t channel_mask|uint16_t feature_seq|uint32_t t_end [ms]|n_channels*n_bands*int16_t power [centi-dB]
+extern uint8_t PACKET_HEADER_FEATURE;
+
+// An event of the triggered capture and the window of full blocks that it opened or extended, see iaware_trigger.h.
+#define PACKET_HEADER_TRIGGER_META_SIZE	(1 + 1 + 4 + 4 + 8 + 4 + 4)	// |(4bytes)|PACKET_HEADER_TRIGGER|uint8_t source|uint32_t trigger_count|uint32_t block_seq|uint64_t t [microsec]|uint32_t first_block_seq|uint32_t last_block_seq
+extern uint8_t PACKET_HEADER_TRIGGER;
+
+// The event markers placed on the scans of the blocks, see iaware_marker.h.
+#define PACKET_HEADER_MARKER_META_SIZE	(1 + 1)	// |(4bytes)|PACKET_HEADER_MARKER|uint8_t n_markers|n_markers*MARKER_RECORD_SIZE records
+extern uint8_t PACKET_HEADER_MARKER;
+
+// The characterization of the ADC, see iaware_adc_cal.h. source is an esp_adc_cal_value_t and atten an adc_atten_t.
+#define PACKET_HEADER_ADC_CAL_META_SIZE	(1 + 1 + 1 + 1 + 4 + 4 + 4 + 4)	// |(4bytes)|PACKET_HEADER_ADC_CAL|uint8_t is_on|uint8_t source|uint8_t atten|uint32_t vref [mV]|uint32_t coeff_a|uint32_t coeff_b|uint32_t uv_per_lsb
+extern uint8_t PACKET_HEADER_ADC_CAL;
+
+// A piece of a sample block in a BLE notification, without the 4-bytes length, see iaware_ble_stream.h.
+extern uint8_t PACKET_HEADER_BLE_FRAGMENT;		// |PACKET_HEADER_BLE_FRAGMENT|uint32_t block_seq|uint16_t i_frag|uint16_t n_frags|frame bytes
+extern uint8_t PACKET_HEADER_BLE_BENCH;			// |PACKET_HEADER_BLE_BENCH|uint32_t bench_seq|uint64_t t [microsec]|padding, see CMD_SET_BLE_BENCH.
+extern uint8_t PACKET_HEADER_BLE_ACK;			// |PACKET_HEADER_BLE_ACK|uint8_t cmd|uint8_t is_known|uint16_t n_cmds, see iaware_ble_svr_com.h.
+extern uint8_t PACKET_HEADER_BLE_LINK;			// The link parameters, see iaware_ble_link.h.
+extern uint8_t PACKET_HEADER_BLE_STATS;			// The value of the stats characteristic, see iaware_ble_svr_com.h.
+extern uint8_t PACKET_HEADER_BLE_HUB;			// |(4bytes)|PACKET_HEADER_BLE_HUB|uint8_t source|6 bytes bda|v2 frame|, see iaware_ble_hub.h.
+
+#define PACKET_HEADER_GROUP1_BACKFILL_META_SIZE	(1 + 4 + 8 + 4)	// |(4bytes)|PACKET_HEADER_GROUP1_BACKFILL|uint32_t block_seq|uint64_t t_begin [microsec]|uint32_t eff_sampling_freq|buff_data
+extern uint8_t PACKET_HEADER_GROUP1_BACKFILL;		// A PACKET_HEADER_GROUP1 block spilled to flash while no client was streaming. See iaware_flash_tier.h.
+
+// The recording on flash. The raw log is addressed by vaddr, see iaware_flash_ring.h for its layout.
+#define PACKET_HEADER_RECORD_INFO_META_SIZE	(1 + 1 + 4 + 8 + 8 + 4)	// |(4bytes)|PACKET_HEADER_RECORD_INFO|uint8_t is_record_mode|uint32_t boot_count|uint64_t vaddr_begin|uint64_t vaddr_end|uint32_t sector_size
+extern uint8_t PACKET_HEADER_RECORD_INFO;
+#define PACKET_HEADER_RECORD_FIND_META_SIZE	(1 + 8)					// |(4bytes)|PACKET_HEADER_RECORD_FIND|uint64_t vaddr
+extern uint8_t PACKET_HEADER_RECORD_FIND;
+#define PACKET_HEADER_RECORD_DATA_META_SIZE	(1 + 4 + 8 + 1)			// |(4bytes)|PACKET_HEADER_RECORD_DATA|uint32_t req_id|uint64_t vaddr|uint8_t flags|raw log
+extern uint8_t PACKET_HEADER_RECORD_DATA;
+#define RECORD_DATA_FLAG_LAST			0x01	// The last packet of a CMD_READ_RECORD request.
+#define RECORD_DATA_FLAG_OVERWRITTEN	0x02	// vaddr is older than the oldest sector. The request ends here.
+
+#define PACKET_HEADER_LOG_META_SIZE	(1 + 1)			// |(4bytes)|PACKET_HEADER_LOG|uint8_t n_records|records. See iaware_blog.h for the record layout.
+extern uint8_t PACKET_HEADER_LOG;
+extern uint8_t PACKET_HEADER_LOG_FORMATS;			// |(4bytes)|PACKET_HEADER_LOG_FORMATS|uint16_t n_formats|uint8_t len_1|fmt_1|...
+
 
 extern uint8_t CMD_SET_FIRMWARE_UPLOAD;				// |x (4bytes)|PACKET_HEADER_COMMAND|CMD_SET_FIRMWARE_UPLOAD	|FIRMWARE.
 
@@ -1,31 +1,86 @@
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "esp_timer.h"
 #include "esp_sleep.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-
+#include "xtensa/hal.h"
+
+#include "iaware_adc_cal.h"
+#include "iaware_arena.h"
+#include "iaware_blog.h"
+#include "iaware_decimate.h"
+#include "iaware_feature.h"
+#include "iaware_filter.h"
+#include "iaware_flash_tier.h"
 #include "iaware_gpio.h"
 #include "iaware_helper.h"
 #include "iaware_packet.h"
 #include "iaware_sampling_data.h"
+#include "iaware_source.h"
+#include "iaware_stats.h"
+#include "iaware_stream.h"
 #include "iaware_tcp_com.h"
+#include "iaware_trigger.h"
 #include "main.h"
 
 static esp_timer_handle_t sampling_data_Timer;
 
 static void sampling_data_callback(void* arg);
-static uint16_t sampling_input(void);
+static void init_source(void);
+static void init_decimate(void);
+static void benchmark_decimate(void);
+static void init_features(void);
+
+static struct decimate sampling_decimate; // Only sampling_data_callback() touches it after init_sampling_data_task().
+
+// The scans of sampling_data_callback(), from the ADC or from a generator chosen with CMD_SET_SOURCE.
+static struct sample_source sampling_source;
+static struct source_synth sampling_synth;
+
+// CMD_SET_FILTER from com_tcp_recv_task() to sampling_filter_task(), which applies it between two blocks.
+static struct filter_bank sampling_filter;
+static uint8_t sampling_filter_enabled = iawFalse;
+static uint8_t sampling_block_flags = 0; // STREAM_FLAG_CALIBRATED and STREAM_FLAG_SYNTHETIC. They are set at boot.
+static uint8_t sampling_cal_in_bits = GPIO_ADC_BITS;  // The bits of the samples before the calibration.
+static uint8_t filter_update_pending = iawFalse;
+static uint8_t filter_update_channel;
+static uint8_t filter_update_n_sections;
+static struct filter_section filter_update_sections[FILTER_MAX_SECTIONS];
+
+// CMD_SET_FEATURES from com_tcp_recv_task() to sampling_filter_task() in the same way. The packets are read by
+// com_tcp_send_task() and by the BLE notifications.
+static struct feature sampling_feature;
+static uint8_t feature_update_pending = iawFalse;
+static uint32_t feature_update_period_ms;
 
 
 uint32_t sampling_data_fs = SAMPLING_DATA_FS;
+uint32_t sampling_data_decimation = DECIMATE_OFF;
+uint8_t sampling_data_bits = GPIO_ADC_BITS;
+uint32_t sampling_data_block_seq = 0;
+uint32_t sampling_data_n_dropped = 0;
+uint32_t sampling_data_rate = 0;
 
 void init_sampling_data_task(void)
 {
+    init_source();
+
+    // The decimation sets the rate of the blocks, so it comes before the buff nodes.
+    init_decimate();
+
     // Initialize buffer nodes.
     init_buff_nodes();
 
+    filter_init(&sampling_filter, gpio_adc_n_channels);
+
+    init_features();
+
+    // Mount the flash ring that keeps the blocks while no client is streaming.
+    init_flash_tier(head_buff_node_ptr->n_samples);
+
     // Create a hardware timer.
     sampling_data_createTimer();
 
@@ -58,25 +113,179 @@ void sampling_data_stopTimer(void)
 }
 
 void init_buff_nodes(void)
+// The buff nodes are sized once from sampling_data_fs, gpio_adc_n_channels, tcp_send_frequency and TCP_MAX_LATENCY and carved
+// out of a single arena, so the heap is touched exactly once for the streaming memory.
 {
+    uint32_t elt_count  = (uint32_t) (sampling_data_fs/sampling_data_decimation/tcp_send_frequency)*gpio_adc_n_channels; // A whole number of scans.
+    uint32_t node_bytes = buff_node_group1_size(elt_count);
+    uint32_t degrade_bytes = (STREAM_HEADROOM + 2*elt_count + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1); // stream_degrade_buff
+
     // Create buffer nodes for filling in the sampled inputs.
     uint32_t N_buff_node = (uint32_t) (TCP_MAX_LATENCY/(1000/tcp_send_frequency));
 
+    // Shorten the latency budget when the heap cannot hold all buff nodes.
+    uint32_t N_buff_node_max = (arena_max_size() > degrade_bytes) ? (arena_max_size() - degrade_bytes)/node_bytes : 0;
+    if (N_buff_node > N_buff_node_max)
+    {
+        ESP_LOGW(IAWARE_CORE, "Sample data: Only %d of %d buff nodes fit in the heap.", N_buff_node_max, N_buff_node);
+
+        N_buff_node = N_buff_node_max;
+    }
+
+    if ((N_buff_node == 0) || (arena_init(N_buff_node*node_bytes + degrade_bytes) == iawFalse))
+    {
+        ESP_LOGE(IAWARE_CORE, "Sample data: Initialize buff_node (%d bytes) FAIL.", node_bytes);
+
+        deep_restart();
+    }
+
     uint32_t i = 0;
-    while ((i < N_buff_node) & (append_buff_node_group1((uint32_t) (sampling_data_fs/tcp_send_frequency)) == iawTrue))
+    while ((i < N_buff_node) && (append_buff_node_group1(elt_count) == iawTrue))
     {
         i = i + 1;
     }
 
+    stream_degrade_buff = (uint8_t *) arena_alloc(degrade_bytes);
+
     if (i == 0)
     {
-        ESP_LOGE(IAWARE_CORE, "Sample data: Initialize buff_node (%d bytes) FAIL.", (uint32_t) (2*sampling_data_fs/tcp_send_frequency));
+        ESP_LOGE(IAWARE_CORE, "Sample data: Initialize buff_node (%d bytes) FAIL.", node_bytes);
 
         deep_restart();
     }
     else
     {
-        ESP_LOGI(IAWARE_CORE, "Sample data: Initialize buff_node (%d buff nodes = %d bytes).", i, (uint32_t) (i*2*sampling_data_fs/tcp_send_frequency));
+        ESP_LOGI(IAWARE_CORE, "Sample data: Initialize buff_node (%d buff nodes = %d bytes, arena uses %d of %d bytes).", i, (uint32_t) (i*2*elt_count), arena_used_bytes(), arena_size_bytes());
+    }
+}
+
+int sampling_data_set_decimation(uint32_t factor)
+// Keep the new factor in NVS. It takes effect at the next boot.
+{
+    if (decimate_factor_is_valid(factor) == 0)
+        return iawFalse;
+
+    return nvs_write_u32(SAMPLING_DATA_NVS_DECIMATION, factor);
+}
+
+int sampling_data_set_source(const struct source_params *params, uint32_t sweep_ms)
+// Keep the new source in NVS. It takes effect at the next boot. params->fs and params->sweep_scans follow from
+// sampling_data_fs and sweep_ms then, and params->full_scale from GPIO_ADC_BITS.
+{
+    if (params->kind > SOURCE_NOISE) // SOURCE_REPLAY has no file on ESP32.
+        return iawFalse;
+
+    if ((params->kind == SOURCE_CHIRP) && (sweep_ms == 0))
+        return iawFalse;
+
+    if ((nvs_write_u32(SAMPLING_DATA_NVS_SOURCE_F0, params->f0_mhz) == iawFalse) ||
+        (nvs_write_u32(SAMPLING_DATA_NVS_SOURCE_F1, params->f1_mhz) == iawFalse) ||
+        (nvs_write_u32(SAMPLING_DATA_NVS_SOURCE_SWEEP, sweep_ms) == iawFalse) ||
+        (nvs_write_u32(SAMPLING_DATA_NVS_SOURCE_LEVEL, ((uint32_t) params->amplitude << 16) | params->offset) == iawFalse) ||
+        (nvs_write_u32(SAMPLING_DATA_NVS_SOURCE_SEED, params->seed) == iawFalse))
+        return iawFalse;
+
+    // The kind goes last, so a partial write leaves the previous source.
+    return nvs_write_u32(SAMPLING_DATA_NVS_SOURCE, params->kind);
+}
+
+int sampling_data_set_filter(uint8_t i_channel, uint8_t n_sections, const struct filter_section *sections)
+// Params:
+//     i_channel    : The position in the scan order, or FILTER_ALL_CHANNELS.
+//     n_sections   : 0 removes the filter of the channel.
+// Return iawFalse when the arguments are invalid or the previous update has not been applied yet.
+{
+    if ((filter_update_pending == iawTrue) || (n_sections > FILTER_MAX_SECTIONS) || ((i_channel != FILTER_ALL_CHANNELS) && (i_channel >= gpio_adc_n_channels)))
+        return iawFalse;
+
+    filter_update_channel = i_channel;
+    filter_update_n_sections = n_sections;
+    memcpy(filter_update_sections, sections, n_sections*sizeof(struct filter_section));
+
+    filter_update_pending = iawTrue;
+
+    return iawTrue;
+}
+
+int sampling_data_set_features(uint32_t period_ms)
+// Params:
+//     period_ms    : FEATURE_PERIOD_OFF, or the period of the band powers, see iaware_feature.h. It is kept in NVS.
+// Return iawFalse when the period is invalid or the previous update has not been applied yet.
+{
+    if ((feature_update_pending == iawTrue) || ((period_ms != FEATURE_PERIOD_OFF) && (feature_period_is_valid(period_ms) == 0)))
+        return iawFalse;
+
+    feature_update_period_ms = period_ms;
+    feature_update_pending = iawTrue;
+
+    return nvs_write_u32(SAMPLING_DATA_NVS_FEATURES, period_ms);
+}
+
+uint32_t sampling_data_features_pack(uint8_t *dst, uint32_t max_len, uint32_t *publish_seq)
+// The latest band powers as a PACKET_HEADER_FEATURE packet without the 4-bytes length, see feature_pack().
+{
+    return feature_pack(&sampling_feature, dst, max_len, publish_seq);
+}
+
+void sampling_filter_task(void *pvParameter)
+// Follow the buff nodes in step with sampling_data_callback(). It visits every block, but filters only the ones that
+// completed while a filter was set or the calibration is on, and then hands them to com_tcp_send_task() and flash_spill_task(). The band powers
+// and the threshold trigger are computed from every block, after the filters.
+{
+    run_filter_buff_node_ptr = run_buff_node_ptr;
+
+    while (1)
+    {
+        if (filter_update_pending == iawTrue)
+        {
+            filter_set(&sampling_filter, filter_update_channel, filter_update_n_sections, filter_update_sections);
+
+            sampling_filter_enabled = (filter_is_active(&sampling_filter) || (adc_cal_enabled == iawTrue)) ? iawTrue : iawFalse;
+
+            filter_update_pending = iawFalse;
+        }
+
+        if (feature_update_pending == iawTrue)
+        {
+            if (feature_init(&sampling_feature, feature_update_period_ms, sampling_data_fs/sampling_data_decimation, gpio_adc_n_channels, gpio_adc_channel_mask) != FEATURE_OK)
+                ESP_LOGE(IAWARE_CORE, "Sample data: %d Hz is too low for the band powers.", sampling_data_fs/sampling_data_decimation);
+
+            feature_update_pending = iawFalse;
+        }
+
+        if (run_filter_buff_node_ptr->is_filtered == iawFalse)
+        {
+            run_filter_buff_node_ptr->is_filtered = iawTrue;
+
+            if (run_filter_buff_node_ptr->is_filter_bypassed == iawFalse)
+            {
+                if (run_filter_buff_node_ptr->stream_flags & STREAM_FLAG_CALIBRATED)
+                    adc_cal_process_block(run_filter_buff_node_ptr->samples_buff + STREAM_HEADROOM, run_filter_buff_node_ptr->n_samples/2, sampling_cal_in_bits);
+
+                filter_process_block(&sampling_filter, run_filter_buff_node_ptr->samples_buff + STREAM_HEADROOM, run_filter_buff_node_ptr->n_samples/(2*gpio_adc_n_channels), run_filter_buff_node_ptr->stream_flags & STREAM_FLAG_PLANAR, sampling_data_bits);
+
+                run_filter_buff_node_ptr->is_spilled = iawFalse;
+                run_filter_buff_node_ptr->is_sent = iawFalse;
+            }
+
+            // A bypassed block may be sent at the same time, which only reads it too.
+            feature_process_block(&sampling_feature, run_filter_buff_node_ptr->samples_buff + STREAM_HEADROOM, run_filter_buff_node_ptr->n_samples/(2*gpio_adc_n_channels), run_filter_buff_node_ptr->stream_flags & STREAM_FLAG_PLANAR, sampling_data_bits, run_filter_buff_node_ptr->t_begin, run_filter_buff_node_ptr->eff_sampling_freq);
+
+            trigger_scan_block(run_filter_buff_node_ptr);
+
+            if (run_filter_buff_node_ptr->next != NULL)
+            {
+                run_filter_buff_node_ptr = run_filter_buff_node_ptr->next;
+            }
+            else
+            {
+                run_filter_buff_node_ptr = head_buff_node_ptr;
+            }
+        }
+        else
+        {
+            vTaskDelay((250/tcp_send_frequency) / portTICK_PERIOD_MS);
+        }
     }
 }
 
@@ -93,34 +302,69 @@ static void sampling_data_callback(void* arg)
 {
     int64_t pre_time = esp_timer_get_time();
 
-    if (run_buff_node_ptr->i_samples == 0)
+    uint8_t *samples = run_buff_node_ptr->samples_buff + STREAM_HEADROOM; // The header is written in front when the node is sent.
+    uint32_t i_samples = run_buff_node_ptr->i_samples;
+
+    if (i_samples == 0)
     {
         run_buff_node_ptr->t_begin = (uint64_t) pre_time; // Record the time that we begin recording.
+        run_buff_node_ptr->stream_flags = stream_layout_flags | sampling_block_flags; // The layout cannot change in the middle of a block.
+    }
+
+    // Scan the channels. With the decimation on, a scan is stored only when the decimators produce an output.
+    uint16_t scan[GPIO_ADC_MAX_CHANNELS];
+    uint8_t is_output = iawTrue;
+
+    sampling_source.read_scan(sampling_source.ctx, scan, gpio_adc_n_channels);
+
+    stats_add(&(run_buff_node_ptr->stats), scan, gpio_adc_n_channels, (1 << GPIO_ADC_BITS) - 1);
+
+    if (sampling_data_decimation != DECIMATE_OFF)
+    {
+        for (uint8_t i_channel = 0; i_channel < gpio_adc_n_channels; i_channel++)
+        {
+            is_output = (uint8_t) decimate_push(&sampling_decimate, i_channel, scan[i_channel], &(scan[i_channel]));
+        }
     }
 
-    uint16_t sample = sampling_input();
+    if (is_output == iawTrue)
+    {
+        // Each sample is stored as the high byte followed by the low byte.
+        if (run_buff_node_ptr->stream_flags & STREAM_FLAG_PLANAR)
+        {
+            uint32_t i_plane = i_samples/gpio_adc_n_channels;
+            uint32_t plane_bytes = run_buff_node_ptr->n_samples/gpio_adc_n_channels;
+
+            for (uint8_t i_channel = 0; i_channel < gpio_adc_n_channels; i_channel++)
+            {
+                samples[i_plane]        = highbyte(scan[i_channel]);
+                samples[i_plane + 1]    = lowbyte(scan[i_channel]);
 
-    uint8_t high_sample = highbyte(sample);
-    uint8_t low_sample  = lowbyte(sample);
+                i_plane = i_plane + plane_bytes;
+            }
+        }
+        else
+        {
+            for (uint8_t i_channel = 0; i_channel < gpio_adc_n_channels; i_channel++)
+            {
+                samples[i_samples + 2*i_channel]       = highbyte(scan[i_channel]);
+                samples[i_samples + 2*i_channel + 1]   = lowbyte(scan[i_channel]);
+            }
+        }
 
-    // Store the high byte of the sample.
-    (run_buff_node_ptr->samples_buff)[4 + PACKET_HEADER_GROUP1_META_SIZE + (run_buff_node_ptr->i_samples)] = high_sample; // 4 bytes for the length of the data
-    (run_buff_node_ptr->samples_buff)[4 + PACKET_HEADER_GROUP1_META_SIZE + (run_buff_node_ptr->i_samples)] = low_sample;   
-    run_buff_node_ptr->i_samples = run_buff_node_ptr->i_samples + 2;
+        run_buff_node_ptr->i_samples = i_samples + 2*gpio_adc_n_channels;
+    }
 
     if (run_buff_node_ptr->i_samples == run_buff_node_ptr->n_samples)
     {        
-        // Calculate the effective sampling frequency.
-        run_buff_node_ptr->eff_sampling_freq = (uint32_t) ( (run_buff_node_ptr->n_samples - 2)*500000 )/( ( (uint64_t) pre_time ) - (run_buff_node_ptr->t_begin) );
+        // Calculate the effective sampling frequency of each channel, i.e. the scans per second.
+        uint32_t n_scans = run_buff_node_ptr->n_samples/(2*gpio_adc_n_channels);
+        run_buff_node_ptr->eff_sampling_freq = (uint32_t) ( ((uint64_t) (n_scans - 1))*1000000/( ( (uint64_t) pre_time ) - (run_buff_node_ptr->t_begin) ) );
 
-        // Record the effective sampling frequency into the streamed data.
-        uint8_t tmp[4];
-        uint32_to_bytes(run_buff_node_ptr->eff_sampling_freq, tmp);
+        sampling_data_rate = run_buff_node_ptr->eff_sampling_freq;
 
-        (run_buff_node_ptr->samples_buff)[5] = tmp[0];
-        (run_buff_node_ptr->samples_buff)[6] = tmp[1];
-        (run_buff_node_ptr->samples_buff)[7] = tmp[2];
-        (run_buff_node_ptr->samples_buff)[8] = tmp[3];
+        run_buff_node_ptr->block_seq = sampling_data_block_seq;
+        sampling_data_block_seq = sampling_data_block_seq + 1;
 
         struct buff_node *tmp_ptr = run_buff_node_ptr; // Guarantee thread safe.        
 
@@ -136,21 +380,146 @@ static void sampling_data_callback(void* arg)
         }
 
         run_buff_node_ptr->i_samples = 0;     
+        stats_reset(&(run_buff_node_ptr->stats), gpio_adc_n_channels);
+
+        if ((tcp_is_draining == iawTrue) && (run_buff_node_ptr->is_sent == iawFalse))
+            sampling_data_n_dropped = sampling_data_n_dropped + 1;
+
         run_buff_node_ptr->is_sent = iawTrue;
+        run_buff_node_ptr->is_spilled = iawTrue;
+        run_buff_node_ptr->is_filtered = iawTrue;
+
+        // Set bit to tell com_tcp_send_task() to send this buffer node, and flash_spill_task() to keep it when nobody streams.
+        // With a filter set, sampling_filter_task() sets them after filtering instead.
+        tmp_ptr->is_filter_bypassed = (sampling_filter_enabled == iawTrue) ? iawFalse : iawTrue;
+
+        if (tmp_ptr->is_filter_bypassed == iawTrue)
+        {
+            tmp_ptr->is_spilled = iawFalse;
+            tmp_ptr->is_sent  = iawFalse;
+        }
 
-        // Set bit to tell com_tcp_send_task() to send this buffer node.
-        tmp_ptr->is_sent  = iawFalse;
+        tmp_ptr->is_filtered = iawFalse;
     }
 
     int64_t cur_time = esp_timer_get_time();
 
     // Check if the operation is longer that the sampling frequency. If it is, we cannot guarantee the right timing.    
     if ((cur_time - pre_time) > (int64_t) (1000000/sampling_data_fs))
-        ESP_LOGW(IAWARE_CORE, "Sample data: Too high sampling frequency by %" PRId64 " microsec.", (cur_time - pre_time) - (int64_t) (1000000/sampling_data_fs));   
+        BLOGW(BLOG_TAG_IAWARE_CORE, BLOG_FMT_SAMPLING_TOO_HIGH_FS, (cur_time - pre_time) - (int64_t) (1000000/sampling_data_fs), 0, 0);
+
+}
+
+static void init_source(void)
+// A generator starts at its first scan at every boot, so the blocks of a boot are the same from one run to the next.
+{
+    struct source_params params;
+    uint32_t value;
+
+    source_init_adc(&sampling_source);
+
+    if ((nvs_read_u32(SAMPLING_DATA_NVS_SOURCE, &value) == iawFalse) || (value == SOURCE_ADC))
+        return;
+
+    memset(&params, 0, sizeof(params));
+
+    params.kind         = (uint8_t) value;
+    params.fs           = sampling_data_fs;
+    params.full_scale   = (1 << GPIO_ADC_BITS) - 1;
+
+    nvs_read_u32(SAMPLING_DATA_NVS_SOURCE_F0, &(params.f0_mhz));
+    nvs_read_u32(SAMPLING_DATA_NVS_SOURCE_F1, &(params.f1_mhz));
+    nvs_read_u32(SAMPLING_DATA_NVS_SOURCE_SEED, &(params.seed));
+
+    if (nvs_read_u32(SAMPLING_DATA_NVS_SOURCE_SWEEP, &value) == iawTrue)
+        params.sweep_scans = (uint32_t) ((uint64_t) value*sampling_data_fs/1000);
+
+    if (nvs_read_u32(SAMPLING_DATA_NVS_SOURCE_LEVEL, &value) == iawTrue)
+    {
+        params.amplitude    = (uint16_t) (value >> 16);
+        params.offset       = (uint16_t) (value & 0xFFFF);
+    }
+
+    if (source_init_synth(&sampling_source, &sampling_synth, &params) != SOURCE_OK)
+    {
+        ESP_LOGE(IAWARE_CORE, "Sample data: Source %d is invalid. The ADC is sampled.", params.kind);
+
+        source_init_adc(&sampling_source);
 
+        return;
+    }
+
+    sampling_block_flags = sampling_block_flags | STREAM_FLAG_SYNTHETIC;
+
+    ESP_LOGW(IAWARE_CORE, "Sample data: Source %d, %d..%d mHz, amplitude %d around %d. The ADC is NOT sampled.", params.kind, params.f0_mhz, params.f1_mhz, params.amplitude, params.offset);
+}
+
+static void init_decimate(void)
+{
+    uint32_t value;
+
+    if ((nvs_read_u32(SAMPLING_DATA_NVS_DECIMATION, &value) == iawTrue) && (decimate_factor_is_valid(value)))
+        sampling_data_decimation = value;
+
+    if ((sampling_data_fs/sampling_data_decimation) < tcp_send_frequency)
+    {
+        ESP_LOGW(IAWARE_CORE, "Sample data: Decimation by %d leaves less than one scan per block. It is turned off.", sampling_data_decimation);
+
+        sampling_data_decimation = DECIMATE_OFF;
+    }
+
+    if (sampling_data_decimation != DECIMATE_OFF)
+        benchmark_decimate();
+
+    decimate_init(&sampling_decimate, sampling_data_decimation, gpio_adc_n_channels);
+
+    sampling_data_bits = sampling_decimate.bits;
+
+    // The calibration runs in sampling_filter_task(), which then gets every block.
+    if (adc_cal_enabled == iawTrue)
+    {
+        sampling_cal_in_bits = sampling_data_bits;
+        sampling_data_bits = ADC_CAL_BITS;
+        sampling_block_flags = sampling_block_flags | STREAM_FLAG_CALIBRATED;
+        sampling_filter_enabled = iawTrue;
+    }
+
+    ESP_LOGI(IAWARE_CORE, "Sample data: Decimation by %d, %d Hz and %d bits per channel.", sampling_data_decimation, sampling_data_fs/sampling_data_decimation, sampling_data_bits);
 }
 
-static uint16_t sampling_input(void)
+static void benchmark_decimate(void)
+// Time decimate_push() in CPU cycles, because it runs for every channel at every tick of the sampling timer.
 {
-    return (uint16_t) iaware_analogRead();
-}
\ No newline at end of file
+    uint16_t out;
+    uint32_t n_outputs = 0;
+
+    decimate_init(&sampling_decimate, sampling_data_decimation, 1);
+
+    uint32_t pre_ccount = xthal_get_ccount();
+
+    for (uint32_t i = 0; i < SAMPLING_DATA_BENCH_SAMPLES; i++)
+    {
+        n_outputs = n_outputs + decimate_push(&sampling_decimate, 0, (uint16_t) (i & 0x0FFF), &out);
+    }
+
+    uint32_t cycles = xthal_get_ccount() - pre_ccount;
+
+    ESP_LOGI(IAWARE_CORE, "Sample data: Decimation by %d takes %d cycles per input sample (%d outputs).", sampling_data_decimation, cycles/SAMPLING_DATA_BENCH_SAMPLES, n_outputs);
+}
+
+static void init_features(void)
+{
+    uint32_t value;
+
+    if ((nvs_read_u32(SAMPLING_DATA_NVS_FEATURES, &value) == iawTrue) && (feature_period_is_valid(value)))
+    {
+        if (feature_init(&sampling_feature, value, sampling_data_fs/sampling_data_decimation, gpio_adc_n_channels, gpio_adc_channel_mask) == FEATURE_OK)
+            ESP_LOGI(IAWARE_CORE, "Sample data: Band powers every %d ms.", value);
+        else
+            ESP_LOGW(IAWARE_CORE, "Sample data: %d Hz is too low for the band powers. They are turned off.", sampling_data_fs/sampling_data_decimation);
+    }
+    else
+    {
+        feature_init(&sampling_feature, FEATURE_PERIOD_OFF, 0, 0, 0);
+    }
+}
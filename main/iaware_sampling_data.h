@@ -1,13 +1,31 @@
 #ifndef IAWARE_SAMPLING_DATA_H
 #define IAWARE_SAMPLING_DATA_H
 
+#include "iaware_filter.h"
+#include "iaware_source.h"
+
 // #define SAMPLING_DATA_FS 30000	// Default sampling frequency
 #define SAMPLING_DATA_FS 20000	// Default sampling frequency
 // #define SAMPLING_DATA_FS 1000	// Default sampling frequency
 // #define SAMPLING_DATA_FS 2000	// Default sampling frequency
 // #define SAMPLING_DATA_FS 2	// Default sampling frequency
 
-extern uint32_t sampling_data_fs;	// The sampling frequency of the signal.
+#define SAMPLING_DATA_NVS_DECIMATION	"dec"
+#define SAMPLING_DATA_NVS_FEATURES		"feat"
+#define SAMPLING_DATA_NVS_SOURCE		"src"		// See iaware_source.h. SOURCE_ADC when it is missing.
+#define SAMPLING_DATA_NVS_SOURCE_F0		"src_f0"
+#define SAMPLING_DATA_NVS_SOURCE_F1		"src_f1"
+#define SAMPLING_DATA_NVS_SOURCE_SWEEP	"src_sweep"	// [ms]
+#define SAMPLING_DATA_NVS_SOURCE_LEVEL	"src_lvl"	// amplitude << 16 | offset
+#define SAMPLING_DATA_NVS_SOURCE_SEED	"src_seed"
+#define SAMPLING_DATA_BENCH_SAMPLES		4096	// The samples timed by init_sampling_data_task() when the decimation is on.
+
+extern uint32_t sampling_data_fs;	// The sampling frequency of the signal, i.e. of the ADC.
+extern uint32_t sampling_data_decimation;	// The blocks hold sampling_data_fs/sampling_data_decimation scans per second. See iaware_decimate.h.
+extern uint8_t sampling_data_bits;	// The significant bits of a stored sample.
+extern uint32_t sampling_data_block_seq;	// The block_seq of the next completed buff node.
+extern uint32_t sampling_data_n_dropped;	// The blocks overwritten before com_tcp_send_task() sent them to a streaming client.
+extern uint32_t sampling_data_rate;	// The eff_sampling_freq of the last completed buff node, for the tasks that do not own the buff nodes.
 
 void init_sampling_data_task(void);
 void sampling_data_createTimer(void);
@@ -16,4 +34,11 @@ void sampling_data_stopTimer(void);
 
 void init_buff_nodes(void);
 
+int sampling_data_set_decimation(uint32_t factor);
+int sampling_data_set_source(const struct source_params *params, uint32_t sweep_ms);
+int sampling_data_set_filter(uint8_t i_channel, uint8_t n_sections, const struct filter_section *sections);
+int sampling_data_set_features(uint32_t period_ms);
+uint32_t sampling_data_features_pack(uint8_t *dst, uint32_t max_len, uint32_t *publish_seq);
+void sampling_filter_task(void *pvParameter);
+
 #endif
\ No newline at end of file
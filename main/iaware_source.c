@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "iaware_source.h"
+
+static void synth_read_scan(void *ctx, uint16_t *scan, uint8_t n_channels);
+static void replay_read_scan(void *ctx, uint16_t *scan, uint8_t n_channels);
+static uint32_t synth_inc(uint32_t f_mhz, uint32_t fs);
+static uint16_t synth_clip(int32_t v, uint16_t full_scale);
+
+// round(32767*sin(i*pi/128)), i.e. a quarter period in 64 steps.
+const int16_t source_sine_table[SOURCE_SINE_TABLE_SIZE] =
+{
+        0,   804,  1608,  2410,  3212,  4011,  4808,  5602,
+     6393,  7179,  7962,  8739,  9512, 10278, 11039, 11793,
+    12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+    18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+    23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+    27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+    30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+    32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+    32767
+};
+
+int source_init_synth(struct sample_source *src, struct source_synth *synth, const struct source_params *params)
+{
+    if (((params->kind != SOURCE_SINE) && (params->kind != SOURCE_CHIRP) && (params->kind != SOURCE_NOISE)) || (params->fs == 0))
+        return SOURCE_ERR_PARAMS;
+
+    if ((params->kind == SOURCE_CHIRP) && (params->sweep_scans == 0))
+        return SOURCE_ERR_PARAMS;
+
+    memset(synth, 0, sizeof(struct source_synth));
+
+    synth->params   = *params;
+    synth->inc0     = synth_inc(params->f0_mhz, params->fs);
+    synth->inc1     = synth_inc(params->f1_mhz, params->fs);
+    synth->rng      = (params->seed != 0) ? params->seed : 1;
+
+    src->ctx        = synth;
+    src->kind       = params->kind;
+    src->read_scan  = synth_read_scan;
+
+    return SOURCE_OK;
+}
+
+int source_init_replay(struct sample_source *src, struct source_replay *replay, const uint8_t *scans, uint32_t len, uint8_t n_channels)
+// Params:
+//     scans        : len bytes of big-endian interleaved scans of n_channels channels. A partial last scan is ignored.
+{
+    if ((n_channels == 0) || (len < 2u*n_channels))
+        return SOURCE_ERR_PARAMS;
+
+    replay->scans       = scans;
+    replay->n_scans     = len/(2u*n_channels);
+    replay->n_channels  = n_channels;
+    replay->i_scan      = 0;
+
+    src->ctx        = replay;
+    src->kind       = SOURCE_REPLAY;
+    src->read_scan  = replay_read_scan;
+
+    return SOURCE_OK;
+}
+
+int16_t source_sin_q15(uint32_t phase)
+// sin(2*pi*phase/2^32) in Q15, interpolated linearly between the 256 steps of a period.
+{
+    int32_t y[2];
+
+    for (uint8_t k = 0; k < 2; k++)
+    {
+        uint8_t step = (uint8_t) ((phase >> 24) + k);
+        uint8_t i = step & 63;
+
+        switch (step >> 6)
+        {
+            case 0:     y[k] = source_sine_table[i];        break;
+            case 1:     y[k] = source_sine_table[64 - i];   break;
+            case 2:     y[k] = -source_sine_table[i];       break;
+            default:    y[k] = -source_sine_table[64 - i];  break;
+        }
+    }
+
+    return (int16_t) (y[0] + (((y[1] - y[0])*(int32_t) ((phase >> 8) & 0xFFFF)) >> 16));
+}
+
+//////////////////// Private ////////////////////
+
+static void synth_read_scan(void *ctx, uint16_t *scan, uint8_t n_channels)
+{
+    struct source_synth *s = (struct source_synth *) ctx;
+    const struct source_params *p = &(s->params);
+
+    for (uint8_t i_channel = 0; i_channel < n_channels; i_channel++)
+    {
+        int32_t v;
+
+        if (p->kind == SOURCE_NOISE)
+        {
+            s->rng ^= s->rng << 13;
+            s->rng ^= s->rng >> 17;
+            s->rng ^= s->rng << 5;
+
+            v = (int32_t) (s->rng % (2u*p->amplitude + 1)) - p->amplitude;
+        }
+        else
+        {
+            v = ((int32_t) p->amplitude*source_sin_q15(s->phase - i_channel*SOURCE_CHANNEL_PHASE)) >> 15;
+        }
+
+        scan[i_channel] = synth_clip(p->offset + v, p->full_scale);
+    }
+
+    if (p->kind == SOURCE_SINE)
+    {
+        s->phase = s->phase + s->inc0;
+    }
+    else if (p->kind == SOURCE_CHIRP)
+    {
+        // The increment ramps linearly, so the phase is quadratic in the scan.
+        int64_t d_inc = (int64_t) s->inc1 - (int64_t) s->inc0;
+
+        s->phase = s->phase + (uint32_t) ((int64_t) s->inc0 + d_inc*s->i_scan/(int64_t) p->sweep_scans);
+        s->i_scan = s->i_scan + 1;
+
+        if (s->i_scan == p->sweep_scans)
+        {
+            s->i_scan = 0;
+            s->phase = 0;
+        }
+    }
+}
+
+static void replay_read_scan(void *ctx, uint16_t *scan, uint8_t n_channels)
+{
+    struct source_replay *r = (struct source_replay *) ctx;
+    const uint8_t *rec = &(r->scans[2u*r->n_channels*r->i_scan]);
+
+    for (uint8_t i_channel = 0; i_channel < n_channels; i_channel++)
+    {
+        const uint8_t *b = &(rec[2*(i_channel % r->n_channels)]);
+
+        scan[i_channel] = (uint16_t) ((b[0] << 8) | b[1]);
+    }
+
+    r->i_scan = (r->i_scan + 1 < r->n_scans) ? (r->i_scan + 1) : 0;
+}
+
+static uint32_t synth_inc(uint32_t f_mhz, uint32_t fs)
+// The phase increment per scan of a sine of f_mhz, rounded.
+{
+    return (uint32_t) ((((uint64_t) f_mhz << 32) + 500ull*fs)/(1000ull*fs));
+}
+
+static uint16_t synth_clip(int32_t v, uint16_t full_scale)
+{
+    if (v < 0)
+        return 0;
+
+    return (v > full_scale) ? full_scale : (uint16_t) v;
+}
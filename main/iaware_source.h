@@ -0,0 +1,86 @@
+#ifndef IAWARE_SOURCE_H
+#define IAWARE_SOURCE_H
+
+#include <stdint.h>
+
+// The source of the scans that sampling_data_callback() stores, so the pipeline (decimation, filters, stream encoding, TCP
+// sender) can run on a known signal instead of the analog noise of the pads. A source fills one scan per call:
+//
+//     SOURCE_ADC      The ADC pads, see source_init_adc() in iaware_gpio.c.
+//     SOURCE_SINE     offset + amplitude*sin(2*pi*f0*t). Channel i lags channel 0 by i/8 of a period.
+//     SOURCE_CHIRP    A sine sweeping linearly from f0 to f1 within sweep_scans scans, then again from f0.
+//     SOURCE_NOISE    offset + a uniform integer in [-amplitude, amplitude], from a xorshift32 seeded with seed.
+//     SOURCE_REPLAY   A recording of big-endian interleaved scans, i.e. the samples of a 1-channel-mask block in the
+//                     interleaved layout, looped. Recorded channel i % n_channels feeds channel i.
+//
+// The synthetic sources advance by scan, not by time, and use integer arithmetic only, so scan k of a boot is the same
+// on the ESP32, on Linux and in source_reference() of iaware_host.py whatever the jitter of the timer, see
+// test_host_source.py. The replay from a file is in iaware_source_file.c, for Linux.
+#define SOURCE_ADC              0
+#define SOURCE_SINE             1
+#define SOURCE_CHIRP            2
+#define SOURCE_NOISE            3
+#define SOURCE_REPLAY           4
+
+#define SOURCE_MAX_CHANNELS     8       // GPIO_ADC_MAX_CHANNELS
+#define SOURCE_SINE_TABLE_SIZE  65      // A quarter period, both ends included.
+#define SOURCE_CHANNEL_PHASE    (1u << 29)      // 1/8 of a period.
+
+#define SOURCE_OK               0
+#define SOURCE_ERR_PARAMS       -1
+
+struct source_params
+{
+    uint8_t kind;
+    uint32_t fs;                // [scans/sec]
+    uint32_t f0_mhz;            // [mHz]. SOURCE_SINE and SOURCE_CHIRP.
+    uint32_t f1_mhz;            // [mHz]. SOURCE_CHIRP.
+    uint32_t sweep_scans;       // SOURCE_CHIRP.
+    uint16_t amplitude;         // [LSB]
+    uint16_t offset;            // [LSB]
+    uint16_t full_scale;        // [LSB]. The output is clipped to [0, full_scale].
+    uint32_t seed;              // SOURCE_NOISE. 0 is replaced by 1.
+};
+
+struct source_synth
+{
+    struct source_params params;
+
+    uint32_t phase;             // Channel 0, in 1/2^32 of a period.
+    uint32_t inc0;              // The phase increment per scan at f0.
+    uint32_t inc1;              // At f1.
+    uint32_t i_scan;            // The scan in the sweep.
+    uint32_t rng;
+};
+
+struct source_replay
+{
+    const uint8_t *scans;
+    uint32_t n_scans;
+    uint8_t n_channels;         // The channels of a recorded scan.
+    uint32_t i_scan;
+};
+
+// A source. ctx is a struct source_synth, a struct source_replay, or NULL for SOURCE_ADC.
+struct sample_source
+{
+    void *ctx;
+    uint8_t kind;
+
+    void (*read_scan)(void *ctx, uint16_t *scan, uint8_t n_channels);
+};
+
+extern const int16_t source_sine_table[SOURCE_SINE_TABLE_SIZE];
+
+int source_init_synth(struct sample_source *src, struct source_synth *synth, const struct source_params *params);
+int source_init_replay(struct sample_source *src, struct source_replay *replay, const uint8_t *scans, uint32_t len, uint8_t n_channels);
+int16_t source_sin_q15(uint32_t phase);
+
+// iaware_gpio.c
+void source_init_adc(struct sample_source *src);
+
+// iaware_source_file.c
+int source_init_replay_file(struct sample_source *src, struct source_replay *replay, const char *path, uint8_t n_channels);
+void source_close_replay_file(struct source_replay *replay);
+
+#endif
@@ -0,0 +1,60 @@
+// Replay of a recorded binary file through iaware_source.c on Linux. It is not in COMPONENT_SRCS, so the ESP32 firmware
+// does not use it. Build it together with the source, e.g. gcc -I. iaware_source.c iaware_source_file.c my_program.c
+// The file holds big-endian interleaved scans, e.g. as written by source_record() of iaware_host.py. It is read whole,
+// so the replay never touches the disk and a benchmark times only the pipeline.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "iaware_source.h"
+
+int source_init_replay_file(struct sample_source *src, struct source_replay *replay, const char *path, uint8_t n_channels)
+// Return SOURCE_OK when success. Release the file with source_close_replay_file().
+{
+    FILE *fp;
+    long len;
+    uint8_t *scans;
+
+    replay->scans = NULL;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+        return SOURCE_ERR_PARAMS;
+
+    if ((fseek(fp, 0, SEEK_END) != 0) || ((len = ftell(fp)) <= 0) || (fseek(fp, 0, SEEK_SET) != 0))
+    {
+        fclose(fp);
+        return SOURCE_ERR_PARAMS;
+    }
+
+    if ((scans = (uint8_t *) malloc((size_t) len)) == NULL)
+    {
+        fclose(fp);
+        return SOURCE_ERR_PARAMS;
+    }
+
+    if (fread(scans, 1, (size_t) len, fp) != (size_t) len)
+    {
+        free(scans);
+        fclose(fp);
+        return SOURCE_ERR_PARAMS;
+    }
+
+    fclose(fp);
+
+    if (source_init_replay(src, replay, scans, (uint32_t) len, n_channels) != SOURCE_OK)
+    {
+        free(scans);
+        return SOURCE_ERR_PARAMS;
+    }
+
+    return SOURCE_OK;
+}
+
+void source_close_replay_file(struct source_replay *replay)
+{
+    free((void *) replay->scans);
+
+    replay->scans = NULL;
+    replay->n_scans = 0;
+}
@@ -0,0 +1,118 @@
+#include <stdint.h>
+
+#include "iaware_stats.h"
+
+static uint32_t isqrt64(uint64_t v);
+
+void stats_reset(struct block_stats *s, uint8_t n_channels)
+{
+    s->n_reads = 0;
+
+    for (uint8_t i_channel = 0; (i_channel < n_channels) && (i_channel < STATS_MAX_CHANNELS); i_channel++)
+    {
+        struct stats_channel *c = &(s->channels[i_channel]);
+
+        c->min = 0xFFFF;
+        c->max = 0;
+        c->n_saturated = 0;
+        c->sum = 0;
+        c->sum_sq = 0;
+    }
+}
+
+void stats_add(struct block_stats *s, const uint16_t *scan, uint8_t n_channels, uint16_t full_scale)
+// Add a scan of raw reads. It runs in the sampling callback, so it only compares and adds.
+// Params:
+//     full_scale   : The highest read, e.g. 4095 for 12 bits.
+{
+    for (uint8_t i_channel = 0; i_channel < n_channels; i_channel++)
+    {
+        struct stats_channel *c = &(s->channels[i_channel]);
+        uint16_t v = scan[i_channel];
+
+        if (v < c->min)
+            c->min = v;
+
+        if (v > c->max)
+            c->max = v;
+
+        if (((v == 0) || (v >= full_scale)) && (c->n_saturated < 0xFFFF))
+            c->n_saturated = c->n_saturated + 1;
+
+        c->sum = c->sum + v;
+        c->sum_sq = c->sum_sq + (uint32_t) v*v;
+    }
+
+    s->n_reads = s->n_reads + 1;
+}
+
+uint32_t stats_pack(const struct block_stats *s, uint8_t n_channels, uint8_t *dst)
+// Write the statistics in the layout of iaware_stats.h, big-endian. Return STATS_SIZE(n_channels).
+{
+    uint32_t n = s->n_reads;
+
+    dst[0] = (uint8_t) (n >> 24);
+    dst[1] = (uint8_t) (n >> 16);
+    dst[2] = (uint8_t) (n >> 8);
+    dst[3] = (uint8_t) (n & 0xFF);
+
+    for (uint8_t i_channel = 0; i_channel < n_channels; i_channel++)
+    {
+        const struct stats_channel *c = &(s->channels[i_channel]);
+        uint8_t *p = &(dst[4 + STATS_CHANNEL_SIZE*i_channel]);
+        uint16_t min = (n > 0) ? c->min : 0;
+        uint16_t mean = 0;
+        uint16_t std = 0;
+
+        if (n > 0)
+        {
+            // n*sum_sq - sum^2 is n^2 times the variance, exactly.
+            uint64_t var_n2 = (uint64_t) n*c->sum_sq - (uint64_t) c->sum*c->sum;
+
+            mean = (uint16_t) ((((uint64_t) c->sum << STATS_FRAC_BITS) + n/2)/n);
+            std = (uint16_t) (isqrt64(var_n2 << (2*STATS_FRAC_BITS))/n);
+        }
+
+        p[0] = (uint8_t) (min >> 8);
+        p[1] = (uint8_t) (min & 0xFF);
+        p[2] = (uint8_t) (c->max >> 8);
+        p[3] = (uint8_t) (c->max & 0xFF);
+        p[4] = (uint8_t) (mean >> 8);
+        p[5] = (uint8_t) (mean & 0xFF);
+        p[6] = (uint8_t) (std >> 8);
+        p[7] = (uint8_t) (std & 0xFF);
+        p[8] = (uint8_t) (c->n_saturated >> 8);
+        p[9] = (uint8_t) (c->n_saturated & 0xFF);
+    }
+
+    return STATS_SIZE(n_channels);
+}
+
+//////////////////// Private ////////////////////
+
+static uint32_t isqrt64(uint64_t v)
+// floor(sqrt(v)), bit by bit.
+{
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t) 1 << 62;
+
+    while (bit > v)
+        bit = bit >> 2;
+
+    while (bit != 0)
+    {
+        if (v >= root + bit)
+        {
+            v = v - root - bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root = root >> 1;
+        }
+
+        bit = bit >> 2;
+    }
+
+    return (uint32_t) root;
+}
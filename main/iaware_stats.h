@@ -0,0 +1,41 @@
+#ifndef IAWARE_STATS_H
+#define IAWARE_STATS_H
+
+#include <stdint.h>
+
+// The data-quality statistics of a block, so that a client can flag clipping, flat lines and DC drift without touching
+// the samples. The sampling callback adds every raw ADC read of a channel, before the decimation and the filters, so a
+// saturated read is one at 0 or at the full scale of GPIO_ADC_BITS. A block spans the reads from the completion of the
+// previous block to its own.
+//
+// A v2 client asks for them with CMD_SET_STREAM_STATS. They follow the v2 header of every live block, see iaware_stream.h:
+//
+//     |uint32_t n_reads|n_channels*|uint16_t min|uint16_t max|uint16_t mean|uint16_t std|uint16_t n_saturated||
+//
+// mean and std are in 1/2^STATS_FRAC_BITS LSB of the raw reads. n_saturated stops at 0xFFFF.
+#define STATS_MAX_CHANNELS      8       // GPIO_ADC_MAX_CHANNELS
+#define STATS_FRAC_BITS         4       // A 12-bit mean or std still fits in 16 bits.
+#define STATS_CHANNEL_SIZE      (2 + 2 + 2 + 2 + 2)     // [bytes]
+#define STATS_SIZE(n_channels)  (4 + STATS_CHANNEL_SIZE*(n_channels))
+#define STATS_MAX_SIZE          STATS_SIZE(STATS_MAX_CHANNELS)
+
+struct stats_channel
+{
+    uint16_t min;
+    uint16_t max;
+    uint16_t n_saturated;
+    uint32_t sum;
+    uint64_t sum_sq;
+};
+
+struct block_stats
+{
+    uint32_t n_reads;               // The reads of every channel.
+    struct stats_channel channels[STATS_MAX_CHANNELS];
+};
+
+void stats_reset(struct block_stats *s, uint8_t n_channels);
+void stats_add(struct block_stats *s, const uint16_t *scan, uint8_t n_channels, uint16_t full_scale);
+uint32_t stats_pack(const struct block_stats *s, uint8_t n_channels, uint8_t *dst);
+
+#endif
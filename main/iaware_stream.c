@@ -0,0 +1,264 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "iaware_blog.h"
+#include "iaware_degrade.h"
+#include "iaware_gpio.h"
+#include "iaware_helper.h"
+#include "iaware_packet.h"
+#include "iaware_sampling_data.h"
+#include "iaware_stats.h"
+#include "iaware_stream.h"
+#include "iaware_tcp_com.h"
+#include "iaware_trigger.h"
+#include "main.h"
+
+static uint8_t *stream_pack_degraded(struct buff_node *node, uint8_t level, uint32_t factor, uint8_t flags, uint32_t *frame_len);
+
+uint8_t stream_version = STREAM_VERSION_1;
+uint8_t stream_send_version_pending = iawFalse;
+uint8_t stream_layout_flags = 0;
+uint8_t stream_stats_flags = 0;
+uint8_t *stream_degrade_buff = NULL;
+struct degrade stream_degrade = {DEGRADE_LEVEL_FULL, DEGRADE_LEVEL_MAX, 2, 0, 0, 0, 0};
+
+uint8_t stream_set_version(uint8_t version)
+// The client asks for the highest version that it understands. Return the version that is used from the next block on.
+{
+    if (version > STREAM_VERSION_MAX)
+        version = STREAM_VERSION_MAX;
+
+    if (version < STREAM_VERSION_1)
+        version = STREAM_VERSION_1;
+
+    stream_version = version;
+
+    if (stream_version == STREAM_VERSION_1)
+    {
+        stream_layout_flags = 0;
+        stream_stats_flags = 0;
+    }
+
+    return stream_version;
+}
+
+uint8_t stream_set_layout(uint8_t layout)
+// Only a v2 header tells the layout, so a v1 client stays interleaved. Return the layout that is used from the next block on.
+{
+    if ((layout == STREAM_LAYOUT_PLANAR) && (stream_version == STREAM_VERSION_2))
+        stream_layout_flags = STREAM_FLAG_PLANAR;
+    else
+        stream_layout_flags = 0;
+
+    return (stream_layout_flags == STREAM_FLAG_PLANAR) ? STREAM_LAYOUT_PLANAR : STREAM_LAYOUT_INTERLEAVED;
+}
+
+uint8_t stream_set_stats(uint8_t is_on)
+// Only a v2 header carries the statistics. Return iawTrue when they follow the header from the next block on.
+{
+    stream_stats_flags = (is_on && (stream_version == STREAM_VERSION_2)) ? STREAM_FLAG_STATS : 0;
+
+    return (stream_stats_flags == STREAM_FLAG_STATS) ? iawTrue : iawFalse;
+}
+
+uint32_t stream_header_size(uint8_t version, const struct stream_block_meta *meta)
+// Including the 4-bytes length and the statistics.
+{
+    if (version != STREAM_VERSION_2)
+        return 4 + PACKET_HEADER_GROUP1_META_SIZE;
+
+    return 4 + PACKET_HEADER_STREAM_V2_META_SIZE + ((meta->flags & STREAM_FLAG_STATS) ? STATS_SIZE(meta->n_channels) : 0);
+}
+
+uint32_t stream_header_write(uint8_t *dst, uint8_t version, struct stream_block_meta *meta, uint32_t payload_len)
+// Write |(4bytes)|header| of a block with payload_len bytes of samples to dst. Return stream_header_size(version, meta).
+{
+    uint32_t header_size = stream_header_size(version, meta);
+
+    uint32_to_bytes(header_size - 4 + payload_len, &(dst[0]));
+
+    if (version == STREAM_VERSION_2)
+    {
+        dst[4]  = PACKET_HEADER_STREAM;
+        dst[5]  = STREAM_VERSION_2;
+        dst[6]  = meta->flags;
+        dst[7]  = meta->n_channels;
+        dst[8]  = meta->encoding;
+        dst[9]  = meta->bits;
+        dst[10] = meta->channel_mask;
+        dst[11] = meta->level;
+        uint32_to_bytes(meta->block_seq, &(dst[12]));
+        uint64_to_bytes(meta->t_begin, &(dst[16]));
+        uint32_to_bytes(meta->rate, &(dst[24]));
+        uint32_to_bytes(meta->n_samples, &(dst[28]));
+
+        if (meta->flags & STREAM_FLAG_STATS)
+            stats_pack(meta->stats, meta->n_channels, &(dst[4 + PACKET_HEADER_STREAM_V2_META_SIZE]));
+    }
+    else
+    {
+        dst[4] = PACKET_HEADER_GROUP1;
+        uint32_to_bytes(meta->rate, &(dst[5]));
+    }
+
+    return header_size;
+}
+
+void stream_meta_init(struct stream_block_meta *meta)
+// The fields that follow the acquisition settings rather than the block.
+{
+    meta->flags         = 0;
+    meta->n_channels    = gpio_adc_n_channels;
+    meta->encoding      = STREAM_ENCODING_U16_BE;
+    meta->bits          = sampling_data_bits;
+    meta->channel_mask  = gpio_adc_channel_mask;
+    meta->level         = DEGRADE_LEVEL_FULL;
+    meta->stats         = NULL;
+}
+
+void stream_meta_of_node(struct buff_node *node, struct stream_block_meta *meta)
+{
+    stream_meta_init(meta);
+
+    meta->flags         = node->stream_flags;
+    meta->block_seq     = node->block_seq;
+    meta->t_begin       = node->t_begin;
+    meta->rate          = node->eff_sampling_freq;
+    meta->n_samples     = node->n_samples/(2*meta->n_channels);
+
+    if (stream_stats_flags == STREAM_FLAG_STATS)
+    {
+        meta->flags = meta->flags | STREAM_FLAG_STATS;
+        meta->stats = &(node->stats);
+    }
+}
+
+uint8_t *stream_pack_node(struct buff_node *node, uint32_t *frame_len)
+// Write the header in the headroom of node->samples_buff, right in front of the samples. Return the start of the frame.
+{
+    struct stream_block_meta meta;
+
+    uint8_t version = stream_version; // The client may renegotiate while the header is being written.
+    uint8_t trigger_flags = (version == STREAM_VERSION_2) ? trigger_block_flags(node->block_seq) : 0;
+
+    if ((trigger_flags == STREAM_FLAG_PREVIEW) && (stream_degrade_buff != NULL))
+        return stream_pack_degraded(node, DEGRADE_LEVEL_PREVIEW, TRIGGER_PREVIEW_AVERAGE, STREAM_FLAG_PREVIEW, frame_len);
+
+    if ((trigger_flags == 0) && (version == STREAM_VERSION_2) && (stream_degrade.level != DEGRADE_LEVEL_FULL) && (stream_degrade_buff != NULL))
+    {
+        uint8_t *frame = stream_pack_degraded(node, stream_degrade.level, DEGRADE_AVERAGE, 0, frame_len);
+
+        if (frame != NULL)
+            return frame;
+    }
+
+    stream_meta_of_node(node, &meta);
+
+    meta.flags = meta.flags | (trigger_flags & STREAM_FLAG_TRIGGERED);
+
+    uint8_t *frame = node->samples_buff + STREAM_HEADROOM - stream_header_size(version, &meta);
+
+    *frame_len = stream_header_write(frame, version, &meta, node->n_samples) + node->n_samples;
+
+    return frame;
+}
+
+uint32_t stream_pack_version(uint8_t *dst, uint8_t version)
+// The reply to CMD_SET_STREAM_VERSION, |(4bytes)|PACKET_HEADER_STREAM_VERSION|version|.
+{
+    uint32_to_bytes(2, &(dst[0]));
+    dst[4] = PACKET_HEADER_STREAM_VERSION;
+    dst[5] = version;
+
+    return 4 + 2;
+}
+
+void stream_degrade_reset(void)
+// A new client starts from the full blocks.
+{
+    uint32_t n_buff_nodes = 0;
+
+    for (struct buff_node *node = head_buff_node_ptr; node != NULL; node = node->next)
+    {
+        n_buff_nodes = n_buff_nodes + 1;
+    }
+
+    degrade_init(&stream_degrade, stream_degrade.max_level, n_buff_nodes);
+}
+
+void stream_degrade_update(uint32_t backlog, uint32_t send_us)
+// Called by com_tcp_send_task() after every live block that it sent.
+{
+    if (degrade_update(&stream_degrade, backlog, send_us, 1000000/tcp_send_frequency))
+        BLOGI(BLOG_TAG_IAWARE_NETWORK, BLOG_FMT_DEGRADE_LEVEL, stream_degrade.level, backlog, stream_degrade.send_us_avg);
+}
+
+void stream_set_degrade(uint8_t max_level)
+// DEGRADE_LEVEL_FULL turns the degradation off. The level follows at the next block.
+{
+    stream_degrade.max_level = (max_level > DEGRADE_LEVEL_MAX) ? DEGRADE_LEVEL_MAX : max_level;
+}
+
+//////////////////// Private ////////////////////
+
+static uint8_t *stream_pack_degraded(struct buff_node *node, uint8_t level, uint32_t factor, uint8_t flags, uint32_t *frame_len)
+// Write the degraded copy of node with its v2 header to stream_degrade_buff. Return the start of the frame, or NULL when
+// the compression does not pay off for DEGRADE_LEVEL_COMPRESS, so that the full block is sent instead.
+// Params:
+//     factor   : The scans averaged into one by DEGRADE_LEVEL_DECIMATE and DEGRADE_LEVEL_PREVIEW.
+//     flags    : Added to the flags of the header.
+{
+    struct stream_block_meta meta;
+
+    uint8_t *samples = node->samples_buff + STREAM_HEADROOM;
+    uint8_t *payload = stream_degrade_buff + STREAM_HEADROOM;
+    uint32_t n_scans = node->n_samples/(2*gpio_adc_n_channels);
+    uint8_t is_planar = node->stream_flags & STREAM_FLAG_PLANAR;
+    uint32_t len;
+
+    stream_meta_of_node(node, &meta);
+
+    meta.level = level;
+    meta.flags = meta.flags | flags;
+
+    if (meta.level == DEGRADE_LEVEL_COMPRESS)
+    {
+        if ((len = degrade_delta8(samples, payload, n_scans, meta.n_channels, is_planar, node->n_samples)) == 0)
+            return NULL;
+
+        meta.encoding = STREAM_ENCODING_DELTA8;
+    }
+    else
+    {
+        // Average into the end of the payload, then encode to its start.
+        uint32_t averaged_len = 2*((n_scans + factor - 1)/factor)*meta.n_channels;
+        uint8_t *averaged = payload + node->n_samples - averaged_len;
+
+        meta.n_samples = degrade_average(samples, averaged, n_scans, meta.n_channels, is_planar, factor);
+        meta.rate = meta.rate/factor;
+
+        if (meta.level == DEGRADE_LEVEL_PREVIEW)
+        {
+            len = degrade_to_u8(averaged, payload, meta.n_samples*meta.n_channels, meta.bits);
+
+            meta.encoding = STREAM_ENCODING_U8;
+            meta.bits = 8;
+        }
+        else if ((len = degrade_delta8(averaged, payload, meta.n_samples, meta.n_channels, is_planar, node->n_samples - averaged_len)) > 0)
+        {
+            meta.encoding = STREAM_ENCODING_DELTA8;
+        }
+        else
+        {
+            len = averaged_len;
+
+            memmove(payload, averaged, len);
+        }
+    }
+
+    uint8_t *frame = payload - stream_header_size(STREAM_VERSION_2, &meta);
+
+    *frame_len = stream_header_write(frame, STREAM_VERSION_2, &meta, len) + len;
+
+    return frame;
+}
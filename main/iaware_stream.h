@@ -0,0 +1,92 @@
+#ifndef IAWARE_STREAM_H
+#define IAWARE_STREAM_H
+
+#include <stdint.h>
+
+#include "iaware_degrade.h"
+#include "iaware_helper.h"
+#include "iaware_stats.h"
+
+// The header of a sample block is built by com_tcp_send_task() right before the block is sent, in the version that the
+// client negotiated with CMD_SET_STREAM_VERSION. The samples stay where the sampling callback put them: every samples_buff
+// starts with STREAM_HEADROOM bytes, and the header is written back to back in front of the samples.
+//
+// v1 (default, the original format): |(4bytes)|PACKET_HEADER_GROUP1|uint32_t eff_sampling_freq|samples|
+// v2: |(4bytes)|PACKET_HEADER_STREAM|version|flags|n_channels|encoding|bits|channel_mask|level|block_seq|t_begin|rate|n_samples|samples|
+//     It is fixed-size, so a client can parse it with one struct unpack. New capabilities set flags or encoding instead of
+//     taking a new header id.
+//
+// A block of several channels holds n_samples scans. By default the samples are interleaved, |ch0|ch1|..|ch0|ch1|..|, in
+// the order of the bits of channel_mask. A v2 client may ask for the planar layout with CMD_SET_STREAM_LAYOUT instead,
+// |ch0 ch0 ..|ch1 ch1 ..|.., which the sampling callback then fills directly from the next block on. A v1 client always gets
+// interleaved blocks.
+//
+// A v2 client may ask for the data-quality statistics of every block with CMD_SET_STREAM_STATS. A block with
+// STREAM_FLAG_STATS then has them between the header and the samples, in the layout of iaware_stats.h. They describe the
+// raw reads, so they are the same whatever the encoding. The backfilled blocks do not have them.
+//
+// A v2 client may get degraded blocks when the link cannot keep up, see iaware_degrade.h. The level, the encoding, bits,
+// rate and n_samples of the header tell how each block was degraded, so every transition shows in the first block after
+// it. A v1 client always gets the full blocks. The triggered capture, see iaware_trigger.h, takes precedence over it.
+#define STREAM_VERSION_1        1
+#define STREAM_VERSION_2        2
+#define STREAM_VERSION_MAX      STREAM_VERSION_2
+
+#define STREAM_HEADROOM         (4 + PACKET_HEADER_STREAM_V2_META_SIZE + STATS_MAX_SIZE) // [bytes]. It fits every header version.
+
+// v2 flags.
+#define STREAM_FLAG_BACKFILL    0x01    // The block was spilled to flash while no client was streaming.
+#define STREAM_FLAG_PLANAR      0x02    // The samples are grouped by channel.
+#define STREAM_FLAG_TRIGGERED   0x04    // A full block of a trigger window, maybe sent again after its preview. See iaware_trigger.h.
+#define STREAM_FLAG_PREVIEW     0x08    // A preview block between the trigger windows.
+#define STREAM_FLAG_STATS       0x10    // The header is followed by STATS_SIZE(n_channels) bytes of statistics.
+#define STREAM_FLAG_CALIBRATED  0x20    // The samples are in units of adc_cal_uv_per_lsb microvolts, see iaware_adc_cal.h.
+#define STREAM_FLAG_SYNTHETIC   0x40    // The samples come from a generator of iaware_source.h, not from the ADC.
+
+// CMD_SET_STREAM_LAYOUT
+#define STREAM_LAYOUT_INTERLEAVED   0
+#define STREAM_LAYOUT_PLANAR        1
+
+// v2 sample encodings.
+#define STREAM_ENCODING_U16_BE  0       // Unsigned 16-bit, big-endian, i.e. the encoding of v1.
+#define STREAM_ENCODING_DELTA8  1       // The differences of DEGRADE_LEVEL_COMPRESS, see degrade_delta8().
+#define STREAM_ENCODING_U8      2       // The 8 high bits of every sample. bits is then 8.
+
+struct stream_block_meta
+{
+    uint8_t flags;
+    uint8_t n_channels;
+    uint8_t encoding;
+    uint8_t bits;           // The number of significant bits per sample.
+    uint8_t channel_mask;   // Bit i is ADC1_CHANNEL_i.
+    uint8_t level;          // The degradation level, DEGRADE_LEVEL_FULL for a full block.
+
+    uint32_t block_seq;
+    uint64_t t_begin;       // [microsec]
+    uint32_t rate;          // [Hz]. The effective sampling frequency per channel.
+    uint32_t n_samples;     // The number of samples per channel.
+
+    const struct block_stats *stats;    // With STREAM_FLAG_STATS, else NULL.
+};
+
+extern uint8_t stream_version;                  // Negotiated per client. com_tcp_recv_task() resets it to v1 at every new client.
+extern uint8_t stream_send_version_pending;     // Set by CMD_SET_STREAM_VERSION. Cleared by com_tcp_send_task() after the reply.
+extern uint8_t stream_layout_flags;             // STREAM_FLAG_PLANAR or 0. The sampling callback copies it at the start of every block.
+extern uint8_t stream_stats_flags;              // STREAM_FLAG_STATS or 0. Set by CMD_SET_STREAM_STATS.
+extern uint8_t *stream_degrade_buff;            // STREAM_HEADROOM plus the samples of a block, from the arena. NULL turns the degradation off.
+extern struct degrade stream_degrade;           // Only com_tcp_send_task() touches it, except max_level.
+
+uint8_t stream_set_version(uint8_t version);
+uint8_t stream_set_layout(uint8_t layout);
+uint8_t stream_set_stats(uint8_t is_on);
+uint32_t stream_header_size(uint8_t version, const struct stream_block_meta *meta);
+uint32_t stream_header_write(uint8_t *dst, uint8_t version, struct stream_block_meta *meta, uint32_t payload_len);
+void stream_meta_init(struct stream_block_meta *meta);
+void stream_meta_of_node(struct buff_node *node, struct stream_block_meta *meta);
+uint8_t *stream_pack_node(struct buff_node *node, uint32_t *frame_len);
+uint32_t stream_pack_version(uint8_t *dst, uint8_t version);
+void stream_degrade_reset(void);
+void stream_degrade_update(uint32_t backlog, uint32_t send_us);
+void stream_set_degrade(uint8_t max_level);
+
+#endif
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "esp_gatts_api.h"     // ESP32 BLE
 #include "esp_event.h"
 #include "esp_event_loop.h"
 #include "esp_log.h"
@@ -20,11 +21,20 @@
 #include "lwip/dns.h"
 #include "nvs_flash.h"
 
+#include "iaware_adc_cal.h"
+#include "iaware_ble_hub.h"
+#include "iaware_ble_svr_com.h"
+#include "iaware_blog.h"
+#include "iaware_feature.h"
+#include "iaware_flash_tier.h"
 #include "iaware_gpio.h"
 #include "iaware_helper.h"
+#include "iaware_marker.h"
 #include "iaware_packet.h"
 #include "iaware_sampling_data.h"
+#include "iaware_stream.h"
 #include "iaware_tcp_com.h"
+#include "iaware_trigger.h"
 #include "main.h"
 
 static void close_all(const char *TAG, int socket, int accept);
@@ -35,17 +45,39 @@ static const uint8_t COM_TCP_RECV_WAITFOR_DATALENGTH = 0;
 static const uint8_t COM_TCP_RECV_FETCH_MSG = 1;
 static const uint8_t COM_TCP_RECV_PROCESS_MSG = 2;
 static uint8_t com_tcp_recv_task_err(void);
+static uint8_t com_cmd_process(struct com_cmd_parser *p);
+static uint32_t com_cmd_args_len(uint8_t cmd);
+static uint8_t com_cmd_is_tcp_only(uint8_t cmd);
 static void set_new_sampling_frequency(uint32_t new_fs);
+static void set_new_channel_mask(uint8_t new_channel_mask);
+static void set_new_decimation(uint8_t new_factor);
+static void set_new_adc_cal(uint8_t is_on);
+static void set_new_source(uint8_t *args, uint32_t args_len);
+static void set_new_filter(uint8_t *args, uint32_t args_len);
+static void set_new_trigger(uint8_t *args, uint32_t args_len);
 static int cs_recv_ext = -1;
+static SemaphoreHandle_t com_cmd_mutex = NULL;    // com_tcp_recv_task() and the Bluedroid task run the commands.
 
 // com_tcp_send_task
 static const char *TAG_TCP_SEND = "com_tcp_send_task";
 static int cs_send_ext = -1;
 static int send_all(int socket, uint8_t *buffer, size_t length);
 static uint8_t com_tcp_send_task_err(void);
+static void send_blog(int cs);
+static void send_stream_version(int cs);
+static void send_adc_cal(int cs);
+static void send_features(int cs);
+static void send_trigger(int cs);
+static void send_markers(int cs);
+static void send_hub(int cs);
+static uint8_t send_trigger_resend(int cs);
+static uint8_t send_backfill(int cs);
+static uint8_t send_record(int cs);
+static uint8_t blog_tx_buff[2048]; // It holds either a PACKET_HEADER_LOG packet or the PACKET_HEADER_LOG_FORMATS packet.
 
 uint8_t tcp_send_frequency = TCP_SEND_FREQUENCY;
 uint8_t is_start_stream = iawFalse;
+uint8_t tcp_is_draining = iawFalse;
 // uint8_t is_start_stream = iawTrue;
 
 void com_tcp_recv_task(void *event_group)
@@ -53,16 +85,15 @@ void com_tcp_recv_task(void *event_group)
     struct sockaddr_in tcpServerAddr, remote_addr;
 
     uint32_t socklen = sizeof(remote_addr);
-    uint32_t data_len = 0, i_data_len;
 
-    uint8_t recv_buf[MAX_PACKET_SIZE_SENTTO_ESP32], tmp_len[4], recv_state;
-    uint8_t data_len_bytes[4], i_data_len_bytes;
+    uint8_t recv_buf[MAX_PACKET_SIZE_SENTTO_ESP32];
 
     int s, cs, mytrue = 1;
 
     ssize_t r;
 
-    uint8_t *msg = NULL;
+    static uint8_t msg[MAX_MSG_SIZE_SENTTO_ESP32]; // A complete message. It is reused for every message, so recv() never touches the heap.
+    static struct com_cmd_parser parser;
 
     tcpServerAddr.sin_addr.s_addr   = htonl(INADDR_ANY);
     tcpServerAddr.sin_family        = AF_INET;
@@ -70,15 +101,11 @@ void com_tcp_recv_task(void *event_group)
 
     WAIT_AP_START: while (1)    // Level 0
     {
-        free_null((void **) (&msg));
-
         // Wait for the Wifi AP to start.Because INCLUDE_vTaskSuspend in FreeRTOSConfig.h is set to 1, xEventGroupWaitBits will wait forever.
         xEventGroupWaitBits((EventGroupHandle_t) event_group, AP_IS_START_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
 
         RECREATE_SOCKET: while (1)  // Level 1
         {
-            free_null((void **) (&msg));
-
             ESP_LOGI(IAWARE_NETWORK, "Recv. conns: Try to create a socket.");
 
             // Create an IP4 socket.
@@ -129,12 +156,9 @@ void com_tcp_recv_task(void *event_group)
 
             WAIT_FOR_A_CLIENT: while (1)    // Level 2
             {
-                free_null((void **) (&msg));
-
                 ESP_LOGI(IAWARE_NETWORK, "Recv. conns: Wait for a client.");
 
-                recv_state = COM_TCP_RECV_WAITFOR_DATALENGTH; // Here, we implicitly assume that new accept causes fresh recv().
-                i_data_len_bytes = 0;
+                com_cmd_reset(&parser, COM_CMD_LINK_TCP, msg, NULL); // Here, we implicitly assume that new accept causes fresh recv().
 
                 // Wait for a new client to connect. This corresponds to socket.socket.connect.
                 if ((cs = accept(s, (struct sockaddr *) (&remote_addr), &socklen)) < 0)
@@ -149,6 +173,14 @@ void com_tcp_recv_task(void *event_group)
                 }
                 cs_recv_ext = cs;
 
+                // A new client speaks v1 until it sends CMD_SET_STREAM_VERSION.
+                xSemaphoreTake(com_cmd_mutex, portMAX_DELAY);
+
+                stream_set_version(STREAM_VERSION_1);
+                trigger_set(0, 0, 0, 0, 0);
+
+                xSemaphoreGive(com_cmd_mutex);
+
                 // x_printf("Recv. conns: New connection request.\n");
 
                 WAIT_TO_RECV: while (1) // Level 3
@@ -201,136 +233,119 @@ void com_tcp_recv_task(void *event_group)
 
                         goto WAIT_FOR_A_CLIENT;                        
                     }
-                    else
+                    else if (com_cmd_feed(&parser, recv_buf, (uint32_t) r) == iawFalse)
                     {
-                        ssize_t remain_r = r;
-                        int i_r = 0;
+                        close_all(TAG_TCP_RECV, -1, cs);
 
-                        // We process it till nothing left in the buffer. 
-                        while (remain_r > 0)
-                        {
-                            // This state is for getting the first four bytes that are for identifying the length of the data in bytes.
-                            if (recv_state == COM_TCP_RECV_WAITFOR_DATALENGTH)
-                            {                                
-                                // Fetch recv() till either 4-bytes data length is filled or the buffer is empty.
-                                while ((i_data_len_bytes < 4) && (i_r < r))
-                                {
-                                    data_len_bytes[i_data_len_bytes] = recv_buf[i_r];
-
-                                    i_data_len_bytes = i_data_len_bytes + 1;
-                                    i_r = i_r + 1;
-
-                                    remain_r = remain_r - 1;
-                                }
-
-                                // If the 4-bytes data length is completely filled, we go to the next state. 
-                                // It might be possible that there is some data left in the recv() buffer.
-                                if (i_data_len_bytes == 4)
-                                {
-                                    data_len = bytes_to_uint32(data_len_bytes);
-                                    i_data_len = 0;
-
-                                    if ((msg = (uint8_t *)calloc(data_len, sizeof(uint8_t))) == NULL)
-                                    {
-                                        ESP_LOGE(IAWARE_CORE, "Recv. conns: calloc() fails.");
-
-                                        close_all(TAG_TCP_RECV, -1, cs);
-
-                                        goto WAIT_FOR_A_CLIENT;
-                                    }
-
-                                    recv_state = COM_TCP_RECV_FETCH_MSG;
-                                }
-                            }
+                        goto WAIT_FOR_A_CLIENT;
+                    }
+                }
+            }
+        }
+    }
+}
 
-                            // When we already knew the lenght of the msg in bytes, we collect all those bytes. When it completes, we pass to the next state that is processing the msg.
-                            if (recv_state == COM_TCP_RECV_FETCH_MSG)
-                            {
-                                while ((i_data_len < data_len) && (i_r < r))
-                                {
-                                    msg[i_data_len] = recv_buf[i_r];
+void com_cmd_init(void)
+// Before com_tcp_recv_task() and the BLE server start.
+{
+    if ((com_cmd_mutex = xSemaphoreCreateMutex()) == NULL)
+    {
+        ESP_LOGE(IAWARE_CORE, "Recv. conns: Create the command mutex FAIL.");
+
+        deep_restart();
+    }
+}
 
-                                    i_data_len = i_data_len + 1;
-                                    i_r = i_r + 1;
+void com_cmd_reset(struct com_cmd_parser *p, uint8_t link, uint8_t *msg, void (*on_msg)(uint8_t cmd, uint8_t is_known))
+// Params:
+//     link     : COM_CMD_LINK_TCP or COM_CMD_LINK_BLE, the link that the commands come from.
+//     msg      : MAX_MSG_SIZE_SENTTO_ESP32 bytes that hold a complete message, owned by the caller.
+//     on_msg   : Called after every message, or NULL.
+{
+    p->link             = link;
+    p->state            = COM_TCP_RECV_WAITFOR_DATALENGTH;
+    p->i_data_len_bytes = 0;
+    p->data_len         = 0;
+    p->i_data_len       = 0;
+    p->msg              = msg;
+    p->on_msg           = on_msg;
+}
 
-                                    remain_r = remain_r - 1;
-                                }
+uint8_t com_cmd_feed(struct com_cmd_parser *p, const uint8_t *buf, uint32_t len)
+// Run every message that completes within buf. A message may span several calls. Return iawFalse when a message is too
+// long for p->msg, the caller then drops the link or calls com_cmd_reset().
+{
+    uint32_t i_buf = 0;
 
-                                // We have a complete message.
-                                if (i_data_len == data_len)
-                                {
-                                    recv_state = COM_TCP_RECV_PROCESS_MSG;
-                                }
-                            }
+    // We process it till nothing left in the buffer.
+    while (i_buf < len)
+    {
+        // This state is for getting the first four bytes that are for identifying the length of the data in bytes.
+        if (p->state == COM_TCP_RECV_WAITFOR_DATALENGTH)
+        {
+            // Fetch till either 4-bytes data length is filled or the buffer is empty.
+            while ((p->i_data_len_bytes < 4) && (i_buf < len))
+            {
+                p->data_len_bytes[p->i_data_len_bytes] = buf[i_buf];
 
-                            // When we finish process the msg, we return the state back to getting next msg.
-                            if (recv_state == COM_TCP_RECV_PROCESS_MSG)
-                            {
-                                ESP_LOGI(IAWARE_NETWORK, "Recv. conns: Get %d bytes.", data_len);
-
-                                uint32_t i_msg = 0;
-
-                                if (msg[i_msg] == PACKET_HEADER_COMMAND)
-                                {            
-                                    i_msg = i_msg + 1;
-
-                                    if (msg[i_msg] == CMD_START_STREAM)
-                                    {
-                                        ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_START_STREAM");
-
-                                        is_start_stream = iawTrue;
-                                    }
-                                    else if (msg[i_msg] == CMD_STOP_STREAM)
-                                    {
-                                        ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_STOP_STREAM");
-
-                                        is_start_stream = iawFalse;
-                                    }
-                                    else if (msg[i_msg] == CMD_SET_SAMPLING_FREQUENCY)
-                                    {
-                                        ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_SAMPLING_FREQUENCY");
-                                        
-                                        i_msg = i_msg + 1;
-                                        tmp_len[0] = msg[i_msg];        
-
-                                        i_msg = i_msg + 1;
-                                        tmp_len[1] = msg[i_msg];
-
-                                        i_msg = i_msg + 1;
-                                        tmp_len[2] = msg[i_msg];
-
-                                        i_msg = i_msg + 1;
-                                        tmp_len[3] = msg[i_msg];
-
-                                        uint32_t new_sampling_frequency = bytes_to_uint32(tmp_len);
-
-                                        set_new_sampling_frequency(new_sampling_frequency);                                                                                
-                                        
-                                    }
-                                    else if (msg[i_msg] == CMD_SET_SEND_DATA_FREQUENCY)
-                                    {
-                                        ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_SEND_DATA_FREQUENCY");
-
-                                        i_msg = i_msg + 1;
-                                        printf("Recv. conns: Set new send-data sampling frequency to %f Hz.", msg[i_msg]*0.1);
-                                    }
-                                }
-                                else
-                                    ESP_LOGI(IAWARE_CORE, "Recv. conns: header %d does not support.", msg[i_msg]);
-
-                                free_null((void **) (&msg));
-
-                                recv_state = COM_TCP_RECV_WAITFOR_DATALENGTH;
-                                i_data_len_bytes = 0;
-                            }      
-                        }                  
-                    }
+                p->i_data_len_bytes = p->i_data_len_bytes + 1;
+                i_buf = i_buf + 1;
+            }
+
+            // If the 4-bytes data length is completely filled, we go to the next state.
+            if (p->i_data_len_bytes == 4)
+            {
+                p->data_len = bytes_to_uint32(p->data_len_bytes);
+                p->i_data_len = 0;
+
+                if ((p->data_len == 0) || (p->data_len > MAX_MSG_SIZE_SENTTO_ESP32))
+                {
+                    ESP_LOGE(IAWARE_CORE, "Recv. conns: Message of %d bytes is not supported.", p->data_len);
+
+                    return iawFalse;
                 }
+
+                p->state = COM_TCP_RECV_FETCH_MSG;
             }
         }
+
+        // When we already knew the lenght of the msg in bytes, we collect all those bytes. When it completes, we pass to the next state that is processing the msg.
+        if (p->state == COM_TCP_RECV_FETCH_MSG)
+        {
+            uint32_t n = ((p->data_len - p->i_data_len) < (len - i_buf)) ? (p->data_len - p->i_data_len) : (len - i_buf);
+
+            memcpy(&(p->msg[p->i_data_len]), &(buf[i_buf]), n);
+
+            p->i_data_len = p->i_data_len + n;
+            i_buf = i_buf + n;
+
+            // We have a complete message.
+            if (p->i_data_len == p->data_len)
+                p->state = COM_TCP_RECV_PROCESS_MSG;
+        }
+
+        // When we finish process the msg, we return the state back to getting next msg.
+        if (p->state == COM_TCP_RECV_PROCESS_MSG)
+        {
+            ESP_LOGI(IAWARE_NETWORK, "Recv. conns: Get %d bytes.", p->data_len);
+
+            // com_tcp_recv_task() and the Bluedroid task change the same settings.
+            xSemaphoreTake(com_cmd_mutex, portMAX_DELAY);
+
+            uint8_t is_known = com_cmd_process(p);
+
+            xSemaphoreGive(com_cmd_mutex);
+
+            if (p->on_msg != NULL)
+                p->on_msg((p->data_len > 1) ? p->msg[1] : 0, is_known);
+
+            p->state = COM_TCP_RECV_WAITFOR_DATALENGTH;
+            p->i_data_len_bytes = 0;
+        }
     }
-}
 
+    return iawTrue;
+}
 
 void close_cs(void)
 {
@@ -409,6 +424,12 @@ void com_tcp_send_task(void *event_group)
 
             WAIT_FOR_A_CLIENT: while (1)    // Level 2
             {
+                tcp_is_draining = iawFalse;
+
+                // Without a client the log goes back to the UART, blog_drain_task() takes the ring from here.
+                blog_sink = BLOG_SINK_UART;
+                blog_consume(BLOG_SINK_NETWORK);
+
                 ESP_LOGI(IAWARE_NETWORK, "Send conns: Wait for a client.");
 
                 // Wait for a new client to connect. This corresponds to socket.socket.connect.
@@ -423,8 +444,13 @@ void com_tcp_send_task(void *event_group)
                 cs_send_ext = cs;
                 run_tcp_send_buff_node_ptr = run_buff_node_ptr;
 
+                stream_degrade_reset();
+                trigger_reset();
+
                 WAIT_TO_SEND: while (1) // Level 3
                 {
+                    tcp_is_draining = is_start_stream;
+
                     if (run_tcp_send_buff_node_ptr->is_sent == iawFalse)
                     {
                         run_tcp_send_buff_node_ptr->is_sent = iawTrue;
@@ -436,12 +462,26 @@ void com_tcp_send_task(void *event_group)
                         if (is_start_stream == iawTrue)
                         {
                             led_onboard_send_data_to_client();
-                            r = send_all(cs, run_tcp_send_buff_node_ptr->samples_buff, run_tcp_send_buff_node_ptr->n_samples + 4 + PACKET_HEADER_GROUP1_META_SIZE);    
+                            uint32_t frame_len;
+                            uint8_t *frame = stream_pack_node(run_tcp_send_buff_node_ptr, &frame_len);
+
+                            int64_t send_time = esp_timer_get_time(); // [microsec.]
+
+                            r = send_all(cs, frame, frame_len);    
+
+                            // The blocks completed behind this one are the backlog.
+                            if (r == 0)
+                            {
+                                stream_degrade_update(sampling_data_block_seq - 1 - run_tcp_send_buff_node_ptr->block_seq, (uint32_t) (esp_timer_get_time() - send_time));
+                                trigger_live_sent(run_tcp_send_buff_node_ptr->block_seq);
+                            }
                         }
 
                         if (r < 0)
                         {
-                            ESP_LOGW(IAWARE_NETWORK, "Send conns: Send data fail caused by %s (%d)", strerror(errno), errno);
+                            tcp_is_draining = iawFalse;
+
+                            BLOGW(BLOG_TAG_IAWARE_NETWORK, BLOG_FMT_SEND_FAIL, errno, 0, 0);
 
                             vTaskDelay(1000 / portTICK_PERIOD_MS);
 
@@ -450,24 +490,24 @@ void com_tcp_send_task(void *event_group)
                                 case 0:
                                     close_all(TAG_TCP_RECV, s, cs);
 
-                                    ESP_LOGW(IAWARE_NETWORK, "Send conns: Wait for AP to start.");
+                                    BLOGW(BLOG_TAG_IAWARE_NETWORK, BLOG_FMT_SEND_WAIT_AP, 0, 0, 0);
 
                                     goto WAIT_AP_START;
                                 case 1:
                                     close_all(TAG_TCP_RECV, s, cs);
 
-                                    ESP_LOGW(IAWARE_NETWORK, "Send conns: Recreate a socket.");
+                                    BLOGW(BLOG_TAG_IAWARE_NETWORK, BLOG_FMT_SEND_RECREATE_SOCKET, 0, 0, 0);
 
                                     goto RECREATE_SOCKET;
                                 case 2:
                                     close_all(TAG_TCP_RECV, s, cs);                            
 
-                                    ESP_LOGW(IAWARE_NETWORK, "Send conns: Wait for a new client.");
+                                    BLOGW(BLOG_TAG_IAWARE_NETWORK, BLOG_FMT_SEND_WAIT_CLIENT, 0, 0, 0);
 
                                     goto WAIT_FOR_A_CLIENT;
                                 case 3:
 
-                                    ESP_LOGW(IAWARE_NETWORK, "Send conns: Wait for a new recv().");
+                                    BLOGW(BLOG_TAG_IAWARE_NETWORK, BLOG_FMT_SEND_WAIT_SEND, 0, 0, 0);
 
                                     goto WAIT_TO_SEND;
                             }                                                
@@ -476,7 +516,7 @@ void com_tcp_send_task(void *event_group)
                         int64_t cur_time = esp_timer_get_time();
 
                         if ((cur_time - pre_time) > (int64_t) (1000000/tcp_send_frequency))
-                            ESP_LOGW(IAWARE_NETWORK, "Send conns: Too high latency by %" PRId64 " microsec.", (cur_time - pre_time) - (int64_t) (1000000/sampling_data_fs));                    
+                            BLOGW(BLOG_TAG_IAWARE_NETWORK, BLOG_FMT_SEND_TOO_HIGH_LATENCY, (cur_time - pre_time) - (int64_t) (1000000/tcp_send_frequency), 0, 0);
 
                         // if ( (cur_time - pre_time) > ((int64_t) (TCP_MAX_LATENCY*1000)) )
                         //     ESP_LOGW( IAWARE_NETWORK, "Send conns: Latency is longer than expected by %" PRId64 " microsec.", (cur_time - pre_time) - ( (int64_t) (TCP_MAX_LATENCY*1000) ) );                    
@@ -490,6 +530,27 @@ void com_tcp_send_task(void *event_group)
                             run_tcp_send_buff_node_ptr = head_buff_node_ptr;
                         }
                     }
+                    else if (((tcp_is_draining == iawTrue) && (send_trigger_resend(cs) == iawTrue)) || (send_record(cs) == iawTrue) || ((tcp_is_draining == iawTrue) && (send_backfill(cs) == iawTrue)))
+                    {
+                        // Drain the pre-trigger window and the flash at the link's pace while the live blocks keep the priority.
+                        send_stream_version(cs);
+                        send_adc_cal(cs);
+                        send_trigger(cs);
+                        send_markers(cs);
+                        send_features(cs);
+                        send_hub(cs);
+                        send_blog(cs);
+
+                        continue;
+                    }
+
+                    send_stream_version(cs);
+                    send_adc_cal(cs);
+                    send_trigger(cs);
+                    send_markers(cs);
+                    send_features(cs);
+                    send_hub(cs);
+                    send_blog(cs);
 
                     vTaskDelay(1 / portTICK_PERIOD_MS);   
                 }
@@ -500,6 +561,289 @@ void com_tcp_send_task(void *event_group)
 
 
 //////////////////// Private ////////////////////
+static uint8_t com_cmd_process(struct com_cmd_parser *p)
+// Run a complete message. Return iawFalse when it is not a known command.
+{
+    uint8_t *msg = p->msg;
+    uint32_t data_len = p->data_len;
+
+    uint32_t i_msg = 0;
+    uint8_t tmp_len[4], is_known = iawTrue;
+
+    if ((msg[i_msg] == PACKET_HEADER_COMMAND) && (data_len < 2))
+    {
+        ESP_LOGE(IAWARE_CORE, "Recv. conns: Message of %d bytes has no command.", data_len);
+
+        return iawFalse;
+    }
+
+    if (msg[i_msg] == PACKET_HEADER_COMMAND)
+    {
+        i_msg = i_msg + 1;
+
+        if ((data_len - 2) < com_cmd_args_len(msg[i_msg]))
+        {
+            ESP_LOGE(IAWARE_CORE, "Recv. conns: command %d of %d bytes is too short.", msg[i_msg], data_len);
+
+            return iawFalse;
+        }
+
+        if ((p->link == COM_CMD_LINK_BLE) && (com_cmd_is_tcp_only(msg[i_msg]) == iawTrue))
+        {
+            ESP_LOGW(IAWARE_CORE, "Recv. conns: command %d is for the TCP client only.", msg[i_msg]);
+
+            return iawFalse;
+        }
+
+        if (msg[i_msg] == CMD_START_STREAM)
+        {
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_START_STREAM");
+
+            // On BLE, the on_msg() of iaware_ble_svr_com.c starts the notifications of the client that wrote it.
+            if (p->link == COM_CMD_LINK_TCP)
+                is_start_stream = iawTrue;
+        }
+        else if (msg[i_msg] == CMD_STOP_STREAM)
+        {
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_STOP_STREAM");
+
+            if (p->link == COM_CMD_LINK_TCP)
+                is_start_stream = iawFalse;
+        }
+        else if (msg[i_msg] == CMD_SET_SAMPLING_FREQUENCY)
+        {
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_SAMPLING_FREQUENCY");
+
+            i_msg = i_msg + 1;
+            tmp_len[0] = msg[i_msg];
+
+            i_msg = i_msg + 1;
+            tmp_len[1] = msg[i_msg];
+
+            i_msg = i_msg + 1;
+            tmp_len[2] = msg[i_msg];
+
+            i_msg = i_msg + 1;
+            tmp_len[3] = msg[i_msg];
+
+            uint32_t new_sampling_frequency = bytes_to_uint32(tmp_len);
+
+            set_new_sampling_frequency(new_sampling_frequency);
+
+        }
+        else if (msg[i_msg] == CMD_SET_SEND_DATA_FREQUENCY)
+        {
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_SEND_DATA_FREQUENCY");
+
+            i_msg = i_msg + 1;
+            printf("Recv. conns: Set new send-data sampling frequency to %f Hz.", msg[i_msg]*0.1);
+        }
+        else if (msg[i_msg] == CMD_SET_LOG_SINK)
+        {
+            i_msg = i_msg + 1;
+
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_LOG_SINK %d", msg[i_msg]);
+
+            blog_sink = (msg[i_msg] == BLOG_SINK_NETWORK) ? BLOG_SINK_NETWORK : BLOG_SINK_UART;
+        }
+        else if (msg[i_msg] == CMD_GET_LOG_FORMATS)
+        {
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_GET_LOG_FORMATS");
+
+            blog_send_formats_pending = iawTrue;
+        }
+        else if (msg[i_msg] == CMD_SET_STREAM_VERSION)
+        {
+            i_msg = i_msg + 1;
+
+            // The BLE frames are always v2, the BLE server replies on its own, see cmd_on_msg().
+            if (p->link == COM_CMD_LINK_TCP)
+            {
+                ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_STREAM_VERSION %d -> %d", msg[i_msg], stream_set_version(msg[i_msg]));
+
+                stream_send_version_pending = iawTrue;
+            }
+        }
+        else if (msg[i_msg] == CMD_SET_STREAM_LAYOUT)
+        {
+            i_msg = i_msg + 1;
+
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_STREAM_LAYOUT %d -> %d", msg[i_msg], stream_set_layout(msg[i_msg]));
+        }
+        else if (msg[i_msg] == CMD_SET_STREAM_STATS)
+        {
+            i_msg = i_msg + 1;
+
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_STREAM_STATS %d -> %d", msg[i_msg], stream_set_stats(msg[i_msg]));
+        }
+        else if (msg[i_msg] == CMD_SET_CHANNEL_MASK)
+        {
+            i_msg = i_msg + 1;
+
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_CHANNEL_MASK 0x%02x", msg[i_msg]);
+
+            set_new_channel_mask(msg[i_msg]);
+        }
+        else if (msg[i_msg] == CMD_SET_DECIMATION)
+        {
+            i_msg = i_msg + 1;
+
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_DECIMATION %d", msg[i_msg]);
+
+            set_new_decimation(msg[i_msg]);
+        }
+        else if (msg[i_msg] == CMD_GET_ADC_CAL)
+        {
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_GET_ADC_CAL");
+
+            // The BLE server replies on its own, see cmd_on_msg().
+            if (p->link == COM_CMD_LINK_TCP)
+                adc_cal_send_pending = iawTrue;
+        }
+        else if (msg[i_msg] == CMD_SET_ADC_CAL)
+        {
+            i_msg = i_msg + 1;
+
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_ADC_CAL %d", msg[i_msg]);
+
+            set_new_adc_cal(msg[i_msg]);
+        }
+        else if (msg[i_msg] == CMD_SET_SOURCE)
+        {
+            set_new_source(&(msg[i_msg + 1]), data_len - 2);
+        }
+        else if (msg[i_msg] == CMD_SET_BLE_BENCH)
+        {
+            i_msg = i_msg + 1;
+
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_BLE_BENCH %d", msg[i_msg]);
+
+            ble_server_set_bench(msg[i_msg]);
+        }
+        else if (msg[i_msg] == CMD_SET_BLE_ADV)
+        {
+            uint8_t is_metrics = msg[i_msg + 1];
+            uint16_t interval_ms = (uint16_t) ((msg[i_msg + 2] << 8) | msg[i_msg + 3]);
+
+            i_msg = i_msg + 3;
+
+            if (ble_server_set_adv(is_metrics, interval_ms) == iawTrue)
+                ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_BLE_ADV metrics %d, every %d ms", is_metrics, interval_ms);
+            else
+                ESP_LOGE(IAWARE_CORE, "Recv. conns: CMD_SET_BLE_ADV metrics %d, every %d ms FAIL", is_metrics, interval_ms);
+        }
+        else if (msg[i_msg] == CMD_SET_FILTER)
+        {
+            set_new_filter(&(msg[i_msg + 1]), data_len - 2);
+        }
+        else if (msg[i_msg] == CMD_SET_DEGRADE)
+        {
+            i_msg = i_msg + 1;
+
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_DEGRADE %d", msg[i_msg]);
+
+            stream_set_degrade(msg[i_msg]);
+        }
+        else if (msg[i_msg] == CMD_SET_TRIGGER)
+        {
+            set_new_trigger(&(msg[i_msg + 1]), data_len - 2);
+        }
+        else if (msg[i_msg] == CMD_TRIGGER)
+        {
+            if (trigger_fire_host() == iawFalse)
+                ESP_LOGW(IAWARE_CORE, "Recv. conns: CMD_TRIGGER is ignored, TRIGGER_SOURCE_HOST is not armed.");
+        }
+        else if (msg[i_msg] == CMD_MARKER)
+        {
+            i_msg = i_msg + 1;
+
+            if (marker_host(msg[i_msg]) == iawFalse)
+                ESP_LOGW(IAWARE_CORE, "Recv. conns: CMD_MARKER %d is dropped.", msg[i_msg]);
+        }
+        else if (msg[i_msg] == CMD_SET_FEATURES)
+        {
+            uint16_t period_ms = (uint16_t) ((msg[i_msg + 1] << 8) | msg[i_msg + 2]);
+
+            i_msg = i_msg + 2;
+
+            if (sampling_data_set_features(period_ms) == iawTrue)
+                ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_FEATURES every %d ms", period_ms);
+            else
+                ESP_LOGE(IAWARE_CORE, "Recv. conns: CMD_SET_FEATURES every %d ms FAIL", period_ms);
+        }
+        else if (msg[i_msg] == CMD_SET_RECORD_MODE)
+        {
+            i_msg = i_msg + 1;
+
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_RECORD_MODE %d", msg[i_msg]);
+
+            flash_tier_set_record_mode(msg[i_msg]);
+        }
+        else if (msg[i_msg] == CMD_GET_RECORD_INFO)
+        {
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_GET_RECORD_INFO");
+
+            flash_tier_request_info();
+        }
+        else if (msg[i_msg] == CMD_FIND_RECORD)
+        {
+            flash_tier_request_find(bytes_to_uint32(&(msg[i_msg + 1])), bytes_to_uint64(&(msg[i_msg + 5])));
+        }
+        else if (msg[i_msg] == CMD_READ_RECORD)
+        {
+            if (flash_tier_request_read(bytes_to_uint32(&(msg[i_msg + 1])), bytes_to_uint64(&(msg[i_msg + 5])), bytes_to_uint32(&(msg[i_msg + 13]))) == iawFalse)
+                ESP_LOGW(IAWARE_CORE, "Recv. conns: CMD_READ_RECORD is dropped. Keep at most %d requests in flight.", FLASH_TIER_READ_QUEUE_LEN);
+        }
+        else
+        {
+            ESP_LOGI(IAWARE_CORE, "Recv. conns: command %d does not support.", msg[i_msg]);
+
+            is_known = iawFalse;
+        }
+    }
+    else
+    {
+        ESP_LOGI(IAWARE_CORE, "Recv. conns: header %d does not support.", msg[i_msg]);
+
+        is_known = iawFalse;
+    }
+
+    return is_known;
+}
+
+static uint32_t com_cmd_args_len(uint8_t cmd)
+// The fixed arguments of a command [bytes]. set_new_source(), set_new_filter() and set_new_trigger() check the rest.
+{
+    if (cmd == CMD_SET_SAMPLING_FREQUENCY)
+        return 4;
+    else if ((cmd == CMD_SET_SEND_DATA_FREQUENCY) || (cmd == CMD_SET_LOG_SINK) || (cmd == CMD_SET_STREAM_VERSION) || (cmd == CMD_SET_STREAM_LAYOUT) ||
+             (cmd == CMD_SET_STREAM_STATS) || (cmd == CMD_SET_CHANNEL_MASK) || (cmd == CMD_SET_DECIMATION) || (cmd == CMD_SET_ADC_CAL) ||
+             (cmd == CMD_SET_BLE_BENCH) || (cmd == CMD_SET_DEGRADE) || (cmd == CMD_MARKER) || (cmd == CMD_SET_RECORD_MODE))
+        return 1;
+    else if (cmd == CMD_SET_FEATURES)
+        return 2;
+    else if (cmd == CMD_SET_BLE_ADV)
+        return 1 + 2;
+    else if (cmd == CMD_FIND_RECORD)
+        return 4 + 8;
+    else if (cmd == CMD_READ_RECORD)
+        return 4 + 8 + 4;
+
+    return 0;
+}
+
+static uint8_t com_cmd_is_tcp_only(uint8_t cmd)
+// The commands that set the frames, the log or the pacing of com_tcp_send_task(), or whose reply only it sends. The
+// frames of BLE are fixed (see iaware_ble_stream.h) and it has no room for the log or the recording.
+{
+    if ((cmd == CMD_SET_SEND_DATA_FREQUENCY) || (cmd == CMD_SET_LOG_SINK) || (cmd == CMD_GET_LOG_FORMATS) ||
+        (cmd == CMD_SET_STREAM_LAYOUT) || (cmd == CMD_SET_STREAM_STATS) || (cmd == CMD_SET_DEGRADE) ||
+        (cmd == CMD_GET_RECORD_INFO) || (cmd == CMD_FIND_RECORD) || (cmd == CMD_READ_RECORD))
+        return iawTrue;
+
+    return iawFalse;
+}
+
 static void set_new_sampling_frequency(uint32_t new_fs)
 {
     ESP_LOGI(IAWARE_CORE, "Recv. conns: Setting new sampling frequency to %d Hz ...", new_fs);    
@@ -554,6 +898,153 @@ static void set_new_sampling_frequency(uint32_t new_fs)
     // }    
 }
 
+static void set_new_channel_mask(uint8_t new_channel_mask)
+// Like a new sampling frequency, the new channels resize the buff nodes, so ESP32 restarts.
+{
+    if (gpio_adc_set_channel_mask(new_channel_mask) == iawTrue)
+    {
+        ESP_LOGI(IAWARE_CORE, "Recv. conns: Changed to new channel mask 0x%02x SUCCESS", new_channel_mask);
+    }
+    else
+    {
+        ESP_LOGE(IAWARE_CORE, "Recv. conns: Changed to new channel mask 0x%02x FAIL", new_channel_mask);
+
+        return;
+    }
+
+    close_cs();
+
+    deep_restart();
+}
+
+static void set_new_decimation(uint8_t new_factor)
+// The decimation sets the rate of the blocks, so ESP32 restarts like for a new sampling frequency.
+{
+    if (sampling_data_set_decimation(new_factor) == iawTrue)
+    {
+        ESP_LOGI(IAWARE_CORE, "Recv. conns: Changed to new decimation by %d SUCCESS", new_factor);
+    }
+    else
+    {
+        ESP_LOGE(IAWARE_CORE, "Recv. conns: Changed to new decimation by %d FAIL", new_factor);
+
+        return;
+    }
+
+    close_cs();
+
+    deep_restart();
+}
+
+static void set_new_adc_cal(uint8_t is_on)
+// The calibration sets the bits of the samples, so ESP32 restarts like for a new decimation.
+{
+    if (adc_cal_set_enabled(is_on) == iawTrue)
+    {
+        ESP_LOGI(IAWARE_CORE, "Recv. conns: Changed the ADC calibration to %d SUCCESS", is_on);
+    }
+    else
+    {
+        ESP_LOGE(IAWARE_CORE, "Recv. conns: Changed the ADC calibration to %d FAIL", is_on);
+
+        return;
+    }
+
+    close_cs();
+
+    deep_restart();
+}
+
+static void set_new_source(uint8_t *args, uint32_t args_len)
+// The source is set up at boot, so ESP32 restarts like for a new decimation.
+// Params:
+//     args     : |uint8_t kind|uint32_t f0|uint32_t f1|uint32_t sweep_ms|uint16_t amplitude|uint16_t offset|uint32_t seed|, see CMD_SET_SOURCE.
+{
+    struct source_params params;
+
+    if (args_len < 21)
+    {
+        ESP_LOGE(IAWARE_CORE, "Recv. conns: CMD_SET_SOURCE of %d bytes is invalid.", args_len + 2);
+
+        return;
+    }
+
+    memset(&params, 0, sizeof(params));
+
+    params.kind         = args[0];
+    params.f0_mhz       = bytes_to_uint32(&(args[1]));
+    params.f1_mhz       = bytes_to_uint32(&(args[5]));
+    params.amplitude    = (uint16_t) ((args[13] << 8) | args[14]);
+    params.offset       = (uint16_t) ((args[15] << 8) | args[16]);
+    params.seed         = bytes_to_uint32(&(args[17]));
+
+    if (sampling_data_set_source(&params, bytes_to_uint32(&(args[9]))) == iawTrue)
+    {
+        ESP_LOGI(IAWARE_CORE, "Recv. conns: Changed to source %d SUCCESS", params.kind);
+    }
+    else
+    {
+        ESP_LOGE(IAWARE_CORE, "Recv. conns: Changed to source %d FAIL", params.kind);
+
+        return;
+    }
+
+    close_cs();
+
+    deep_restart();
+}
+
+static void set_new_filter(uint8_t *args, uint32_t args_len)
+// Params:
+//     args     : |uint8_t i_channel|uint8_t n_sections|sections|, see CMD_SET_FILTER.
+{
+    struct filter_section sections[FILTER_MAX_SECTIONS];
+
+    if ((args_len < 2) || (args[1] > FILTER_MAX_SECTIONS) || (args_len < (uint32_t) (2 + 10*args[1])))
+    {
+        ESP_LOGE(IAWARE_CORE, "Recv. conns: CMD_SET_FILTER of %d bytes is invalid.", args_len + 2);
+
+        return;
+    }
+
+    for (uint8_t i = 0; i < args[1]; i++)
+    {
+        uint8_t *p = &(args[2 + 10*i]);
+
+        sections[i].b0 = (int16_t) ((p[0] << 8) | p[1]);
+        sections[i].b1 = (int16_t) ((p[2] << 8) | p[3]);
+        sections[i].b2 = (int16_t) ((p[4] << 8) | p[5]);
+        sections[i].a1 = (int16_t) ((p[6] << 8) | p[7]);
+        sections[i].a2 = (int16_t) ((p[8] << 8) | p[9]);
+    }
+
+    if (sampling_data_set_filter(args[0], args[1], sections) == iawTrue)
+        ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_FILTER channel %d, %d sections", args[0], args[1]);
+    else
+        ESP_LOGE(IAWARE_CORE, "Recv. conns: CMD_SET_FILTER channel %d, %d sections FAIL", args[0], args[1]);
+}
+
+static void set_new_trigger(uint8_t *args, uint32_t args_len)
+// Params:
+//     args     : |uint8_t sources|uint16_t pre_ms|uint16_t post_ms|uint8_t i_channel|uint16_t threshold|, see CMD_SET_TRIGGER.
+{
+    if (args_len < 8)
+    {
+        ESP_LOGE(IAWARE_CORE, "Recv. conns: CMD_SET_TRIGGER of %d bytes is invalid.", args_len + 2);
+
+        return;
+    }
+
+    uint16_t pre_ms = (uint16_t) ((args[1] << 8) | args[2]);
+    uint16_t post_ms = (uint16_t) ((args[3] << 8) | args[4]);
+    uint16_t threshold = (uint16_t) ((args[6] << 8) | args[7]);
+
+    if ((stream_version == STREAM_VERSION_2) && (trigger_set(args[0], pre_ms, post_ms, args[5], threshold) == iawTrue))
+        ESP_LOGI(IAWARE_CORE, "Recv. conns: CMD_SET_TRIGGER sources 0x%02x, %d ms before, %d ms after", args[0], pre_ms, post_ms);
+    else
+        ESP_LOGE(IAWARE_CORE, "Recv. conns: CMD_SET_TRIGGER sources 0x%02x, %d ms before, %d ms after FAIL", args[0], pre_ms, post_ms);
+}
+
 static int send_all(int cs, uint8_t *buffer, size_t length)
 {
     uint8_t *ptr = buffer;
@@ -572,6 +1063,158 @@ static int send_all(int cs, uint8_t *buffer, size_t length)
     return 0;
 }
 
+static void send_stream_version(int cs)
+// Confirm CMD_SET_STREAM_VERSION. A block may switch to the new version before this reply, the header id tells them apart.
+{
+    uint8_t reply[4 + 2];
+
+    if (stream_send_version_pending == iawTrue)
+    {
+        stream_send_version_pending = iawFalse;
+
+        send_all(cs, reply, stream_pack_version(reply, stream_version));
+    }
+}
+
+static void send_adc_cal(int cs)
+// Reply to CMD_GET_ADC_CAL. A failure is ignored like in send_blog().
+{
+    uint8_t reply[4 + PACKET_HEADER_ADC_CAL_META_SIZE];
+
+    if (adc_cal_send_pending == iawTrue)
+    {
+        adc_cal_send_pending = iawFalse;
+
+        send_all(cs, reply, adc_cal_pack(reply));
+    }
+}
+
+static void send_features(int cs)
+// Send the band powers once per period, whether the samples are streamed or not. A failure is ignored like in send_blog().
+{
+    static uint32_t publish_seq = 0;
+
+    uint8_t packet[4 + PACKET_HEADER_FEATURE_META_SIZE + 2*FEATURE_N_BANDS*FEATURE_MAX_CHANNELS];
+    uint32_t len;
+
+    if ((len = sampling_data_features_pack(&(packet[4]), sizeof(packet) - 4, &publish_seq)) > 0)
+    {
+        uint32_to_bytes(len, &(packet[0]));
+
+        send_all(cs, packet, 4 + len);
+    }
+}
+
+static void send_markers(int cs)
+// Send the markers whose block has completed. A failure is ignored like in send_blog().
+{
+    uint8_t packet[4 + PACKET_HEADER_MARKER_META_SIZE + MARKER_QUEUE_LEN*MARKER_RECORD_SIZE];
+    uint32_t len;
+
+    if ((len = marker_pack(packet, sizeof(packet))) > 0)
+        send_all(cs, packet, len);
+}
+
+static void send_hub(int cs)
+// Forward the blocks of the BLE peripherals of the hub, see iaware_ble_hub.h. A failure is ignored like in send_blog().
+{
+    uint8_t *packet;
+    uint32_t len;
+
+    while ((len = ble_hub_peek(&packet)) > 0)
+    {
+        send_all(cs, packet, len);
+
+        ble_hub_pop();
+    }
+}
+
+static void send_trigger(int cs)
+// Announce the last trigger event. A failure is ignored like in send_blog().
+{
+    uint8_t packet[4 + PACKET_HEADER_TRIGGER_META_SIZE];
+    uint32_t len;
+
+    if ((len = trigger_pack_event(packet)) > 0)
+        send_all(cs, packet, len);
+}
+
+static uint8_t send_trigger_resend(int cs)
+// Send again in full the next block of the trigger window that went out as a preview. Return iawTrue when one was sent.
+// A failure is left to the next send() of the samples, like in send_backfill().
+{
+    struct buff_node *node;
+    uint32_t frame_len;
+
+    if ((node = trigger_next_resend()) == NULL)
+        return iawFalse;
+
+    uint8_t *frame = stream_pack_node(node, &frame_len);
+
+    if (send_all(cs, frame, frame_len) < 0)
+        tcp_is_draining = iawFalse;
+
+    return iawTrue;
+}
+
+static void send_blog(int cs)
+// Ship the binary log to the client when it asks for it. A failure is ignored here because the next send() of the samples detects it.
+{
+    uint32_t len;
+
+    if (blog_send_formats_pending == iawTrue)
+    {
+        blog_send_formats_pending = iawFalse;
+
+        if ((len = blog_pack_formats(blog_tx_buff, sizeof(blog_tx_buff))) > 0)
+            send_all(cs, blog_tx_buff, len);
+        else
+            ESP_LOGE(IAWARE_CORE, "Send conns: blog_tx_buff is too small for the log formats.");
+    }
+
+    if (blog_consume(BLOG_SINK_NETWORK) == iawTrue)
+    {
+        if ((len = blog_pack_records(blog_tx_buff, BLOG_MAX_RECORDS_PER_PACKET)) > 0)
+            send_all(cs, blog_tx_buff, len);
+    }
+}
+
+static uint8_t send_record(int cs)
+// Send the next reply about the recording on flash. Return iawTrue when one was sent. It does not need CMD_START_STREAM.
+// A failure is ignored here like in send_blog().
+{
+    uint32_t len;
+
+    if ((len = flash_tier_record_pack()) == 0)
+        return iawFalse;
+
+    send_all(cs, flash_tier_tx_buff(), len);
+
+    return iawTrue;
+}
+
+static uint8_t send_backfill(int cs)
+// Send the oldest block spilled to flash. Return iawTrue when one was sent. A failure is left to the next send() of the samples.
+{
+    uint32_t block_seq;
+    uint32_t len;
+    uint8_t *frame;
+
+    if ((frame = flash_tier_backfill_pack(&block_seq, &len)) == NULL)
+        return iawFalse;
+
+    if (send_all(cs, frame, len) < 0)
+    {
+        tcp_is_draining = iawFalse;
+
+        return iawFalse;
+    }
+
+    flash_tier_backfill_done(block_seq);
+
+    return iawTrue;
+}
+
 static uint8_t com_tcp_recv_task_err(void)
 {
     switch (errno)
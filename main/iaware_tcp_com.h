@@ -1,6 +1,8 @@
 #ifndef IAWARE_TCP_COM_H
 #define IAWARE_TCP_COM_H
 
+#include <stdint.h>
+
 #define TCP_MAX_LATENCY	2000 // [ms]. The maximum latency that could be possible in the transmission.
 
 #define TCP_RECV_PORT   5001
@@ -13,10 +15,37 @@
 extern uint8_t tcp_send_frequency;
 
 extern uint8_t is_start_stream;
+extern uint8_t tcp_is_draining;	// A client is connected to TCP_SEND_PORT and streams, so flash_spill_task() leaves the blocks alone.
+
+// The framed commands of TCP_RECV_PORT, |uint32_t len|PACKET_HEADER_COMMAND|cmd|args|, parsed from any byte stream. The
+// RX characteristic of iaware_ble_svr_com.c feeds its writes to a parser of its own, so both links run the same commands,
+// one at a time. CMD_START_STREAM and CMD_STOP_STREAM of BLE start and stop the notifications of the client that wrote
+// them, not the TCP stream. The commands about the frames, the log and the recording replies of the TCP client are
+// refused on BLE, and CMD_SET_STREAM_VERSION leaves the TCP client as it is. A command shorter than its arguments is
+// refused.
+#define COM_CMD_LINK_TCP    0
+#define COM_CMD_LINK_BLE    1
+
+struct com_cmd_parser
+{
+    uint8_t link;                   // COM_CMD_LINK_x
+    uint8_t state;
+    uint8_t data_len_bytes[4];
+    uint8_t i_data_len_bytes;
+    uint32_t data_len;
+    uint32_t i_data_len;
+    uint8_t *msg;
+
+    void (*on_msg)(uint8_t cmd, uint8_t is_known);
+};
 
 void com_tcp_recv_task(void *event_group);
 void com_tcp_send_task(void *event_group);
 
 void close_cs(void);
 
+void com_cmd_init(void);
+void com_cmd_reset(struct com_cmd_parser *p, uint8_t link, uint8_t *msg, void (*on_msg)(uint8_t cmd, uint8_t is_known));
+uint8_t com_cmd_feed(struct com_cmd_parser *p, const uint8_t *buf, uint32_t len);
+
 #endif
\ No newline at end of file
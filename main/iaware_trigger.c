@@ -0,0 +1,289 @@
+#include <stdint.h>
+
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "iaware_blog.h"
+#include "iaware_gpio.h"
+#include "iaware_helper.h"
+#include "iaware_packet.h"
+#include "iaware_sampling_data.h"
+#include "iaware_stream.h"
+#include "iaware_tcp_com.h"
+#include "iaware_trigger.h"
+#include "main.h"
+
+static void trigger_gpio_isr(void *arg);
+static uint32_t trigger_ms_to_blocks(uint32_t ms);
+
+volatile uint8_t trigger_sources = 0;
+
+static uint32_t trigger_n_buff_nodes = 0;
+static uint32_t trigger_pre_blocks = 0;
+static uint32_t trigger_post_blocks = 0;
+static uint8_t trigger_i_channel = 0;
+static uint16_t trigger_threshold = 0;
+
+// The last event. The GPIO interrupt, sampling_filter_task() and com_tcp_recv_task() write it, com_tcp_send_task() reads it.
+static portMUX_TYPE trigger_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t trigger_count = 0;
+static uint8_t trigger_source = 0;
+static uint32_t trigger_block_seq = 0;
+static uint64_t trigger_t = 0;
+
+// The threshold detector. Only sampling_filter_task() touches it.
+static uint16_t scan_prev = 0xFFFF;     // The last sample of the previous block. No crossing right after arming.
+static uint32_t scan_holdoff_seq = 0;   // The next block that may fire, i.e. one event per window.
+
+// The window. Only com_tcp_send_task() touches it.
+static uint32_t win_count = 0;          // The trigger_count of the last event handled.
+static uint8_t win_is_open = iawFalse;
+static uint32_t win_lo = 0;             // The first and the last block_seq of the window.
+static uint32_t win_hi = 0;
+static uint32_t win_resend_seq = 0;     // The next block of the window to send again.
+static uint32_t win_live_seq = 0;       // The last live block sent plus one.
+
+void init_trigger(void)
+// Call it after init_sampling_data_task(), which allocates the buff nodes.
+{
+    gpio_config_t io_conf;
+
+    trigger_n_buff_nodes = 0;
+
+    for (struct buff_node *node = head_buff_node_ptr; node != NULL; node = node->next)
+    {
+        trigger_n_buff_nodes = trigger_n_buff_nodes + 1;
+    }
+
+    io_conf.pin_bit_mask    = (1ULL << GPIO_TRIGGER);
+    io_conf.mode            = GPIO_MODE_INPUT;
+    io_conf.pull_up_en      = GPIO_PULLUP_DISABLE;
+    io_conf.pull_down_en    = GPIO_PULLDOWN_ENABLE;
+    io_conf.intr_type       = GPIO_INTR_POSEDGE;
+
+    if ((gpio_config(&io_conf) != ESP_OK) || (gpio_isr_handler_add(GPIO_TRIGGER, trigger_gpio_isr, NULL) != ESP_OK))
+        ESP_LOGE(IAWARE_GPIO, "Main: Trigger input on GPIO %d FAIL", GPIO_TRIGGER);
+    else
+        ESP_LOGI(IAWARE_GPIO, "Main: Trigger input on GPIO %d, a pre-trigger window of up to %d blocks.", GPIO_TRIGGER, (trigger_n_buff_nodes > 2) ? (trigger_n_buff_nodes - 2) : 0);
+}
+
+int trigger_set(uint8_t sources, uint32_t pre_ms, uint32_t post_ms, uint8_t i_channel, uint16_t threshold)
+// Params:
+//     sources      : TRIGGER_SOURCE_x ORed, or 0 to turn the triggered capture off.
+//     pre_ms       : [ms]. It is cut to the blocks that the ring can hold behind the ones being filled and sent.
+//     i_channel    : The position of the channel of TRIGGER_SOURCE_THRESHOLD in the scan order.
+//     threshold    : In the units of the stored samples, see sampling_data_bits.
+{
+    if ((sources & ~TRIGGER_SOURCE_ALL) || ((sources & TRIGGER_SOURCE_THRESHOLD) && (i_channel >= gpio_adc_n_channels)))
+        return iawFalse;
+
+    trigger_sources = 0; // The detectors stop while the settings change.
+
+    uint32_t max_pre_blocks = (trigger_n_buff_nodes > 2) ? (trigger_n_buff_nodes - 2) : 0;
+
+    trigger_pre_blocks = trigger_ms_to_blocks(pre_ms);
+    trigger_pre_blocks = (trigger_pre_blocks > max_pre_blocks) ? max_pre_blocks : trigger_pre_blocks;
+    trigger_post_blocks = trigger_ms_to_blocks(post_ms);
+    trigger_i_channel = i_channel;
+    trigger_threshold = threshold;
+
+    scan_prev = 0xFFFF;
+    scan_holdoff_seq = 0;
+
+    trigger_sources = sources;
+
+    return iawTrue;
+}
+
+int trigger_fire_host(void)
+// CMD_TRIGGER. The event falls in the block being filled.
+{
+    if ((trigger_sources & TRIGGER_SOURCE_HOST) == 0)
+        return iawFalse;
+
+    portENTER_CRITICAL(&trigger_mux);
+
+    trigger_count = trigger_count + 1;
+    trigger_source = TRIGGER_SOURCE_HOST;
+    trigger_block_seq = sampling_data_block_seq;
+    trigger_t = (uint64_t) esp_timer_get_time();
+
+    portEXIT_CRITICAL(&trigger_mux);
+
+    return iawTrue;
+}
+
+void trigger_scan_block(struct buff_node *node)
+// Called by sampling_filter_task() for every completed block, after the filters.
+{
+    if ((trigger_sources & TRIGGER_SOURCE_THRESHOLD) == 0)
+        return;
+
+    uint8_t *samples = node->samples_buff + STREAM_HEADROOM;
+    uint32_t n_scans = node->n_samples/(2*gpio_adc_n_channels);
+    uint32_t stride = (node->stream_flags & STREAM_FLAG_PLANAR) ? 2 : 2*gpio_adc_n_channels; // [bytes]
+    uint8_t *p = (node->stream_flags & STREAM_FLAG_PLANAR) ? (samples + 2*trigger_i_channel*n_scans) : (samples + 2*trigger_i_channel);
+    uint16_t prev = scan_prev;
+
+    for (uint32_t i = 0; i < n_scans; i++)
+    {
+        uint16_t v = (uint16_t) ((p[0] << 8) | p[1]);
+
+        if ((prev < trigger_threshold) && (v >= trigger_threshold) && (node->block_seq >= scan_holdoff_seq))
+        {
+            portENTER_CRITICAL(&trigger_mux);
+
+            trigger_count = trigger_count + 1;
+            trigger_source = TRIGGER_SOURCE_THRESHOLD;
+            trigger_block_seq = node->block_seq;
+            trigger_t = node->t_begin + (uint64_t) i*1000000/node->eff_sampling_freq;
+
+            portEXIT_CRITICAL(&trigger_mux);
+
+            scan_holdoff_seq = node->block_seq + trigger_post_blocks + 1;
+        }
+
+        prev = v;
+        p = p + stride;
+    }
+
+    scan_prev = prev;
+}
+
+void trigger_reset(void)
+// A new client starts without a window. The events before it are dropped.
+{
+    portENTER_CRITICAL(&trigger_mux);
+
+    win_count = trigger_count;
+
+    portEXIT_CRITICAL(&trigger_mux);
+
+    win_is_open = iawFalse;
+    win_live_seq = sampling_data_block_seq;
+}
+
+uint8_t trigger_block_flags(uint32_t block_seq)
+// Return STREAM_FLAG_TRIGGERED for a block of the window, STREAM_FLAG_PREVIEW for any other block, or 0 when the
+// triggered capture is off.
+{
+    if (trigger_sources == 0)
+        return 0;
+
+    if ((win_is_open == iawTrue) && (block_seq >= win_lo) && (block_seq <= win_hi))
+        return STREAM_FLAG_TRIGGERED;
+
+    return STREAM_FLAG_PREVIEW;
+}
+
+void trigger_live_sent(uint32_t block_seq)
+// Called by com_tcp_send_task() after every live block. The blocks of a new window up to here are sent again.
+{
+    win_live_seq = block_seq + 1;
+
+    if ((win_is_open == iawTrue) && (win_live_seq > win_hi + 1) && (win_resend_seq > win_hi))
+        win_is_open = iawFalse;
+}
+
+uint32_t trigger_pack_event(uint8_t *dst)
+// Open or extend the window of the last event, and write its PACKET_HEADER_TRIGGER packet to dst. Only the last one of
+// the events since the previous call is announced. Return the length of the packet, or 0 without a new event.
+{
+    uint32_t count;
+    uint8_t source;
+    uint32_t block_seq;
+    uint64_t t;
+
+    portENTER_CRITICAL(&trigger_mux);
+
+    count = trigger_count;
+    source = trigger_source;
+    block_seq = trigger_block_seq;
+    t = trigger_t;
+
+    portEXIT_CRITICAL(&trigger_mux);
+
+    if (count == win_count)
+        return 0;
+
+    win_count = count;
+
+    if (trigger_sources == 0)
+        return 0;
+
+    uint32_t lo = (block_seq > trigger_pre_blocks) ? (block_seq - trigger_pre_blocks) : 0;
+    uint32_t hi = block_seq + trigger_post_blocks;
+
+    if ((win_is_open == iawTrue) && (lo <= win_hi + 1))
+    {
+        win_hi = (hi > win_hi) ? hi : win_hi;
+    }
+    else
+    {
+        win_is_open = iawTrue;
+        win_lo = lo;
+        win_hi = hi;
+        win_resend_seq = lo;
+    }
+
+    BLOGI(BLOG_TAG_IAWARE_NETWORK, BLOG_FMT_TRIGGER_EVENT, source, block_seq, win_hi);
+
+    uint32_to_bytes(PACKET_HEADER_TRIGGER_META_SIZE, &(dst[0]));
+    dst[4] = PACKET_HEADER_TRIGGER;
+    dst[5] = source;
+    uint32_to_bytes(count, &(dst[6]));
+    uint32_to_bytes(block_seq, &(dst[10]));
+    uint64_to_bytes(t, &(dst[14]));
+    uint32_to_bytes(win_lo, &(dst[22]));
+    uint32_to_bytes(win_hi, &(dst[26]));
+
+    return 4 + PACKET_HEADER_TRIGGER_META_SIZE;
+}
+
+struct buff_node *trigger_next_resend(void)
+// Return the next block of the window that was sent as a preview, or NULL. A block that the ring has overwritten is
+// skipped. stream_pack_node() packs the returned block in full because it is in the window.
+{
+    while ((win_is_open == iawTrue) && (win_resend_seq < win_live_seq) && (win_resend_seq <= win_hi))
+    {
+        uint32_t block_seq = win_resend_seq;
+
+        win_resend_seq = win_resend_seq + 1;
+
+        for (struct buff_node *node = head_buff_node_ptr; node != NULL; node = node->next)
+        {
+            // The node being filled still has the block_seq of the block that it overwrites.
+            if ((node->block_seq == block_seq) && (node != run_buff_node_ptr))
+                return node;
+        }
+
+        BLOGW(BLOG_TAG_IAWARE_NETWORK, BLOG_FMT_TRIGGER_LOST, block_seq, 0, 0);
+    }
+
+    return NULL;
+}
+
+//////////////////// Private ////////////////////
+
+static void IRAM_ATTR trigger_gpio_isr(void *arg)
+{
+    if ((trigger_sources & TRIGGER_SOURCE_GPIO) == 0)
+        return;
+
+    portENTER_CRITICAL_ISR(&trigger_mux);
+
+    trigger_count = trigger_count + 1;
+    trigger_source = TRIGGER_SOURCE_GPIO;
+    trigger_block_seq = sampling_data_block_seq;
+    trigger_t = (uint64_t) esp_timer_get_time();
+
+    portEXIT_CRITICAL_ISR(&trigger_mux);
+}
+
+static uint32_t trigger_ms_to_blocks(uint32_t ms)
+// The blocks that cover ms, rounded up. A block lasts 1000/tcp_send_frequency ms.
+{
+    return (ms*tcp_send_frequency + 999)/1000;
+}
@@ -0,0 +1,44 @@
+#ifndef IAWARE_TRIGGER_H
+#define IAWARE_TRIGGER_H
+
+#include <stdint.h>
+
+#include "iaware_helper.h"
+
+// The event-triggered capture. While a source is armed with CMD_SET_TRIGGER, the live stream of a v2 client is only a
+// preview, DEGRADE_LEVEL_PREVIEW with TRIGGER_PREVIEW_AVERAGE scans averaged into one. An event opens a window of full
+// blocks around the block that it falls in, from pre_ms before it to post_ms after it:
+//
+//     TRIGGER_SOURCE_GPIO      A rising edge on GPIO_TRIGGER, e.g. the TTL of a stimulator.
+//     TRIGGER_SOURCE_THRESHOLD A sample of one channel that crosses the threshold upwards, after the filters.
+//     TRIGGER_SOURCE_HOST      CMD_TRIGGER.
+//
+// The ring of buff nodes is the pre-trigger buffer. The blocks of the window that were already sent as a preview are sent
+// again in full from the ring, before the flash and the backfill, as long as the ring has not overwritten them. The
+// blocks after the event go out full as they complete. A full block carries STREAM_FLAG_TRIGGERED and a preview block
+// STREAM_FLAG_PREVIEW, so the client keeps the full copy of a block_seq that it got twice. Every event is announced with
+// a PACKET_HEADER_TRIGGER packet. Events that fall in an open window extend it.
+//
+// It does not change the blocks in the ring, the flash or the band powers. It is off at every new client, and a v1 client
+// always gets the full stream.
+#define TRIGGER_SOURCE_GPIO         0x01
+#define TRIGGER_SOURCE_THRESHOLD    0x02
+#define TRIGGER_SOURCE_HOST         0x04
+#define TRIGGER_SOURCE_ALL          (TRIGGER_SOURCE_GPIO | TRIGGER_SOURCE_THRESHOLD | TRIGGER_SOURCE_HOST)
+
+#define TRIGGER_PREVIEW_AVERAGE     16          // The preview of 8-bit samples is 1/32 of the full stream.
+
+extern volatile uint8_t trigger_sources;        // 0 turns the triggered capture off.
+
+void init_trigger(void);
+int trigger_set(uint8_t sources, uint32_t pre_ms, uint32_t post_ms, uint8_t i_channel, uint16_t threshold);
+int trigger_fire_host(void);
+void trigger_scan_block(struct buff_node *node);
+
+void trigger_reset(void);
+uint8_t trigger_block_flags(uint32_t block_seq);
+void trigger_live_sent(uint32_t block_seq);
+uint32_t trigger_pack_event(uint8_t *dst);
+struct buff_node *trigger_next_resend(void);
+
+#endif
@@ -9,6 +9,9 @@
 // Choose idf.py menuconfig->Component config->Bluedroid Enable->Enable Include GATT server module
 // Choose idf.py menuconfig->Component config->Bluedroid Enable->Enable Include GATT client module
 
+// Choose idf.py menuconfig->Partition Table->Custom partition table CSV->partitions.csv
+// Choose idf.py menuconfig->Component config->SPI Flash driver->Enables yield operation during flash erase
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,13 +43,18 @@
 #include "nvs.h"
 #include "nvs_flash.h"
 
+#include "iaware_adc_cal.h"
 #include "iaware_ble_clt_com.h"
 #include "iaware_ble_svr_com.h"
+#include "iaware_blog.h"
+#include "iaware_flash_tier.h"
 #include "iaware_gpio.h"
 #include "iaware_helper.h"
+#include "iaware_marker.h"
 #include "iaware_packet.h"
 #include "iaware_sampling_data.h"
 #include "iaware_tcp_com.h"
+#include "iaware_trigger.h"
 #include "main.h"
 
 
@@ -75,6 +83,8 @@ struct buff_node *run_buff_node_ptr = NULL;
 struct buff_node *tail_buff_node_ptr = NULL;
 
 struct buff_node *run_tcp_send_buff_node_ptr = NULL;
+struct buff_node *run_flash_spill_buff_node_ptr = NULL;
+struct buff_node *run_filter_buff_node_ptr = NULL;
 
 
 // Logging
@@ -98,11 +108,23 @@ void app_main()
     // esp_log_level_set("phy", ESP_LOG_LEVEL_PHY);
     // esp_log_level_set("tcpip_adapter", ESP_LOG_LEVEL_TCPIP_ADAPTER);
 
-    esp_log_level_set(IAWARE_EVENT, ESP_LOG_LEVEL_IAWARE_EVENT);
-    esp_log_level_set(IAWARE_NETWORK, ESP_LOG_LEVEL_IAWARE_NETWORK);
-    esp_log_level_set(IAWARE_CORE, ESP_LOG_LEVEL_IAWARE_CORE);
-    esp_log_level_set(IAWARE_GPIO, ESP_LOG_LEVEL_IAWARE_GPIO);
-    esp_log_level_set(IAWARE_BLE, ESP_LOG_LEVEL_IAWARE_BLE);
+    // The binary log shares the tags and the levels with ESP_LOGx.
+    blog_init();
+    blog_level_set(BLOG_TAG_IAWARE_EVENT, ESP_LOG_LEVEL_IAWARE_EVENT);
+    blog_level_set(BLOG_TAG_IAWARE_NETWORK, ESP_LOG_LEVEL_IAWARE_NETWORK);
+    blog_level_set(BLOG_TAG_IAWARE_CORE, ESP_LOG_LEVEL_IAWARE_CORE);
+    blog_level_set(BLOG_TAG_IAWARE_GPIO, ESP_LOG_LEVEL_IAWARE_GPIO);
+    blog_level_set(BLOG_TAG_IAWARE_BLE, ESP_LOG_LEVEL_IAWARE_BLE);
+
+    // Format the binary log away from the hot paths.
+    xTaskCreatePinnedToCore(
+        blog_drain_task, // Function to implement the task
+        "blog_drain_task", // Name of the task
+        2048, // Stack size in words (32 bits in esp32)
+        NULL, // Task input parameter
+        XTASK_LOW_PRIORITY, // Priority of the task
+        NULL, // Task handle.
+        0); // Core where the task should run
 
 
     // Initializes a non-volatile memory in flash memory, so it can be used by concurrent tasks
@@ -130,8 +152,13 @@ void app_main()
 
     init_wifi_in_ap();    
 
+    com_cmd_init();
+
+#ifdef CONFIG_IAWARE_BLE_HUB
+    init_ble_client();
+#else
     init_ble_server();
-    // init_ble_client();
+#endif
      
     // This task is not intended for OTA upload.
     xTaskCreatePinnedToCore(
@@ -158,6 +185,35 @@ void app_main()
 
     // The task of sampling input data uses the hardware timer. Therefore, the callback of the hardware timer always runs in Core 0.
     init_sampling_data_task();
+
+    // The GPIO of the external trigger. The triggered capture stays off until CMD_SET_TRIGGER.
+    init_trigger();
+
+    // The GPIO of the event markers.
+    init_marker();
+
+    // Filter the completed blocks before they are sent or spilled, and compute the band powers. It idles until CMD_SET_FILTER or CMD_SET_FEATURES.
+    xTaskCreatePinnedToCore(
+        sampling_filter_task, // Function to implement the task
+        "sampling_filter_task", // Name of the task
+        2048, // Stack size in words (32 bits in esp32)
+        NULL, // Task input parameter
+        XTASK_LOW_PRIORITY, // Priority of the task
+        NULL, // Task handle.
+        0); // Core where the task should run
+
+    // Keep the blocks in flash while no client is streaming. The flash operations stay on Core 0 away from Wi-Fi and lwIP.
+    if (flash_tier_enabled == iawTrue)
+    {
+        xTaskCreatePinnedToCore(
+            flash_spill_task, // Function to implement the task
+            "flash_spill_task", // Name of the task
+            2048, // Stack size in words (32 bits in esp32)
+            NULL, // Task input parameter
+            XTASK_LOW_PRIORITY, // Priority of the task
+            NULL, // Task handle.
+            0); // Core where the task should run
+    }
 }
 
 
@@ -270,6 +326,101 @@ int nvs_write_sampling_data_fs(uint32_t fs)
 }
 
 
+int nvs_read_u32(const char *key, uint32_t *value)
+// Read key from the "storage" namespace. value is left untouched when key is not found. Return iawTrue when key is read.
+{
+    nvs_handle my_handle;
+
+    esp_err_t err = nvs_open("storage", NVS_READONLY, &my_handle);
+    if (err != ESP_OK) 
+    {
+        ESP_LOGE(IAWARE_CORE, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+
+        return iawFalse;
+    }
+
+    err = nvs_get_u32(my_handle, key, value);
+    if ((err != ESP_OK) && (err != ESP_ERR_NVS_NOT_FOUND))
+        ESP_LOGE(IAWARE_CORE, "Reading %s from the non-volatile storage FAIL with Error (%s).", key, esp_err_to_name(err));
+
+    nvs_close(my_handle);
+
+    return (err == ESP_OK) ? iawTrue : iawFalse;
+}
+
+int nvs_write_u32(const char *key, uint32_t value)
+// Write and commit key in the "storage" namespace.
+{
+    nvs_handle my_handle;
+
+    esp_err_t err = nvs_open("storage", NVS_READWRITE, &my_handle);
+    if (err != ESP_OK) 
+    {
+        ESP_LOGE(IAWARE_CORE, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+
+        return iawFalse;
+    }
+
+    if ((err = nvs_set_u32(my_handle, key, value)) == ESP_OK)
+        err = nvs_commit(my_handle);
+
+    if (err != ESP_OK)
+        ESP_LOGE(IAWARE_CORE, "Writting %s = %d in the non-volatile storage FAIL with Error (%s).", key, value, esp_err_to_name(err));
+
+    nvs_close(my_handle);
+
+    return (err == ESP_OK) ? iawTrue : iawFalse;
+}
+
+int nvs_read_blob(const char *key, void *value, uint32_t len)
+// Read key from the "storage" namespace. Return iawTrue when key is read and holds exactly len bytes, value may be
+// overwritten otherwise.
+{
+    nvs_handle my_handle;
+    size_t stored_len = len;
+
+    esp_err_t err = nvs_open("storage", NVS_READONLY, &my_handle);
+    if (err != ESP_OK) 
+    {
+        ESP_LOGE(IAWARE_CORE, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+
+        return iawFalse;
+    }
+
+    err = nvs_get_blob(my_handle, key, value, &stored_len);
+    if ((err != ESP_OK) && (err != ESP_ERR_NVS_NOT_FOUND))
+        ESP_LOGE(IAWARE_CORE, "Reading %s from the non-volatile storage FAIL with Error (%s).", key, esp_err_to_name(err));
+
+    nvs_close(my_handle);
+
+    return ((err == ESP_OK) && (stored_len == len)) ? iawTrue : iawFalse;
+}
+
+int nvs_write_blob(const char *key, const void *value, uint32_t len)
+// Write and commit key in the "storage" namespace.
+{
+    nvs_handle my_handle;
+
+    esp_err_t err = nvs_open("storage", NVS_READWRITE, &my_handle);
+    if (err != ESP_OK) 
+    {
+        ESP_LOGE(IAWARE_CORE, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+
+        return iawFalse;
+    }
+
+    if ((err = nvs_set_blob(my_handle, key, value, len)) == ESP_OK)
+        err = nvs_commit(my_handle);
+
+    if (err != ESP_OK)
+        ESP_LOGE(IAWARE_CORE, "Writting %s of %d bytes in the non-volatile storage FAIL with Error (%s).", key, len, esp_err_to_name(err));
+
+    nvs_close(my_handle);
+
+    return (err == ESP_OK) ? iawTrue : iawFalse;
+}
+
+
 //////////////////// Private ////////////////////
 
 static esp_err_t event_handler(void *ctx, system_event_t *event)
@@ -407,5 +558,8 @@ static void iaware_init(void)
     // Initialize GPIOs.
     iaware_init_gpio();
 
+    // Characterize the ADC before the sampling takes the bits of the samples.
+    init_adc_cal();
+
     ESP_LOGI(IAWARE_CORE, "Done initializing.");
 }
\ No newline at end of file
@@ -8,6 +8,8 @@
 #include "FreeRTOSConfig.h"
 #include "freertos/event_groups.h"
 
+#include "iaware_bool.h"
+
 // Core
 #define SLEEP_TIME_MICROSEC 1000000 // [microsec]
 
@@ -25,9 +27,6 @@
 #define ESP_LOG_LEVEL_PHY           ESP_LOG_ERROR
 #define ESP_LOG_LEVEL_TCPIP_ADAPTER ESP_LOG_ERROR
 
-#define iawTrue     1
-#define iawFalse    0
-
 extern char *IAWARE_EVENT;
 #define ESP_LOG_LEVEL_IAWARE_EVENT 	ESP_LOG_WARN
 // #define ESP_LOG_LEVEL_IAWARE_EVENT  ESP_LOG_INFO
@@ -67,6 +66,8 @@ extern struct buff_node *run_buff_node_ptr;
 extern struct buff_node *tail_buff_node_ptr;
 
 extern struct buff_node *run_tcp_send_buff_node_ptr;
+extern struct buff_node *run_flash_spill_buff_node_ptr;
+extern struct buff_node *run_filter_buff_node_ptr;
 
 // Reboot ESP32.
 void deep_restart(void);
@@ -74,5 +75,9 @@ void deep_restart(void);
 // The non-volatile storage
 void nvs_read_sampling_data_fs(void);
 int nvs_write_sampling_data_fs(uint32_t fs);
+int nvs_read_u32(const char *key, uint32_t *value);
+int nvs_write_u32(const char *key, uint32_t value);
+int nvs_read_blob(const char *key, void *value, uint32_t len);
+int nvs_write_blob(const char *key, const void *value, uint32_t len);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,20 @@
+import ctypes
+import os
+import subprocess
+import tempfile
+
+MAIN_DIR_g = os.path.dirname(os.path.abspath(__file__))
+
+def host_library(sources_p):
+    # Build the C files sources_p of main/ into a shared library for the PC and load it with ctypes. Only the modules that
+    # do not include ESP-IDF build here. CC picks the compiler, cc by default.
+    dir_l = tempfile.mkdtemp(prefix="iaware_host_")
+    lib_l = os.path.join(dir_l, "libiaware_host.so")
+
+    subprocess.check_call([os.environ.get("CC", "cc"), "-O2", "-shared", "-fPIC", "-Wall", "-I", MAIN_DIR_g, "-o", lib_l] + [os.path.join(MAIN_DIR_g, s_l) for s_l in sources_p])
+
+    return ctypes.CDLL(lib_l)
+
+def host_struct(size_p=8192):
+    # An opaque buffer for a C struct that the tests only pass by pointer.
+    return ctypes.create_string_buffer(size_p)
@@ -0,0 +1,51 @@
+import ctypes
+import unittest
+
+import iaware_host
+import test_host
+
+# iaware_ble_adv.c against ble_adv_metrics_from_adv() of iaware_host.py. Run with: python3 test_host_ble_adv.py
+class BleAdvMetrics(ctypes.Structure):
+    _fields_ = [("flags", ctypes.c_uint8), ("n_channels", ctypes.c_uint8), ("battery", ctypes.c_uint8), ("rate", ctypes.c_uint32),
+                ("block_seq", ctypes.c_uint32), ("n_dropped", ctypes.c_uint32), ("n_skipped", ctypes.c_uint16)]
+
+BLE_ADV_MAX_SIZE_g = 31
+
+class TestBleAdv(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.lib = test_host.host_library(["iaware_ble_adv.c"])
+        cls.lib.ble_adv_metrics_pack.restype = ctypes.c_uint32
+
+    def pack(self, name_p, **fields_p):
+        m_l = BleAdvMetrics(**fields_p)
+        dst_l = ctypes.create_string_buffer(BLE_ADV_MAX_SIZE_g)
+        n_l = self.lib.ble_adv_metrics_pack(ctypes.byref(m_l), name_p, dst_l)
+
+        self.assertLessEqual(n_l, BLE_ADV_MAX_SIZE_g)
+
+        return dst_l.raw[:n_l]
+
+    def test_round_trip(self):
+        fields_l = dict(flags=0x2B, n_channels=3, battery=0xFF, rate=0x01020304, block_seq=0xA0B0C0D0, n_dropped=7, n_skipped=0xFFFF)
+
+        for name_l in (b"", b"iAware", b"a-much-too-long-device-name"):
+            with self.subTest(name=name_l):
+                adv_l = self.pack(name_l, **fields_l)
+                m_l = BleAdvMetrics()
+
+                self.assertEqual(iaware_host.ble_adv_metrics_from_adv(adv_l), iaware_host.BleAdvMetrics(**fields_l))
+                self.assertEqual(self.lib.ble_adv_metrics_parse(adv_l, len(adv_l), ctypes.byref(m_l)), 1)
+                self.assertEqual({k_l: getattr(m_l, k_l) for k_l in fields_l}, fields_l)
+
+    def test_parse_rejects(self):
+        adv_l = bytearray(self.pack(b"iAware", rate=1))
+        m_l = BleAdvMetrics()
+
+        # Cut short, and another version.
+        self.assertEqual(self.lib.ble_adv_metrics_parse(bytes(adv_l[:-1]), len(adv_l) - 1, ctypes.byref(m_l)), 0)
+        adv_l[-(2 + 4 + 4 + 4 + 4)] = iaware_host.BLE_ADV_METRICS_VERSION + 1
+        self.assertEqual(self.lib.ble_adv_metrics_parse(bytes(adv_l), len(adv_l), ctypes.byref(m_l)), 0)
+
+if __name__ == "__main__":
+    unittest.main()
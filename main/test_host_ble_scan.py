@@ -0,0 +1,131 @@
+import ctypes
+import io
+import os
+import random
+import time
+import unittest
+
+import iaware_host
+import test_host
+
+# iaware_ble_scan.c, the scan of the hub, and a benchmark of its parser over a stream of advertising reports. The stream
+# is a synthetic busy room unless IAWARE_BLE_SCAN_CAPTURES names capture files, see ble_scan_capture() of iaware_host.py.
+# Run with: python3 test_host_ble_scan.py
+AD_FLAGS_g = bytes([0x02, 0x01, 0x06])
+
+def adv_uuid128(uuid128_p, ad_type_p=0x07):
+    return AD_FLAGS_g + bytes([1 + len(uuid128_p), ad_type_p]) + uuid128_p
+
+def adv_name(name_p):
+    return bytes([1 + len(name_p), 0x09]) + name_p
+
+def busy_room(n_devices_p, n_peripherals_p, n_reports_p, seed_p=1):
+    # The reports of a scan in a room of n_devices_p advertisers, n_peripherals_p of them i-Aware peripherals. Each device
+    # reports many times, half of them with the scan response.
+    rng_l = random.Random(seed_p)
+    devices_l = []
+    for i_l in range(n_devices_p):
+        bda_l = bytes([0xC0 | rng_l.randrange(64)] + [rng_l.randrange(256) for _ in range(5)])
+        if i_l < n_peripherals_p:
+            adv_l = adv_uuid128(iaware_host.BLE_UUID_SERVICE)
+        else:
+            adv_l = AD_FLAGS_g + bytes([0x03, 0x03, 0x0F, 0x18]) + bytes([0x09, 0xFF, 0x4C, 0x00]) + bytes(rng_l.randrange(256) for _ in range(6))
+        devices_l.append((bda_l, adv_l, adv_name(b"dev%d" % i_l), rng_l.randrange(-95, -40)))
+
+    capture_l = io.BytesIO()
+    for _ in range(n_reports_p):
+        bda_l, adv_l, rsp_l, rssi_l = rng_l.choice(devices_l)
+        is_rsp_l = rng_l.random() < 0.5
+        iaware_host.ble_scan_capture(capture_l, bda_l, 0, rssi_l + rng_l.randrange(-3, 4), is_rsp_l, adv_l + rsp_l if is_rsp_l else adv_l)
+
+    return capture_l.getvalue()
+
+def count_reports(capture_p):
+    n_l = 0
+    i_l = 0
+    while i_l < len(capture_p):
+        i_l = i_l + iaware_host.BLE_SCAN_REPORT_STRUCT.size + capture_p[i_l + iaware_host.BLE_SCAN_REPORT_STRUCT.size - 1]
+        n_l = n_l + 1
+
+    return n_l
+
+class TestBleScan(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.lib = test_host.host_library(["iaware_ble_scan.c", "iaware_ble_scan_replay.c"])
+        cls.lib.ble_scan_replay.restype = ctypes.c_uint32
+
+    def setUp(self):
+        self.scan = test_host.host_struct()
+        self.lib.ble_scan_init(self.scan, iaware_host.BLE_UUID_SERVICE)
+
+    def report(self, bda_p, rssi_p, adv_p, is_complete_p=True):
+        return self.lib.ble_scan_report(self.scan, bytes(bda_p), 0, ctypes.c_int8(rssi_p), adv_p, len(adv_p), 1 if is_complete_p else 0)
+
+    def pop_all(self):
+        bda_l = ctypes.create_string_buffer(6)
+        addr_type_l = ctypes.c_uint8()
+        out_l = []
+        while self.lib.ble_scan_pop(self.scan, bda_l, ctypes.byref(addr_type_l)) == 1:
+            out_l.append(bda_l.raw)
+
+        return out_l
+
+    def test_uuid_match(self):
+        other_l = bytes(range(16))
+        has_l = lambda adv_p: self.lib.ble_scan_adv_has_uuid128(adv_p, len(adv_p), iaware_host.BLE_UUID_SERVICE)
+
+        self.assertEqual(has_l(adv_uuid128(iaware_host.BLE_UUID_SERVICE)), 1)
+        self.assertEqual(has_l(adv_uuid128(iaware_host.BLE_UUID_SERVICE, 0x06)), 1)
+        self.assertEqual(has_l(AD_FLAGS_g + bytes([33, 0x07]) + other_l + iaware_host.BLE_UUID_SERVICE), 1)
+        self.assertEqual(has_l(adv_uuid128(other_l)), 0)
+        self.assertEqual(has_l(adv_name(b"i-Aware") + bytes([17, 0x09]) + iaware_host.BLE_UUID_SERVICE), 0)
+        # A structure that runs past the payload, and the padding that ends it.
+        self.assertEqual(has_l(adv_uuid128(iaware_host.BLE_UUID_SERVICE)[:-1]), 0)
+        self.assertEqual(has_l(AD_FLAGS_g + bytes([0, 0]) + adv_uuid128(iaware_host.BLE_UUID_SERVICE)), 0)
+
+    def test_reject_once_complete(self):
+        bda_l = bytes([1, 2, 3, 4, 5, 6])
+        adv_l = AD_FLAGS_g
+
+        # Without its scan response an address is parsed again, with it the address is rejected for good.
+        self.assertEqual(self.report(bda_l, -50, adv_l, False), 0)
+        self.assertEqual(self.report(bda_l, -50, adv_l + adv_uuid128(iaware_host.BLE_UUID_SERVICE)[3:], True), 1)
+
+        self.lib.ble_scan_start(self.scan)
+        self.assertEqual(self.report(bda_l, -50, adv_l, True), 0)
+        self.assertEqual(self.report(bda_l, -50, adv_uuid128(iaware_host.BLE_UUID_SERVICE), True), 0)
+        self.assertEqual(self.pop_all(), [])
+
+    def test_rank_by_rssi(self):
+        adv_l = adv_uuid128(iaware_host.BLE_UUID_SERVICE)
+        rssi_l = [-70, -40, -90, -60, -80, -50]
+        for i_l, r_l in enumerate(rssi_l):
+            self.assertEqual(self.report(bytes([i_l]*6), r_l, adv_l), 1)
+
+        # A candidate that reports again moves with its new RSSI.
+        self.assertEqual(self.report(bytes([3]*6), -30, adv_l), 1)
+
+        self.assertEqual(self.pop_all(), [bytes([3]*6), bytes([1]*6), bytes([5]*6), bytes([0]*6)])
+        self.assertEqual(self.pop_all(), [])
+
+    def test_bench(self):
+        paths_l = [p_l for p_l in os.environ.get("IAWARE_BLE_SCAN_CAPTURES", "").split(os.pathsep) if p_l]
+        captures_l = [(p_l, open(p_l, "rb").read()) for p_l in paths_l] or [("busy room", busy_room(200, 3, 20000))]
+        n_rounds_l = 20
+
+        for name_l, capture_l in captures_l:
+            n_reports_l = count_reports(capture_l)
+            t_l = time.perf_counter_ns()
+            n_parsed_l = self.lib.ble_scan_replay(self.scan, capture_l, len(capture_l), n_rounds_l)
+            t_l = time.perf_counter_ns() - t_l
+
+            self.assertNotEqual(n_parsed_l, 0xFFFFFFFF, name_l)
+            print("\n%s: %d reports, %.1f ns/report, %.1f%% parsed" % (name_l, n_reports_l, t_l/(n_rounds_l*n_reports_l), 100.0*n_parsed_l/(n_rounds_l*n_reports_l)))
+
+        if not paths_l:
+            # Most reports are a lookup: an address is parsed until its scan response comes.
+            self.assertLess(n_parsed_l, 0.05*n_rounds_l*n_reports_l)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,57 @@
+import ctypes
+import unittest
+
+import numpy as np
+
+import iaware_host
+import test_host
+
+# iaware_decimate.c against decimate_reference() of iaware_host.py, bit for bit. Run with: python3 test_host_decimate.py
+class TestDecimate(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.lib = test_host.host_library(["iaware_decimate.c"])
+
+    def decimate_c(self, raw_p):
+        # raw_p has the shape (n_scans, n_channels). Return the outputs per channel.
+        n_scans_l, n_channels_l = raw_p.shape
+        dec_l = test_host.host_struct()
+        out_l = ctypes.c_uint16()
+        y_l = [[] for _ in range(n_channels_l)]
+
+        self.assertEqual(self.lib.decimate_init(dec_l, self.factor, n_channels_l), 0)
+
+        for i_l in range(n_scans_l):
+            for i_channel_l in range(n_channels_l):
+                if self.lib.decimate_push(dec_l, i_channel_l, int(raw_p[i_l, i_channel_l]), ctypes.byref(out_l)) == 1:
+                    y_l[i_channel_l].append(out_l.value)
+
+        return [np.array(v_l, dtype=np.uint16) for v_l in y_l]
+
+    def check(self, raw_p):
+        for self.factor in (4, 8, 16, 32, 64):
+            with self.subTest(factor=self.factor):
+                y_l = self.decimate_c(raw_p)
+
+                for i_channel_l in range(raw_p.shape[1]):
+                    np.testing.assert_array_equal(y_l[i_channel_l], iaware_host.decimate_reference(raw_p[:, i_channel_l], self.factor))
+
+    def test_noise(self):
+        rng_l = np.random.default_rng(1)
+
+        self.check(rng_l.integers(0, 1 << iaware_host.DECIMATE_IN_BITS, size=(4096, 2)))
+
+    def test_sine(self):
+        t_l = np.arange(4096)
+        raw_l = 2048 + 2000*np.sin(2*np.pi*t_l[:, None]*np.array([0.001, 0.013]))
+
+        self.check(np.round(raw_l).astype(np.int64))
+
+    def test_rail_steps(self):
+        # Full-scale steps overflow the integrators, which must wrap around like the reference.
+        raw_l = np.where((np.arange(4096) // 300) % 2 == 0, 0, (1 << iaware_host.DECIMATE_IN_BITS) - 1)
+
+        self.check(np.stack([raw_l, raw_l[::-1]], axis=1))
+
+if __name__ == "__main__":
+    unittest.main()
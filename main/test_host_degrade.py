@@ -0,0 +1,109 @@
+import unittest
+
+import numpy as np
+
+import iaware_host
+import test_host
+
+# iaware_degrade.c on the PC: the controller against a link with a bandwidth cap, and the codecs against the decoders of
+# iaware_host.py. Run with: python3 test_host_degrade.py
+N_BUFF_NODES_g = 16
+PERIOD_US_g = 100000                    # The time that a block takes to fill.
+BLOCK_BYTES_g = 10000                   # A full block.
+LEVEL_RATIO_g = [1.0, 0.5, 0.3, 0.25]   # The size of a sent block per level, about what the codecs give on EEG.
+
+class TestDegrade(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.lib = test_host.host_library(["iaware_degrade.c"])
+
+    def simulate(self, d_p, caps_p):
+        # Send one block after the other over a link of caps_p[i] bytes/sec, like com_tcp_send_task(). The blocks fill every
+        # PERIOD_US_g and wait in the ring. Return the level after every block.
+        t_us_l = 0
+        n_sent_l = 0
+        levels_l = []
+
+        for cap_l in caps_p:
+            # Wait for the block when the sender is ahead.
+            t_us_l = max(t_us_l, (n_sent_l + 1)*PERIOD_US_g)
+
+            level_l = d_p.raw[0]
+            send_us_l = int(BLOCK_BYTES_g*LEVEL_RATIO_g[level_l]*1000000/cap_l)
+
+            t_us_l = t_us_l + send_us_l
+            n_sent_l = n_sent_l + 1
+
+            backlog_l = min(max(t_us_l//PERIOD_US_g - n_sent_l, 0), N_BUFF_NODES_g - 1)
+
+            self.lib.degrade_update(d_p, backlog_l, send_us_l, PERIOD_US_g)
+            levels_l.append(d_p.raw[0])
+
+        return levels_l
+
+    def test_settles_and_recovers(self):
+        d_l = test_host.host_struct()
+        self.lib.degrade_init(d_l, iaware_host.DEGRADE_LEVEL_PREVIEW, N_BUFF_NODES_g)
+
+        # DEGRADE_LEVEL_DECIMATE takes 60 % of the period, DEGRADE_LEVEL_COMPRESS all of it.
+        cap_l = BLOCK_BYTES_g*LEVEL_RATIO_g[iaware_host.DEGRADE_LEVEL_DECIMATE]*1000000/(0.6*PERIOD_US_g)
+
+        levels_l = self.simulate(d_l, [cap_l]*300)
+
+        self.assertEqual(levels_l[-1], iaware_host.DEGRADE_LEVEL_DECIMATE)
+        self.assertNotIn(iaware_host.DEGRADE_LEVEL_PREVIEW, levels_l)
+        self.assertEqual(levels_l[-100:], [iaware_host.DEGRADE_LEVEL_DECIMATE]*100)
+
+        # Once the cap lifts it steps back up to the full blocks.
+        levels_l = self.simulate(d_l, [100*cap_l]*300)
+
+        self.assertEqual(levels_l[-1], iaware_host.DEGRADE_LEVEL_FULL)
+
+    def test_max_level(self):
+        d_l = test_host.host_struct()
+        self.lib.degrade_init(d_l, iaware_host.DEGRADE_LEVEL_FULL, N_BUFF_NODES_g)
+
+        self.assertEqual(set(self.simulate(d_l, [1000]*100)), {iaware_host.DEGRADE_LEVEL_FULL})
+
+    def test_delta8(self):
+        rng_l = np.random.default_rng(1)
+
+        for is_planar_l in (False, True):
+            with self.subTest(is_planar=is_planar_l):
+                # Small steps with rail-to-rail jumps that need the escape.
+                x_l = np.clip(2048 + np.cumsum(rng_l.integers(-60, 61, size=(300, 3)), axis=0), 0, 4095)
+                x_l[::37] = 4095 - x_l[::37]
+
+                samples_l = (x_l.T if is_planar_l else x_l).astype(np.uint16).ravel()
+                dst_l = test_host.host_struct(3*samples_l.size)
+
+                len_l = self.lib.degrade_delta8(samples_l.astype(">u2").tobytes(), dst_l, 300, 3, 1 if is_planar_l else 0, len(dst_l))
+
+                self.assertGreater(len_l, 0)
+                np.testing.assert_array_equal(iaware_host.stream_delta8_decode(dst_l.raw[:len_l], 300, 3, is_planar_l), samples_l)
+
+    def test_delta8_max_len(self):
+        samples_l = np.array([0, 4095]*50, dtype=">u2").tobytes()
+        dst_l = test_host.host_struct(len(samples_l))
+
+        self.assertEqual(self.lib.degrade_delta8(samples_l, dst_l, 100, 1, 0, 100), 0)
+
+    def test_average_to_u8(self):
+        x_l = np.random.default_rng(2).integers(0, 4096, size=(301, 2)).astype(np.uint16)
+        dst_l = test_host.host_struct(x_l.nbytes)
+
+        n_out_l = self.lib.degrade_average(x_l.astype(">u2").tobytes(), dst_l, 301, 2, 0, 2)
+
+        # The odd last scan is averaged on its own.
+        pad_l = np.concatenate([x_l, x_l[-1:]]).astype(np.uint32)
+        avg_l = (pad_l[0::2] + pad_l[1::2] + 1)//2
+
+        self.assertEqual(n_out_l, 151)
+        np.testing.assert_array_equal(np.frombuffer(dst_l.raw[:4*n_out_l], dtype=">u2").reshape(-1, 2), avg_l)
+
+        u8_l = test_host.host_struct(2*n_out_l)
+        self.assertEqual(self.lib.degrade_to_u8(dst_l.raw[:4*n_out_l], u8_l, 2*n_out_l, 12), 2*n_out_l)
+        np.testing.assert_array_equal(np.frombuffer(u8_l.raw, dtype=np.uint8), (avg_l >> 4).ravel())
+
+if __name__ == "__main__":
+    unittest.main()
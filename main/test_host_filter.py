@@ -0,0 +1,63 @@
+import unittest
+
+import numpy as np
+
+import iaware_host
+import test_host
+
+# iaware_filter.c against filter_reference() of iaware_host.py, bit for bit. Run with: python3 test_host_filter.py
+class TestFilter(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.lib = test_host.host_library(["iaware_filter.c"])
+
+    def filter_c(self, samples_p, bits_p, sections_q_p, is_planar_p, n_blocks_p):
+        # samples_p has the shape (n_scans, n_channels), filtered in n_blocks_p blocks so the state carries over.
+        n_scans_l, n_channels_l = samples_p.shape
+        bank_l = test_host.host_struct()
+        sections_l = np.array(sections_q_p, dtype=np.int16).tobytes()
+
+        self.lib.filter_init(bank_l, n_channels_l)
+        self.assertEqual(self.lib.filter_set(bank_l, iaware_host.FILTER_ALL_CHANNELS, len(sections_q_p), sections_l), 0)
+
+        out_l = []
+        for block_l in np.array_split(samples_p, n_blocks_p):
+            data_l = (block_l.T if is_planar_p else block_l).astype(">u2").tobytes()
+            buff_l = test_host.host_struct(len(data_l))
+            buff_l.raw = data_l
+
+            self.lib.filter_process_block(bank_l, buff_l, len(block_l), 1 if is_planar_p else 0, bits_p)
+
+            y_l = np.frombuffer(buff_l.raw, dtype=">u2")
+            out_l.append(y_l.reshape(n_channels_l, -1).T if is_planar_p else y_l.reshape(-1, n_channels_l))
+
+        return np.concatenate(out_l)
+
+    def test_notch_bandpass(self):
+        fs_l = 1000
+        sections_l = iaware_host.filter_quantize([iaware_host.biquad_notch(50, fs_l), iaware_host.biquad_bandpass(10, fs_l)])
+        rng_l = np.random.default_rng(1)
+
+        for bits_l in (12, 13, 15):
+            for is_planar_l in (False, True):
+                with self.subTest(bits=bits_l, is_planar=is_planar_l):
+                    t_l = np.arange(1500)[:, None]
+                    x_l = (1 << (bits_l - 1)) + 0.4*(1 << bits_l)*np.sin(2*np.pi*50*t_l/fs_l) + rng_l.normal(0, 0.05*(1 << bits_l), size=(1500, 3))
+                    x_l = np.clip(np.round(x_l), 0, (1 << bits_l) - 1).astype(np.int64)
+
+                    y_l = self.filter_c(x_l, bits_l, sections_l, is_planar_l, 7)
+
+                    for i_channel_l in range(x_l.shape[1]):
+                        np.testing.assert_array_equal(y_l[:, i_channel_l], iaware_host.filter_reference(x_l[:, i_channel_l], bits_l, sections_l))
+
+    def test_saturation(self):
+        # Gains above 1 drive every section into its 16-bit saturation.
+        sections_l = [(32767, 0, 0, 0, 0), (32767, -32768, 16384, -16384, 8192)]
+        x_l = np.where((np.arange(600) // 40) % 2 == 0, 0, 4095)[:, None]
+
+        y_l = self.filter_c(x_l, 12, sections_l, False, 3)
+
+        np.testing.assert_array_equal(y_l[:, 0], iaware_host.filter_reference(x_l[:, 0], 12, sections_l))
+
+if __name__ == "__main__":
+    unittest.main()
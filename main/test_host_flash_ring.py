@@ -0,0 +1,232 @@
+import ctypes
+import os
+import shutil
+import tempfile
+import unittest
+
+import iaware_host
+import test_host
+
+# iaware_flash_ring.c on the file-backed NOR emulator of iaware_flash_file.c, and the recording index of CMD_FIND_RECORD and
+# CMD_READ_RECORD against record_parse() of iaware_host.py. Run with: python3 test_host_flash_ring.py
+class FlashRecHdr(ctypes.Structure):
+    _fields_ = [("magic", ctypes.c_uint16), ("flags", ctypes.c_uint8), ("stream_flags", ctypes.c_uint8), ("len", ctypes.c_uint16),
+                ("channel_mask", ctypes.c_uint8), ("bits", ctypes.c_uint8), ("block_seq", ctypes.c_uint32), ("eff_sampling_freq", ctypes.c_uint32),
+                ("t_begin", ctypes.c_uint64)]
+
+class FlashRing(ctypes.Structure):
+    _fields_ = [("dev", ctypes.c_void_p), ("head_sector", ctypes.c_uint32), ("head_offset", ctypes.c_uint32), ("head_seq", ctypes.c_uint32),
+                ("oldest_seq", ctypes.c_uint32), ("boot_count", ctypes.c_uint32), ("tail_sector", ctypes.c_uint32), ("tail_offset", ctypes.c_uint32),
+                ("n_pending", ctypes.c_uint32), ("n_overwritten", ctypes.c_uint32), ("erase_count_min", ctypes.c_uint32), ("erase_count_max", ctypes.c_uint32)]
+
+FLASH_RING_OK_g = 0
+FLASH_RING_ERR_EMPTY_g = -3
+
+SECTOR_SIZE_g = 1024
+N_SECTORS_g = 8
+PAYLOAD_LEN_g = 200
+RECS_PER_SECTOR_g = (SECTOR_SIZE_g - iaware_host.FLASH_SECTOR_STRUCT.size)//(iaware_host.FLASH_REC_STRUCT.size + PAYLOAD_LEN_g)
+BOOT_COUNT_g = 3
+
+def payload(block_seq_p):
+    return bytes((7*block_seq_p + i_l) & 0xFF for i_l in range(PAYLOAD_LEN_g))
+
+def t_begin(block_seq_p):
+    # [microsec]
+    return 1000000 + 50000*block_seq_p
+
+class TestFlashRing(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.lib = test_host.host_library(["iaware_flash_ring.c", "iaware_flash_file.c"])
+        cls.lib.flash_ring_vaddr_begin.restype = ctypes.c_uint64
+        cls.lib.flash_ring_vaddr_end.restype = ctypes.c_uint64
+        cls.lib.flash_ring_find.restype = ctypes.c_uint64
+        cls.lib.flash_ring_read_raw.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_void_p, ctypes.c_uint32]
+        cls.lib.flash_ring_find.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint64]
+
+    def setUp(self):
+        self.dir = tempfile.mkdtemp(prefix="iaware_flash_")
+        self.path = os.path.join(self.dir, "log.bin")
+        self.dev = None
+        self.mount()
+
+    def tearDown(self):
+        self.close()
+        shutil.rmtree(self.dir)
+
+    def mount(self):
+        self.dev = test_host.host_struct()
+        self.ring = FlashRing()
+        self.ring.boot_count = BOOT_COUNT_g
+
+        self.assertEqual(self.lib.flash_dev_init_file(self.dev, self.path.encode(), SECTOR_SIZE_g, N_SECTORS_g), 0)
+        self.assertEqual(self.lib.flash_ring_mount(ctypes.byref(self.ring), self.dev), FLASH_RING_OK_g)
+
+    def close(self):
+        if self.dev is not None:
+            self.lib.flash_dev_close_file(self.dev)
+            self.dev = None
+
+    def append(self, n_blocks_p, first_p=0):
+        for block_seq_l in range(first_p, first_p + n_blocks_p):
+            hdr_l = FlashRecHdr(len=PAYLOAD_LEN_g, channel_mask=0x07, bits=12, block_seq=block_seq_l, eff_sampling_freq=20000, t_begin=t_begin(block_seq_l))
+
+            self.assertEqual(self.lib.flash_ring_append(ctypes.byref(self.ring), ctypes.byref(hdr_l), payload(block_seq_l)), FLASH_RING_OK_g)
+
+    def read(self):
+        # The oldest pending block as (block_seq, payload), None when there is none.
+        hdr_l = FlashRecHdr()
+        buff_l = ctypes.create_string_buffer(SECTOR_SIZE_g)
+        n_l = self.lib.flash_ring_read(ctypes.byref(self.ring), ctypes.byref(hdr_l), buff_l, SECTOR_SIZE_g)
+
+        if n_l == FLASH_RING_ERR_EMPTY_g:
+            return None
+
+        self.assertEqual(n_l, PAYLOAD_LEN_g)
+
+        return hdr_l.block_seq, buff_l.raw[:n_l]
+
+    def state(self):
+        return tuple(getattr(self.ring, f_l) for f_l in ("head_sector", "head_offset", "head_seq", "oldest_seq", "tail_sector", "tail_offset", "n_pending"))
+
+    def test_mount_fresh(self):
+        self.assertEqual(os.path.getsize(self.path), SECTOR_SIZE_g*N_SECTORS_g)
+        self.assertEqual((self.ring.head_sector, self.ring.head_seq, self.ring.oldest_seq, self.ring.n_pending), (0, 1, 1, 0))
+        self.assertEqual(self.ring.head_offset, iaware_host.FLASH_SECTOR_STRUCT.size)
+        self.assertIsNone(self.read())
+
+        # A blank ring mounts again as it is, nothing is erased twice.
+        self.close()
+        self.mount()
+        self.assertEqual((self.ring.head_sector, self.ring.head_seq, self.ring.erase_count_max), (0, 1, 1))
+
+    def test_wrap_and_remount(self):
+        n_blocks_l = 2*N_SECTORS_g*RECS_PER_SECTOR_g + 1
+        self.append(n_blocks_l)
+
+        # The sectors are taken round robin, each erased once per lap, and the oldest sector is the one after the head.
+        self.assertEqual(self.ring.head_seq, 1 + (n_blocks_l - 1)//RECS_PER_SECTOR_g)
+        self.assertEqual(self.ring.head_sector, (self.ring.head_seq - 1) % N_SECTORS_g)
+        self.assertEqual(self.ring.oldest_seq, self.ring.head_seq - N_SECTORS_g + 1)
+        self.assertEqual(self.ring.n_pending + self.ring.n_overwritten, n_blocks_l)
+        self.assertEqual(self.ring.n_pending, n_blocks_l - (self.ring.oldest_seq - 1)*RECS_PER_SECTOR_g)
+
+        state_l = self.state()
+
+        self.close()
+        self.mount()
+
+        self.assertEqual(self.state(), state_l)
+
+        # The mount reads the erase counts of the sector headers: 3 laps started in sector 0, 2 in the others.
+        self.assertEqual((self.ring.erase_count_min, self.ring.erase_count_max), (2, 3))
+
+    def test_backfill_and_consume(self):
+        n_blocks_l = N_SECTORS_g*RECS_PER_SECTOR_g + 2*RECS_PER_SECTOR_g
+        self.append(n_blocks_l)
+
+        first_l = (self.ring.oldest_seq - 1)*RECS_PER_SECTOR_g
+
+        # The backfill starts at the oldest block that the wrap left, reading does not consume.
+        self.assertEqual(self.read(), (first_l, payload(first_l)))
+        self.assertEqual(self.read(), (first_l, payload(first_l)))
+
+        # Only the block just read can be consumed.
+        self.assertEqual(self.lib.flash_ring_consume(ctypes.byref(self.ring), first_l + 1), FLASH_RING_ERR_EMPTY_g)
+
+        for block_seq_l in range(first_l, first_l + RECS_PER_SECTOR_g + 1):
+            self.assertEqual(self.read(), (block_seq_l, payload(block_seq_l)))
+            self.assertEqual(self.lib.flash_ring_consume(ctypes.byref(self.ring), block_seq_l), FLASH_RING_OK_g)
+
+        n_pending_l = self.ring.n_pending
+        self.assertEqual(n_pending_l, n_blocks_l - first_l - RECS_PER_SECTOR_g - 1)
+
+        # The consumed blocks stay consumed after a restart.
+        self.close()
+        self.mount()
+
+        self.assertEqual(self.ring.n_pending, n_pending_l)
+        self.assertEqual(self.read(), (first_l + RECS_PER_SECTOR_g + 1, payload(first_l + RECS_PER_SECTOR_g + 1)))
+
+        for block_seq_l in range(first_l + RECS_PER_SECTOR_g + 1, n_blocks_l):
+            self.assertEqual(self.read(), (block_seq_l, payload(block_seq_l)))
+            self.assertEqual(self.lib.flash_ring_consume(ctypes.byref(self.ring), block_seq_l), FLASH_RING_OK_g)
+
+        self.assertIsNone(self.read())
+        self.assertEqual(self.ring.n_pending, 0)
+
+    def read_raw(self, vaddr_p, len_p):
+        buff_l = ctypes.create_string_buffer(len_p)
+        n_l = self.lib.flash_ring_read_raw(ctypes.byref(self.ring), vaddr_p, buff_l, len_p)
+
+        return n_l if n_l < 0 else buff_l.raw[:n_l]
+
+    def test_find(self):
+        # Across a wrap, with one block in the head sector.
+        n_blocks_l = N_SECTORS_g*RECS_PER_SECTOR_g + 2*RECS_PER_SECTOR_g + 1
+        self.append(n_blocks_l)
+
+        first_l = (self.ring.oldest_seq - 1)*RECS_PER_SECTOR_g
+        vaddr_begin_l = self.lib.flash_ring_vaddr_begin(ctypes.byref(self.ring))
+        vaddr_head_l = self.ring.head_seq*SECTOR_SIZE_g
+        find_l = lambda boot_count_p, t_p: self.lib.flash_ring_find(ctypes.byref(self.ring), boot_count_p, t_p)
+
+        self.assertEqual(vaddr_begin_l, self.ring.oldest_seq*SECTOR_SIZE_g)
+
+        # Every block is found in the sector that holds it, also between two blocks and right before a sector starts.
+        for block_seq_l in range(first_l, n_blocks_l):
+            vaddr_l = (1 + block_seq_l//RECS_PER_SECTOR_g)*SECTOR_SIZE_g
+
+            for t_l in (t_begin(block_seq_l), t_begin(block_seq_l) + 1, t_begin(block_seq_l + 1) - 1):
+                with self.subTest(block_seq=block_seq_l, t=t_l):
+                    self.assertEqual(find_l(BOOT_COUNT_g, t_l), vaddr_l)
+
+            blocks_l = iaware_host.record_parse(self.read_raw(vaddr_l, SECTOR_SIZE_g), vaddr_l, SECTOR_SIZE_g)
+            self.assertIn(block_seq_l, [b_l[1] for b_l in blocks_l])
+
+        # Before the tail, i.e. overwritten or of an earlier boot, is the oldest sector.
+        self.assertEqual(find_l(BOOT_COUNT_g, 0), vaddr_begin_l)
+        self.assertEqual(find_l(BOOT_COUNT_g, t_begin(first_l) - 1), vaddr_begin_l)
+        self.assertEqual(find_l(BOOT_COUNT_g - 1, 2**63), vaddr_begin_l)
+
+        # After the head, or of a later boot, is the head sector.
+        self.assertEqual(find_l(BOOT_COUNT_g, t_begin(n_blocks_l) + 10**9), vaddr_head_l)
+        self.assertEqual(find_l(BOOT_COUNT_g + 1, 0), vaddr_head_l)
+
+    def test_read_raw(self):
+        n_blocks_l = N_SECTORS_g*RECS_PER_SECTOR_g + 3*RECS_PER_SECTOR_g + 2
+        self.append(n_blocks_l)
+
+        first_l = (self.ring.oldest_seq - 1)*RECS_PER_SECTOR_g
+        vaddr_begin_l = self.lib.flash_ring_vaddr_begin(ctypes.byref(self.ring))
+        vaddr_end_l = self.lib.flash_ring_vaddr_end(ctypes.byref(self.ring))
+
+        # The whole log holds every block that the wrap left, as it was appended.
+        raw_l = self.read_raw(vaddr_begin_l, vaddr_end_l - vaddr_begin_l)
+        self.assertEqual(len(raw_l), vaddr_end_l - vaddr_begin_l)
+        self.assertEqual([(b_l[0], b_l[1], b_l[2], b_l[7]) for b_l in iaware_host.record_parse(raw_l, vaddr_begin_l, SECTOR_SIZE_g)],
+                         [(BOOT_COUNT_g, i_l, t_begin(i_l), payload(i_l)) for i_l in range(first_l, n_blocks_l)])
+
+        # Byte ranges, one across a sector boundary and over the sector of the wrap, clipped at the end.
+        ranges_l = [(vaddr_begin_l + 100, 300), (vaddr_begin_l + SECTOR_SIZE_g - 100, 300),
+                    ((N_SECTORS_g + 1)*SECTOR_SIZE_g - 50, 2*SECTOR_SIZE_g), (vaddr_end_l - 10, 100)]
+        reads_l = [self.read_raw(v_l, n_l) for v_l, n_l in ranges_l]
+
+        self.assertEqual(self.read_raw(vaddr_begin_l - 1, 100), FLASH_RING_ERR_EMPTY_g)
+
+        self.close()
+        with open(self.path, "rb") as f_l:
+            image_l = f_l.read()
+
+        for (vaddr_l, n_l), read_l in zip(ranges_l, reads_l):
+            with self.subTest(vaddr=vaddr_l, n=n_l):
+                expected_l = b""
+                for v_l in range(vaddr_l, min(vaddr_l + n_l, vaddr_end_l)):
+                    sector_l = ((v_l//SECTOR_SIZE_g) - 1) % N_SECTORS_g   # The ring starts at seq 1 in sector 0.
+                    expected_l = expected_l + image_l[sector_l*SECTOR_SIZE_g + v_l % SECTOR_SIZE_g:][:1]
+
+                self.assertEqual(read_l, expected_l)
+
+if __name__ == "__main__":
+    unittest.main()
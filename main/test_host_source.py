@@ -0,0 +1,90 @@
+import ctypes
+import os
+import tempfile
+import unittest
+
+import numpy as np
+
+import iaware_host
+import test_host
+
+# The synthetic sources of iaware_source.c against source_reference() of iaware_host.py, bit for bit, and the replay of
+# iaware_source_file.c. Run with: python3 test_host_source.py
+class SourceParams(ctypes.Structure):
+    _fields_ = [("kind", ctypes.c_uint8), ("fs", ctypes.c_uint32), ("f0_mhz", ctypes.c_uint32), ("f1_mhz", ctypes.c_uint32), ("sweep_scans", ctypes.c_uint32),
+                ("amplitude", ctypes.c_uint16), ("offset", ctypes.c_uint16), ("full_scale", ctypes.c_uint16), ("seed", ctypes.c_uint32)]
+
+READ_SCAN_g = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint16), ctypes.c_uint8)
+
+class SampleSource(ctypes.Structure):
+    _fields_ = [("ctx", ctypes.c_void_p), ("kind", ctypes.c_uint8), ("read_scan", READ_SCAN_g)]
+
+class TestSource(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.lib = test_host.host_library(["iaware_source.c", "iaware_source_file.c"])
+
+    def read_scans(self, src_p, n_scans_p, n_channels_p):
+        scan_l = (ctypes.c_uint16*n_channels_p)()
+        out_l = np.zeros((n_scans_p, n_channels_p), dtype=np.uint16)
+
+        for i_l in range(n_scans_p):
+            src_p.read_scan(src_p.ctx, scan_l, n_channels_p)
+            out_l[i_l] = scan_l
+
+        return out_l
+
+    def check(self, n_channels_p, kind_p, fs_p, f0_mhz_p=0, f1_mhz_p=0, sweep_scans_p=0, amplitude_p=0, offset_p=0, seed_p=1):
+        full_scale_l = (1 << iaware_host.DECIMATE_IN_BITS) - 1
+        params_l = SourceParams(kind_p, fs_p, f0_mhz_p, f1_mhz_p, sweep_scans_p, amplitude_p, offset_p, full_scale_l, seed_p)
+        src_l = SampleSource()
+        synth_l = test_host.host_struct()
+
+        self.assertEqual(self.lib.source_init_synth(ctypes.byref(src_l), synth_l, ctypes.byref(params_l)), 0)
+
+        n_scans_l = 3*sweep_scans_p if sweep_scans_p else 5000
+
+        np.testing.assert_array_equal(self.read_scans(src_l, n_scans_l, n_channels_p),
+                                      iaware_host.source_reference(n_scans_l, n_channels_p, kind_p, fs_p, f0_mhz_p, f1_mhz_p, sweep_scans_p, amplitude_p, offset_p, full_scale_l, seed_p))
+
+    def test_sine(self):
+        # A clipped one too.
+        for fs_l, f0_mhz_l, amplitude_l in ((20000, 10000, 2000), (1000, 333333, 1500), (20000, 50000, 4000)):
+            with self.subTest(fs=fs_l, f0_mhz=f0_mhz_l, amplitude=amplitude_l):
+                self.check(8, iaware_host.SOURCE_SINE, fs_l, f0_mhz_p=f0_mhz_l, amplitude_p=amplitude_l, offset_p=2048)
+
+    def test_chirp(self):
+        # Up and down sweeps, the second one with a negative increment.
+        for f0_mhz_l, f1_mhz_l in ((1000, 40000000), (40000000, 1000)):
+            with self.subTest(f0_mhz=f0_mhz_l, f1_mhz=f1_mhz_l):
+                self.check(3, iaware_host.SOURCE_CHIRP, 20000, f0_mhz_p=f0_mhz_l, f1_mhz_p=f1_mhz_l, sweep_scans_p=2000, amplitude_p=1800, offset_p=2048)
+
+    def test_noise(self):
+        for seed_l in (0, 1, 0xDEADBEEF):
+            with self.subTest(seed=seed_l):
+                self.check(4, iaware_host.SOURCE_NOISE, 20000, amplitude_p=300, offset_p=2048, seed_p=seed_l)
+
+    def test_replay_file(self):
+        # 3 recorded channels feed 4 channels, looped.
+        x_l = np.random.default_rng(1).integers(0, 4096, size=(50, 3)).astype(np.uint16)
+        fd_l, path_l = tempfile.mkstemp()
+
+        with os.fdopen(fd_l, "wb") as file_l:
+            file_l.write(x_l.astype(">u2").tobytes())
+
+        src_l = SampleSource()
+        replay_l = test_host.host_struct()
+
+        try:
+            self.assertEqual(self.lib.source_init_replay_file(ctypes.byref(src_l), replay_l, path_l.encode(), 3), 0)
+
+            y_l = self.read_scans(src_l, 120, 4)
+            self.lib.source_close_replay_file(replay_l)
+        finally:
+            os.remove(path_l)
+
+        i_l = np.arange(120) % 50
+        np.testing.assert_array_equal(y_l, x_l[i_l][:, [0, 1, 2, 0]])
+
+if __name__ == "__main__":
+    unittest.main()